@@ -8,6 +8,8 @@
 #include <XnVSessionManager.h>
 #include <XnVCircleDetector.h>
 
+#include "../SessionManager/GestureBus.h"
+
 // 設定ファイルのパス(環境に合わせて変更してください)
 #if (XN_PLATFORM == XN_PLATFORM_WIN32)
 const char* CONFIG_XML_PATH = "../../../Data/SamplesConfig.xml";
@@ -22,26 +24,27 @@ const char* CONFIG_XML_PATH = "Data/SamplesConfig.xml";
 // セッションの開始を通知されるコールバック
 void XN_CALLBACK_TYPE SessionStart(const XnPoint3D& pFocus, void* UserCxt)
 {
-    std::cout << "SessionStart" << std::endl;
+    ((GestureBus*)UserCxt)->publish(GestureEvent("SessionStart").at(pFocus));
 }
 
 // セッションの終了を通知されるコールバック
 void XN_CALLBACK_TYPE SessionEnd(void* UserCxt)
 {
-    std::cout << "SessionEnd" << std::endl;
+    ((GestureBus*)UserCxt)->publish(GestureEvent("SessionEnd"));
 }
 
 // 円を描いたことを通知されるコールバック
 void XN_CALLBACK_TYPE Circle(XnFloat fTimes, XnBool bConfident,
             const XnVCircle *pCircle, void *pUserCxt)
 {
-    std::cout << "Circle:" << fTimes << "," << bConfident << std::endl;
+    ((GestureBus*)pUserCxt)->publish(GestureEvent("Circle").value(fTimes).value(bConfident).
+                                     at(pCircle->ptCenter));
 }
 
 void XN_CALLBACK_TYPE NoCircle(XnFloat fLastValue, XnVCircleDetector::XnVNoCircleReason eReason,
               void *pUserCxt)
 {
-    std::cout << "NoCircle:" << fLastValue << "," << eReason << std::endl;
+    ((GestureBus*)pUserCxt)->publish(GestureEvent("NoCircle").value(fLastValue).value(eReason));
 }
 
 
@@ -80,15 +83,20 @@ int main (int argc, char * const argv[]) {
             throw std::runtime_error(xnGetStatusString(rc));
         }
         
+        // コールバックはイベントを積むだけにして、表示は配信スレッドで行う
+        GestureBus bus;
+        bus.subscribe(&GestureBus::print);
+        bus.start();
+        
         // セッションの開始終了を通知するコールバックを登録する
         XnVHandle sessionCallnack = sessionManager.RegisterSession(
-                                                                   0, &SessionStart, &SessionEnd );
+                                                                   &bus, &SessionStart, &SessionEnd );
         
         // 円の検出器を作成する
         XnVCircleDetector circleDetector;
-        XnCallbackHandle circleCallback = circleDetector.RegisterCircle(0, Circle);
+        XnCallbackHandle circleCallback = circleDetector.RegisterCircle(&bus, Circle);
         XnCallbackHandle noCircleCallback =
-                                    circleDetector.RegisterNoCircle(0, NoCircle);
+                                    circleDetector.RegisterNoCircle(&bus, NoCircle);
         
         // セッションマネージャーに検出器を登録する
         sessionManager.AddListener(&circleDetector);
@@ -124,6 +132,10 @@ int main (int argc, char * const argv[]) {
         circleDetector.UnregisterCircle(circleCallback);
         circleDetector.UnregisterNoCircle(noCircleCallback);
         sessionManager.UnregisterSession(sessionCallnack);
+        
+        // 配信を止めて、キューの統計を表示する
+        bus.stop();
+        bus.printStats(std::cout);
     }
     catch (std::exception& ex) {
         std::cout << ex.what() << std::endl;
@@ -0,0 +1,133 @@
+#ifndef FRAMECONSUMER_H_INCLUDE
+#define FRAMECONSUMER_H_INCLUDE
+
+#include <ostream>
+#include <algorithm>
+
+#include <XnCppWrapper.h>
+
+#include "../MultiProcessFlowServer/FrameRing.h"
+
+// 共有メモリのフレームを順に受け取る
+//  LATEST      : 待っている間に来たフレームは飛ばして、いつも最新を受け取る
+//  EVERY_FRAME : 1つずつ順に受け取る。リングが一周して上書きされた分は飛ばす
+//  どちらも飛ばしたフレームの数を数える。サーバーは待たないので、
+//  遅いクライアントはここで数えた分だけ取りこぼしている
+class FrameConsumer
+{
+public:
+
+  enum Mode
+  {
+    LATEST,
+    EVERY_FRAME
+  };
+
+  FrameConsumer(const FrameRingReader& reader, Mode mode = LATEST)
+    :reader_(reader), mode_(mode), last_(reader.latestFrame()),
+     received_(0), missed_(0), torn_(0)
+  {
+  }
+
+  // 次のフレームをtimeout(ms)まで待つ。来なければ(サーバーの終了も)false
+  //  viewは共有メモリを直接指すので、使い終わったら release を呼ぶ
+  bool wait(FrameView& view, XnUInt32 timeout)
+  {
+    while (1) {
+      const XnUInt32 latest = reader_.latestFrame();
+      if (latest == last_) {
+        if (reader_.isClosed() || !reader_.waitFrame(last_, timeout)) {
+          return false;
+        }
+        continue;
+      }
+
+      // 次に読むフレーム
+      XnUInt32 next = latest;
+      if (mode_ == EVERY_FRAME) {
+        // サーバーが書いているかもしれないスロットの分、1つ余裕をみる
+        const XnUInt32 slots = reader_.header().slotCount;
+        const XnUInt32 oldest = (latest > slots - 1) ? (latest - slots + 2) : 1;
+        next = std::max(last_ + 1, oldest);
+      }
+
+      if (reader_.read(next, view)) {
+        missed_ += next - last_ - 1;
+        last_ = next;
+        ++received_;
+        return true;
+      }
+
+      // 読む前に上書きされた。数えて次へ
+      ++torn_;
+      missed_ += next - last_;
+      last_ = next;
+    }
+  }
+
+  // viewを使い終わった。読んでいる間に上書きされていたらfalse(飛ばした数に入れる)
+  bool release(const FrameView& view)
+  {
+    if (reader_.isValid(view)) {
+      return true;
+    }
+
+    ++torn_;
+    ++missed_;
+    --received_;
+    return false;
+  }
+
+  void setMode(Mode mode)
+  {
+    mode_ = mode;
+  }
+
+  Mode mode() const
+  {
+    return mode_;
+  }
+
+  // サーバーが書いたのに、まだ受け取っていないフレームの数
+  XnUInt32 lag() const
+  {
+    return reader_.latestFrame() - last_;
+  }
+
+  XnUInt32 received() const
+  {
+    return received_;
+  }
+
+  XnUInt32 missed() const
+  {
+    return missed_;
+  }
+
+  // 読んでいる途中で上書きされたフレームの数(missedにも入っている)
+  XnUInt32 torn() const
+  {
+    return torn_;
+  }
+
+  void printStats(std::ostream& out) const
+  {
+    out << "FrameConsumer(" << ((mode_ == LATEST) ? "latest" : "every frame") << ") : received " <<
+      received_ << ", missed " << missed_ << " (torn " << torn_ << "), lag " << lag() << std::endl;
+  }
+
+private:
+
+  FrameConsumer(const FrameConsumer&);
+  FrameConsumer& operator=(const FrameConsumer&);
+
+  const FrameRingReader& reader_;
+  Mode mode_;
+  XnUInt32 last_;       // 最後に受け取ったフレームの番号
+
+  XnUInt32 received_;
+  XnUInt32 missed_;
+  XnUInt32 torn_;
+};
+
+#endif // #ifndef FRAMECONSUMER_H_INCLUDE
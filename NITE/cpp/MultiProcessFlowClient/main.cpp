@@ -1,5 +1,6 @@
 #include <iostream>
 #include <stdexcept>
+#include <string>
 
 #include <opencv/cv.h>
 #include <opencv/highgui.h>
@@ -8,6 +9,11 @@
 #include <XnVMultiProcessFlowClient.h>
 #include <XnVPushDetector.h>
 
+#include "FrameConsumer.h"
+
+// サーバーがフレームを配る共有メモリの名前
+const char* FRAME_RING_NAME = "MultiProcessFlowFrames";
+
 // セッションの開始を通知されるコールバック
 void XN_CALLBACK_TYPE SessionStart(const XnPoint3D& pFocus, void* UserCxt)
 {
@@ -35,35 +41,28 @@ void XN_CALLBACK_TYPE Stabilized(XnFloat fVelocity, void *UserCxt)
 
 int main (int argc, char * const argv[]) {
   IplImage* camera = 0;
+  IplImage* frameImage = 0;
 
   try {
-    /* OpenNIのコンテキストを初期化する */
-    xn::Context context;
-    XnStatus rc = context.Init();
-    if (rc != XN_STATUS_OK) {
-      throw std::runtime_error(xnGetStatusString(rc));
-    }
-
-    // イメージジェネレータの作成
-    xn::ImageGenerator image;
-    rc = image.Create(context);
-    if (rc != XN_STATUS_OK) {
-      throw std::runtime_error(xnGetStatusString(rc));
+    // サーバーが配るフレームを開く(センサーは開かない)
+    FrameRingReader frames(FRAME_RING_NAME);
+    if (frames.imageXRes() == 0) {
+      throw std::runtime_error("error : server does not publish image frames");
     }
 
     // カメラサイズのイメージを作成(8bitのRGB)
-    XnMapOutputMode outputMode;
-    image.GetMapOutputMode(outputMode);
-    camera = ::cvCreateImage(cvSize(outputMode.nXRes, outputMode.nYRes),
-      IPL_DEPTH_8U, 3);
-    if (!camera) {
+    //  frameImageは共有メモリのフレームを指すだけのヘッダ
+    CvSize size = cvSize(frames.imageXRes(), frames.imageYRes());
+    camera = ::cvCreateImage(size, IPL_DEPTH_8U, 3);
+    frameImage = ::cvCreateImageHeader(size, IPL_DEPTH_8U, 3);
+    if (!camera || !frameImage) {
       throw std::runtime_error("error : cvCreateImage");
     }
 
 
     /* NITEのセッションマネージャーを初期化する */
     XnVMultiProcessFlowClient sessionManager("shared_memory");
-    rc = sessionManager.Initialize();
+    XnStatus rc = sessionManager.Initialize();
     if (rc != XN_STATUS_OK) {
       throw std::runtime_error(xnGetStatusString(rc));
     }
@@ -83,27 +82,46 @@ int main (int argc, char * const argv[]) {
 
     std::cout << "Client Initialize Success" << std::endl;
 
+    // フレームの受け取り方(引数に every を付けると、1つずつすべて受け取る)
+    FrameConsumer consumer(frames, ((argc > 1) && (std::string(argv[1]) == "every")) ?
+      FrameConsumer::EVERY_FRAME : FrameConsumer::LATEST);
+
     /* メインループ */
     while (1) {
+      // 新しいフレームが来るまで待ち、共有メモリから直接変換して表示する
+      //  変換中にサーバーが同じスロットを書き始めていたら、そのフレームは捨てる
+      FrameView view;
+      if (consumer.wait(view, 100)) {
+        ::cvSetData(frameImage, (void*)view.image, frameImage->widthStep);
+        ::cvCvtColor(frameImage, camera, CV_BGR2RGB);
+        if (consumer.release(view)) {
+          ::cvShowImage("MultiProcessFlowClient", camera);
+        }
+      }
+      else if (frames.isClosed()) {
+        std::cout << "Server closed" << std::endl;
+        break;
+      }
+
       /* ステータスの読み込み */
       sessionManager.ReadState();
 
-      xn::ImageMetaData imageMD;
-      image.GetMetaData(imageMD);
-
-      // カメラ画像の表示
-      memcpy(camera->imageData, imageMD.RGB24Data(), camera->imageSize);
-      ::cvCvtColor(camera, camera, CV_BGR2RGB);
-      ::cvShowImage("MultiProcessFlowClient", camera);
-
       /* キーの取得 */
-      char key = cvWaitKey(10);
+      char key = cvWaitKey(1);
       /* 終了する */
       if (key == 'q') {
         break;
       }
+      // 受け取り方を切り替える
+      else if (key == 'm') {
+        consumer.setMode((consumer.mode() == FrameConsumer::LATEST) ?
+          FrameConsumer::EVERY_FRAME : FrameConsumer::LATEST);
+        consumer.printStats(std::cout);
+      }
     }
 
+    consumer.printStats(std::cout);
+
     // 登録したコールバックを削除
     pushDetector.UnregisterPush(pushCallback);
     pushDetector.UnregisterStabilized(stabilizedCallback);
@@ -114,6 +132,7 @@ int main (int argc, char * const argv[]) {
   }
 
   ::cvReleaseImage(&camera);
+  ::cvReleaseImageHeader(&frameImage);
 
   return 0;
 }
@@ -0,0 +1,145 @@
+#ifndef DEPTHCODEC_H_INCLUDE
+#define DEPTHCODEC_H_INCLUDE
+
+#include <vector>
+#include <stdexcept>
+
+#include <XnCppWrapper.h>
+
+// デプスの可逆圧縮
+//  左の画素(行の先頭は上の画素)との差を、小さければ1バイト、中くらいなら2バイトで書く。
+//  0(距離なし)の続きは長さだけを書く。0の後は、0の前の値から差をとる
+//
+//  0x00-0x7F : 差 -64..63 (値 - 64)
+//  0x80-0xBF : 0が 1..64 画素続く (下位6ビット + 1)
+//  0xC0-0xDF : 差 -4096..4095 (下位5ビットと次の1バイトの13ビット - 4096)
+//  0xFF      : 次の2バイトがそのままの値(リトルエンディアン)
+class DepthCodec
+{
+public:
+
+  // 最悪の大きさ(すべて3バイト)
+  static size_t maxEncodedSize(XnUInt32 xRes, XnUInt32 yRes)
+  {
+    return (size_t)xRes * yRes * 3;
+  }
+
+  // 圧縮してdstの後ろに足す。足したバイト数を返す
+  static size_t encode(const XnDepthPixel* src, XnUInt32 xRes, XnUInt32 yRes,
+    std::vector<XnUInt8>& dst)
+  {
+    const size_t begin = dst.size();
+    dst.resize(begin + maxEncodedSize(xRes, yRes));
+    XnUInt8* out = &dst[begin];
+
+    XnDepthPixel above = 0;
+    for (XnUInt32 y = 0; y < yRes; ++y) {
+      const XnDepthPixel* row = src + y * xRes;
+      XnDepthPixel previous = above;
+      XnUInt32 x = 0;
+      while (x < xRes) {
+        const XnDepthPixel value = row[x];
+        if (value == 0) {
+          XnUInt32 run = 1;
+          while ((x + run < xRes) && (run < 64) && (row[x + run] == 0)) {
+            ++run;
+          }
+          *out++ = (XnUInt8)(0x80 | (run - 1));
+          x += run;
+          continue;
+        }
+
+        const int delta = (int)value - (int)previous;
+        if ((delta >= -64) && (delta < 64)) {
+          *out++ = (XnUInt8)(delta + 64);
+        }
+        else if ((delta >= -4096) && (delta < 4096)) {
+          const int code = delta + 4096;
+          *out++ = (XnUInt8)(0xC0 | (code >> 8));
+          *out++ = (XnUInt8)(code & 0xFF);
+        }
+        else {
+          *out++ = 0xFF;
+          *out++ = (XnUInt8)(value & 0xFF);
+          *out++ = (XnUInt8)(value >> 8);
+        }
+        previous = value;
+        ++x;
+      }
+
+      // 次の行の先頭は、この行の先頭の0でない値から
+      above = firstNonZero(row, xRes, above);
+    }
+
+    const size_t size = out - &dst[begin];
+    dst.resize(begin + size);
+    return size;
+  }
+
+  // 展開する。壊れたデータなら例外
+  static void decode(const XnUInt8* src, size_t size, XnDepthPixel* dst,
+    XnUInt32 xRes, XnUInt32 yRes)
+  {
+    const XnUInt8* end = src + size;
+    XnDepthPixel above = 0;
+    for (XnUInt32 y = 0; y < yRes; ++y) {
+      XnDepthPixel* row = dst + y * xRes;
+      XnDepthPixel previous = above;
+      XnUInt32 x = 0;
+      while (x < xRes) {
+        if (src >= end) {
+          throw std::runtime_error("error : depth data is truncated");
+        }
+
+        const XnUInt8 code = *src++;
+        if (code < 0x80) {
+          previous = (XnDepthPixel)(previous + code - 64);
+          row[x++] = previous;
+        }
+        else if (code < 0xC0) {
+          const XnUInt32 run = (code & 0x3F) + 1;
+          if (x + run > xRes) {
+            throw std::runtime_error("error : depth data is broken");
+          }
+          for (XnUInt32 i = 0; i < run; ++i) {
+            row[x++] = 0;
+          }
+        }
+        else if (code < 0xE0) {
+          if (src >= end) {
+            throw std::runtime_error("error : depth data is truncated");
+          }
+          previous = (XnDepthPixel)(previous + (((code & 0x1F) << 8) | *src++) - 4096);
+          row[x++] = previous;
+        }
+        else if (code == 0xFF) {
+          if (src + 2 > end) {
+            throw std::runtime_error("error : depth data is truncated");
+          }
+          previous = (XnDepthPixel)(src[0] | (src[1] << 8));
+          src += 2;
+          row[x++] = previous;
+        }
+        else {
+          throw std::runtime_error("error : depth data is broken");
+        }
+      }
+
+      above = firstNonZero(row, xRes, above);
+    }
+  }
+
+private:
+
+  static XnDepthPixel firstNonZero(const XnDepthPixel* row, XnUInt32 xRes, XnDepthPixel other)
+  {
+    for (XnUInt32 x = 0; x < xRes; ++x) {
+      if (row[x] != 0) {
+        return row[x];
+      }
+    }
+    return other;
+  }
+};
+
+#endif // #ifndef DEPTHCODEC_H_INCLUDE
@@ -0,0 +1,392 @@
+#ifndef FRAMERING_H_INCLUDE
+#define FRAMERING_H_INCLUDE
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <XnCppWrapper.h>
+#include <XnOS.h>
+
+#if (XN_PLATFORM == XN_PLATFORM_WIN32)
+#include <windows.h>
+#elif (XN_PLATFORM == XN_PLATFORM_LINUX_X86) || (XN_PLATFORM == XN_PLATFORM_LINUX_ARM)
+#include <unistd.h>
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#define FRAME_RING_USE_FUTEX
+#endif
+
+// 共有メモリのフレームのリング
+//  サーバーがイメージ、デプス、ラベルのフレームをスロットに順に書き、
+//  クライアントはセンサーを開かずに、共有メモリの中のフレームをコピーせずに読む。
+//  スロットごとにシーケンス番号(seqlock)を持ち、書いている間は奇数になる。
+//  読む側は読む前と後で番号が変わっていなければ、そのフレームは壊れていない。
+//  新しいフレームを待つのは、Linuxでは latest へのfutex、ほかは短いスリープでのぞく
+
+// 共有メモリの先頭
+struct FrameRingHeader
+{
+  enum { MAGIC = 0x464d5258, VERSION = 2 };
+
+  XnUInt32 magic;
+  XnUInt32 version;
+  XnUInt32 size;              // 共有メモリ全体の大きさ
+  XnUInt32 slotCount;
+  XnUInt32 slotSize;
+  XnUInt32 imageXRes, imageYRes;
+  XnUInt32 depthXRes, depthYRes;
+  XnUInt32 imageOffset;       // スロットの先頭からの位置(0なら持っていない)
+  XnUInt32 depthOffset;
+  XnUInt32 labelOffset;
+
+  volatile XnUInt32 latest;   // 最後に書き終えたフレームの番号(0ならまだない)
+  volatile XnUInt32 isClosed; // サーバーが終了した
+  volatile XnUInt32 waiters;  // latest が変わるのを待っているクライアントの数
+};
+
+// スロットの先頭
+struct FrameSlotHeader
+{
+  volatile XnUInt32 sequence; // 書いている間は奇数
+  volatile XnUInt32 frame;    // フレームの番号(1から)
+  XnUInt32 imageFrameID;
+  XnUInt32 depthFrameID;
+  XnUInt64 timestamp;         // デプスのタイムスタンプ(us)
+};
+
+// クライアントに見せるフレーム(共有メモリを直接指す)
+struct FrameView
+{
+  XnUInt32 frame;
+  XnUInt32 sequence;
+  XnUInt32 imageFrameID;
+  XnUInt32 depthFrameID;
+  XnUInt64 timestamp;
+
+  const XnRGB24Pixel* image;    // 持っていなければ0
+  const XnDepthPixel* depth;
+  const XnLabel* labels;
+  const FrameSlotHeader* slot;
+};
+
+// 共有メモリのリングの共通部分
+class FrameRing
+{
+public:
+
+  const FrameRingHeader& header() const
+  {
+    return *header_;
+  }
+
+  XnUInt32 imageXRes() const { return header_->imageXRes; }
+  XnUInt32 imageYRes() const { return header_->imageYRes; }
+  XnUInt32 depthXRes() const { return header_->depthXRes; }
+  XnUInt32 depthYRes() const { return header_->depthYRes; }
+
+protected:
+
+  FrameRing()
+    :memory_(0), header_(0)
+  {
+  }
+
+  ~FrameRing()
+  {
+    if (memory_ != 0) {
+      xnOSCloseSharedMemory(memory_);
+    }
+  }
+
+  void map()
+  {
+    void* address = 0;
+    XnStatus rc = xnOSSharedMemoryGetAddress(memory_, &address);
+    if (rc != XN_STATUS_OK) {
+      throw std::runtime_error(xnGetStatusString(rc));
+    }
+    header_ = (FrameRingHeader*)address;
+  }
+
+  FrameSlotHeader* slot(XnUInt32 frame) const
+  {
+    return (FrameSlotHeader*)((XnUInt8*)header_ + slotBegin() +
+      (size_t)((frame - 1) % header_->slotCount) * header_->slotSize);
+  }
+
+  static XnUInt32 slotBegin()
+  {
+    return align(sizeof(FrameRingHeader));
+  }
+
+  static XnUInt32 align(XnUInt32 size)
+  {
+    return (size + 63) & ~63u;
+  }
+
+  static void memoryBarrier()
+  {
+#if (XN_PLATFORM == XN_PLATFORM_WIN32)
+    MemoryBarrier();
+#else
+    __sync_synchronize();
+#endif
+  }
+
+  static void add(volatile XnUInt32* target, XnInt32 value)
+  {
+#if (XN_PLATFORM == XN_PLATFORM_WIN32)
+    InterlockedExchangeAdd((volatile LONG*)target, value);
+#else
+    __sync_fetch_and_add(target, value);
+#endif
+  }
+
+  // latest が expected から変わるか、timeout(ms)が過ぎるまで待つ
+  void waitLatest(XnUInt32 expected, XnUInt32 timeout) const
+  {
+    volatile XnUInt32* latest = &header_->latest;
+#ifdef FRAME_RING_USE_FUTEX
+    add(&header_->waiters, 1);
+    struct timespec interval;
+    interval.tv_sec = timeout / 1000;
+    interval.tv_nsec = (timeout % 1000) * 1000000L;
+    syscall(SYS_futex, latest, FUTEX_WAIT, expected, &interval, 0, 0);
+    add(&header_->waiters, -1);
+#else
+    // 待っている間も1msごとにのぞく
+    for (XnUInt32 i = 0; (i < timeout) && (*latest == expected); ++i) {
+      xnOSSleep(1);
+    }
+#endif
+  }
+
+  // 待っているクライアントを起こす
+  void wakeWaiters()
+  {
+#ifdef FRAME_RING_USE_FUTEX
+    memoryBarrier();
+    if (header_->waiters != 0) {
+      syscall(SYS_futex, &header_->latest, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+    }
+#endif
+  }
+
+  XN_SHARED_MEMORY_HANDLE memory_;
+  FrameRingHeader* header_;
+
+private:
+
+  FrameRing(const FrameRing&);
+  FrameRing& operator=(const FrameRing&);
+};
+
+// フレームを書く側(サーバー、1プロセス1スレッドから)
+class FrameRingWriter : public FrameRing
+{
+public:
+
+  // 解像度が0のマップは持たない。ラベルはデプスと同じ解像度
+  //  スロットが1つだと読んでいるスロットに次のフレームを書いてしまうので、2つ以上必要
+  FrameRingWriter(const XnChar* name, XnUInt32 slotCount,
+    XnUInt32 imageXRes, XnUInt32 imageYRes, XnUInt32 depthXRes, XnUInt32 depthYRes,
+    bool hasLabels)
+    :frame_(0)
+  {
+    if (slotCount < 2) {
+      throw std::runtime_error("error : frame ring needs at least 2 slots");
+    }
+
+    FrameRingHeader layout;
+    memset(&layout, 0, sizeof(layout));
+    layout.magic = FrameRingHeader::MAGIC;
+    layout.version = FrameRingHeader::VERSION;
+    layout.slotCount = slotCount;
+    layout.imageXRes = imageXRes;
+    layout.imageYRes = imageYRes;
+    layout.depthXRes = depthXRes;
+    layout.depthYRes = depthYRes;
+
+    // スロットの中の並び(それぞれ64バイト境界)
+    XnUInt32 offset = align(sizeof(FrameSlotHeader));
+    if (imageXRes * imageYRes != 0) {
+      layout.imageOffset = offset;
+      offset += align(imageXRes * imageYRes * sizeof(XnRGB24Pixel));
+    }
+    if (depthXRes * depthYRes != 0) {
+      layout.depthOffset = offset;
+      offset += align(depthXRes * depthYRes * sizeof(XnDepthPixel));
+      if (hasLabels) {
+        layout.labelOffset = offset;
+        offset += align(depthXRes * depthYRes * sizeof(XnLabel));
+      }
+    }
+    layout.slotSize = offset;
+    layout.size = slotBegin() + slotCount * layout.slotSize;
+
+    XnStatus rc = xnOSCreateSharedMemory(name, layout.size,
+      XN_OS_FILE_READ | XN_OS_FILE_WRITE, &memory_);
+    if (rc != XN_STATUS_OK) {
+      throw std::runtime_error(xnGetStatusString(rc));
+    }
+    map();
+
+    // スロットを空にしてから、最後にマジックを書いて読めるようにする
+    memset(header_, 0, layout.size);
+    FrameRingHeader* header = header_;
+    layout.magic = 0;
+    *header = layout;
+    memoryBarrier();
+    header->magic = FrameRingHeader::MAGIC;
+  }
+
+  ~FrameRingWriter()
+  {
+    if (header_ != 0) {
+      header_->isClosed = 1;
+      wakeWaiters();
+    }
+  }
+
+  // フレームを次のスロットに書く(持っていないマップは0でよい)
+  void publish(const XnRGB24Pixel* image, const XnDepthPixel* depth, const XnLabel* labels,
+    XnUInt32 imageFrameID, XnUInt32 depthFrameID, XnUInt64 timestamp)
+  {
+    ++frame_;
+    FrameSlotHeader* slot = this->slot(frame_);
+    XnUInt8* data = (XnUInt8*)slot;
+
+    // 書いている間は奇数にする
+    slot->sequence = slot->sequence + 1;
+    memoryBarrier();
+
+    slot->frame = frame_;
+    slot->imageFrameID = imageFrameID;
+    slot->depthFrameID = depthFrameID;
+    slot->timestamp = timestamp;
+    copy(data + header_->imageOffset, header_->imageOffset, image,
+      header_->imageXRes * header_->imageYRes * sizeof(XnRGB24Pixel));
+    copy(data + header_->depthOffset, header_->depthOffset, depth,
+      header_->depthXRes * header_->depthYRes * sizeof(XnDepthPixel));
+    copy(data + header_->labelOffset, header_->labelOffset, labels,
+      header_->depthXRes * header_->depthYRes * sizeof(XnLabel));
+
+    memoryBarrier();
+    slot->sequence = slot->sequence + 1;
+    memoryBarrier();
+    header_->latest = frame_;
+    wakeWaiters();
+  }
+
+  XnUInt32 frame() const
+  {
+    return frame_;
+  }
+
+private:
+
+  static void copy(XnUInt8* dst, XnUInt32 offset, const void* src, size_t size)
+  {
+    if (offset == 0) {
+      return;
+    }
+    if (src != 0) {
+      memcpy(dst, src, size);
+    }
+    else {
+      memset(dst, 0, size);
+    }
+  }
+
+  XnUInt32 frame_;
+};
+
+// フレームを読む側(クライアント)
+class FrameRingReader : public FrameRing
+{
+public:
+
+  FrameRingReader(const XnChar* name)
+  {
+    XnStatus rc = xnOSOpenSharedMemory(name, XN_OS_FILE_READ | XN_OS_FILE_WRITE, &memory_);
+    if (rc != XN_STATUS_OK) {
+      throw std::runtime_error(std::string("error : cannot open shared memory ") + name +
+        " (is the server running?)");
+    }
+    map();
+
+    if ((header_->magic != FrameRingHeader::MAGIC) ||
+        (header_->version != FrameRingHeader::VERSION) || (header_->slotCount < 2)) {
+      throw std::runtime_error("error : shared memory format mismatch");
+    }
+  }
+
+  // 最後に書き終えたフレームを見る。まだないか書き換え中ならfalse
+  //  viewは共有メモリを直接指すので、使い終わったら isValid で壊れていないか確かめる
+  bool latest(FrameView& view) const
+  {
+    const XnUInt32 frame = header_->latest;
+    return (frame != 0) && read(frame, view);
+  }
+
+  // フレームの番号を指定して見る。上書きされていればfalse
+  bool read(XnUInt32 frame, FrameView& view) const
+  {
+    const FrameSlotHeader* slot = this->slot(frame);
+    const XnUInt32 sequence = slot->sequence;
+    memoryBarrier();
+    if (((sequence & 1) != 0) || (slot->frame != frame)) {
+      return false;
+    }
+
+    const XnUInt8* data = (const XnUInt8*)slot;
+    view.frame = frame;
+    view.sequence = sequence;
+    view.imageFrameID = slot->imageFrameID;
+    view.depthFrameID = slot->depthFrameID;
+    view.timestamp = slot->timestamp;
+    view.image = (header_->imageOffset != 0) ?
+      (const XnRGB24Pixel*)(data + header_->imageOffset) : 0;
+    view.depth = (header_->depthOffset != 0) ?
+      (const XnDepthPixel*)(data + header_->depthOffset) : 0;
+    view.labels = (header_->labelOffset != 0) ?
+      (const XnLabel*)(data + header_->labelOffset) : 0;
+    view.slot = slot;
+
+    memoryBarrier();
+    return slot->sequence == sequence;
+  }
+
+  // viewを読んでいる間に、サーバーが同じスロットに書き始めていなければtrue
+  bool isValid(const FrameView& view) const
+  {
+    memoryBarrier();
+    return view.slot->sequence == view.sequence;
+  }
+
+  // 最後に書き終えたフレームの番号
+  XnUInt32 latestFrame() const
+  {
+    return header_->latest;
+  }
+
+  // 最後のフレームが frame から変わるまで待つ(timeout ms)。変わっていればtrue
+  bool waitFrame(XnUInt32 frame, XnUInt32 timeout) const
+  {
+    if ((header_->latest == frame) && !isClosed()) {
+      waitLatest(frame, timeout);
+    }
+    return header_->latest != frame;
+  }
+
+  // サーバーが終了したか
+  bool isClosed() const
+  {
+    return header_->isClosed != 0;
+  }
+};
+
+#endif // #ifndef FRAMERING_H_INCLUDE
@@ -0,0 +1,517 @@
+#ifndef FRAMESTREAM_H_INCLUDE
+#define FRAMESTREAM_H_INCLUDE
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <ostream>
+
+#include <opencv/cv.h>
+#include <opencv/highgui.h>
+
+#include <XnCppWrapper.h>
+#include <XnOS.h>
+
+#include "DepthCodec.h"
+
+// Unixドメインソケットでフレームを流す(Windowsでは使えない)
+#if (XN_PLATFORM != XN_PLATFORM_WIN32)
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <poll.h>
+
+// イメージの圧縮方法
+enum FrameImageCodec
+{
+  IMAGE_NONE,     // 送らない
+  IMAGE_RAW,      // そのまま
+  IMAGE_JPEG,     // cvEncodeImage(非可逆)
+  IMAGE_PNG       // cvEncodeImage(可逆)
+};
+
+// パケットの先頭(この前に、この後ろの大きさを4バイトで書く)
+//  続けてイメージ、デプスの順にデータが入る
+struct FramePacketHeader
+{
+  enum { MAGIC = 0x46535452, VERSION = 1 };
+
+  // 受け取る側が認める大きさの上限(これを超えるパケットは壊れているとみなす)
+  enum { MAX_PIXELS = 4096 * 4096, MAX_SIZE = 128 * 1024 * 1024 };
+
+  XnUInt32 magic;
+  XnUInt32 version;
+  XnUInt32 frame;
+  XnUInt32 imageCodec;
+  XnUInt32 imageXRes, imageYRes;
+  XnUInt32 depthXRes, depthYRes;
+  XnUInt32 imageSize;         // データの大きさ(バイト)
+  XnUInt32 depthSize;
+  XnUInt64 timestamp;         // デプスのタイムスタンプ(us)
+  XnUInt64 sentTime;          // サーバーが送った時刻(xnOSGetHighResTimeStamp、us)
+};
+
+// 受け取ったフレーム(展開済み)
+struct StreamFrame
+{
+  FramePacketHeader header;
+  std::vector<XnUInt8> image;         // RGB、imageXRes * imageYRes * 3
+  std::vector<XnDepthPixel> depth;
+  XnUInt32 packetSize;
+};
+
+// フレームを流すサーバー
+//  フレームは1回だけ圧縮し、クライアントごとに長さ、ヘッダ、イメージ、デプスを
+//  1回の sendmsg でまとめて送る(ソケットはノンブロッキング)。
+//  送りきれなかったクライアントは残りを送り終えるまで次のフレームを飛ばす
+class FrameStreamServer
+{
+public:
+
+  FrameStreamServer(const char* path, FrameImageCodec codec = IMAGE_RAW, int quality = 90)
+    :path_(path), listener_(-1), codec_(codec), quality_(quality),
+     frames_(0), bytes_(0), dropped_(0)
+  {
+    listener_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener_ < 0) {
+      throw std::runtime_error(std::string("error : socket ") + strerror(errno));
+    }
+
+    sockaddr_un address;
+    if (!makeAddress(path, address)) {
+      close();
+      throw std::runtime_error("error : socket path is too long");
+    }
+
+    ::unlink(path);
+    if ((::bind(listener_, (sockaddr*)&address, sizeof(address)) != 0) ||
+        (::listen(listener_, 8) != 0)) {
+      const std::string message = std::string("error : bind ") + path + " " + strerror(errno);
+      close();
+      throw std::runtime_error(message);
+    }
+    setNonBlocking(listener_);
+  }
+
+  ~FrameStreamServer()
+  {
+    close();
+  }
+
+  // フレームを圧縮して、つながっているクライアントに送る
+  //  imageはRGBで、持っていなければ0
+  void publish(XnUInt32 frame, XnUInt64 timestamp,
+    const XnRGB24Pixel* image, XnUInt32 imageXRes, XnUInt32 imageYRes,
+    const XnDepthPixel* depth, XnUInt32 depthXRes, XnUInt32 depthYRes)
+  {
+    if (accept() == 0) {
+      return;
+    }
+
+    // 圧縮する
+    FramePacketHeader& header = packet_.header;
+    memset(&header, 0, sizeof(header));
+    header.magic = FramePacketHeader::MAGIC;
+    header.version = FramePacketHeader::VERSION;
+    header.frame = frame;
+    header.timestamp = timestamp;
+
+    const XnUInt8* imageData = 0;
+    if ((image != 0) && (codec_ != IMAGE_NONE)) {
+      header.imageCodec = codec_;
+      header.imageXRes = imageXRes;
+      header.imageYRes = imageYRes;
+      imageData = encodeImage(image, imageXRes, imageYRes, header.imageSize);
+    }
+
+    depthData_.clear();
+    if (depth != 0) {
+      header.depthXRes = depthXRes;
+      header.depthYRes = depthYRes;
+      header.depthSize = (XnUInt32)DepthCodec::encode(depth, depthXRes, depthYRes, depthData_);
+    }
+
+    packet_.size = (XnUInt32)(sizeof(header) + header.imageSize + header.depthSize);
+    xnOSGetHighResTimeStamp(&header.sentTime);
+
+    iovec parts[PARTS];
+    parts[0].iov_base = &packet_.size;
+    parts[0].iov_len = sizeof(packet_.size);
+    parts[1].iov_base = &header;
+    parts[1].iov_len = sizeof(header);
+    parts[2].iov_base = (void*)imageData;
+    parts[2].iov_len = header.imageSize;
+    parts[3].iov_base = depthData_.empty() ? 0 : &depthData_[0];
+    parts[3].iov_len = header.depthSize;
+    const size_t total = sizeof(packet_.size) + packet_.size;
+
+    // クライアントごとに送る
+    for (size_t i = 0; i < clients_.size(); ) {
+      Client& client = clients_[i];
+      if (!flush(client)) {
+        drop(i);
+        continue;
+      }
+
+      if (!client.pending.empty()) {
+        ++client.dropped;
+        ++dropped_;
+        ++i;
+        continue;
+      }
+
+      const ssize_t sent = send(client.socket, parts, PARTS);
+      if (sent < 0) {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+          ++client.dropped;
+          ++dropped_;
+          ++i;
+          continue;
+        }
+        drop(i);
+        continue;
+      }
+
+      // 送りきれなかった残りを取っておく(次のフレームより先に送る)
+      if ((size_t)sent < total) {
+        keep(client, parts, PARTS, sent);
+      }
+      bytes_ += sent;
+      ++i;
+    }
+    ++frames_;
+  }
+
+  // 新しいクライアントを受け付ける(publishでも行う)。つながっている数を返す
+  XnUInt32 accept()
+  {
+    while (1) {
+      const int socket = ::accept(listener_, 0, 0);
+      if (socket < 0) {
+        break;
+      }
+      setNonBlocking(socket);
+#ifdef SO_NOSIGPIPE
+      int on = 1;
+      ::setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+      Client client;
+      client.socket = socket;
+      client.dropped = 0;
+      clients_.push_back(client);
+    }
+    return (XnUInt32)clients_.size();
+  }
+
+  // 送りきれていない残りをすべて送ってから、送信側を閉じる
+  //  クライアントは受け取り終えたところで receive が false になる
+  void finish()
+  {
+    for (size_t i = 0; i < clients_.size(); ) {
+      Client& client = clients_[i];
+      bool isAlive = true;
+      while (isAlive && !client.pending.empty()) {
+        pollfd fd = { client.socket, POLLOUT, 0 };
+        isAlive = ((::poll(&fd, 1, -1) >= 0) || (errno == EINTR)) && flush(client);
+      }
+      if (!isAlive) {
+        drop(i);
+        continue;
+      }
+      ::shutdown(client.socket, SHUT_WR);
+      ++i;
+    }
+  }
+
+  void printStats(std::ostream& out) const
+  {
+    out << "FrameStreamServer : frames " << frames_ << ", bytes " << bytes_ <<
+      ", dropped " << dropped_ << ", clients " << clients_.size() << std::endl;
+  }
+
+private:
+
+  FrameStreamServer(const FrameStreamServer&);
+  FrameStreamServer& operator=(const FrameStreamServer&);
+
+  // 大きさ、ヘッダ、イメージ、デプス
+  enum { PARTS = 4 };
+
+  struct Client
+  {
+    int socket;
+    std::vector<XnUInt8> pending;   // 送りきれなかったパケットの残り
+    XnUInt32 dropped;
+  };
+
+  // 送っているパケットの大きさとヘッダ
+  struct Packet
+  {
+    XnUInt32 size;
+    FramePacketHeader header;
+  };
+
+  static bool makeAddress(const char* path, sockaddr_un& address)
+  {
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+      return false;
+    }
+    strcpy(address.sun_path, path);
+    return true;
+  }
+
+  static void setNonBlocking(int socket)
+  {
+    ::fcntl(socket, F_SETFL, ::fcntl(socket, F_GETFL, 0) | O_NONBLOCK);
+  }
+
+  // 切れたクライアントに送っても、SIGPIPEで落ちないようにする
+  static ssize_t send(int socket, iovec* parts, int count)
+  {
+    msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = parts;
+    message.msg_iovlen = count;
+    return ::sendmsg(socket, &message, sendFlags());
+  }
+
+  static int sendFlags()
+  {
+#ifdef MSG_NOSIGNAL
+    return MSG_NOSIGNAL;
+#else
+    return 0;
+#endif
+  }
+
+  // 残りを送る。切れていればfalse
+  bool flush(Client& client)
+  {
+    if (client.pending.empty()) {
+      return true;
+    }
+
+    const ssize_t sent = ::send(client.socket, &client.pending[0], client.pending.size(),
+      sendFlags());
+    if (sent < 0) {
+      return (errno == EAGAIN) || (errno == EWOULDBLOCK);
+    }
+    client.pending.erase(client.pending.begin(), client.pending.begin() + sent);
+    bytes_ += sent;
+    return true;
+  }
+
+  static void keep(Client& client, const iovec* parts, int count, size_t sent)
+  {
+    for (int i = 0; i < count; ++i) {
+      const XnUInt8* data = (const XnUInt8*)parts[i].iov_base;
+      if (sent >= parts[i].iov_len) {
+        sent -= parts[i].iov_len;
+        continue;
+      }
+      client.pending.insert(client.pending.end(), data + sent, data + parts[i].iov_len);
+      sent = 0;
+    }
+  }
+
+  void drop(size_t index)
+  {
+    ::close(clients_[index].socket);
+    clients_.erase(clients_.begin() + index);
+  }
+
+  const XnUInt8* encodeImage(const XnRGB24Pixel* image, XnUInt32 xRes, XnUInt32 yRes,
+    XnUInt32& size)
+  {
+    if (codec_ == IMAGE_RAW) {
+      size = xRes * yRes * sizeof(XnRGB24Pixel);
+      return (const XnUInt8*)image;
+    }
+
+    // RGBのままBGRとして圧縮する(展開しても同じ並びに戻る)
+    IplImage* header = ::cvCreateImageHeader(cvSize(xRes, yRes), IPL_DEPTH_8U, 3);
+    ::cvSetData(header, (void*)image, xRes * 3);
+    int params[] = { CV_IMWRITE_JPEG_QUALITY, quality_, 0 };
+    const char* extension = ".jpg";
+    if (codec_ == IMAGE_PNG) {
+      params[0] = CV_IMWRITE_PNG_COMPRESSION;
+      params[1] = 1;
+      extension = ".png";
+    }
+    CvMat* encoded = ::cvEncodeImage(extension, header, params);
+    ::cvReleaseImageHeader(&header);
+    if (encoded == 0) {
+      throw std::runtime_error("error : cvEncodeImage");
+    }
+
+    size = encoded->cols * encoded->rows;
+    imageData_.assign(encoded->data.ptr, encoded->data.ptr + size);
+    ::cvReleaseMat(&encoded);
+    return &imageData_[0];
+  }
+
+  void close()
+  {
+    for (size_t i = 0; i < clients_.size(); ++i) {
+      ::close(clients_[i].socket);
+    }
+    clients_.clear();
+    if (listener_ >= 0) {
+      ::close(listener_);
+      ::unlink(path_.c_str());
+      listener_ = -1;
+    }
+  }
+
+  std::string path_;
+  int listener_;
+  std::vector<Client> clients_;
+
+  FrameImageCodec codec_;
+  int quality_;
+
+  Packet packet_;
+  std::vector<XnUInt8> imageData_;
+  std::vector<XnUInt8> depthData_;
+
+  XnUInt64 frames_;
+  XnUInt64 bytes_;
+  XnUInt64 dropped_;
+};
+
+// フレームを受け取るクライアント(ブロッキング)
+class FrameStreamClient
+{
+public:
+
+  FrameStreamClient(const char* path)
+    :socket_(-1)
+  {
+    socket_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socket_ < 0) {
+      throw std::runtime_error(std::string("error : socket ") + strerror(errno));
+    }
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    if (::connect(socket_, (sockaddr*)&address, sizeof(address)) != 0) {
+      const std::string message = std::string("error : connect ") + path + " " + strerror(errno);
+      ::close(socket_);
+      throw std::runtime_error(message);
+    }
+  }
+
+  ~FrameStreamClient()
+  {
+    ::close(socket_);
+  }
+
+  // 次のフレームを受け取って展開する。サーバーが切ったらfalse
+  bool receive(StreamFrame& frame)
+  {
+    XnUInt32 size = 0;
+    if (!read(&size, sizeof(size))) {
+      return false;
+    }
+    if ((size < sizeof(FramePacketHeader)) || (size > FramePacketHeader::MAX_SIZE)) {
+      throw std::runtime_error("error : broken packet");
+    }
+    packet_.resize(size);
+    if (!read(&packet_[0], size)) {
+      return false;
+    }
+
+    // 解像度の積は32ビットであふれないよう64ビットで調べる
+    FramePacketHeader& header = frame.header;
+    memcpy(&header, &packet_[0], sizeof(header));
+    if ((header.magic != FramePacketHeader::MAGIC) ||
+        ((XnUInt64)sizeof(header) + header.imageSize + header.depthSize != size) ||
+        ((XnUInt64)header.imageXRes * header.imageYRes > FramePacketHeader::MAX_PIXELS) ||
+        ((XnUInt64)header.depthXRes * header.depthYRes > FramePacketHeader::MAX_PIXELS)) {
+      throw std::runtime_error("error : broken packet");
+    }
+    frame.packetSize = size + sizeof(size);
+
+    const XnUInt8* data = &packet_[sizeof(header)];
+    decodeImage(header, data, frame.image);
+    data += header.imageSize;
+
+    frame.depth.resize((size_t)header.depthXRes * header.depthYRes);
+    if (!frame.depth.empty()) {
+      DepthCodec::decode(data, header.depthSize, &frame.depth[0],
+        header.depthXRes, header.depthYRes);
+    }
+    return true;
+  }
+
+private:
+
+  FrameStreamClient(const FrameStreamClient&);
+  FrameStreamClient& operator=(const FrameStreamClient&);
+
+  bool read(void* buffer, size_t size)
+  {
+    XnUInt8* p = (XnUInt8*)buffer;
+    while (size > 0) {
+      const ssize_t received = ::recv(socket_, p, size, 0);
+      if (received <= 0) {
+        if ((received < 0) && (errno == EINTR)) {
+          continue;
+        }
+        return false;
+      }
+      p += received;
+      size -= received;
+    }
+    return true;
+  }
+
+  static void decodeImage(const FramePacketHeader& header, const XnUInt8* data,
+    std::vector<XnUInt8>& image)
+  {
+    const size_t size = (size_t)header.imageXRes * header.imageYRes * 3;
+    if ((header.imageCodec == IMAGE_NONE) || (size == 0)) {
+      image.clear();
+      return;
+    }
+
+    if (header.imageCodec == IMAGE_RAW) {
+      if (header.imageSize != size) {
+        throw std::runtime_error("error : broken image");
+      }
+      image.assign(data, data + size);
+      return;
+    }
+
+    CvMat encoded = cvMat(1, header.imageSize, CV_8UC1, (void*)data);
+    IplImage* decoded = ::cvDecodeImage(&encoded, CV_LOAD_IMAGE_COLOR);
+    if ((decoded == 0) || ((XnUInt32)decoded->width != header.imageXRes) ||
+        ((XnUInt32)decoded->height != header.imageYRes)) {
+      ::cvReleaseImage(&decoded);
+      throw std::runtime_error("error : cvDecodeImage");
+    }
+    image.resize(size);
+    for (XnUInt32 y = 0; y < header.imageYRes; ++y) {
+      memcpy(&image[y * header.imageXRes * 3], decoded->imageData + y * decoded->widthStep,
+        header.imageXRes * 3);
+    }
+    ::cvReleaseImage(&decoded);
+  }
+
+  int socket_;
+  std::vector<XnUInt8> packet_;
+};
+
+#endif // #if (XN_PLATFORM != XN_PLATFORM_WIN32)
+
+#endif // #ifndef FRAMESTREAM_H_INCLUDE
@@ -1,5 +1,9 @@
 #include <iostream>
 #include <stdexcept>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <algorithm>
 
 #include <opencv/cv.h>
 #include <opencv/highgui.h>
@@ -8,6 +12,9 @@
 #include <XnVSessionManager.h>
 #include <XnVMultiProcessFlowServer.h>
 
+#include "FrameRing.h"
+#include "FrameStream.h"
+
 // 設定ファイルのパス(環境に合わせて変更してください)
 #if (XN_PLATFORM == XN_PLATFORM_WIN32)
 const char* CONFIG_XML_PATH = "../../../Data/SamplesConfig.xml";
@@ -19,6 +26,123 @@ const char* CONFIG_XML_PATH = "../../../Data/SamplesConfig.xml";
 const char* CONFIG_XML_PATH = "Data/SamplesConfig.xml";
 #endif
 
+// フレームを配る共有メモリの名前とスロットの数
+const char* FRAME_RING_NAME = "MultiProcessFlowFrames";
+const XnUInt32 FRAME_RING_SLOTS = 4;
+
+#if (XN_PLATFORM != XN_PLATFORM_WIN32)
+// フレームを流すUnixドメインソケット
+const char* FRAME_STREAM_PATH = "/tmp/MultiProcessFlowFrames.sock";
+
+// 引数からイメージの圧縮方法を決める(raw, jpeg, png, none)
+FrameImageCodec imageCodec(const std::string& name)
+{
+  if (name == "jpeg") {
+    return IMAGE_JPEG;
+  }
+  else if (name == "png") {
+    return IMAGE_PNG;
+  }
+  else if (name == "none") {
+    return IMAGE_NONE;
+  }
+  return IMAGE_RAW;
+}
+
+// ベンチマークのクライアント(別スレッドでソケットから受け取る)
+struct StreamBenchClient
+{
+  XnUInt32 frames;
+  XnUInt64 bytes;
+  XnUInt64 latency;     // 送ってから展開し終わるまでの合計(us)
+  XnUInt64 maxLatency;
+  XnUInt32 errors;
+};
+
+XN_THREAD_PROC streamBenchClient(XN_THREAD_PARAM param)
+{
+  StreamBenchClient& result = *(StreamBenchClient*)param;
+  try {
+    FrameStreamClient client(FRAME_STREAM_PATH);
+    StreamFrame frame;
+    while (client.receive(frame)) {
+      XnUInt64 now;
+      xnOSGetHighResTimeStamp(&now);
+      const XnUInt64 latency = now - frame.header.sentTime;
+      result.latency += latency;
+      result.maxLatency = std::max(result.maxLatency, latency);
+      result.bytes += frame.packetSize;
+      if (frame.depth[frame.depth.size() / 2] != (frame.header.frame & 0x3FF) + 500) {
+        ++result.errors;
+      }
+      ++result.frames;
+    }
+  }
+  catch (std::exception& ex) {
+    std::cout << ex.what() << std::endl;
+    ++result.errors;
+  }
+  XN_THREAD_PROC_RETURN(0);
+}
+
+// 作ったフレームをループバックのクライアントに流して、圧縮率、スループット、遅延を測る
+void benchmark()
+{
+  const XnUInt32 X_RES = 640, Y_RES = 480, FRAMES = 300;
+
+  // 奥に向かって傾いた面と、穴(0)、ノイズのあるデプスと、なめらかなイメージ
+  std::vector<XnDepthPixel> depth(X_RES * Y_RES);
+  std::vector<XnRGB24Pixel> image(X_RES * Y_RES);
+  for (XnUInt32 y = 0; y < Y_RES; ++y) {
+    for (XnUInt32 x = 0; x < X_RES; ++x) {
+      const XnUInt32 i = y * X_RES + x;
+      depth[i] = ((x / 32 + y / 24) % 9 == 0) ? 0 :
+        (XnDepthPixel)(1000 + x + y * 2 + 100 * std::sin(x * 0.05) + (i * 7919) % 5);
+      image[i].nRed = (XnUInt8)x;
+      image[i].nGreen = (XnUInt8)y;
+      image[i].nBlue = (XnUInt8)((x + y) / 4);
+    }
+  }
+
+  const FrameImageCodec codecs[] = { IMAGE_NONE, IMAGE_RAW, IMAGE_JPEG, IMAGE_PNG };
+  const char* names[] = { "none", "raw", "jpeg", "png" };
+  for (int c = 0; c < 4; ++c) {
+    StreamBenchClient result = { 0, 0, 0, 0, 0 };
+    XN_THREAD_HANDLE thread;
+    XnUInt64 begin, end;
+    {
+      FrameStreamServer server(FRAME_STREAM_PATH, codecs[c]);
+      xnOSCreateThread(streamBenchClient, &result, &thread);
+      while (server.accept() == 0) {
+        xnOSSleep(1);
+      }
+
+      xnOSGetHighResTimeStamp(&begin);
+      for (XnUInt32 frame = 1; frame <= FRAMES; ++frame) {
+        depth[depth.size() / 2] = (XnDepthPixel)((frame & 0x3FF) + 500);
+        server.publish(frame, frame, &image[0], X_RES, Y_RES, &depth[0], X_RES, Y_RES);
+      }
+      xnOSGetHighResTimeStamp(&end);
+
+      // 残りを送りきって送信側を閉じ、クライアントが最後まで受け取り終えるのを待つ
+      server.finish();
+      xnOSWaitForThreadExit(thread, XN_WAIT_INFINITE);
+      xnOSCloseThread(&thread);
+      server.printStats(std::cout);
+    }
+
+    const double seconds = (end - begin) / 1000000.0;
+    const double raw = (double)X_RES * Y_RES * (2 + ((codecs[c] == IMAGE_NONE) ? 0 : 3));
+    std::cout << names[c] << " : " << (FRAMES / seconds) << " frames/s sent, " <<
+      result.frames << " received, " <<
+      (result.frames ? raw * result.frames / result.bytes : 0) << "x compression, " <<
+      (result.bytes / seconds / 1000000) << " MB/s, latency avg " <<
+      (result.frames ? result.latency / result.frames : 0) << " us, max " <<
+      result.maxLatency << " us, errors " << result.errors << std::endl;
+  }
+}
+#endif
+
 // セッションの開始を通知されるコールバック
 void XN_CALLBACK_TYPE SessionStart(const XnPoint3D& pFocus, void* UserCxt)
 {
@@ -32,6 +156,13 @@ void XN_CALLBACK_TYPE SessionEnd(void* UserCxt)
 }
 
 int main (int argc, char * const argv[]) {
+#if (XN_PLATFORM != XN_PLATFORM_WIN32)
+  if ((argc > 1) && (std::string(argv[1]) == "bench")) {
+    benchmark();
+    return 0;
+  }
+#endif
+
   IplImage* camera = 0;
 
   try {
@@ -49,6 +180,17 @@ int main (int argc, char * const argv[]) {
       throw std::runtime_error(xnGetStatusString(rc));
     }
 
+    // デプスジェネレータの作成
+    xn::DepthGenerator depth;
+    rc = context.FindExistingNode(XN_NODE_TYPE_DEPTH, depth);
+    if (rc != XN_STATUS_OK) {
+      throw std::runtime_error(xnGetStatusString(rc));
+    }
+
+    // ユーザージェネレータ(設定ファイルになければラベルは配らない)
+    xn::UserGenerator user;
+    const bool hasUser = context.FindExistingNode(XN_NODE_TYPE_USER, user) == XN_STATUS_OK;
+
     // カメラサイズのイメージを作成(8bitのRGB)
     XnMapOutputMode outputMode;
     image.GetMapOutputMode(outputMode);
@@ -83,6 +225,22 @@ int main (int argc, char * const argv[]) {
     sessionManager.RegisterSession(&server);
     sessionManager.AddListener(&server);
 
+    // イメージ、デプス、ラベルのフレームを共有メモリで配る
+    //  クライアントはセンサーを開かずに、ここに書いたフレームを読む
+    //  (共有メモリはmainを抜けるときに閉じる)
+    XnMapOutputMode depthMode;
+    depth.GetMapOutputMode(depthMode);
+    FrameRingWriter frames(FRAME_RING_NAME, FRAME_RING_SLOTS,
+      outputMode.nXRes, outputMode.nYRes, depthMode.nXRes, depthMode.nYRes, hasUser);
+
+#if (XN_PLATFORM != XN_PLATFORM_WIN32)
+    // 同じマシンの、共有メモリを使わないクライアントには、圧縮してUnixドメインソケットで流す
+    //  (Unixドメインソケットなので、別のマシンからはつながらない)
+    //  MultiProcessFlowServer [raw|jpeg|png|none]
+    FrameStreamServer stream(FRAME_STREAM_PATH,
+      imageCodec((argc > 1) ? argv[1] : ""));
+#endif
+
     // ジェスチャーの検出を開始する
     context.StartGeneratingAll();
 
@@ -97,6 +255,25 @@ int main (int argc, char * const argv[]) {
       xn::ImageMetaData imageMD;
       image.GetMetaData(imageMD);
 
+      xn::DepthMetaData depthMD;
+      depth.GetMetaData(depthMD);
+
+      xn::SceneMetaData sceneMD;
+      if (hasUser) {
+        user.GetUserPixels(0, sceneMD);
+      }
+
+      // 共有メモリにフレームを書く
+      frames.publish(imageMD.RGB24Data(), depthMD.Data(), hasUser ? sceneMD.Data() : 0,
+        imageMD.FrameID(), depthMD.FrameID(), depthMD.Timestamp());
+
+#if (XN_PLATFORM != XN_PLATFORM_WIN32)
+      // ソケットのクライアントに流す(受け取りが遅いクライアントの分は捨てる)
+      stream.publish(frames.frame(), depthMD.Timestamp(),
+        imageMD.RGB24Data(), imageMD.XRes(), imageMD.YRes(),
+        depthMD.Data(), depthMD.XRes(), depthMD.YRes());
+#endif
+
       /* カメラ画像の表示 */
       memcpy(camera->imageData, imageMD.RGB24Data(), camera->imageSize);
       ::cvCvtColor(camera, camera, CV_BGR2RGB);
@@ -112,6 +289,10 @@ int main (int argc, char * const argv[]) {
 
     // 登録したコールバックを削除
     sessionManager.UnregisterSession(sessionCallnack);
+
+#if (XN_PLATFORM != XN_PLATFORM_WIN32)
+    stream.printStats(std::cout);
+#endif
   }
   catch (std::exception& ex) {
     std::cout << ex.what() << std::endl;
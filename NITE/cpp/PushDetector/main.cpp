@@ -8,6 +8,8 @@
 #include <XnVSessionManager.h>
 #include <XnVPushDetector.h>
 
+#include "../SessionManager/GestureBus.h"
+
 // 設定ファイルのパス(環境に合わせて変更してください)
 #if (XN_PLATFORM == XN_PLATFORM_WIN32)
 const char* CONFIG_XML_PATH = "../../../Data/SamplesConfig.xml";
@@ -23,25 +25,25 @@ const char* CONFIG_XML_PATH = "Data/SamplesConfig.xml";
 // セッションの開始を通知されるコールバック
 void XN_CALLBACK_TYPE SessionStart(const XnPoint3D& pFocus, void* UserCxt)
 {
-  std::cout << "SessionStart" << std::endl;
+  ((GestureBus*)UserCxt)->publish(GestureEvent("SessionStart").at(pFocus));
 }
 
 // セッションの終了を通知されるコールバック
 void XN_CALLBACK_TYPE SessionEnd(void* UserCxt)
 {
-  std::cout << "SessionEnd" << std::endl;
+  ((GestureBus*)UserCxt)->publish(GestureEvent("SessionEnd"));
 }
 
 // プッシュイベントを通知されるコールバック
 void XN_CALLBACK_TYPE Push(XnFloat fVelocity, XnFloat fAngle, void *UserCxt)
 {
-  std::cout << "Push:" << fVelocity << "," << fAngle << std::endl;
+  ((GestureBus*)UserCxt)->publish(GestureEvent("Push").value(fVelocity).value(fAngle));
 }
 
 // プッシュ後、停止したことを通知されるコールバック
 void XN_CALLBACK_TYPE Stabilized(XnFloat fVelocity, void *UserCxt)
 {
-  std::cout << "Stabilized:" << fVelocity << std::endl;
+  ((GestureBus*)UserCxt)->publish(GestureEvent("Stabilized").value(fVelocity));
 }
 
 
@@ -80,15 +82,20 @@ int main (int argc, char * const argv[]) {
       throw std::runtime_error(xnGetStatusString(rc));
     }
 
+    // コールバックはイベントを積むだけにして、表示は配信スレッドで行う
+    GestureBus bus;
+    bus.subscribe(&GestureBus::print);
+    bus.start();
+
     // セッションの開始終了を通知するコールバックを登録する
     XnVHandle sessionCallnack = sessionManager.RegisterSession(
-      0, &SessionStart, &SessionEnd );
+      &bus, &SessionStart, &SessionEnd );
 
     // 検出器を作成する
     XnVPushDetector pushDetector;
-    XnCallbackHandle pushCallback = pushDetector.RegisterPush(0, Push);
+    XnCallbackHandle pushCallback = pushDetector.RegisterPush(&bus, Push);
     XnCallbackHandle stabilizedCallback =
-                    pushDetector.RegisterStabilized(0, Stabilized);
+                    pushDetector.RegisterStabilized(&bus, Stabilized);
 
     // セッションマネージャーに検出器を登録する
     sessionManager.AddListener(&pushDetector);
@@ -124,6 +131,10 @@ int main (int argc, char * const argv[]) {
     pushDetector.UnregisterPush(pushCallback);
     pushDetector.UnregisterStabilized(stabilizedCallback);
     sessionManager.UnregisterSession(sessionCallnack);
+
+    // 配信を止めて、キューの統計を表示する
+    bus.stop();
+    bus.printStats(std::cout);
   }
   catch (std::exception& ex) {
     std::cout << ex.what() << std::endl;
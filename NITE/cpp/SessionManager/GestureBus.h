@@ -0,0 +1,312 @@
+#ifndef GESTUREBUS_H_INCLUDE
+#define GESTUREBUS_H_INCLUDE
+
+#include <vector>
+#include <ostream>
+#include <iostream>
+#include <cstring>
+#include <stdexcept>
+
+#include <XnCppWrapper.h>
+#include <XnOS.h>
+
+#if (XN_PLATFORM == XN_PLATFORM_WIN32)
+#include <windows.h>
+#endif
+
+// ジェスチャーのイベント
+//  コールバックの中で作り、そのままキューのセルにコピーする(newしない)
+struct GestureEvent
+{
+  enum { MAX_VALUES = 4, MAX_NAME = 32 };
+
+  XnChar    name[MAX_NAME];     // "Swipe:Up" など
+  XnUInt32  id;                 // 手やユーザーのID(なければ0)
+  XnPoint3D position;
+  XnFloat   values[MAX_VALUES];
+  XnUInt32  valueCount;
+  XnUInt64  timestamp;          // コールバックが呼ばれた時刻(us)
+
+  GestureEvent(const XnChar* eventName, XnUInt32 eventId = 0)
+    :id(eventId), valueCount(0)
+  {
+    strncpy(name, eventName, MAX_NAME - 1);
+    name[MAX_NAME - 1] = '\0';
+    position.X = position.Y = position.Z = 0;
+    xnOSGetHighResTimeStamp(&timestamp);
+  }
+
+  GestureEvent& value(XnFloat v)
+  {
+    if (valueCount < MAX_VALUES) {
+      values[valueCount++] = v;
+    }
+    return *this;
+  }
+
+  GestureEvent& at(const XnPoint3D& point)
+  {
+    position = point;
+    return *this;
+  }
+};
+
+// ジェスチャーのイベントバス
+//  コールバックはイベントをキューに積むだけにして、購読者への配信は専用のスレッドで行う。
+//  購読者の処理が重くても、WaitAndUpdateAll や sessionManager.Update は止まらない。
+//  キューは決まった数のセルを持つリングで、積む側は何スレッドからでもよく(ロックなし)、
+//  取り出すのは配信スレッドだけ。いっぱいのときは積まずに捨てる
+class GestureBus
+{
+public:
+
+  typedef void (*Handler)(const GestureEvent& event, void* cookie);
+
+  // capacityは2のべき乗に切り上げる
+  GestureBus(XnUInt32 capacity = 256)
+    :enqueuePos_(0), dequeuePos_(0), thread_(0), isQuit_(false),
+     published_(0), dropped_(0), dispatched_(0), maxDepth_(0),
+     latencySum_(0), latencyMax_(0)
+  {
+    XnUInt32 size = 2;
+    while (size < capacity) {
+      size *= 2;
+    }
+
+    cells_.resize(size);
+    for (XnUInt32 i = 0; i < size; ++i) {
+      cells_[i].sequence = i;
+    }
+
+    XnStatus rc = xnOSCreateEvent(&wakeup_, FALSE);
+    if (rc != XN_STATUS_OK) {
+      throw std::runtime_error(xnGetStatusString(rc));
+    }
+  }
+
+  ~GestureBus()
+  {
+    stop();
+    xnOSCloseEvent(&wakeup_);
+  }
+
+  // 購読者を登録する(startの前に行う)
+  void subscribe(Handler handler, void* cookie = 0)
+  {
+    Subscriber subscriber = { handler, cookie };
+    subscribers_.push_back(subscriber);
+  }
+
+  // 配信スレッドを開始する
+  void start()
+  {
+    if (thread_ != 0) {
+      return;
+    }
+
+    isQuit_ = false;
+    XnStatus rc = xnOSCreateThread(threadProc, this, &thread_);
+    if (rc != XN_STATUS_OK) {
+      throw std::runtime_error(xnGetStatusString(rc));
+    }
+  }
+
+  // 配信スレッドを止める(残っているイベントは配信してから止まる)
+  void stop()
+  {
+    if (thread_ == 0) {
+      return;
+    }
+
+    isQuit_ = true;
+    xnOSSetEvent(wakeup_);
+    xnOSWaitForThreadExit(thread_, XN_WAIT_INFINITE);
+    xnOSCloseThread(&thread_);
+    thread_ = 0;
+  }
+
+  // イベントを積む。キューがいっぱいならfalse
+  bool publish(const GestureEvent& event)
+  {
+    const XnUInt32 mask = (XnUInt32)cells_.size() - 1;
+    XnUInt32 pos = enqueuePos_;
+    Cell* cell = 0;
+    while (1) {
+      cell = &cells_[pos & mask];
+      const XnInt32 diff = (XnInt32)(cell->sequence - pos);
+      if (diff == 0) {
+        // このセルを取れたら書き込む
+        if (compareAndSwap(&enqueuePos_, pos, pos + 1)) {
+          break;
+        }
+        pos = enqueuePos_;
+      }
+      else if (diff < 0) {
+        increment(&dropped_);
+        return false;
+      }
+      else {
+        pos = enqueuePos_;
+      }
+    }
+
+    cell->event = event;
+    memoryBarrier();
+    cell->sequence = pos + 1;
+
+    increment(&published_);
+    xnOSSetEvent(wakeup_);
+    return true;
+  }
+
+  // 配信を待っているイベントの数
+  XnUInt32 depth() const
+  {
+    return enqueuePos_ - dequeuePos_;
+  }
+
+  // 統計を表示する
+  void printStats(std::ostream& out) const
+  {
+    out << "GestureBus : published " << published_ << ", dispatched " << dispatched_ <<
+      ", dropped " << dropped_ << ", depth " << depth() << " (max " << maxDepth_ << ")";
+    if (dispatched_ != 0) {
+      out << ", latency avg " << (latencySum_ / dispatched_) << " us, max " << latencyMax_ << " us";
+    }
+    out << std::endl;
+  }
+
+  // 標準出力に書く購読者(名前:値,値...)
+  static void print(const GestureEvent& event, void* cookie)
+  {
+    std::cout << event.name;
+    for (XnUInt32 i = 0; i < event.valueCount; ++i) {
+      std::cout << ((i == 0) ? ":" : ",") << event.values[i];
+    }
+    std::cout << std::endl;
+  }
+
+private:
+
+  GestureBus(const GestureBus&);
+  GestureBus& operator=(const GestureBus&);
+
+  struct Cell
+  {
+    volatile XnUInt32 sequence;
+    GestureEvent event;
+
+    Cell()
+      :sequence(0), event("")
+    {
+    }
+  };
+
+  struct Subscriber
+  {
+    Handler handler;
+    void* cookie;
+  };
+
+  static bool compareAndSwap(volatile XnUInt32* target, XnUInt32 expected, XnUInt32 desired)
+  {
+#if (XN_PLATFORM == XN_PLATFORM_WIN32)
+    return (XnUInt32)InterlockedCompareExchange((volatile LONG*)target,
+      (LONG)desired, (LONG)expected) == expected;
+#else
+    return __sync_bool_compare_and_swap(target, expected, desired);
+#endif
+  }
+
+  static void increment(volatile XnUInt32* target)
+  {
+    XnUInt32 value = *target;
+    while (!compareAndSwap(target, value, value + 1)) {
+      value = *target;
+    }
+  }
+
+  static void memoryBarrier()
+  {
+#if (XN_PLATFORM == XN_PLATFORM_WIN32)
+    MemoryBarrier();
+#else
+    __sync_synchronize();
+#endif
+  }
+
+  // 1つ取り出す(配信スレッドからだけ呼ぶ)
+  bool pop(GestureEvent& event)
+  {
+    const XnUInt32 mask = (XnUInt32)cells_.size() - 1;
+    const XnUInt32 pos = dequeuePos_;
+    Cell& cell = cells_[pos & mask];
+    if ((XnInt32)(cell.sequence - (pos + 1)) != 0) {
+      return false;
+    }
+
+    memoryBarrier();
+    event = cell.event;
+    memoryBarrier();
+    cell.sequence = pos + mask + 1;
+    dequeuePos_ = pos + 1;
+    return true;
+  }
+
+  static XN_THREAD_PROC threadProc(XN_THREAD_PARAM param)
+  {
+    GestureBus& self = *(GestureBus*)param;
+    GestureEvent event("");
+
+    while (1) {
+      xnOSWaitEvent(self.wakeup_, XN_WAIT_INFINITE);
+
+      const XnUInt32 depth = self.depth();
+      if (depth > self.maxDepth_) {
+        self.maxDepth_ = depth;
+      }
+
+      while (self.pop(event)) {
+        for (std::vector<Subscriber>::const_iterator it = self.subscribers_.begin();
+             it != self.subscribers_.end(); ++it) {
+          it->handler(event, it->cookie);
+        }
+
+        // コールバックから購読者の処理が終わるまで
+        XnUInt64 now;
+        xnOSGetHighResTimeStamp(&now);
+        const XnUInt64 latency = now - event.timestamp;
+        self.latencySum_ += latency;
+        if (latency > self.latencyMax_) {
+          self.latencyMax_ = latency;
+        }
+        ++self.dispatched_;
+      }
+
+      if (self.isQuit_) {
+        break;
+      }
+    }
+
+    XN_THREAD_PROC_RETURN(0);
+  }
+
+  std::vector<Cell> cells_;
+  volatile XnUInt32 enqueuePos_;
+  volatile XnUInt32 dequeuePos_;
+
+  std::vector<Subscriber> subscribers_;
+  XN_THREAD_HANDLE thread_;
+  XN_EVENT_HANDLE wakeup_;
+  volatile bool isQuit_;
+
+  // 統計(dispatched_以降は配信スレッドだけが書く)
+  volatile XnUInt32 published_;
+  volatile XnUInt32 dropped_;
+  volatile XnUInt32 dispatched_;
+  volatile XnUInt32 maxDepth_;
+  volatile XnUInt64 latencySum_;
+  volatile XnUInt64 latencyMax_;
+};
+
+#endif // #ifndef GESTUREBUS_H_INCLUDE
@@ -7,6 +7,8 @@
 #include <XnCppWrapper.h>
 #include <XnVSessionManager.h>
 
+#include "GestureBus.h"
+
 // 設定ファイルのパス(環境に合わせて変更してください)
 #if (XN_PLATFORM == XN_PLATFORM_WIN32)
 const char* CONFIG_XML_PATH = "../../../Data/SamplesConfig.xml";
@@ -23,19 +25,19 @@ const char* CONFIG_XML_PATH = "Data/SamplesConfig.xml";
 void XN_CALLBACK_TYPE SessionDetected(const XnChar* strFocus,
       const XnPoint3D& ptPosition, XnFloat fProgress, void* UserCxt)
 {
-  std::cout << "SessionDetected:" << strFocus << "," << fProgress << std::endl;
+  ((GestureBus*)UserCxt)->publish(GestureEvent("SessionDetected").value(fProgress).at(ptPosition));
 }
 
 // セッションの開始を通知されるコールバック
 void XN_CALLBACK_TYPE SessionStart(const XnPoint3D& pFocus, void* UserCxt)
 {
-  std::cout << "SessionStart" << std::endl;
+  ((GestureBus*)UserCxt)->publish(GestureEvent("SessionStart").at(pFocus));
 }
 
 // セッションの終了を通知されるコールバック
 void XN_CALLBACK_TYPE SessionEnd(void* UserCxt)
 {
-  std::cout << "SessionEnd" << std::endl;
+  ((GestureBus*)UserCxt)->publish(GestureEvent("SessionEnd"));
 }
 
 int main (int argc, char * const argv[]) {
@@ -73,9 +75,14 @@ int main (int argc, char * const argv[]) {
       throw std::runtime_error(xnGetStatusString(rc));
     }
 
+    // コールバックはイベントを積むだけにして、表示は配信スレッドで行う
+    GestureBus bus;
+    bus.subscribe(&GestureBus::print);
+    bus.start();
+
     // セッションの開始終了を通知するコールバックを登録する
     XnVHandle sessionCallnack = sessionManager.RegisterSession(
-      0, &SessionStart, &SessionEnd,
+      &bus, &SessionStart, &SessionEnd,
       &SessionDetected);
 
     // メインループ
@@ -102,6 +109,10 @@ int main (int argc, char * const argv[]) {
 
     // セッションのコールバックを削除する
     sessionManager.UnregisterSession(sessionCallnack);
+
+    // 配信を止めて、キューの統計を表示する
+    bus.stop();
+    bus.printStats(std::cout);
   }
   catch (std::exception& ex) {
     std::cout << ex.what() << std::endl;
@@ -8,6 +8,8 @@
 #include <XnVSessionManager.h>
 #include <XnVSwipeDetector.h>
 
+#include "../SessionManager/GestureBus.h"
+
 // 設定ファイルのパス(環境に合わせて変更してください)
 #if (XN_PLATFORM == XN_PLATFORM_WIN32)
 const char* CONFIG_XML_PATH = "../../../Data/SamplesConfig.xml";
@@ -22,23 +24,32 @@ const char* CONFIG_XML_PATH = "Data/SamplesConfig.xml";
 // セッションの開始を通知されるコールバック
 void XN_CALLBACK_TYPE SessionStart(const XnPoint3D& pFocus, void* UserCxt)
 {
-  std::cout << "SessionStart" << std::endl;
+  ((GestureBus*)UserCxt)->publish(GestureEvent("SessionStart").at(pFocus));
 }
 
 // セッションの終了を通知されるコールバック
 void XN_CALLBACK_TYPE SessionEnd(void* UserCxt)
 {
-  std::cout << "SessionEnd" << std::endl;
+  ((GestureBus*)UserCxt)->publish(GestureEvent("SessionEnd"));
 }
 
+// 方向ごとのスワイプのコールバックに渡す情報
+struct SwipeDirection
+{
+  GestureBus* bus;
+  const XnChar* name;
+};
+
 void XN_CALLBACK_TYPE Swipe(XnFloat fVelocity, XnFloat fAngle, void *pUserCxt)
 {
-  std::cout << "Swipe:" << (char*)pUserCxt << "," << fVelocity << "," << fAngle << std::endl;
+  SwipeDirection* direction = (SwipeDirection*)pUserCxt;
+  direction->bus->publish(GestureEvent(direction->name).value(fVelocity).value(fAngle));
 }
 
 void XN_CALLBACK_TYPE GeneralSwipe(XnVDirection eDir, XnFloat fVelocity, XnFloat fAngle, void *pUserCxt)
 {
-  std::cout << "GeneralSwipe:" << eDir << "," << fVelocity << "," << fAngle << std::endl;
+  ((GestureBus*)pUserCxt)->publish(GestureEvent("GeneralSwipe").value(eDir).value(fVelocity).
+    value(fAngle));
 }
 
 
@@ -77,22 +88,31 @@ int main (int argc, char * const argv[]) {
       throw std::runtime_error(xnGetStatusString(rc));
     }
 
+    // コールバックはイベントを積むだけにして、表示は配信スレッドで行う
+    GestureBus bus;
+    bus.subscribe(&GestureBus::print);
+    bus.start();
+
     // セッションの開始終了を通知するコールバックを登録する
     XnVHandle sessionCallnack = sessionManager.RegisterSession(
-      0, &SessionStart, &SessionEnd );
+      &bus, &SessionStart, &SessionEnd );
 
     // プッシュの検出器を作成する
     XnVSwipeDetector swipeDetector;
+    SwipeDirection up = { &bus, "Swipe:Up" };
+    SwipeDirection down = { &bus, "Swipe:Down" };
+    SwipeDirection right = { &bus, "Swipe:Right" };
+    SwipeDirection left = { &bus, "Swipe:Left" };
     XnCallbackHandle swipeUpCallback =
-      swipeDetector.RegisterSwipeUp((void*)"Up", Swipe);
+      swipeDetector.RegisterSwipeUp(&up, Swipe);
     XnCallbackHandle swipeDownCallback =
-      swipeDetector.RegisterSwipeDown((void*)"Down", Swipe);
+      swipeDetector.RegisterSwipeDown(&down, Swipe);
     XnCallbackHandle swipeRightCallback =
-      swipeDetector.RegisterSwipeRight((void*)"Right", Swipe);
+      swipeDetector.RegisterSwipeRight(&right, Swipe);
     XnCallbackHandle swipeLeftCallback =
-      swipeDetector.RegisterSwipeLeft((void*)"Left", Swipe);
+      swipeDetector.RegisterSwipeLeft(&left, Swipe);
     XnCallbackHandle generalSwipeCallback =
-      swipeDetector.RegisterSwipe(0, GeneralSwipe);
+      swipeDetector.RegisterSwipe(&bus, GeneralSwipe);
 
     // セッションマネージャーに検出器を登録する
     sessionManager.AddListener(&swipeDetector);
@@ -131,6 +151,10 @@ int main (int argc, char * const argv[]) {
     swipeDetector.UnregisterSwipeLeft(swipeLeftCallback);
     swipeDetector.UnregisterSwipe(generalSwipeCallback);
     sessionManager.UnregisterSession(sessionCallnack);
+
+    // 配信を止めて、キューの統計を表示する
+    bus.stop();
+    bus.printStats(std::cout);
   }
   catch (std::exception& ex) {
     std::cout << ex.what() << std::endl;
@@ -8,6 +8,8 @@
 #include <XnVSessionManager.h>
 #include <XnVWaveDetector.h>
 
+#include "../SessionManager/GestureBus.h"
+
 // 設定ファイルのパス(環境に合わせて変更してください)
 #if (XN_PLATFORM == XN_PLATFORM_WIN32)
 const char* CONFIG_XML_PATH = "../../../Data/SamplesConfig.xml";
@@ -22,19 +24,19 @@ const char* CONFIG_XML_PATH = "Data/SamplesConfig.xml";
 // セッションの開始を通知されるコールバック
 void XN_CALLBACK_TYPE SessionStart(const XnPoint3D& pFocus, void* UserCxt)
 {
-  std::cout << "SessionStart" << std::endl;
+  ((GestureBus*)UserCxt)->publish(GestureEvent("SessionStart").at(pFocus));
 }
 
 // セッションの終了を通知されるコールバック
 void XN_CALLBACK_TYPE SessionEnd(void* UserCxt)
 {
-  std::cout << "SessionEnd" << std::endl;
+  ((GestureBus*)UserCxt)->publish(GestureEvent("SessionEnd"));
 }
 
 // ウェーブイベントを通知されるコールバック
 void XN_CALLBACK_TYPE Wave(void *pUserCxt)
 {
-  std::cout << "Wave" << std::endl;
+  ((GestureBus*)pUserCxt)->publish(GestureEvent("Wave"));
 }
 
 int main (int argc, char * const argv[]) {
@@ -72,13 +74,18 @@ int main (int argc, char * const argv[]) {
       throw std::runtime_error(xnGetStatusString(rc));
     }
 
+    // コールバックはイベントを積むだけにして、表示は配信スレッドで行う
+    GestureBus bus;
+    bus.subscribe(&GestureBus::print);
+    bus.start();
+
     // セッションの開始終了を通知するコールバックを登録する
-    XnVHandle sessionCallnack = sessionManager.RegisterSession(0,
+    XnVHandle sessionCallnack = sessionManager.RegisterSession(&bus,
                                           &SessionStart, &SessionEnd );
 
     // プッシュの検出器を作成する
     XnVWaveDetector waveDetector;
-    XnCallbackHandle waveCallback = waveDetector.RegisterWave(0, Wave);
+    XnCallbackHandle waveCallback = waveDetector.RegisterWave(&bus, Wave);
 
     // セッションマネージャーに検出器を登録する
     sessionManager.AddListener(&waveDetector);
@@ -113,6 +120,10 @@ int main (int argc, char * const argv[]) {
     // 登録したコールバックを削除
     waveDetector.UnregisterWave(waveCallback);
     sessionManager.UnregisterSession(sessionCallnack);
+
+    // 配信を止めて、キューの統計を表示する
+    bus.stop();
+    bus.printStats(std::cout);
   }
   catch (std::exception& ex) {
     std::cout << ex.what() << std::endl;
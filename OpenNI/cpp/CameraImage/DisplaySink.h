@@ -0,0 +1,384 @@
+#ifndef DISPLAYSINK_H_INCLUDE
+#define DISPLAYSINK_H_INCLUDE
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+#include <opencv/cv.h>
+#include <opencv/highgui.h>
+
+#include <XnCppWrapper.h>
+#include <XnOS.h>
+
+#if (XN_PLATFORM == XN_PLATFORM_WIN32)
+#include <windows.h>
+#endif
+
+// 画像の表示先
+//  cvShowImage + cvWaitKey(10) の代わりに使う。
+//  ウィンドウのない環境(キオスクやサーバー)では、表示しない・一定の間隔でファイルに書く・
+//  共有メモリに書く のどれかにして、メインループは待たずにセンサーの速さで回す。
+//  コマンドラインの display=... で選ぶ(create()を参照)
+class DisplaySink
+{
+public:
+
+  virtual ~DisplaySink()
+  {
+  }
+
+  // nameの表示先に画像を出す
+  virtual void show(const char* name, const IplImage* image) = 0;
+
+  // ウィンドウを置く位置(ウィンドウのときだけ使う)
+  virtual void move(const char* name, int x, int y)
+  {
+  }
+
+  // 押されたキー(なければ-1)。キーを待たない。
+  //  ウィンドウがなければキーで止められないので、Ctrl+Cを'q'として返す
+  virtual int pollKey()
+  {
+    return (interruptFlag() != 0) ? 'q' : -1;
+  }
+
+  // コマンドラインから表示先を作る(指定がなければウィンドウ)
+  //  display=window                      ウィンドウ(cvShowImage)
+  //  display=null                        表示しない
+  //  display=snapshot[,dir[,fps[,.ext]]] fps枚/秒で dir/名前.ext に書く(.ppm か .png など)
+  //  display=shm[,prefix]                共有メモリ prefix_名前 に書く(SharedFrameHeader)
+  static DisplaySink* create(int argc, char* argv[]);
+
+protected:
+
+  DisplaySink()
+  {
+  }
+
+  // Ctrl+Cで終了できるようにする
+  static void catchInterrupt()
+  {
+    std::signal(SIGINT, &DisplaySink::onInterrupt);
+  }
+
+  // ファイル名や共有メモリの名前に使えるように、英数字以外を'_'にする
+  static std::string safeName(const char* name)
+  {
+    std::string safe(name);
+    for (size_t i = 0; i < safe.size(); ++i) {
+      const char c = safe[i];
+      if (!(((c >= '0') && (c <= '9')) || ((c >= 'A') && (c <= 'Z')) || ((c >= 'a') && (c <= 'z')))) {
+        safe[i] = '_';
+      }
+    }
+    return safe;
+  }
+
+private:
+
+  DisplaySink(const DisplaySink&);
+  DisplaySink& operator=(const DisplaySink&);
+
+  static volatile std::sig_atomic_t& interruptFlag()
+  {
+    static volatile std::sig_atomic_t flag = 0;
+    return flag;
+  }
+
+  static void onInterrupt(int)
+  {
+    interruptFlag() = 1;
+  }
+};
+
+// ウィンドウに表示する
+class WindowSink : public DisplaySink
+{
+public:
+
+  void show(const char* name, const IplImage* image)
+  {
+    ::cvShowImage(name, image);
+  }
+
+  void move(const char* name, int x, int y)
+  {
+    ::cvNamedWindow(name);
+    ::cvMoveWindow(name, x, y);
+  }
+
+  // ウィンドウのイベントを処理させるため、1msだけ待つ
+  int pollKey()
+  {
+    const int key = ::cvWaitKey(1);
+    return (key < 0) ? -1 : (key & 0xFF);
+  }
+};
+
+// 表示しない(処理だけを回す)
+class NullSink : public DisplaySink
+{
+public:
+
+  NullSink()
+  {
+    catchInterrupt();
+  }
+
+  void show(const char* name, const IplImage* image)
+  {
+  }
+};
+
+// 一定の間隔で画像をファイルに書く
+//  dir/名前.ext を上書きする。書きかけのファイルが見えないよう、別名で書いてから名前を変える。
+//  .ppm は自前で書き(圧縮しないので速い)、それ以外はcvSaveImageで書く
+class SnapshotSink : public DisplaySink
+{
+public:
+
+  SnapshotSink(const std::string& directory, double fps, const std::string& extension)
+    :directory_(directory), extension_(extension),
+     interval_((fps > 0) ? (XnUInt64)(1000000 / fps) : 0), written_(0)
+  {
+    catchInterrupt();
+  }
+
+  void show(const char* name, const IplImage* image)
+  {
+    XnUInt64 now;
+    xnOSGetHighResTimeStamp(&now);
+    std::map<std::string, XnUInt64>::iterator it = last_.find(name);
+    if ((it != last_.end()) && ((now - it->second) < interval_)) {
+      return;
+    }
+    last_[name] = now;
+
+    const std::string path = directory_ + "/" + safeName(name) + extension_;
+    const std::string temporary = directory_ + "/" + safeName(name) + ".tmp" + extension_;
+    const bool isWritten = (extension_ == ".ppm") ? writePpm(temporary, image) :
+                                                     (::cvSaveImage(temporary.c_str(), image) != 0);
+    if (!isWritten) {
+      throw std::runtime_error("error : write " + temporary);
+    }
+#if (XN_PLATFORM == XN_PLATFORM_WIN32)
+    std::remove(path.c_str());
+#endif
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+      throw std::runtime_error("error : rename " + path);
+    }
+    ++written_;
+  }
+
+  // 書いたファイルの数
+  XnUInt32 written() const
+  {
+    return written_;
+  }
+
+private:
+
+  // 8bitの1チャンネル(P5)か3チャンネルBGR(P6)
+  static bool writePpm(const std::string& path, const IplImage* image)
+  {
+    if ((image->depth != IPL_DEPTH_8U) || ((image->nChannels != 1) && (image->nChannels != 3))) {
+      return false;
+    }
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (file == 0) {
+      return false;
+    }
+
+    std::fprintf(file, "P%d\n%d %d\n255\n", (image->nChannels == 1) ? 5 : 6,
+                 image->width, image->height);
+    std::string row(image->width * image->nChannels, '\0');
+    bool isOk = true;
+    for (int y = 0; (y < image->height) && isOk; ++y) {
+      const char* src = image->imageData + y * image->widthStep;
+      if (image->nChannels == 1) {
+        memcpy(&row[0], src, row.size());
+      }
+      else {
+        // BGRからRGBにする
+        for (size_t i = 0; i < row.size(); i += 3) {
+          row[i] = src[i + 2];
+          row[i + 1] = src[i + 1];
+          row[i + 2] = src[i];
+        }
+      }
+      isOk = (std::fwrite(row.data(), 1, row.size(), file) == row.size());
+    }
+    return (std::fclose(file) == 0) && isOk;
+  }
+
+  std::string directory_;
+  std::string extension_;
+  XnUInt64 interval_;
+  std::map<std::string, XnUInt64> last_;
+  XnUInt32 written_;
+};
+
+// 共有メモリの表示先の先頭
+//  この後ろ(dataOffset)に、widthStep x height の画素が続く。
+//  書いている間は sequence が奇数になる。読む側は読む前と後で sequence が同じで
+//  偶数なら、その画像は壊れていない
+struct SharedFrameHeader
+{
+  enum { MAGIC = 0x42464853, VERSION = 1 };
+
+  XnUInt32 magic;
+  XnUInt32 version;
+  XnUInt32 dataOffset;
+  XnUInt32 capacity;          // 画素に使える大きさ
+  XnUInt32 width;
+  XnUInt32 height;
+  XnUInt32 channels;
+  XnUInt32 widthStep;
+  volatile XnUInt32 sequence;
+  volatile XnUInt32 frame;    // 書いた画像の数
+  XnUInt64 timestamp;         // 書いた時刻(us)
+};
+
+// 共有メモリに画像を書く(他のプロセスが表示や録画をする)
+//  表示先ごとに prefix_名前 の共有メモリを、最初の画像の大きさで作る
+class SharedMemorySink : public DisplaySink
+{
+public:
+
+  explicit SharedMemorySink(const std::string& prefix)
+    :prefix_(prefix)
+  {
+    catchInterrupt();
+  }
+
+  ~SharedMemorySink()
+  {
+    for (std::map<std::string, Segment>::iterator it = segments_.begin(); it != segments_.end(); ++it) {
+      xnOSCloseSharedMemory(it->second.memory);
+    }
+  }
+
+  void show(const char* name, const IplImage* image)
+  {
+    SharedFrameHeader* header = open(name, image);
+    if ((XnUInt32)image->imageSize > header->capacity) {
+      throw std::runtime_error("error : image is larger than shared memory " + segmentName(name));
+    }
+
+    header->sequence = header->sequence + 1;
+    memoryBarrier();
+    header->width = image->width;
+    header->height = image->height;
+    header->channels = image->nChannels;
+    header->widthStep = image->widthStep;
+    xnOSGetHighResTimeStamp(&header->timestamp);
+    memcpy((XnUInt8*)header + header->dataOffset, image->imageData, image->imageSize);
+    header->frame = header->frame + 1;
+    memoryBarrier();
+    header->sequence = header->sequence + 1;
+  }
+
+private:
+
+  struct Segment
+  {
+    XN_SHARED_MEMORY_HANDLE memory;
+    SharedFrameHeader* header;
+  };
+
+  std::string segmentName(const char* name) const
+  {
+    return prefix_ + "_" + safeName(name);
+  }
+
+  SharedFrameHeader* open(const char* name, const IplImage* image)
+  {
+    std::map<std::string, Segment>::iterator it = segments_.find(name);
+    if (it != segments_.end()) {
+      return it->second.header;
+    }
+
+    const XnUInt32 dataOffset = (sizeof(SharedFrameHeader) + 63) & ~63u;
+    Segment segment;
+    XnStatus rc = xnOSCreateSharedMemory(segmentName(name).c_str(), dataOffset + image->imageSize,
+                                         XN_OS_FILE_READ | XN_OS_FILE_WRITE, &segment.memory);
+    if (rc != XN_STATUS_OK) {
+      throw std::runtime_error(xnGetStatusString(rc));
+    }
+    void* address = 0;
+    rc = xnOSSharedMemoryGetAddress(segment.memory, &address);
+    if (rc != XN_STATUS_OK) {
+      xnOSCloseSharedMemory(segment.memory);
+      throw std::runtime_error(xnGetStatusString(rc));
+    }
+
+    segment.header = (SharedFrameHeader*)address;
+    memset(segment.header, 0, sizeof(SharedFrameHeader));
+    segment.header->dataOffset = dataOffset;
+    segment.header->capacity = image->imageSize;
+    segment.header->version = SharedFrameHeader::VERSION;
+    memoryBarrier();
+    segment.header->magic = SharedFrameHeader::MAGIC;
+
+    segments_[name] = segment;
+    return segment.header;
+  }
+
+  static void memoryBarrier()
+  {
+#if (XN_PLATFORM == XN_PLATFORM_WIN32)
+    MemoryBarrier();
+#else
+    __sync_synchronize();
+#endif
+  }
+
+  std::string prefix_;
+  std::map<std::string, Segment> segments_;
+};
+
+inline DisplaySink* DisplaySink::create(int argc, char* argv[])
+{
+  std::string spec = "window";
+  for (int i = 1; i < argc; ++i) {
+    if (strncmp(argv[i], "display=", 8) == 0) {
+      spec = argv[i] + 8;
+    }
+  }
+
+  // カンマで区切る
+  std::string fields[4];
+  size_t count = 0;
+  for (size_t begin = 0; (begin <= spec.size()) && (count < 4); ++count) {
+    size_t end = spec.find(',', begin);
+    if (end == std::string::npos) {
+      end = spec.size();
+    }
+    fields[count] = spec.substr(begin, end - begin);
+    begin = end + 1;
+  }
+
+  if (fields[0] == "window") {
+    return new WindowSink();
+  }
+  else if (fields[0] == "null") {
+    return new NullSink();
+  }
+  else if (fields[0] == "snapshot") {
+    return new SnapshotSink(fields[1].empty() ? "." : fields[1],
+                            fields[2].empty() ? 1.0 : atof(fields[2].c_str()),
+                            fields[3].empty() ? ".ppm" : fields[3]);
+  }
+  else if (fields[0] == "shm") {
+    return new SharedMemorySink(fields[1].empty() ? "KinectDisplay" : fields[1]);
+  }
+
+  throw std::runtime_error("error : display=" + spec);
+}
+
+#endif // #ifndef DISPLAYSINK_H_INCLUDE
@@ -6,6 +6,8 @@
 
 #include <XnCppWrapper.h>
 
+#include "DisplaySink.h"
+
 // 設定ファイルのパス(環境に合わせて変更してください)
 #if (XN_PLATFORM == XN_PLATFORM_WIN32)
 const char* CONFIG_XML_PATH = "../../../Data/SamplesConfig.xml";
@@ -20,8 +22,12 @@ const char* CONFIG_XML_PATH = "Data/SamplesConfig.xml";
 int main (int argc, char * argv[])
 {
   IplImage* camera = 0;
+  DisplaySink* display = 0;
 
   try {
+    // 表示先(display=null などでウィンドウなしで動かす)
+    display = DisplaySink::create(argc, argv);
+
     // コンテキストの初期化 ... (1)
     xn::Context context;
     XnStatus rc = context.InitFromXmlFile(CONFIG_XML_PATH);
@@ -56,10 +62,10 @@ int main (int argc, char * argv[])
       //  Kinectからの入力がRGBであるため、BGRに変換して表示する
       memcpy(camera->imageData, imageMD.RGB24Data(), camera->imageSize);
       ::cvCvtColor(camera, camera, CV_RGB2BGR);
-      ::cvShowImage("KinectImage", camera);
+      display->show("KinectImage", camera);
 
-      // キーの取得
-      char key = cvWaitKey(10);
+      // キーの取得(待たない)
+      int key = display->pollKey();
       // 終了する
       if (key == 'q') {
         break;
@@ -71,6 +77,7 @@ int main (int argc, char * argv[])
   }
 
   ::cvReleaseImage(&camera);
+  delete display;
 
   return 0;
 }
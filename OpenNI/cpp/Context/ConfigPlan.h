@@ -0,0 +1,1229 @@
+#ifndef CONFIGPLAN_H_INCLUDE
+#define CONFIGPLAN_H_INCLUDE
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <XnCppWrapper.h>
+#include <XnLog.h>
+#include <XnOS.h>
+
+// XMLのタグ1つ
+struct XmlElement
+{
+  std::string name;
+  std::vector<std::pair<std::string, std::string> > attributes;
+  std::vector<size_t> children;   // XmlDocument::element() の番号
+  int line;
+
+  // 属性の値(なければ0)
+  const std::string* attribute(const char* key) const
+  {
+    for (size_t i = 0; i < attributes.size(); ++i) {
+      if (attributes[i].first == key) {
+        return &attributes[i].second;
+      }
+    }
+    return 0;
+  }
+};
+
+// 設定ファイルを読むだけの小さなXMLパーサー
+//  タグ・属性・コメント・<?xml ...?> を読み、タグの間の文字は読み飛ばす。
+//  CDATAとDOCTYPEは扱わない
+class XmlDocument
+{
+public:
+
+  XmlDocument(const std::string& text, const std::string& path)
+    :text_(text), path_(path), pos_(0), line_(1)
+  {
+    // UTF-8のBOM
+    if (text_.compare(0, 3, "\xEF\xBB\xBF") == 0) {
+      pos_ = 3;
+    }
+
+    skipMisc();
+    if (!isAt("<")) {
+      fail("no root element");
+    }
+    parseElement();
+    skipMisc();
+    if (pos_ != text_.size()) {
+      fail("text after the root element");
+    }
+  }
+
+  const XmlElement& root() const
+  {
+    return elements_[0];
+  }
+
+  const XmlElement& element(size_t index) const
+  {
+    return elements_[index];
+  }
+
+  // 読んだファイルの line 行目のエラー
+  std::string errorAt(int line, const std::string& message) const
+  {
+    std::ostringstream error;
+    error << "error : " << path_ << "(" << line << ") : " << message;
+    return error.str();
+  }
+
+private:
+
+  void fail(const std::string& message) const
+  {
+    throw std::runtime_error(errorAt(line_, message));
+  }
+
+  bool isAt(const char* s) const
+  {
+    return text_.compare(pos_, strlen(s), s) == 0;
+  }
+
+  // n文字進める(行数を数えながら)
+  void advance(size_t n)
+  {
+    for (size_t end = std::min(pos_ + n, text_.size()); pos_ < end; ++pos_) {
+      if (text_[pos_] == '\n') {
+        ++line_;
+      }
+    }
+  }
+
+  // endの後ろまで進める
+  void skipPast(const char* end)
+  {
+    const size_t found = text_.find(end, pos_);
+    if (found == std::string::npos) {
+      fail(std::string("missing ") + end);
+    }
+    advance(found + strlen(end) - pos_);
+  }
+
+  void skipSpace()
+  {
+    while ((pos_ < text_.size()) && isspace((unsigned char)text_[pos_])) {
+      advance(1);
+    }
+  }
+
+  // 空白・コメント・<?...?>
+  void skipMisc()
+  {
+    for (;;) {
+      skipSpace();
+      if (isAt("<?")) {
+        skipPast("?>");
+      }
+      else if (isAt("<!--")) {
+        skipPast("-->");
+      }
+      else if (isAt("<!")) {
+        fail("DOCTYPE and CDATA are not supported");
+      }
+      else {
+        return;
+      }
+    }
+  }
+
+  std::string readName()
+  {
+    const size_t begin = pos_;
+    while ((pos_ < text_.size()) &&
+           (isalnum((unsigned char)text_[pos_]) || (strchr("_-.:", text_[pos_]) != 0))) {
+      ++pos_;
+    }
+    if (pos_ == begin) {
+      fail("name expected");
+    }
+    return text_.substr(begin, pos_ - begin);
+  }
+
+  std::string readValue()
+  {
+    if ((pos_ >= text_.size()) || ((text_[pos_] != '"') && (text_[pos_] != '\''))) {
+      fail("quoted value expected");
+    }
+    const char quote = text_[pos_];
+    advance(1);
+    const size_t end = text_.find(quote, pos_);
+    if (end == std::string::npos) {
+      fail("unterminated value");
+    }
+    const std::string raw = text_.substr(pos_, end - pos_);
+    advance(end + 1 - pos_);
+
+    // 実体参照を戻す
+    static const char* ENTITIES[][2] = {
+      { "&lt;", "<" }, { "&gt;", ">" }, { "&quot;", "\"" }, { "&apos;", "'" }, { "&amp;", "&" },
+    };
+    std::string value;
+    for (size_t i = 0; i < raw.size(); ) {
+      size_t e = 0;
+      while ((e < 5) && (raw.compare(i, strlen(ENTITIES[e][0]), ENTITIES[e][0]) != 0)) {
+        ++e;
+      }
+      if (e < 5) {
+        value += ENTITIES[e][1];
+        i += strlen(ENTITIES[e][0]);
+      }
+      else {
+        value += raw[i++];
+      }
+    }
+    return value;
+  }
+
+  // <name attr="value" ...> ... </name> か <name ... />
+  //  要素を足すと参照が無効になるので、番号で扱う
+  size_t parseElement()
+  {
+    const size_t index = elements_.size();
+    elements_.push_back(XmlElement());
+    elements_[index].line = line_;
+
+    advance(1);
+    elements_[index].name = readName();
+
+    for (;;) {
+      skipSpace();
+      if (isAt("/>")) {
+        advance(2);
+        return index;
+      }
+      if (isAt(">")) {
+        advance(1);
+        break;
+      }
+      const std::string key = readName();
+      skipSpace();
+      if (!isAt("=")) {
+        fail("'=' expected after " + key);
+      }
+      advance(1);
+      skipSpace();
+      const std::string value = readValue();
+      if (elements_[index].attribute(key.c_str()) != 0) {
+        fail("duplicate attribute " + key);
+      }
+      elements_[index].attributes.push_back(std::make_pair(key, value));
+    }
+
+    for (;;) {
+      const size_t tag = text_.find('<', pos_);
+      if (tag == std::string::npos) {
+        fail("missing </" + elements_[index].name + ">");
+      }
+      advance(tag - pos_);
+
+      if (isAt("</")) {
+        advance(2);
+        if (readName() != elements_[index].name) {
+          fail("mismatched </...> for <" + elements_[index].name + ">");
+        }
+        skipSpace();
+        if (!isAt(">")) {
+          fail("'>' expected");
+        }
+        advance(1);
+        return index;
+      }
+      else if (isAt("<!--")) {
+        skipPast("-->");
+      }
+      else if (isAt("<?")) {
+        skipPast("?>");
+      }
+      else if (isAt("<!")) {
+        fail("DOCTYPE and CDATA are not supported");
+      }
+      else {
+        const size_t child = parseElement();
+        elements_[index].children.push_back(child);
+      }
+    }
+  }
+
+  std::string text_;
+  std::string path_;
+  size_t pos_;
+  int line_;
+  std::vector<XmlElement> elements_;
+};
+
+// 作るノード1つ
+struct NodePlan
+{
+  XnProductionNodeType type;
+  std::string name;               // 空ならOpenNIが名前を付ける
+  XnUInt32 stage;                 // ConfigPlan::STAGE_xxx
+  bool hasMapOutputMode;
+  XnMapOutputMode mapOutputMode;
+  XnInt32 mirror;                 // -1なら設定しない
+  bool startGenerating;           // このノードだけ生成を始める
+  bool isImplicit;                // 設定ファイルにはない(センサーを並列に作るため先に作るデバイス)
+};
+
+// 設定ファイルを検証して、ノードを作る手順にしたもの
+//  XMLのハッシュと一緒にバイナリで保存しておき、XMLが変わっていなければ読み直さない
+struct ConfigPlan
+{
+  enum { MAGIC = 0x4E4C5043, VERSION = 1 };
+
+  // 作る順番。同じ段のノードは互いに依存しないので並列に作れる
+  enum
+  {
+    STAGE_DEVICE,       // Device
+    STAGE_SENSOR,       // Image, Depth, IR, Audio (デバイスを使う)
+    STAGE_MIDDLEWARE,   // User, Scene, Gesture, Hands (Depthを使う)
+    STAGE_COUNT
+  };
+
+  ConfigPlan()
+    :hash(0), hasLog(false), logToConsole(false), logToFile(false), logLevel(-1),
+     globalMirror(-1), startGeneratingAll(true)
+  {
+  }
+
+  XnUInt64 hash;                  // XMLのハッシュ(hashOf)
+  std::string unsupported;        // 空でなければ、この手順では作れない理由(InitFromXmlFileに任せる)
+
+  std::vector<XnLicense> licenses;
+
+  bool hasLog;
+  bool logToConsole;
+  bool logToFile;
+  XnInt32 logLevel;               // -1なら設定しない
+  std::vector<std::pair<std::string, bool> > logMasks;
+
+  XnInt32 globalMirror;           // -1なら設定しない
+  bool startGeneratingAll;
+  std::vector<NodePlan> nodes;
+
+  // XMLを検証して手順にする(間違いがあれば行番号つきで例外)
+  static ConfigPlan compile(const std::string& xml, const std::string& path);
+
+  std::string serialize() const;
+
+  // 壊れている・バージョンが違うときはfalse
+  static bool deserialize(const std::string& data, ConfigPlan& plan);
+
+  // FNV-1a (64bit)
+  static XnUInt64 hashOf(const std::string& data)
+  {
+    XnUInt64 hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < data.size(); ++i) {
+      hash ^= (XnUInt8)data[i];
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+};
+
+// XMLから手順を作る
+//  分かるのはSamplesConfig.xmlで使うタグ(Licenses, Log, ProductionNodes, Node,
+//  MapOutputMode, Mirror, GlobalMirror)だけ。それ以外のタグや属性があれば
+//  unsupported にして、InitFromXmlFileで初期化させる。値の間違いはエラーにする
+class ConfigCompiler
+{
+public:
+
+  ConfigCompiler(const std::string& xml, const std::string& path)
+    :document_(xml, path)
+  {
+  }
+
+  ConfigPlan compile()
+  {
+    ConfigPlan plan;
+    const XmlElement& root = document_.root();
+    if (root.name != "OpenNI") {
+      fail(root, "root element must be <OpenNI>");
+    }
+    if (!checkAttributes(plan, root, 0)) {
+      return plan;
+    }
+
+    for (size_t i = 0; (i < root.children.size()) && plan.unsupported.empty(); ++i) {
+      const XmlElement& element = document_.element(root.children[i]);
+      if (element.name == "Licenses") {
+        readLicenses(plan, element);
+      }
+      else if (element.name == "Log") {
+        readLog(plan, element);
+      }
+      else if (element.name == "ProductionNodes") {
+        readProductionNodes(plan, element);
+      }
+      else {
+        unsupported(plan, element);
+      }
+    }
+    if (plan.unsupported.empty()) {
+      addImplicitDevice(plan);
+    }
+    return plan;
+  }
+
+private:
+
+  void fail(const XmlElement& element, const std::string& message) const
+  {
+    throw std::runtime_error(document_.errorAt(element.line, message));
+  }
+
+  void unsupported(ConfigPlan& plan, const XmlElement& element, const std::string& what = "") const
+  {
+    if (plan.unsupported.empty()) {
+      std::ostringstream reason;
+      reason << "line " << element.line << " : <" << element.name << ">" << what;
+      plan.unsupported = reason.str();
+    }
+  }
+
+  // 知らない属性があればunsupportedにする
+  //  known : カンマで区切った属性の名前
+  bool checkAttributes(ConfigPlan& plan, const XmlElement& element, const char* known) const
+  {
+    for (size_t i = 0; i < element.attributes.size(); ++i) {
+      const std::string key = "," + element.attributes[i].first + ",";
+      if ((known == 0) || (std::string(",") + known + ",").find(key) == std::string::npos) {
+        unsupported(plan, element, " " + element.attributes[i].first);
+        return false;
+      }
+    }
+    return true;
+  }
+
+  const std::string& required(const XmlElement& element, const char* key) const
+  {
+    const std::string* value = element.attribute(key);
+    if (value == 0) {
+      fail(element, std::string("<") + element.name + "> needs " + key);
+    }
+    return *value;
+  }
+
+  bool readBool(const XmlElement& element, const char* key, bool defaultValue) const
+  {
+    const std::string* value = element.attribute(key);
+    if (value == 0) {
+      return defaultValue;
+    }
+    if ((*value == "true") || (*value == "1")) {
+      return true;
+    }
+    if ((*value == "false") || (*value == "0")) {
+      return false;
+    }
+    fail(element, std::string(key) + " must be true or false : " + *value);
+    return false;
+  }
+
+  XnUInt32 readUInt(const XmlElement& element, const char* key, XnUInt32 minimum, XnUInt32 maximum) const
+  {
+    const std::string& value = required(element, key);
+    char* end = 0;
+    const unsigned long number = strtoul(value.c_str(), &end, 10);
+    if (value.empty() || (*end != '\0') || (value[0] == '-') || (number < minimum) || (number > maximum)) {
+      std::ostringstream message;
+      message << key << " must be " << minimum << " - " << maximum << " : " << value;
+      fail(element, message.str());
+    }
+    return (XnUInt32)number;
+  }
+
+  void copyString(const XmlElement& element, XnChar* dest, size_t size, const std::string& value) const
+  {
+    if (value.size() >= size) {
+      fail(element, "too long : " + value);
+    }
+    memcpy(dest, value.c_str(), value.size() + 1);
+  }
+
+  void readLicenses(ConfigPlan& plan, const XmlElement& licenses) const
+  {
+    if (!checkAttributes(plan, licenses, 0)) {
+      return;
+    }
+    for (size_t i = 0; (i < licenses.children.size()) && plan.unsupported.empty(); ++i) {
+      const XmlElement& element = document_.element(licenses.children[i]);
+      if ((element.name != "License") || !checkAttributes(plan, element, "vendor,key")) {
+        unsupported(plan, element);
+        return;
+      }
+      XnLicense license;
+      memset(&license, 0, sizeof(license));
+      copyString(element, license.strVendor, sizeof(license.strVendor), required(element, "vendor"));
+      copyString(element, license.strKey, sizeof(license.strKey), required(element, "key"));
+      plan.licenses.push_back(license);
+    }
+  }
+
+  void readLog(ConfigPlan& plan, const XmlElement& log) const
+  {
+    if (!checkAttributes(plan, log, "writeToConsole,writeToFile")) {
+      return;
+    }
+    plan.hasLog = true;
+    plan.logToConsole = readBool(log, "writeToConsole", false);
+    plan.logToFile = readBool(log, "writeToFile", false);
+
+    for (size_t i = 0; (i < log.children.size()) && plan.unsupported.empty(); ++i) {
+      const XmlElement& element = document_.element(log.children[i]);
+      if (element.name == "LogLevel") {
+        if (checkAttributes(plan, element, "value")) {
+          // 0 - Verbose, 1 - Info, 2 - Warning, 3 - Error
+          plan.logLevel = readUInt(element, "value", 0, 3);
+        }
+      }
+      else if (element.name == "Masks") {
+        for (size_t m = 0; (m < element.children.size()) && plan.unsupported.empty(); ++m) {
+          const XmlElement& mask = document_.element(element.children[m]);
+          if ((mask.name != "Mask") || !checkAttributes(plan, mask, "name,on")) {
+            unsupported(plan, mask);
+            return;
+          }
+          plan.logMasks.push_back(std::make_pair(required(mask, "name"), readBool(mask, "on", false)));
+        }
+      }
+      else if ((element.name == "Dumps") && element.children.empty()) {
+        // ダンプの指定がなければ何もしない
+      }
+      else {
+        unsupported(plan, element);
+      }
+    }
+  }
+
+  void readProductionNodes(ConfigPlan& plan, const XmlElement& productionNodes) const
+  {
+    if (!checkAttributes(plan, productionNodes, "startGenerating")) {
+      return;
+    }
+    plan.startGeneratingAll = readBool(productionNodes, "startGenerating", true);
+
+    for (size_t i = 0; (i < productionNodes.children.size()) && plan.unsupported.empty(); ++i) {
+      const XmlElement& element = document_.element(productionNodes.children[i]);
+      if (element.name == "Node") {
+        readNode(plan, element);
+      }
+      else if (element.name == "GlobalMirror") {
+        if (checkAttributes(plan, element, "on")) {
+          plan.globalMirror = readBool(element, "on", false) ? 1 : 0;
+        }
+      }
+      else {
+        unsupported(plan, element);
+      }
+    }
+  }
+
+  void readNode(ConfigPlan& plan, const XmlElement& element) const
+  {
+    if (!checkAttributes(plan, element, "type,name,startGenerating")) {
+      return;
+    }
+
+    NodePlan node;
+    const std::string& type = required(element, "type");
+    if (xnProductionNodeTypeFromString(type.c_str(), &node.type) != XN_STATUS_OK) {
+      fail(element, "unknown node type : " + type);
+    }
+    if (node.type == XN_NODE_TYPE_DEVICE) {
+      node.stage = ConfigPlan::STAGE_DEVICE;
+    }
+    else if ((node.type == XN_NODE_TYPE_IMAGE) || (node.type == XN_NODE_TYPE_DEPTH) ||
+             (node.type == XN_NODE_TYPE_IR) || (node.type == XN_NODE_TYPE_AUDIO)) {
+      node.stage = ConfigPlan::STAGE_SENSOR;
+    }
+    else if ((node.type == XN_NODE_TYPE_USER) || (node.type == XN_NODE_TYPE_SCENE) ||
+             (node.type == XN_NODE_TYPE_GESTURE) || (node.type == XN_NODE_TYPE_HANDS)) {
+      node.stage = ConfigPlan::STAGE_MIDDLEWARE;
+    }
+    else {
+      // Recorder, Player, Codec など
+      unsupported(plan, element, " type=" + type);
+      return;
+    }
+
+    const std::string* name = element.attribute("name");
+    node.name = (name != 0) ? *name : "";
+    if (node.name.size() >= XN_MAX_NAME_LENGTH) {
+      fail(element, "too long : " + node.name);
+    }
+    for (size_t n = 0; !node.name.empty() && (n < plan.nodes.size()); ++n) {
+      if (plan.nodes[n].name == node.name) {
+        fail(element, "duplicate node name : " + node.name);
+      }
+    }
+
+    node.hasMapOutputMode = false;
+    memset(&node.mapOutputMode, 0, sizeof(node.mapOutputMode));
+    node.mirror = -1;
+    node.startGenerating = readBool(element, "startGenerating", false);
+    if (node.startGenerating && (node.stage == ConfigPlan::STAGE_DEVICE)) {
+      fail(element, "startGenerating needs a generator");
+    }
+    node.isImplicit = false;
+
+    for (size_t i = 0; (i < element.children.size()) && plan.unsupported.empty(); ++i) {
+      const XmlElement& configuration = document_.element(element.children[i]);
+      if ((configuration.name != "Configuration") || !checkAttributes(plan, configuration, 0)) {
+        // Query など
+        unsupported(plan, configuration);
+        return;
+      }
+
+      for (size_t c = 0; (c < configuration.children.size()) && plan.unsupported.empty(); ++c) {
+        const XmlElement& setting = document_.element(configuration.children[c]);
+        if (setting.name == "MapOutputMode") {
+          if (checkAttributes(plan, setting, "xRes,yRes,FPS")) {
+            if (node.stage != ConfigPlan::STAGE_SENSOR) {
+              fail(setting, "MapOutputMode needs a map generator");
+            }
+            node.hasMapOutputMode = true;
+            node.mapOutputMode.nXRes = readUInt(setting, "xRes", 1, 4096);
+            node.mapOutputMode.nYRes = readUInt(setting, "yRes", 1, 4096);
+            node.mapOutputMode.nFPS = readUInt(setting, "FPS", 1, 1000);
+          }
+        }
+        else if (setting.name == "Mirror") {
+          if (checkAttributes(plan, setting, "on")) {
+            if (node.stage == ConfigPlan::STAGE_DEVICE) {
+              fail(setting, "Mirror needs a generator");
+            }
+            node.mirror = readBool(setting, "on", false) ? 1 : 0;
+          }
+        }
+        else {
+          unsupported(plan, setting);
+        }
+      }
+    }
+
+    plan.nodes.push_back(node);
+  }
+
+  // センサーが2つ以上あれば、先にデバイスを1つ作っておく
+  //  (並列に作るとき、それぞれがデバイスを開こうとしないように)
+  void addImplicitDevice(ConfigPlan& plan) const
+  {
+    size_t sensors = 0;
+    for (size_t i = 0; i < plan.nodes.size(); ++i) {
+      if (plan.nodes[i].stage == ConfigPlan::STAGE_DEVICE) {
+        return;
+      }
+      if (plan.nodes[i].stage == ConfigPlan::STAGE_SENSOR) {
+        ++sensors;
+      }
+    }
+    if (sensors < 2) {
+      return;
+    }
+
+    NodePlan device;
+    device.type = XN_NODE_TYPE_DEVICE;
+    device.stage = ConfigPlan::STAGE_DEVICE;
+    device.hasMapOutputMode = false;
+    memset(&device.mapOutputMode, 0, sizeof(device.mapOutputMode));
+    device.mirror = -1;
+    device.startGenerating = false;
+    device.isImplicit = true;
+    plan.nodes.insert(plan.nodes.begin(), device);
+  }
+
+  XmlDocument document_;
+};
+
+inline ConfigPlan ConfigPlan::compile(const std::string& xml, const std::string& path)
+{
+  ConfigPlan plan = ConfigCompiler(xml, path).compile();
+  plan.hash = hashOf(xml);
+  return plan;
+}
+
+// 保存する形(同じマシンで読むだけなので、バイト順はそのまま)
+//  MAGIC, VERSION, hash, unsupported, ライセンス, ログ, ノード の順
+class PlanWriter
+{
+public:
+
+  void u32(XnUInt32 value)
+  {
+    data.append((const char*)&value, sizeof(value));
+  }
+
+  void u64(XnUInt64 value)
+  {
+    data.append((const char*)&value, sizeof(value));
+  }
+
+  void str(const std::string& value)
+  {
+    u32((XnUInt32)value.size());
+    data += value;
+  }
+
+  std::string data;
+};
+
+class PlanReader
+{
+public:
+
+  explicit PlanReader(const std::string& data)
+    :data_(data), pos_(0), isOk_(true)
+  {
+  }
+
+  XnUInt32 u32()
+  {
+    XnUInt32 value = 0;
+    read(&value, sizeof(value));
+    return value;
+  }
+
+  XnUInt64 u64()
+  {
+    XnUInt64 value = 0;
+    read(&value, sizeof(value));
+    return value;
+  }
+
+  std::string str()
+  {
+    const XnUInt32 size = u32();
+    if (!isOk_ || (size > data_.size() - pos_)) {
+      isOk_ = false;
+      return "";
+    }
+    pos_ += size;
+    return data_.substr(pos_ - size, size);
+  }
+
+  // 文字列を固定長の配列に
+  void str(XnChar* dest, size_t size)
+  {
+    const std::string value = str();
+    if (value.size() >= size) {
+      isOk_ = false;
+      return;
+    }
+    memcpy(dest, value.c_str(), value.size() + 1);
+  }
+
+  // 最後まで読めたか
+  bool isOk() const
+  {
+    return isOk_ && (pos_ == data_.size());
+  }
+
+  bool isGood() const
+  {
+    return isOk_;
+  }
+
+private:
+
+  void read(void* value, size_t size)
+  {
+    if (!isOk_ || (size > data_.size() - pos_)) {
+      isOk_ = false;
+      return;
+    }
+    memcpy(value, data_.data() + pos_, size);
+    pos_ += size;
+  }
+
+  const std::string& data_;
+  size_t pos_;
+  bool isOk_;
+};
+
+inline std::string ConfigPlan::serialize() const
+{
+  PlanWriter writer;
+  writer.u32(MAGIC);
+  writer.u32(VERSION);
+  writer.u64(hash);
+  writer.str(unsupported);
+
+  writer.u32((XnUInt32)licenses.size());
+  for (size_t i = 0; i < licenses.size(); ++i) {
+    writer.str(licenses[i].strVendor);
+    writer.str(licenses[i].strKey);
+  }
+
+  writer.u32(hasLog);
+  writer.u32(logToConsole);
+  writer.u32(logToFile);
+  writer.u32(logLevel);
+  writer.u32((XnUInt32)logMasks.size());
+  for (size_t i = 0; i < logMasks.size(); ++i) {
+    writer.str(logMasks[i].first);
+    writer.u32(logMasks[i].second);
+  }
+
+  writer.u32(globalMirror);
+  writer.u32(startGeneratingAll);
+  writer.u32((XnUInt32)nodes.size());
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    const NodePlan& node = nodes[i];
+    writer.u32(node.type);
+    writer.str(node.name);
+    writer.u32(node.stage);
+    writer.u32(node.hasMapOutputMode);
+    writer.u32(node.mapOutputMode.nXRes);
+    writer.u32(node.mapOutputMode.nYRes);
+    writer.u32(node.mapOutputMode.nFPS);
+    writer.u32(node.mirror);
+    writer.u32(node.startGenerating);
+    writer.u32(node.isImplicit);
+  }
+  return writer.data;
+}
+
+inline bool ConfigPlan::deserialize(const std::string& data, ConfigPlan& plan)
+{
+  PlanReader reader(data);
+  if ((reader.u32() != MAGIC) || (reader.u32() != VERSION)) {
+    return false;
+  }
+
+  ConfigPlan result;
+  result.hash = reader.u64();
+  result.unsupported = reader.str();
+
+  // 数が壊れていても大きな確保をしないよう、1つずつ読めるところまで読む
+  const XnUInt32 licenseCount = reader.u32();
+  for (XnUInt32 i = 0; (i < licenseCount) && reader.isGood(); ++i) {
+    XnLicense license;
+    memset(&license, 0, sizeof(license));
+    reader.str(license.strVendor, sizeof(license.strVendor));
+    reader.str(license.strKey, sizeof(license.strKey));
+    result.licenses.push_back(license);
+  }
+
+  result.hasLog = (reader.u32() != 0);
+  result.logToConsole = (reader.u32() != 0);
+  result.logToFile = (reader.u32() != 0);
+  result.logLevel = (XnInt32)reader.u32();
+  const XnUInt32 maskCount = reader.u32();
+  for (XnUInt32 i = 0; (i < maskCount) && reader.isGood(); ++i) {
+    const std::string name = reader.str();
+    result.logMasks.push_back(std::make_pair(name, reader.u32() != 0));
+  }
+
+  result.globalMirror = (XnInt32)reader.u32();
+  result.startGeneratingAll = (reader.u32() != 0);
+  const XnUInt32 nodeCount = reader.u32();
+  for (XnUInt32 i = 0; (i < nodeCount) && reader.isGood(); ++i) {
+    NodePlan node;
+    node.type = (XnProductionNodeType)reader.u32();
+    node.name = reader.str();
+    node.stage = reader.u32();
+    node.hasMapOutputMode = (reader.u32() != 0);
+    node.mapOutputMode.nXRes = reader.u32();
+    node.mapOutputMode.nYRes = reader.u32();
+    node.mapOutputMode.nFPS = reader.u32();
+    node.mirror = (XnInt32)reader.u32();
+    node.startGenerating = (reader.u32() != 0);
+    node.isImplicit = (reader.u32() != 0);
+    if (node.stage >= STAGE_COUNT) {
+      return false;
+    }
+    result.nodes.push_back(node);
+  }
+
+  if (!reader.isOk()) {
+    return false;
+  }
+  plan = result;
+  return true;
+}
+
+// ノード1つを作るのにかかった時間(us)
+struct NodeTiming
+{
+  std::string name;       // 作ったノードの名前
+  XnUInt64 enumerate;     // EnumerateProductionTrees
+  XnUInt64 create;        // CreateProductionTree
+  XnUInt64 configure;     // MapOutputMode, Mirror
+};
+
+// 設定ファイルからコンテキストを初期化する(InitFromXmlFileの代わり)
+//  1回目はXMLを検証して手順(ConfigPlan)にし、xmlPath + ".plan" に保存する。
+//  次からはXMLのハッシュが同じなら、保存した手順をそのまま使う。
+//  ノードは デバイス → センサー → ミドルウェア の段の順に作る。
+//  OpenNIはノードを並列に作れるとは明記していないので、ふつうは1つずつ作り、
+//  isParallel = true のときだけ同じ段のノードをスレッドで並列に作る。
+//  作ったノードはこのオブジェクトが持っているので、コンテキストより先に破棄しないこと
+class ConfigLoader
+{
+public:
+
+  explicit ConfigLoader(const char* xmlPath, bool isParallel = false)
+    :xmlPath_(xmlPath), planPath_(std::string(xmlPath) + ".plan"), isParallel_(isParallel),
+     isCached_(false), isSaved_(false), loadTime_(0), initTime_(0), startTime_(0), totalTime_(0)
+  {
+    memset(stageTime_, 0, sizeof(stageTime_));
+  }
+
+  void init(xn::Context& context)
+  {
+    XnUInt64 begin, now;
+    xnOSGetHighResTimeStamp(&begin);
+
+    load();
+    xnOSGetHighResTimeStamp(&now);
+    loadTime_ = now - begin;
+
+    if (!plan_.unsupported.empty()) {
+      // この手順では作れないので、いつもどおりOpenNIに読ませる
+      XnStatus rc = context.InitFromXmlFile(xmlPath_.c_str());
+      if (rc != XN_STATUS_OK) {
+        throw std::runtime_error(xnGetStatusString(rc));
+      }
+      finish(begin, totalTime_);
+      initTime_ = totalTime_ - loadTime_;
+      return;
+    }
+
+    XnStatus rc = context.Init();
+    if (rc != XN_STATUS_OK) {
+      throw std::runtime_error(xnGetStatusString(rc));
+    }
+
+    if (plan_.hasLog) {
+      xnLogInitSystem();
+      xnLogSetConsoleOutput(plan_.logToConsole);
+      xnLogSetFileOutput(plan_.logToFile);
+      if (plan_.logLevel >= 0) {
+        xnLogSetSeverityFilter((XnLogSeverity)plan_.logLevel);
+      }
+      for (size_t i = 0; i < plan_.logMasks.size(); ++i) {
+        xnLogSetMaskState(plan_.logMasks[i].first.c_str(), plan_.logMasks[i].second);
+      }
+    }
+
+    for (size_t i = 0; i < plan_.licenses.size(); ++i) {
+      rc = context.AddLicense(plan_.licenses[i]);
+      if (rc != XN_STATUS_OK) {
+        throw std::runtime_error(xnGetStatusString(rc));
+      }
+    }
+    xnOSGetHighResTimeStamp(&now);
+    initTime_ = now - begin - loadTime_;
+
+    // InitFromXmlFileと同じく、全体の反転はノードを作る前に設定し、ノードごとの<Mirror>を優先する
+    if (plan_.globalMirror >= 0) {
+      rc = context.SetGlobalMirror(plan_.globalMirror != 0);
+      if (rc != XN_STATUS_OK) {
+        throw std::runtime_error(xnGetStatusString(rc));
+      }
+    }
+
+    nodes_.assign(plan_.nodes.size(), xn::ProductionNode());
+    generators_.assign(plan_.nodes.size(), xn::Generator());
+    timings_.assign(plan_.nodes.size(), NodeTiming());
+    for (XnUInt32 stage = 0; stage < ConfigPlan::STAGE_COUNT; ++stage) {
+      createStage(context, stage);
+    }
+
+    XnUInt64 startBegin;
+    xnOSGetHighResTimeStamp(&startBegin);
+    for (size_t i = 0; i < plan_.nodes.size(); ++i) {
+      if (plan_.nodes[i].startGenerating) {
+        rc = generators_[i].StartGenerating();
+        if (rc != XN_STATUS_OK) {
+          throw std::runtime_error(xnGetStatusString(rc));
+        }
+      }
+    }
+    if (plan_.startGeneratingAll) {
+      rc = context.StartGeneratingAll();
+      if (rc != XN_STATUS_OK) {
+        throw std::runtime_error(xnGetStatusString(rc));
+      }
+    }
+    finish(startBegin, startTime_);
+    xnOSGetHighResTimeStamp(&now);
+    totalTime_ = now - begin;
+  }
+
+  // 起動にかかった時間の内訳
+  void printTimings(std::ostream& out) const
+  {
+    out << "plan : " << (isCached_ ? "cached" : (isSaved_ ? "compiled and saved" : "compiled (not saved)")) <<
+      ", " << ms(loadTime_) << " ms" << std::endl;
+    if (!plan_.unsupported.empty()) {
+      out << "InitFromXmlFile (" << plan_.unsupported << ") : " << ms(initTime_) << " ms" << std::endl;
+      return;
+    }
+
+    out << "Init + licenses : " << ms(initTime_) << " ms" << std::endl;
+    static const char* STAGE_NAMES[ConfigPlan::STAGE_COUNT] = { "device", "sensor", "middleware" };
+    for (XnUInt32 stage = 0; stage < ConfigPlan::STAGE_COUNT; ++stage) {
+      XnUInt32 count = 0;
+      for (size_t i = 0; i < plan_.nodes.size(); ++i) {
+        if (plan_.nodes[i].stage != stage) {
+          continue;
+        }
+        const NodeTiming& timing = timings_[i];
+        out << "  " << timing.name << " (" << xnProductionNodeTypeToString(plan_.nodes[i].type) <<
+          (plan_.nodes[i].isImplicit ? ", implicit" : "") << ") : enumerate " <<
+          ms(timing.enumerate) << " ms, create " << ms(timing.create) << " ms, configure " <<
+          ms(timing.configure) << " ms" << std::endl;
+        ++count;
+      }
+      if (count != 0) {
+        out << STAGE_NAMES[stage] << " : " << count << " nodes" <<
+          (((count > 1) && isParallel_) ? " in parallel" : "") << ", " <<
+          ms(stageTime_[stage]) << " ms" << std::endl;
+      }
+    }
+    out << "StartGenerating : " << ms(startTime_) << " ms" << std::endl;
+    out << "total : " << ms(totalTime_) << " ms" << std::endl;
+  }
+
+  const ConfigPlan& plan() const
+  {
+    return plan_;
+  }
+
+  bool isCached() const
+  {
+    return isCached_;
+  }
+
+  // XMLを読み、保存した手順があって同じXMLのものならそれを、なければ作って保存する
+  void load()
+  {
+    const std::string xml = readFile(xmlPath_);
+    const XnUInt64 hash = ConfigPlan::hashOf(xml);
+
+    isCached_ = ConfigPlan::deserialize(readFile(planPath_, false), plan_) && (plan_.hash == hash);
+    if (isCached_) {
+      return;
+    }
+
+    plan_ = ConfigPlan::compile(xml, xmlPath_);
+    isSaved_ = writeFile(planPath_, plan_.serialize());
+  }
+
+  // pathを読む(mustExistでなければ、読めないときは空)
+  static std::string readFile(const std::string& path, bool mustExist = true)
+  {
+    std::string data;
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (file == 0) {
+      if (mustExist) {
+        throw std::runtime_error("error : open " + path);
+      }
+      return data;
+    }
+
+    char buffer[4096];
+    size_t size;
+    while ((size = std::fread(buffer, 1, sizeof(buffer), file)) != 0) {
+      data.append(buffer, size);
+    }
+    std::fclose(file);
+    return data;
+  }
+
+  // 書きかけのファイルを読まないよう、別名で書いてから名前を変える
+  //  (Dataのディレクトリに書けないときは保存しないだけ)
+  static bool writeFile(const std::string& path, const std::string& data)
+  {
+    const std::string temporary = path + ".tmp";
+    FILE* file = std::fopen(temporary.c_str(), "wb");
+    if (file == 0) {
+      return false;
+    }
+    const bool isWritten = (std::fwrite(data.data(), 1, data.size(), file) == data.size());
+    if ((std::fclose(file) != 0) || !isWritten) {
+      std::remove(temporary.c_str());
+      return false;
+    }
+#if (XN_PLATFORM == XN_PLATFORM_WIN32)
+    std::remove(path.c_str());
+#endif
+    return std::rename(temporary.c_str(), path.c_str()) == 0;
+  }
+
+private:
+
+  ConfigLoader(const ConfigLoader&);
+  ConfigLoader& operator=(const ConfigLoader&);
+
+  // スレッドに渡すもの
+  struct CreateTask
+  {
+    ConfigLoader* loader;
+    xn::Context* context;
+    size_t index;
+    XN_THREAD_HANDLE thread;
+    std::string error;
+  };
+
+  static double ms(XnUInt64 us)
+  {
+    return us / 1000.0;
+  }
+
+  static void finish(XnUInt64 begin, XnUInt64& elapsed)
+  {
+    XnUInt64 now;
+    xnOSGetHighResTimeStamp(&now);
+    elapsed = now - begin;
+  }
+
+  // 1つの段のノードを作る
+  void createStage(xn::Context& context, XnUInt32 stage)
+  {
+    std::vector<CreateTask> tasks;
+    for (size_t i = 0; i < plan_.nodes.size(); ++i) {
+      if (plan_.nodes[i].stage == stage) {
+        CreateTask task = { this, &context, i, 0, "" };
+        tasks.push_back(task);
+      }
+    }
+    if (tasks.empty()) {
+      return;
+    }
+
+    XnUInt64 begin;
+    xnOSGetHighResTimeStamp(&begin);
+    if (!isParallel_ || (tasks.size() == 1)) {
+      for (size_t t = 0; t < tasks.size(); ++t) {
+        createNode(context, tasks[t].index);
+      }
+    }
+    else {
+      // 1つ目はこのスレッドで作る
+      size_t started = 1;
+      for (; started < tasks.size(); ++started) {
+        if (xnOSCreateThread(createProc, &tasks[started], &tasks[started].thread) != XN_STATUS_OK) {
+          break;
+        }
+      }
+      createProc(&tasks[0]);
+      for (size_t t = 1; t < started; ++t) {
+        xnOSWaitForThreadExit(tasks[t].thread, XN_WAIT_INFINITE);
+        xnOSCloseThread(&tasks[t].thread);
+      }
+      // スレッドを作れなかった分はここで作る
+      for (size_t t = started; t < tasks.size(); ++t) {
+        createProc(&tasks[t]);
+      }
+      for (size_t t = 0; t < tasks.size(); ++t) {
+        if (!tasks[t].error.empty()) {
+          throw std::runtime_error(tasks[t].error);
+        }
+      }
+    }
+    finish(begin, stageTime_[stage]);
+  }
+
+  static XN_THREAD_PROC createProc(XN_THREAD_PARAM param)
+  {
+    CreateTask* task = (CreateTask*)param;
+    try {
+      task->loader->createNode(*task->context, task->index);
+    }
+    catch (std::exception& ex) {
+      task->error = ex.what();
+    }
+    XN_THREAD_PROC_RETURN(XN_STATUS_OK);
+  }
+
+  // ノードを1つ作って設定する(並列に呼ばれるので、自分の番号のところにだけ書く)
+  void createNode(xn::Context& context, size_t index)
+  {
+    const NodePlan& node = plan_.nodes[index];
+    NodeTiming& timing = timings_[index];
+    XnUInt64 t0, t1, t2, t3;
+    xnOSGetHighResTimeStamp(&t0);
+
+    xn::NodeInfoList trees;
+    XnStatus rc = context.EnumerateProductionTrees(node.type, NULL, trees);
+    if (rc != XN_STATUS_OK) {
+      throw std::runtime_error(xnGetStatusString(rc));
+    }
+    if (trees.IsEmpty()) {
+      throw std::runtime_error(std::string("error : no ") + xnProductionNodeTypeToString(node.type) + " node");
+    }
+    xnOSGetHighResTimeStamp(&t1);
+
+    // InitFromXmlFileと同じく、見つかった最初のものを作る
+    xn::NodeInfo info = *trees.Begin();
+    if (!node.name.empty()) {
+      info.SetInstanceName(node.name.c_str());
+    }
+    rc = context.CreateProductionTree(info);
+    if (rc != XN_STATUS_OK) {
+      throw std::runtime_error(xnGetStatusString(rc));
+    }
+    info.GetInstance(nodes_[index]);
+    xnOSGetHighResTimeStamp(&t2);
+
+    if (node.hasMapOutputMode) {
+      xn::MapGenerator generator;
+      info.GetInstance(generator);
+      rc = generator.SetMapOutputMode(node.mapOutputMode);
+      if (rc != XN_STATUS_OK) {
+        throw std::runtime_error(xnGetStatusString(rc));
+      }
+    }
+    if ((node.mirror >= 0) || node.startGenerating) {
+      info.GetInstance(generators_[index]);
+    }
+    if (node.mirror >= 0) {
+      rc = generators_[index].GetMirrorCap().SetMirror(node.mirror != 0);
+      if (rc != XN_STATUS_OK) {
+        throw std::runtime_error(xnGetStatusString(rc));
+      }
+    }
+    xnOSGetHighResTimeStamp(&t3);
+
+    timing.name = nodes_[index].GetName();
+    timing.enumerate = t1 - t0;
+    timing.create = t2 - t1;
+    timing.configure = t3 - t2;
+  }
+
+  std::string xmlPath_;
+  std::string planPath_;
+  bool isParallel_;
+
+  ConfigPlan plan_;
+  bool isCached_;
+  bool isSaved_;
+
+  std::vector<xn::ProductionNode> nodes_;
+  std::vector<xn::Generator> generators_;   // 鏡像や個別の生成開始に使う
+  std::vector<NodeTiming> timings_;
+  XnUInt64 loadTime_;
+  XnUInt64 initTime_;
+  XnUInt64 stageTime_[ConfigPlan::STAGE_COUNT];
+  XnUInt64 startTime_;
+  XnUInt64 totalTime_;
+};
+
+#endif // #ifndef CONFIGPLAN_H_INCLUDE
@@ -1,8 +1,11 @@
 ﻿#include <iostream>
 #include <stdexcept>
+#include <string>
 
 #include <XnCppWrapper.h>
 
+#include "ConfigPlan.h"
+
 // 設定ファイルのパス(環境に合わせて変更してください)
 #if (XN_PLATFORM == XN_PLATFORM_WIN32)
 const char* CONFIG_XML_PATH = "../../../Data/SamplesConfig.xml";
@@ -14,24 +17,68 @@ const char* CONFIG_XML_PATH = "../../../Data/SamplesConfig.xml";
 const char* CONFIG_XML_PATH = "Data/SamplesConfig.xml";
 #endif
 
-int main( char* argv[], int argc )
+// 速度計測モード(Kinectは使わない)
+//  XMLを検証して手順にするのと、保存した手順を読むのにかかる時間を比べる
+void benchmark()
+{
+  const int COUNT = 1000;
+  const std::string xml = ConfigLoader::readFile( CONFIG_XML_PATH );
+
+  XnUInt64 begin, end;
+  ConfigPlan plan;
+  xnOSGetHighResTimeStamp( &begin );
+  for ( int i = 0; i < COUNT; ++i ) {
+    plan = ConfigPlan::compile( xml, CONFIG_XML_PATH );
+  }
+  xnOSGetHighResTimeStamp( &end );
+  std::cout << "parse + validate : " << ((end - begin) / 1000.0 / COUNT) << " ms" << std::endl;
+
+  const std::string data = plan.serialize();
+  ConfigPlan cached;
+  bool isCached = true;
+  xnOSGetHighResTimeStamp( &begin );
+  for ( int i = 0; i < COUNT; ++i ) {
+    isCached = ConfigPlan::deserialize( data, cached ) &&
+      (cached.hash == ConfigPlan::hashOf( xml )) && isCached;
+  }
+  xnOSGetHighResTimeStamp( &end );
+  std::cout << "hash + load plan : " << ((end - begin) / 1000.0 / COUNT) << " ms" << std::endl;
+
+  std::cout << xml.size() << " bytes of XML, " << data.size() << " bytes of plan, " <<
+    plan.nodes.size() << " nodes" << std::endl;
+  if ( !plan.unsupported.empty() ) {
+    std::cout << "unsupported : " << plan.unsupported << std::endl;
+  }
+  std::cout << ((isCached && (cached.serialize() == data)) ? "same plan" : "MISMATCH") << std::endl;
+}
+
+int main( int argc, char* argv[] )
 {
   XnLicense* licenses = 0;
 
   try {
+    // 速度計測モード
+    if ( (argc > 1) && (std::string( argv[1] ) == "bench") ) {
+      benchmark();
+      return 0;
+    }
+
     // XMLをファイルから設定情報を取得して初期化する
-    std::cout << "xn::Context::InitFromXmlFile ... ";
+    //  2回目からはXMLを読まずに保存した手順を使う。parallel を付けると同じ段のノードを並列に作る
+    std::cout << "ConfigLoader::init ... ";
     xn::Context context;
-    XnStatus rc = context.InitFromXmlFile( CONFIG_XML_PATH );
-    if ( rc != XN_STATUS_OK ) {
-      throw std::runtime_error( ::xnGetStatusString( rc ) );
-    }
+    const bool isParallel = (argc > 1) && (std::string( argv[1] ) == "parallel");
+    ConfigLoader loader( CONFIG_XML_PATH, isParallel );
+    loader.init( context );
     std::cout << "Success" << std::endl;
 
+    // ノードごとの起動時間
+    loader.printTimings( std::cout );
+
     // ライセンス情報を取得する
     std::cout << "xn::Context::EnumerateLicenses ... ";
     XnUInt32 lisenceCount = 0;
-    rc = context.EnumerateLicenses( licenses, lisenceCount );
+    XnStatus rc = context.EnumerateLicenses( licenses, lisenceCount );
     if ( rc != XN_STATUS_OK ) {
       throw std::runtime_error( ::xnGetStatusString( rc ) );
     }
@@ -0,0 +1,311 @@
+#ifndef FRAMEROI_H_INCLUDE
+#define FRAMEROI_H_INCLUDE
+
+#include <vector>
+#include <algorithm>
+
+#include <XnCppWrapper.h>
+
+// フレームの中の処理する範囲(クロッピングの窓)
+//  クロッピング中のメタデータは、Data()が窓の大きさ(XRes x YRes)しかなく、
+//  窓の位置はXOffset/YOffset、フレーム全体の大きさはFullXRes/FullYResで表される。
+//  その4つをまとめて持ち歩き、窓の外の画素には触らないようにする
+struct FrameRoi
+{
+  XnUInt32 x;           // 窓の左上(フレーム全体の座標)
+  XnUInt32 y;
+  XnUInt32 width;       // 窓の大きさ(データの1行の画素数)
+  XnUInt32 height;
+  XnUInt32 fullWidth;   // フレーム全体の大きさ
+  XnUInt32 fullHeight;
+
+  FrameRoi()
+    :x(0), y(0), width(0), height(0), fullWidth(0), fullHeight(0)
+  {
+  }
+
+  FrameRoi(XnUInt32 x, XnUInt32 y, XnUInt32 width, XnUInt32 height,
+           XnUInt32 fullWidth, XnUInt32 fullHeight)
+    :x(x), y(y), width(width), height(height), fullWidth(fullWidth), fullHeight(fullHeight)
+  {
+  }
+
+  // メタデータが表している窓
+  static FrameRoi fromMetaData(const xn::MapMetaData& md)
+  {
+    return FrameRoi(md.XOffset(), md.YOffset(), md.XRes(), md.YRes(),
+                    md.FullXRes(), md.FullYRes());
+  }
+
+  // 全体
+  static FrameRoi full(XnUInt32 fullWidth, XnUInt32 fullHeight)
+  {
+    return FrameRoi(0, 0, fullWidth, fullHeight, fullWidth, fullHeight);
+  }
+
+  // ドライバのクロッピングの設定から(無効なら全体)
+  static FrameRoi fromCropping(const XnCropping& cropping, XnUInt32 fullWidth, XnUInt32 fullHeight)
+  {
+    if (!cropping.bEnabled) {
+      return full(fullWidth, fullHeight);
+    }
+    return FrameRoi(cropping.nXOffset, cropping.nYOffset, cropping.nXSize, cropping.nYSize,
+                    fullWidth, fullHeight).clamped();
+  }
+
+  // ドライバに渡すクロッピングの設定(全体なら無効にする)
+  XnCropping toCropping() const
+  {
+    XnCropping cropping;
+    cropping.bEnabled = !isFull();
+    cropping.nXOffset = (XnUInt16)x;
+    cropping.nYOffset = (XnUInt16)y;
+    cropping.nXSize = (XnUInt16)width;
+    cropping.nYSize = (XnUInt16)height;
+    return cropping;
+  }
+
+  bool isFull() const
+  {
+    return (x == 0) && (y == 0) && (width == fullWidth) && (height == fullHeight);
+  }
+
+  bool empty() const
+  {
+    return (width == 0) || (height == 0);
+  }
+
+  XnUInt32 area() const
+  {
+    return width * height;
+  }
+
+  XnUInt32 right() const
+  {
+    return x + width;
+  }
+
+  XnUInt32 bottom() const
+  {
+    return y + height;
+  }
+
+  bool contains(XnUInt32 px, XnUInt32 py) const
+  {
+    return (px >= x) && (px < right()) && (py >= y) && (py < bottom());
+  }
+
+  bool contains(const FrameRoi& other) const
+  {
+    return other.empty() ||
+           ((other.x >= x) && (other.right() <= right()) &&
+            (other.y >= y) && (other.bottom() <= bottom()));
+  }
+
+  // 重なっている部分(重なっていなければ空)
+  FrameRoi intersect(const FrameRoi& other) const
+  {
+    const XnUInt32 left = std::max(x, other.x);
+    const XnUInt32 top = std::max(y, other.y);
+    const XnUInt32 r = std::min(right(), other.right());
+    const XnUInt32 b = std::min(bottom(), other.bottom());
+    if ((r <= left) || (b <= top)) {
+      return FrameRoi(0, 0, 0, 0, fullWidth, fullHeight);
+    }
+    return FrameRoi(left, top, r - left, b - top, fullWidth, fullHeight);
+  }
+
+  // 両方を含む最小の窓
+  FrameRoi unite(const FrameRoi& other) const
+  {
+    if (empty()) {
+      return other;
+    }
+    if (other.empty()) {
+      return *this;
+    }
+    const XnUInt32 left = std::min(x, other.x);
+    const XnUInt32 top = std::min(y, other.y);
+    return FrameRoi(left, top, std::max(right(), other.right()) - left,
+                    std::max(bottom(), other.bottom()) - top, fullWidth, fullHeight);
+  }
+
+  // まわりをmarginだけ広げる(フレームからははみ出さない)
+  FrameRoi expanded(XnUInt32 margin) const
+  {
+    const XnUInt32 left = (x > margin) ? (x - margin) : 0;
+    const XnUInt32 top = (y > margin) ? (y - margin) : 0;
+    return FrameRoi(left, top, right() + margin - left, bottom() + margin - top,
+                    fullWidth, fullHeight).clamped();
+  }
+
+  // 位置と大きさをalignの倍数にそろえる(窓を広げる向きに)
+  //  ドライバによっては、クロッピングの位置や大きさに制限がある
+  FrameRoi aligned(XnUInt32 align) const
+  {
+    const XnUInt32 left = x / align * align;
+    const XnUInt32 top = y / align * align;
+    const XnUInt32 r = (right() + align - 1) / align * align;
+    const XnUInt32 b = (bottom() + align - 1) / align * align;
+    return FrameRoi(left, top, r - left, b - top, fullWidth, fullHeight).clamped();
+  }
+
+  // フレームの中に収める
+  FrameRoi clamped() const
+  {
+    const XnUInt32 left = std::min(x, fullWidth);
+    const XnUInt32 top = std::min(y, fullHeight);
+    return FrameRoi(left, top, std::min(right(), fullWidth) - left,
+                    std::min(bottom(), fullHeight) - top, fullWidth, fullHeight);
+  }
+
+  bool operator==(const FrameRoi& other) const
+  {
+    return (x == other.x) && (y == other.y) && (width == other.width) &&
+           (height == other.height) && (fullWidth == other.fullWidth) &&
+           (fullHeight == other.fullHeight);
+  }
+
+  bool operator!=(const FrameRoi& other) const
+  {
+    return !(*this == other);
+  }
+};
+
+// 窓の中だけを処理する関数
+//  src は srcRoi の大きさのデータ(1行 srcRoi.width 画素)、
+//  dst は dstRoi の大きさのバッファ(1行 dstStep バイト)で、
+//  どちらもフレーム全体の座標で重なっている部分だけを処理する。
+//  mirror なら dst の窓の中を左右反転して書く(反転のためにもう一度なめない)
+namespace RoiKernels
+{
+  // dst の中で、フレーム全体の座標 (x, y) の画素を書く位置
+  inline XnUInt8* pixel(XnUInt8* dst, XnUInt32 dstStep, const FrameRoi& dstRoi,
+                        XnUInt32 x, XnUInt32 y, bool mirror)
+  {
+    const XnUInt32 column = mirror ? (dstRoi.right() - 1 - x) : (x - dstRoi.x);
+    return dst + (y - dstRoi.y) * dstStep + column * 3;
+  }
+
+  // RGBをコピーする(OpenCV用にBGRへ並べ替える)
+  inline void copyImage(const XnRGB24Pixel* src, const FrameRoi& srcRoi,
+                        XnUInt8* dst, XnUInt32 dstStep, const FrameRoi& dstRoi,
+                        bool mirror = false)
+  {
+    const FrameRoi roi = srcRoi.intersect(dstRoi);
+    const int step = mirror ? -3 : 3;
+    for (XnUInt32 y = roi.y; y < roi.bottom(); ++y) {
+      const XnRGB24Pixel* s = src + (y - srcRoi.y) * srcRoi.width + (roi.x - srcRoi.x);
+      XnUInt8* d = pixel(dst, dstStep, dstRoi, roi.x, y, mirror);
+      for (XnUInt32 x = 0; x < roi.width; ++x, ++s, d += step) {
+        d[0] = s->nBlue;
+        d[1] = s->nGreen;
+        d[2] = s->nRed;
+      }
+    }
+  }
+
+  // デプスの累積ヒストグラム(窓の中の画素だけを数える)
+  //  histogram[d] は近いほど明るい 0-255 の値になる
+  inline void depthHistogram(const XnDepthPixel* src, const FrameRoi& srcRoi,
+                             const FrameRoi& roi, std::vector<float>& histogram)
+  {
+    std::fill(histogram.begin(), histogram.end(), 0.0f);
+    const FrameRoi area = srcRoi.intersect(roi);
+    const XnUInt32 bins = (XnUInt32)histogram.size();
+
+    XnUInt32 points = 0;
+    for (XnUInt32 y = area.y; y < area.bottom(); ++y) {
+      const XnDepthPixel* s = src + (y - srcRoi.y) * srcRoi.width + (area.x - srcRoi.x);
+      for (XnUInt32 x = 0; x < area.width; ++x) {
+        if ((s[x] != 0) && (s[x] < bins)) {
+          ++histogram[s[x]];
+          ++points;
+        }
+      }
+    }
+
+    for (XnUInt32 i = 1; i < bins; ++i) {
+      histogram[i] += histogram[i - 1];
+    }
+    if (points != 0) {
+      for (XnUInt32 i = 1; i < bins; ++i) {
+        histogram[i] = 255.0f * (1.0f - (histogram[i] / points));
+      }
+    }
+  }
+
+  // デプスをヒストグラムで明るさにして書く(BGR)
+  inline void colorizeDepth(const XnDepthPixel* src, const FrameRoi& srcRoi,
+                            const std::vector<float>& histogram,
+                            XnUInt8* dst, XnUInt32 dstStep, const FrameRoi& dstRoi,
+                            bool mirror = false)
+  {
+    const FrameRoi roi = srcRoi.intersect(dstRoi);
+    const XnUInt32 bins = (XnUInt32)histogram.size();
+    const int step = mirror ? -3 : 3;
+    for (XnUInt32 y = roi.y; y < roi.bottom(); ++y) {
+      const XnDepthPixel* s = src + (y - srcRoi.y) * srcRoi.width + (roi.x - srcRoi.x);
+      XnUInt8* d = pixel(dst, dstStep, dstRoi, roi.x, y, mirror);
+      for (XnUInt32 x = 0; x < roi.width; ++x, d += step) {
+        const XnUInt8 value = (s[x] < bins) ? (XnUInt8)histogram[s[x]] : 0;
+        d[0] = d[1] = d[2] = value;
+      }
+    }
+  }
+
+  // ラベルのある画素に色を半分混ぜる(BGR)
+  inline void overlayLabels(const XnLabel* labels, const FrameRoi& labelRoi,
+                            const XnRGB24Pixel* colors, XnUInt32 colorCount,
+                            XnUInt8* dst, XnUInt32 dstStep, const FrameRoi& dstRoi,
+                            bool mirror = false)
+  {
+    const FrameRoi roi = labelRoi.intersect(dstRoi);
+    const int step = mirror ? -3 : 3;
+    for (XnUInt32 y = roi.y; y < roi.bottom(); ++y) {
+      const XnLabel* l = labels + (y - labelRoi.y) * labelRoi.width + (roi.x - labelRoi.x);
+      XnUInt8* d = pixel(dst, dstStep, dstRoi, roi.x, y, mirror);
+      for (XnUInt32 x = 0; x < roi.width; ++x, d += step) {
+        if (l[x] != 0) {
+          const XnRGB24Pixel& color = colors[l[x] % colorCount];
+          d[0] = (XnUInt8)((d[0] + color.nBlue) / 2);
+          d[1] = (XnUInt8)((d[1] + color.nGreen) / 2);
+          d[2] = (XnUInt8)((d[2] + color.nRed) / 2);
+        }
+      }
+    }
+  }
+
+  // ラベルのある画素を囲む窓(なければ空)
+  inline FrameRoi labelBounds(const XnLabel* labels, const FrameRoi& labelRoi)
+  {
+    XnUInt32 left = labelRoi.right(), top = labelRoi.bottom(), right = 0, bottom = 0;
+    for (XnUInt32 y = 0; y < labelRoi.height; ++y) {
+      const XnLabel* l = labels + y * labelRoi.width;
+      XnUInt32 x = 0;
+      while ((x < labelRoi.width) && (l[x] == 0)) {
+        ++x;
+      }
+      if (x == labelRoi.width) {
+        continue;
+      }
+      XnUInt32 last = labelRoi.width - 1;
+      while (l[last] == 0) {
+        --last;
+      }
+
+      left = std::min(left, labelRoi.x + x);
+      right = std::max(right, labelRoi.x + last + 1);
+      top = std::min(top, labelRoi.y + y);
+      bottom = labelRoi.y + y + 1;
+    }
+
+    if (right <= left) {
+      return FrameRoi(0, 0, 0, 0, labelRoi.fullWidth, labelRoi.fullHeight);
+    }
+    return FrameRoi(left, top, right - left, bottom - top,
+                    labelRoi.fullWidth, labelRoi.fullHeight);
+  }
+}
+
+#endif // #ifndef FRAMEROI_H_INCLUDE
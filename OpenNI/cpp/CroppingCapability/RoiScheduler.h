@@ -0,0 +1,177 @@
+#ifndef ROISCHEDULER_H_INCLUDE
+#define ROISCHEDULER_H_INCLUDE
+
+#include <vector>
+#include <algorithm>
+
+#include <opencv/cv.h>
+
+#include <XnCppWrapper.h>
+
+#include "FrameRoi.h"
+
+// 追いかける対象(ユーザーや手)を囲む窓から、クロッピングの窓を決める
+//  窓を変えるたびにドライバの設定が変わるので、すぐには変えない(ヒステリシス)。
+//  ・対象が窓からはみ出しそう(端からmargin/2以内)なら、すぐに広げる
+//  ・窓が対象に比べて大きすぎる状態がshrinkFrames続いたら、縮める
+//  ・対象がlostFrames見つからなければ、全体に戻す(窓の外に出た対象を探す)
+class RoiScheduler
+{
+public:
+
+  struct Params
+  {
+    Params()
+      :margin(32), align(8), minWidth(160), minHeight(120),
+       shrinkRatio(0.5f), shrinkFrames(15), lostFrames(30)
+    {
+    }
+
+    XnUInt32 margin;        // 対象のまわりに空ける画素数
+    XnUInt32 align;         // 窓の位置と大きさをそろえる単位
+    XnUInt32 minWidth;      // 窓の最小の大きさ
+    XnUInt32 minHeight;
+    float shrinkRatio;      // 対象に合わせた窓の面積がこれより小さければ縮める候補
+    XnUInt32 shrinkFrames;
+    XnUInt32 lostFrames;
+  };
+
+  RoiScheduler(XnUInt32 fullWidth, XnUInt32 fullHeight, const Params& params = Params())
+    :params_(params), roi_(FrameRoi::full(fullWidth, fullHeight)),
+     shrinkCount_(0), lostCount_(0), changes_(0)
+  {
+  }
+
+  // 点(手の位置など)のまわりradiusの窓
+  static FrameRoi around(XnUInt32 x, XnUInt32 y, XnUInt32 radius,
+                         XnUInt32 fullWidth, XnUInt32 fullHeight)
+  {
+    return FrameRoi(x, y, 1, 1, fullWidth, fullHeight).expanded(radius);
+  }
+
+  // このフレームで対象を囲む窓(見つからなければ空)を渡す。窓を変えたらtrue
+  bool update(const FrameRoi& target)
+  {
+    if (target.empty()) {
+      shrinkCount_ = 0;
+      if (roi_.isFull() || (++lostCount_ < params_.lostFrames)) {
+        return false;
+      }
+      lostCount_ = 0;
+      return change(FrameRoi::full(roi_.fullWidth, roi_.fullHeight));
+    }
+    lostCount_ = 0;
+
+    const FrameRoi wanted = fit(target);
+
+    // はみ出しそうなら、すぐに広げる。続けて広げずに済むよう、余分にマージンをとる
+    if (!roi_.contains(target.expanded(params_.margin / 2))) {
+      shrinkCount_ = 0;
+      return change(fit(target.expanded(params_.margin)));
+    }
+
+    // 大きすぎる状態が続いたら縮める
+    if (wanted.area() < roi_.area() * params_.shrinkRatio) {
+      if (++shrinkCount_ >= params_.shrinkFrames) {
+        shrinkCount_ = 0;
+        return change(wanted);
+      }
+    }
+    else {
+      shrinkCount_ = 0;
+    }
+    return false;
+  }
+
+  // 窓を手で変えたときに、ドライバに設定した窓に合わせる(ヒステリシスもやり直す)
+  void reset(const FrameRoi& roi)
+  {
+    roi_ = roi;
+    shrinkCount_ = 0;
+    lostCount_ = 0;
+  }
+
+  const FrameRoi& roi() const
+  {
+    return roi_;
+  }
+
+  // 窓を変えた回数(ドライバを設定し直した回数)
+  XnUInt32 changes() const
+  {
+    return changes_;
+  }
+
+private:
+
+  // 対象にマージンをつけ、最小の大きさを満たすように広げてそろえる
+  FrameRoi fit(const FrameRoi& target) const
+  {
+    FrameRoi roi = target.expanded(params_.margin);
+    if (roi.width < params_.minWidth) {
+      const XnUInt32 grow = (params_.minWidth - roi.width + 1) / 2;
+      roi = FrameRoi((roi.x > grow) ? (roi.x - grow) : 0, roi.y, params_.minWidth, roi.height,
+                     roi.fullWidth, roi.fullHeight).clamped();
+    }
+    if (roi.height < params_.minHeight) {
+      const XnUInt32 grow = (params_.minHeight - roi.height + 1) / 2;
+      roi = FrameRoi(roi.x, (roi.y > grow) ? (roi.y - grow) : 0, roi.width, params_.minHeight,
+                     roi.fullWidth, roi.fullHeight).clamped();
+    }
+    return roi.aligned(params_.align);
+  }
+
+  bool change(const FrameRoi& roi)
+  {
+    if (roi == roi_) {
+      return false;
+    }
+    roi_ = roi;
+    ++changes_;
+    return true;
+  }
+
+  Params params_;
+  FrameRoi roi_;
+  XnUInt32 shrinkCount_;
+  XnUInt32 lostCount_;
+  XnUInt32 changes_;
+};
+
+// 窓の大きさのIplImage
+//  メモリはフレーム全体の大きさで一度だけ確保し、窓が変わってもヘッダだけを
+//  付け替える(窓の大きさが変わるたびに確保し直さない)
+class RoiImage
+{
+public:
+
+  RoiImage(XnUInt32 fullWidth, XnUInt32 fullHeight, int channels)
+    :channels_(channels), buffer_(fullWidth * fullHeight * channels)
+  {
+    resize(FrameRoi::full(fullWidth, fullHeight));
+  }
+
+  // 窓の大きさにする(データの中身は残らない)
+  IplImage* resize(const FrameRoi& roi)
+  {
+    ::cvInitImageHeader(&header_, cvSize(roi.width, roi.height), IPL_DEPTH_8U, channels_);
+    ::cvSetData(&header_, &buffer_[0], roi.width * channels_);
+    return &header_;
+  }
+
+  IplImage* get()
+  {
+    return &header_;
+  }
+
+private:
+
+  RoiImage(const RoiImage&);
+  RoiImage& operator=(const RoiImage&);
+
+  int channels_;
+  std::vector<XnUInt8> buffer_;
+  IplImage header_;
+};
+
+#endif // #ifndef ROISCHEDULER_H_INCLUDE
@@ -1,11 +1,17 @@
 #include <iostream>
 #include <stdexcept>
+#include <string>
+#include <vector>
+#include <cmath>
 
 #include <opencv/cv.h>
 #include <opencv/highgui.h>
 
 #include <XnCppWrapper.h>
 
+#include "FrameRoi.h"
+#include "RoiScheduler.h"
+
 // 設定ファイルのパス(環境に合わせて変更してください)
 #ifdef WIN32
 const char* CONFIG_XML_PATH = "../../../../../Data/SamplesConfig.xml";
@@ -13,14 +19,135 @@ const char* CONFIG_XML_PATH = "../../../../../Data/SamplesConfig.xml";
 const char* CONFIG_XML_PATH = "../../SamplesConfig.xml";
 #endif
 
+// ユーザーの色
+const XnRGB24Pixel Colors[] = {
+    { 0, 0, 0 },
+    { 255, 0, 0 },
+    { 0, 255, 0 },
+    { 0, 0, 255 },
+    { 255, 255, 0 },
+    { 255, 0, 255 },
+    { 0, 255, 255 },
+};
+
 void XN_CALLBACK_TYPE CroppingChange(xn::ProductionNode &node, void *pCookie)
 {
     std::cout << "StateChangedHandler" << std::endl;
 }
 
+// イメージとデプスの両方に同じクロッピングを設定する
+void setCropping(xn::ImageGenerator& image, xn::DepthGenerator& depth, const XnCropping& cropping)
+{
+    XnStatus rc = image.GetCroppingCap().SetCropping(cropping);
+    if (rc != XN_STATUS_OK) {
+        throw std::runtime_error(xnGetStatusString(rc));
+    }
+    
+    if (depth.IsValid() && depth.IsCapabilitySupported(XN_CAPABILITY_CROPPING)) {
+        depth.GetCroppingCap().SetCropping(cropping);
+    }
+    
+    std::cout << "cropping " << (cropping.bEnabled ? "on" : "off") << " (" <<
+        cropping.nXOffset << "," << cropping.nYOffset << "," <<
+        cropping.nXSize << "," << cropping.nYSize << ")" << std::endl;
+}
+
+// フレーム全体のデータから窓の中だけを切り出す(ドライバのクロッピングの代わり)
+template <typename T>
+void crop(const std::vector<T>& src, const FrameRoi& roi, std::vector<T>& dst)
+{
+    dst.resize(roi.area());
+    for (XnUInt32 y = 0; y < roi.height; ++y) {
+        const T* row = &src[(roi.y + y) * roi.fullWidth + roi.x];
+        std::copy(row, row + roi.width, &dst[y * roi.width]);
+    }
+}
+
+// 左右に動く1人を、クロッピングしない場合とスケジューラで窓を追いかけた場合で、
+// 転送量(イメージ+デプス+ラベル)と窓の中の処理時間を比べる
+void benchmark()
+{
+    const XnUInt32 XRES = 640;
+    const XnUInt32 YRES = 480;
+    const int FRAMES = 600;
+    const FrameRoi full = FrameRoi::full(XRES, YRES);
+    
+    std::vector<XnRGB24Pixel> image(XRES * YRES);
+    std::vector<XnDepthPixel> depth(XRES * YRES);
+    std::vector<XnLabel> labels(XRES * YRES);
+    std::vector<XnRGB24Pixel> imageCrop;
+    std::vector<XnDepthPixel> depthCrop;
+    std::vector<XnLabel> labelCrop;
+    std::vector<float> histogram(10000);
+    RoiImage camera(XRES, YRES, 3), depthImage(XRES, YRES, 3);
+    
+    const char* names[] = { "full", "scheduled" };
+    for (int mode = 0; mode < 2; ++mode) {
+        RoiScheduler scheduler(XRES, YRES);
+        XnUInt64 bytes = 0, area = 0, process = 0;
+        XnUInt32 clipped = 0;
+        
+        for (int f = 0; f < FRAMES; ++f) {
+            // 人(楕円)が左右にゆっくり往復し、ときどき速く動く
+            const int cx = 320 + (int)(220 * std::sin(f * 0.02) + 40 * std::sin(f * 0.11));
+            const int cy = 260;
+            for (XnUInt32 y = 0; y < YRES; ++y) {
+                for (XnUInt32 x = 0; x < XRES; ++x) {
+                    const int dx = (int)x - cx, dy = (int)y - cy;
+                    const bool person = (dx * dx * 9 + dy * dy) < (180 * 180);
+                    const XnUInt32 i = y * XRES + x;
+                    labels[i] = person ? 1 : 0;
+                    depth[i] = person ? (XnDepthPixel)(2000 + (x % 7) * 5) : 3500;
+                    image[i].nRed = (XnUInt8)x;
+                    image[i].nGreen = (XnUInt8)y;
+                    image[i].nBlue = person ? 200 : 50;
+                }
+            }
+            
+            // ドライバが窓の中だけを送ってくる
+            const FrameRoi roi = (mode == 0) ? full : scheduler.roi();
+            crop(image, roi, imageCrop);
+            crop(depth, roi, depthCrop);
+            crop(labels, roi, labelCrop);
+            bytes += roi.area() * (sizeof(XnRGB24Pixel) + sizeof(XnDepthPixel) + sizeof(XnLabel));
+            area += roi.area();
+            if (!roi.contains(RoiKernels::labelBounds(&labels[0], full))) {
+                ++clipped;
+            }
+            
+            XnUInt64 begin, end;
+            xnOSGetHighResTimeStamp(&begin);
+            IplImage* cameraImage = camera.resize(roi);
+            IplImage* depthView = depthImage.resize(roi);
+            RoiKernels::copyImage(&imageCrop[0], roi,
+                                  (XnUInt8*)cameraImage->imageData, cameraImage->widthStep, roi);
+            RoiKernels::depthHistogram(&depthCrop[0], roi, roi, histogram);
+            RoiKernels::colorizeDepth(&depthCrop[0], roi, histogram,
+                                      (XnUInt8*)depthView->imageData, depthView->widthStep, roi);
+            RoiKernels::overlayLabels(&labelCrop[0], roi, Colors, sizeof(Colors) / sizeof(Colors[0]),
+                                      (XnUInt8*)cameraImage->imageData, cameraImage->widthStep, roi);
+            const FrameRoi bounds = RoiKernels::labelBounds(&labelCrop[0], roi);
+            if (mode != 0) {
+                scheduler.update(bounds);
+            }
+            xnOSGetHighResTimeStamp(&end);
+            process += end - begin;
+        }
+        
+        std::cout << names[mode] << " : " << (bytes / FRAMES / 1024) << " KB/frame, window " <<
+            (100.0 * area / FRAMES / full.area()) << "%, " <<
+            (process / 1000.0 / FRAMES) << " ms/frame, " <<
+            scheduler.changes() << " cropping changes, " << clipped << " clipped frames" << std::endl;
+    }
+}
+
 int main (int argc, char * argv[])
 {
-    IplImage* camera = 0;
+    // 速度計測モード
+    if ((argc > 1) && (std::string(argv[1]) == "bench")) {
+        benchmark();
+        return 0;
+    }
     
     try {
         // コンテキストの初期化
@@ -37,6 +164,12 @@ int main (int argc, char * argv[])
             throw std::runtime_error(xnGetStatusString(rc));
         }
         
+        // デプスとユーザーは、設定ファイルにあれば使う
+        xn::DepthGenerator depth;
+        context.FindExistingNode(XN_NODE_TYPE_DEPTH, depth);
+        xn::UserGenerator user;
+        context.FindExistingNode(XN_NODE_TYPE_USER, user);
+        
         XnCropping cropping = { 0 };
         image.GetCroppingCap().GetCropping(cropping);
         std::cout << cropping.bEnabled << "," << 
@@ -55,38 +188,72 @@ int main (int argc, char * argv[])
         cropping.nXSize = 200;
         cropping.nYSize = 300;
         
+        // デプスのヒストグラム
+        std::vector<float> histogram(10000);
         
-        
-        // カメラサイズのイメージを作成(8bitのRGB)
+        // 表示のバッファはフレーム全体の大きさで確保して、窓の大きさで使う
         XnMapOutputMode outputMode;
         image.GetMapOutputMode(outputMode);
-        camera = ::cvCreateImage(cvSize(outputMode.nXRes, outputMode.nYRes),
-                                 IPL_DEPTH_8U, 3);
-        if (!camera) {
-            throw std::runtime_error("error : cvCreateImage");
-        }
-
+        RoiImage camera(outputMode.nXRes, outputMode.nYRes, 3);
+        RoiImage depthImage(outputMode.nXRes, outputMode.nYRes, 3);
+        
+        // ユーザーを追いかけてクロッピングの窓を決める
+        RoiScheduler scheduler(outputMode.nXRes, outputMode.nYRes);
+        bool follow = false;
+        
+        // 表示だけを左右反転する(窓やユーザーの位置はセンサーの座標のまま)
+        bool mirror = false;
+        
         // メインループ
         while (1) {
             // カメライメージの更新を待ち、画像データを取得する
             context.WaitOneUpdateAll(image);
             
+            // 表示も処理も窓の中だけ。バッファは窓の大きさで持つ
             xn::ImageMetaData imageMD;
             image.GetMetaData(imageMD);
+            const FrameRoi roi = FrameRoi::fromMetaData(imageMD);
+            IplImage* cameraImage = camera.resize(roi);
             
             // カメラ画像の表示
-            for (XnUInt y = imageMD.YOffset(); y < (imageMD.YOffset() + imageMD.YRes()); ++y) {
-                const XnUInt8*src = imageMD.Data() + (imageMD.XRes() * y * 3);
-                char* dest = camera->imageData + (camera->width * y * 3);
-                for (XnUInt x = imageMD.XOffset(); x < (imageMD.XOffset() + imageMD.XRes()); ++x, src += 3, dest += 3) {
-                    dest[0] = src[0];
-                    dest[1] = src[1];
-                    dest[2] = src[2];
+            RoiKernels::copyImage(imageMD.RGB24Data(), roi,
+                                  (XnUInt8*)cameraImage->imageData, cameraImage->widthStep, roi, mirror);
+            
+            // デプスも同じ窓だけ、窓の中の分布でヒストグラムを作って表示する
+            if (depth.IsValid()) {
+                xn::DepthMetaData depthMD;
+                depth.GetMetaData(depthMD);
+                const FrameRoi depthRoi = FrameRoi::fromMetaData(depthMD);
+                IplImage* depthView = depthImage.resize(roi);
+                
+                RoiKernels::depthHistogram(depthMD.Data(), depthRoi, roi, histogram);
+                RoiKernels::colorizeDepth(depthMD.Data(), depthRoi, histogram,
+                                          (XnUInt8*)depthView->imageData, depthView->widthStep, roi,
+                                          mirror);
+                ::cvShowImage("Depth", depthView);
+            }
+            
+            // ユーザーの色を窓の中だけ重ねる
+            xn::SceneMetaData sceneMD;
+            if (user.IsValid()) {
+                user.GetUserPixels(0, sceneMD);
+                RoiKernels::overlayLabels(sceneMD.Data(), FrameRoi::fromMetaData(sceneMD),
+                                          Colors, sizeof(Colors) / sizeof(Colors[0]),
+                                          (XnUInt8*)cameraImage->imageData, cameraImage->widthStep, roi,
+                                          mirror);
+                
+                // 窓を変えるかどうかはスケジューラが決める
+                if (follow) {
+                    const FrameRoi bounds = RoiKernels::labelBounds(sceneMD.Data(),
+                                                                    FrameRoi::fromMetaData(sceneMD));
+                    if (scheduler.update(bounds)) {
+                        cropping = scheduler.roi().toCropping();
+                        setCropping(image, depth, cropping);
+                    }
                 }
             }
-
-            ::cvCvtColor(camera, camera, CV_BGR2RGB);
-            ::cvShowImage("KinectImage", camera);
+            
+            ::cvShowImage("KinectImage", cameraImage);
             
             // キーの取得
             char key = cvWaitKey(10);
@@ -97,10 +264,27 @@ int main (int argc, char * argv[])
             // クロッピングの有効/無効を切り替える
             else if (key == 'c') {
                 cropping.bEnabled = !cropping.bEnabled;
-                image.GetCroppingCap().SetCropping(cropping);
-                
-                // 背景の初期化
-                memset(camera->imageData, 255, camera->imageSize);
+                setCropping(image, depth, cropping);
+                scheduler.reset(FrameRoi::fromCropping(cropping, outputMode.nXRes, outputMode.nYRes));
+            }
+            // ユーザーを囲む窓にクロッピングする
+            else if ((key == 'u') && user.IsValid()) {
+                const FrameRoi bounds = RoiKernels::labelBounds(sceneMD.Data(),
+                                                                FrameRoi::fromMetaData(sceneMD));
+                if (!bounds.empty()) {
+                    cropping = bounds.expanded(20).aligned(8).toCropping();
+                    setCropping(image, depth, cropping);
+                    scheduler.reset(FrameRoi::fromCropping(cropping, outputMode.nXRes, outputMode.nYRes));
+                }
+            }
+            // 反転する
+            else if (key == 'm') {
+                mirror = !mirror;
+            }
+            // ユーザーを追いかけて窓を動かし続ける
+            else if ((key == 'a') && user.IsValid()) {
+                follow = !follow;
+                std::cout << "follow " << (follow ? "on" : "off") << std::endl;
             }
         }
     }
@@ -108,7 +292,5 @@ int main (int argc, char * argv[])
         std::cout << ex.what() << std::endl;
     }
     
-    ::cvReleaseImage(&camera);
-    
     return 0;
 }
@@ -22,12 +22,13 @@ const char* CONFIG_XML_PATH = "Data/SamplesConfig.xml";
 typedef std::vector<float> depth_hist;
 
 // デプスのヒストグラムを作成
-depth_hist getDepthHistgram(const xn::DepthGenerator& depth,
-                            const xn::DepthMetaData& depthMD)
+//  毎フレーム確保しないよう、呼び出し側のdepthHistを使いまわす
+void getDepthHistgram(const xn::DepthGenerator& depth,
+                      const xn::DepthMetaData& depthMD, depth_hist& depthHist)
 {
   // デプスの傾向を計算する(アルゴリズムはNiSimpleViewer.cppを利用)
   const int MAX_DEPTH = depth.GetDeviceMaxDepth();
-  depth_hist depthHist(MAX_DEPTH);
+  depthHist.assign(MAX_DEPTH, 0);
 
   unsigned int points = 0;
   const XnDepthPixel* pDepth = depthMD.Data();
@@ -50,8 +51,6 @@ depth_hist getDepthHistgram(const xn::DepthGenerator& depth,
         (unsigned int)(256 * (1.0f - (depthHist[i] / points)));
     }
   }
-
-  return depthHist;
 }
 
 int main (int argc, char * argv[])
@@ -94,19 +93,21 @@ int main (int argc, char * argv[])
       throw std::runtime_error("error : cvCreateImage");
     }
 
+    // フレームごとに作り直さずに使いまわす
+    xn::DepthMetaData depthMD;
+    depth_hist depthHist;
+
     // メインループ
     while (1) {
       // すべての更新を待ち、画像およびデプスデータを取得する
       context.WaitAndUpdateAll();
 
-      xn::ImageMetaData imageMD;
       image.GetMetaData(imageMD);
 
-      xn::DepthMetaData depthMD;
       depth.GetMetaData(depthMD);
 
       // デプスマップの作成
-      depth_hist depthHist = getDepthHistgram(depth, depthMD);
+      getDepthHistgram(depth, depthMD, depthHist);
 
       // イメージをデプスマップで上書きする
       xn::RGB24Map& rgb = imageMD.WritableRGB24Map();
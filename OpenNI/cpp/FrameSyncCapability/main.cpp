@@ -27,12 +27,13 @@ void XN_CALLBACK_TYPE FrameSyncChanged(xn::ProductionNode& node, void* pCookie)
 }
 
 // fvX̃qXgO쐬
-depth_hist getDepthHistgram(const xn::DepthGenerator& depth,
-                            const xn::DepthMetaData& depthMD)
+//  t[mۂȂ悤AĂяodepthHistg܂킷
+void getDepthHistgram(const xn::DepthGenerator& depth,
+                      const xn::DepthMetaData& depthMD, depth_hist& depthHist)
 {
   // fvX̌XvZ(ASYNiSimpleViewer.cpp𗘗p)
   const int MAX_DEPTH = depth.GetDeviceMaxDepth();
-  depth_hist depthHist(MAX_DEPTH);
+  depthHist.assign(MAX_DEPTH, 0);
 
   unsigned int points = 0;
   const XnDepthPixel* pDepth = depthMD.Data();
@@ -55,8 +56,6 @@ depth_hist getDepthHistgram(const xn::DepthGenerator& depth,
         (unsigned int)(256 * (1.0f - (depthHist[i] / points)));
     }
   }
-
-  return depthHist;
 }
 
 int main (int argc, char * argv[])
@@ -108,19 +107,21 @@ int main (int argc, char * argv[])
       throw std::runtime_error("error : cvCreateImage");
     }
 
+    // t[Ƃɍ蒼Ɏg܂킷
+    xn::DepthMetaData depthMD;
+    depth_hist depthHist;
+
     // C[v
     while (1) {
       // ׂĂ̍XV҂A摜уfvXf[^擾
       context.WaitOneUpdateAll(image);
 
-      xn::ImageMetaData imageMD;
       image.GetMetaData(imageMD);
 
-      xn::DepthMetaData depthMD;
       depth.GetMetaData(depthMD);
 
       // fvX}bv̍쐬
-      depth_hist depthHist = getDepthHistgram(depth, depthMD);
+      getDepthHistgram(depth, depthMD, depthHist);
 
       // C[WfvX}bvŏ㏑
       xn::RGB24Map& rgb = imageMD.WritableRGB24Map();
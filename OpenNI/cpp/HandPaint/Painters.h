@@ -0,0 +1,288 @@
+#ifndef PAINTERS_H_INCLUDE
+#define PAINTERS_H_INCLUDE
+
+#include <vector>
+#include <algorithm>
+
+#include <opencv/cv.h>
+
+#include <XnCppWrapper.h>
+
+#include "StrokeCanvas.h"
+#include "../../../apply/cpp/PointCloud/WorkerThreads.h"
+
+// キャンバスのプール
+//  ユーザーが入れ替わるたびに画像を作り直さないよう、返されたキャンバスを使いまわす
+//  (メインスレッドからだけ使う)
+class CanvasPool
+{
+public:
+
+  CanvasPool(CvSize size)
+    :size_(size)
+  {
+  }
+
+  ~CanvasPool()
+  {
+    for (std::vector<StrokeCanvas*>::iterator it = canvases_.begin(); it != canvases_.end(); ++it) {
+      delete *it;
+    }
+  }
+
+  StrokeCanvas* acquire()
+  {
+    if (free_.empty()) {
+      canvases_.push_back(new StrokeCanvas(size_));
+      return canvases_.back();
+    }
+
+    StrokeCanvas* canvas = free_.back();
+    free_.pop_back();
+    return canvas;
+  }
+
+  void release(StrokeCanvas* canvas)
+  {
+    canvas->end();
+    canvas->clear();
+    free_.push_back(canvas);
+  }
+
+  // 作ったキャンバスの数
+  XnUInt32 size() const
+  {
+    return (XnUInt32)canvases_.size();
+  }
+
+private:
+
+  CanvasPool(const CanvasPool&);
+  CanvasPool& operator=(const CanvasPool&);
+
+  CvSize size_;
+  std::vector<StrokeCanvas*> canvases_;
+  std::vector<StrokeCanvas*> free_;
+};
+
+// ユーザーごとのお絵かきの状態
+struct Painter
+{
+  XnUserID      id;
+  StrokeCanvas* canvas;
+  CvScalar      color;
+  bool          isDown;     // 線を描いているか
+
+  // このフレームの入力(メインスレッドで設定し、updateで反映する)
+  bool          hasPoint;
+  CvPoint2D32f  point;
+  bool          isClear;
+  bool          isColorChanged;
+};
+
+// 複数ユーザーのお絵かき
+//  入力はメインスレッドで設定し、キャンバスの更新はユーザーごとにワーカースレッドで行う。
+//  合成はすべてのキャンバスの描いた範囲を1回なめて、上のユーザーの色を採る
+class Painters
+{
+public:
+
+  Painters(CvSize size, WorkerThreads* workers = 0)
+    :pool_(size), workers_(workers), dst_(0), area_(cvRect(0, 0, 0, 0))
+  {
+  }
+
+  ~Painters()
+  {
+    for (std::vector<Painter>::iterator it = painters_.begin(); it != painters_.end(); ++it) {
+      pool_.release(it->canvas);
+    }
+  }
+
+  // ユーザーの状態(なければキャンバスを割り当てる)
+  //  ほかのユーザーを追加すると参照は無効になる
+  Painter& painter(XnUserID id, CvScalar color)
+  {
+    for (std::vector<Painter>::iterator it = painters_.begin(); it != painters_.end(); ++it) {
+      if (it->id == id) {
+        return *it;
+      }
+    }
+
+    Painter painter;
+    painter.id = id;
+    painter.canvas = pool_.acquire();
+    painter.color = color;
+    painter.isDown = false;
+    painter.hasPoint = false;
+    painter.point = cvPoint2D32f(0, 0);
+    painter.isClear = false;
+    painter.isColorChanged = false;
+    painters_.push_back(painter);
+    return painters_.back();
+  }
+
+  // usersにいないユーザーのキャンバスをプールに返す
+  void retain(const XnUserID* users, XnUInt32 count)
+  {
+    for (XnUInt32 i = 0; i < painters_.size(); ) {
+      if (std::find(users, users + count, painters_[i].id) == users + count) {
+        pool_.release(painters_[i].canvas);
+        painters_.erase(painters_.begin() + i);
+      }
+      else {
+        ++i;
+      }
+    }
+  }
+
+  // 入力をキャンバスに反映する(ユーザーごとに並列)
+  void update()
+  {
+    WorkerThreads::run(workers_, updateTask, this);
+  }
+
+  // すべてのキャンバスを左右反転する
+  void flip()
+  {
+    for (std::vector<Painter>::iterator it = painters_.begin(); it != painters_.end(); ++it) {
+      it->canvas->flip();
+    }
+  }
+
+  // すべてのキャンバスをdstに重ねる(行ごとに並列)
+  void draw(IplImage* dst)
+  {
+    // 描いた範囲をまとめる
+    int x0 = dst->width, y0 = dst->height, x1 = 0, y1 = 0;
+    for (std::vector<Painter>::const_iterator it = painters_.begin(); it != painters_.end(); ++it) {
+      const CvRect rect = it->canvas->dirty();
+      if ((rect.width > 0) && (rect.height > 0)) {
+        x0 = std::min(x0, rect.x);
+        y0 = std::min(y0, rect.y);
+        x1 = std::max(x1, rect.x + rect.width);
+        y1 = std::max(y1, rect.y + rect.height);
+      }
+    }
+
+    if ((x0 < x1) && (y0 < y1)) {
+      dst_ = dst;
+      area_ = cvRect(x0, y0, x1 - x0, y1 - y0);
+      rows_.resize((workers_ != 0) ? workers_->size() : 1);
+      WorkerThreads::run(workers_, compositeTask, this);
+    }
+
+    // 確定していない部分
+    for (std::vector<Painter>::const_iterator it = painters_.begin(); it != painters_.end(); ++it) {
+      it->canvas->drawPending(dst);
+    }
+  }
+
+  XnUInt32 size() const
+  {
+    return (XnUInt32)painters_.size();
+  }
+
+  const Painter& operator[](XnUInt32 index) const
+  {
+    return painters_[index];
+  }
+
+  const CanvasPool& pool() const
+  {
+    return pool_;
+  }
+
+private:
+
+  Painters(const Painters&);
+  Painters& operator=(const Painters&);
+
+  static void updateTask(void* param, XnUInt32 index, XnUInt32 count)
+  {
+    Painters& self = *(Painters*)param;
+    for (XnUInt32 i = index; i < self.painters_.size(); i += count) {
+      Painter& painter = self.painters_[i];
+      StrokeCanvas& canvas = *painter.canvas;
+
+      if (painter.isClear) {
+        canvas.clear();
+      }
+
+      if (painter.isDown && painter.hasPoint) {
+        if (!canvas.isDrawing() || painter.isColorChanged) {
+          canvas.begin(painter.color);
+        }
+        canvas.add(painter.point);
+      }
+      else {
+        canvas.end();
+      }
+
+      painter.hasPoint = false;
+      painter.isClear = false;
+      painter.isColorChanged = false;
+    }
+  }
+
+  // 描いた範囲の行を分けて、画素ごとに後のユーザーから順にマスクを見る
+  static void compositeTask(void* param, XnUInt32 index, XnUInt32 count)
+  {
+    Painters& self = *(Painters*)param;
+    const CvRect& area = self.area_;
+    const int begin = area.y + area.height * index / count;
+    const int end = area.y + area.height * (index + 1) / count;
+
+    std::vector<const XnUInt8*>& masks = self.rows_[index].masks;
+    std::vector<const XnUInt8*>& layers = self.rows_[index].layers;
+    for (int y = begin; y < end; ++y) {
+      // この行に描いてあるキャンバス(上のユーザーから)
+      masks.clear();
+      layers.clear();
+      for (std::vector<Painter>::const_reverse_iterator it = self.painters_.rbegin();
+           it != self.painters_.rend(); ++it) {
+        const CvRect rect = it->canvas->dirty();
+        if ((rect.width > 0) && (y >= rect.y) && (y < rect.y + rect.height)) {
+          const IplImage* mask = it->canvas->mask();
+          const IplImage* layer = it->canvas->layer();
+          masks.push_back((const XnUInt8*)mask->imageData + y * mask->widthStep);
+          layers.push_back((const XnUInt8*)layer->imageData + y * layer->widthStep);
+        }
+      }
+      if (masks.empty()) {
+        continue;
+      }
+
+      XnUInt8* dst = (XnUInt8*)self.dst_->imageData + y * self.dst_->widthStep;
+      for (int x = area.x; x < area.x + area.width; ++x) {
+        for (size_t i = 0; i < masks.size(); ++i) {
+          if (masks[i][x] != 0) {
+            const XnUInt8* src = layers[i] + x * 3;
+            dst[x * 3 + 0] = src[0];
+            dst[x * 3 + 1] = src[1];
+            dst[x * 3 + 2] = src[2];
+            break;
+          }
+        }
+      }
+    }
+  }
+
+  CanvasPool pool_;
+  WorkerThreads* workers_;
+  std::vector<Painter> painters_;
+
+  // 合成中の出力と範囲
+  IplImage* dst_;
+  CvRect area_;
+
+  // スレッドごとの、その行に描いてあるキャンバスのマスクとレイヤー
+  struct Rows
+  {
+    std::vector<const XnUInt8*> masks;
+    std::vector<const XnUInt8*> layers;
+  };
+  std::vector<Rows> rows_;
+};
+
+#endif // #ifndef PAINTERS_H_INCLUDE
@@ -0,0 +1,290 @@
+#ifndef STROKECANVAS_H_INCLUDE
+#define STROKECANVAS_H_INCLUDE
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include <opencv/cv.h>
+
+#include <XnCppWrapper.h>
+
+// 線を描きためておくレイヤー
+//  点を追加するたびに Douglas-Peucker で間引き、確定した線分だけをレイヤーに描く。
+//  毎フレームの処理は、描いた範囲のマスク付きコピーと、確定前の1本の線だけになる
+class StrokeCanvas
+{
+public:
+
+  StrokeCanvas(CvSize size, double tolerance = 2.0, int thickness = 3)
+    :layer_(0), mask_(0), tolerance_(tolerance), thickness_(thickness),
+     color_(CV_RGB(0, 0, 0)), isDrawing_(false), vertices_(0)
+  {
+    layer_ = ::cvCreateImage(size, IPL_DEPTH_8U, 3);
+    mask_ = ::cvCreateImage(size, IPL_DEPTH_8U, 1);
+    if ((layer_ == 0) || (mask_ == 0)) {
+      ::cvReleaseImage(&layer_);
+      ::cvReleaseImage(&mask_);
+      throw std::runtime_error("error : cvCreateImage");
+    }
+
+    clear();
+  }
+
+  ~StrokeCanvas()
+  {
+    ::cvReleaseImage(&layer_);
+    ::cvReleaseImage(&mask_);
+  }
+
+  // 線を描き始める(描いている途中なら、最後の点から新しい色で続ける)
+  void begin(CvScalar color)
+  {
+    const bool isContinue = isDrawing_ && !pending_.empty();
+    const CvPoint2D32f last = isContinue ? pending_.back() : cvPoint2D32f(0, 0);
+
+    end();
+    color_ = color;
+    isDrawing_ = true;
+    if (isContinue) {
+      pending_.push_back(last);
+    }
+  }
+
+  // 描いている線に点を追加する
+  void add(CvPoint2D32f point)
+  {
+    if (!isDrawing_) {
+      return;
+    }
+
+    // 最初の点(確定した頂点)
+    if (pending_.empty()) {
+      pending_.push_back(point);
+      commit(point, point);
+      return;
+    }
+
+    // 確定した頂点から新しい点までの線分で、間の点を許容誤差内で表せなくなったら
+    // 1つ前までを間引いて確定する
+    pending_.push_back(point);
+    if ((pending_.size() > MAX_PENDING) || !isStraight()) {
+      flush(pending_.size() - 1);
+    }
+  }
+
+  // 線を描き終える(残りの点を確定する)
+  void end()
+  {
+    if (isDrawing_ && !pending_.empty()) {
+      flush(pending_.size());
+    }
+    pending_.clear();
+    isDrawing_ = false;
+  }
+
+  // 描いた線をすべて消す
+  void clear()
+  {
+    ::cvSetZero(layer_);
+    ::cvSetZero(mask_);
+    pending_.clear();
+    dirty_ = cvRect(0, 0, 0, 0);
+    vertices_ = 0;
+  }
+
+  // 描いた線を左右反転する(表示の鏡モードを切り替えたとき)
+  void flip()
+  {
+    if ((dirty_.width > 0) && (dirty_.height > 0)) {
+      ::cvFlip(layer_, 0, 1);
+      ::cvFlip(mask_, 0, 1);
+      dirty_.x = layer_->width - dirty_.x - dirty_.width;
+    }
+
+    for (std::vector<CvPoint2D32f>::iterator it = pending_.begin(); it != pending_.end(); ++it) {
+      it->x = layer_->width - 1 - it->x;
+    }
+  }
+
+  // 描いた線をdstに重ねる
+  void draw(IplImage* dst) const
+  {
+    // 描いた範囲だけ、マスク付きでコピーする
+    if ((dirty_.width > 0) && (dirty_.height > 0)) {
+      ::cvSetImageROI(layer_, dirty_);
+      ::cvSetImageROI(mask_, dirty_);
+      ::cvSetImageROI(dst, dirty_);
+      ::cvCopy(layer_, dst, mask_);
+      ::cvResetImageROI(dst);
+      ::cvResetImageROI(mask_);
+      ::cvResetImageROI(layer_);
+    }
+
+    drawPending(dst);
+  }
+
+  // 確定していない部分だけをdstに描く
+  void drawPending(IplImage* dst) const
+  {
+    if (pending_.size() > 1) {
+      ::cvLine(dst, toPoint(pending_.front()), toPoint(pending_.back()), color_, thickness_);
+    }
+  }
+
+  // 描きためたレイヤーとマスク、描いた範囲(幅0なら何も描いていない)
+  const IplImage* layer() const
+  {
+    return layer_;
+  }
+
+  const IplImage* mask() const
+  {
+    return mask_;
+  }
+
+  CvRect dirty() const
+  {
+    return dirty_;
+  }
+
+  bool isDrawing() const
+  {
+    return isDrawing_;
+  }
+
+  // レイヤーに描いた頂点の数
+  XnUInt32 vertices() const
+  {
+    return vertices_;
+  }
+
+private:
+
+  StrokeCanvas(const StrokeCanvas&);
+  StrokeCanvas& operator=(const StrokeCanvas&);
+
+  // 確定していない点がこれより多くなったら、まっすぐでも確定する
+  static const size_t MAX_PENDING = 64;
+
+  static CvPoint toPoint(const CvPoint2D32f& point)
+  {
+    return cvPoint(cvRound(point.x), cvRound(point.y));
+  }
+
+  // 点pと線分abの距離
+  static double distance(const CvPoint2D32f& p, const CvPoint2D32f& a, const CvPoint2D32f& b)
+  {
+    const double dx = b.x - a.x, dy = b.y - a.y;
+    const double length2 = dx * dx + dy * dy;
+    double t = 0;
+    if (length2 > 0) {
+      t = std::max(0.0, std::min(1.0, ((p.x - a.x) * dx + (p.y - a.y) * dy) / length2));
+    }
+    const double ex = a.x + t * dx - p.x, ey = a.y + t * dy - p.y;
+    return std::sqrt(ex * ex + ey * ey);
+  }
+
+  // 確定していない点が、最初と最後を結ぶ線分から許容誤差内にあるか
+  bool isStraight() const
+  {
+    const CvPoint2D32f& a = pending_.front();
+    const CvPoint2D32f& b = pending_.back();
+    for (size_t i = 1; i + 1 < pending_.size(); ++i) {
+      if (distance(pending_[i], a, b) > tolerance_) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // pending_[0, count) を間引いてレイヤーに描き、最後の点から続ける
+  void flush(size_t count)
+  {
+    if (count < 2) {
+      return;
+    }
+
+    keep_.assign(count, false);
+    keep_[0] = keep_[count - 1] = true;
+    simplify(0, count - 1);
+
+    size_t last = 0;
+    for (size_t i = 1; i < count; ++i) {
+      if (keep_[i]) {
+        commit(pending_[last], pending_[i]);
+        last = i;
+      }
+    }
+
+    pending_.erase(pending_.begin(), pending_.begin() + (count - 1));
+  }
+
+  // Douglas-Peucker : first～lastの間で一番離れた点が許容誤差を超えていれば残して分割する
+  void simplify(size_t first, size_t last)
+  {
+    if (last <= first + 1) {
+      return;
+    }
+
+    double maxDistance = 0;
+    size_t index = first;
+    for (size_t i = first + 1; i < last; ++i) {
+      const double d = distance(pending_[i], pending_[first], pending_[last]);
+      if (d > maxDistance) {
+        maxDistance = d;
+        index = i;
+      }
+    }
+
+    if (maxDistance > tolerance_) {
+      keep_[index] = true;
+      simplify(first, index);
+      simplify(index, last);
+    }
+  }
+
+  // 確定した線分をレイヤーとマスクに描き、描いた範囲を広げる
+  void commit(const CvPoint2D32f& from, const CvPoint2D32f& to)
+  {
+    const CvPoint pt1 = toPoint(from), pt2 = toPoint(to);
+    ::cvLine(layer_, pt1, pt2, color_, thickness_);
+    ::cvLine(mask_, pt1, pt2, cvScalar(255), thickness_);
+    ++vertices_;
+
+    const int r = thickness_ + 1;
+    const int left = std::max(0, std::min(pt1.x, pt2.x) - r);
+    const int top = std::max(0, std::min(pt1.y, pt2.y) - r);
+    const int right = std::min(layer_->width, std::max(pt1.x, pt2.x) + r + 1);
+    const int bottom = std::min(layer_->height, std::max(pt1.y, pt2.y) + r + 1);
+    if ((right <= left) || (bottom <= top)) {
+      return;
+    }
+
+    if ((dirty_.width == 0) || (dirty_.height == 0)) {
+      dirty_ = cvRect(left, top, right - left, bottom - top);
+    }
+    else {
+      const int x0 = std::min(dirty_.x, left), y0 = std::min(dirty_.y, top);
+      const int x1 = std::max(dirty_.x + dirty_.width, right);
+      const int y1 = std::max(dirty_.y + dirty_.height, bottom);
+      dirty_ = cvRect(x0, y0, x1 - x0, y1 - y0);
+    }
+  }
+
+  IplImage* layer_;
+  IplImage* mask_;
+  CvRect dirty_;          // レイヤーに描いた範囲
+
+  double tolerance_;
+  int thickness_;
+  CvScalar color_;
+  bool isDrawing_;
+  XnUInt32 vertices_;
+
+  std::vector<CvPoint2D32f> pending_;   // 最後に確定した頂点と、その後の点
+  std::vector<bool> keep_;
+};
+
+#endif // #ifndef STROKECANVAS_H_INCLUDE
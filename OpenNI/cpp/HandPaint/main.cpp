@@ -2,12 +2,20 @@
 // 現実的な速度で動作します
 #include <iostream>
 #include <stdexcept>
+#include <string>
 #include <vector>
+#include <cmath>
 
 #include <opencv/cv.h>
 #include <opencv/highgui.h>
 
 #include <XnCppWrapper.h>
+#include <XnOS.h>
+
+#include "../User/LabelRuns.h"
+#include "StrokeCanvas.h"
+#include "Painters.h"
+#include "../../../apply/cpp/PointCloud/WorkerThreads.h"
 
 // 設定ファイルのパス(環境に合わせて変更してください)
 #if (XN_PLATFORM == XN_PLATFORM_WIN32)
@@ -95,12 +103,33 @@ void XN_CALLBACK_TYPE CalibrationEnd(xn::SkeletonCapability& capability,
     }
 }
 
+// 現実の座標を画面座標に変換する
+//  mirrorなら、画面は表示用にコピーするときに左右反転している
+XnPoint3D toScreen(const xn::DepthGenerator& depth, const XnPoint3D& position,
+                   int width, bool mirror)
+{
+    XnPoint3D pt;
+    depth.ConvertRealWorldToProjective(1, &position, &pt);
+    if (mirror) {
+        pt.X = width - 1 - pt.X;
+    }
+    return pt;
+}
+
+// 左右の関節を選ぶ
+//  ドライバで反転していないときは、スケルトンの左右が本人の左右と逆になるので、
+//  画面を反転するときは入れ替えて、ドライバで反転していたときと同じ手にする
+XnSkeletonJoint joint(XnSkeletonJoint right, XnSkeletonJoint left, bool mirror)
+{
+    return mirror ? left : right;
+}
+
 class SkeltonDrawer
 {
 public:
     SkeltonDrawer( IplImage* camera, xn::SkeletonCapability& skelton,
-                  xn::DepthGenerator& depth, XnUserID player )
-    :camera_(camera), skelton_(skelton), depth_(depth), player_(player)
+                  xn::DepthGenerator& depth, XnUserID player, bool mirror = false )
+    :camera_(camera), skelton_(skelton), depth_(depth), player_(player), mirror_(mirror)
     {
     }
     
@@ -148,8 +177,8 @@ private:
 	    }
         
         // 座標を変換する
-        XnPoint3D pt[2] = { joint1.position, joint2.position };
-	    depth_.ConvertRealWorldToProjective(2, pt, pt);
+        XnPoint3D pt[2] = { toScreen(depth_, joint1.position, camera_->width, mirror_),
+                            toScreen(depth_, joint2.position, camera_->width, mirror_) };
         cvLine(camera_,cvPoint(pt[0].X, pt[0].Y), cvPoint(pt[1].X, pt[1].Y),
                CV_RGB(0, 255, 255),2,CV_AA ,0);
     }
@@ -160,6 +189,7 @@ private:
     xn::SkeletonCapability& skelton_;
     xn::DepthGenerator& depth_;
     XnUserID player_;
+    bool mirror_;
 };
 
 // RGBピクセルの初期化
@@ -169,8 +199,90 @@ inline XnRGB24Pixel xnRGB24Pixel( int r, int g, int b )
     return pixel;
 }
 
+// 手の動き(円を描きながら揺れる)を長く描き続けて、1フレームの描画時間を比べる
+//  以前の方法 : すべての点を毎フレーム cvLine で描く
+//  StrokeCanvas : 間引いて確定した線分だけをレイヤーに描き、マスク付きで重ねる
+void benchmark()
+{
+    const int FRAMES = 3000;
+    IplImage* camera = ::cvCreateImage(cvSize(640, 480), IPL_DEPTH_8U, 3);
+    if (!camera) {
+        throw std::runtime_error("error : cvCreateImage");
+    }
+    ::cvSetZero(camera);
+    
+    std::vector<CvPoint2D32f> stroke;
+    for (int f = 0; f < FRAMES; ++f) {
+        double t = f * 0.05;
+        stroke.push_back(cvPoint2D32f(320 + 150 * cos(t) + 3 * sin(t * 7),
+                                      240 + 150 * sin(t) + 3 * cos(t * 5)));
+    }
+    
+    XnUInt64 begin, end;
+    xnOSGetHighResTimeStamp(&begin);
+    for (int f = 1; f < FRAMES; ++f) {
+        for (int i = 1; i <= f; ++i) {
+            ::cvLine(camera, cvPoint(stroke[i - 1].x, stroke[i - 1].y),
+                     cvPoint(stroke[i].x, stroke[i].y), CV_RGB(255, 0, 0), 3);
+        }
+    }
+    xnOSGetHighResTimeStamp(&end);
+    double lineTime = (end - begin) / 1000.0 / FRAMES;
+    
+    StrokeCanvas canvas(cvSize(camera->width, camera->height));
+    canvas.begin(CV_RGB(255, 0, 0));
+    xnOSGetHighResTimeStamp(&begin);
+    for (int f = 0; f < FRAMES; ++f) {
+        canvas.add(stroke[f]);
+        canvas.draw(camera);
+    }
+    xnOSGetHighResTimeStamp(&end);
+    double canvasTime = (end - begin) / 1000.0 / FRAMES;
+    canvas.end();
+    
+    std::cout << "cvLine       : " << lineTime << " ms/frame (average over " << FRAMES <<
+        " frames, " << FRAMES << " points at the end)" << std::endl;
+    std::cout << "StrokeCanvas : " << canvasTime << " ms/frame (" << canvas.vertices() <<
+        " vertices)" << std::endl;
+    
+    // 6人が同時に描く(30fpsで30秒分)
+    const int PAINTERS = 6;
+    const int PAINT_FRAMES = 900;
+    const XnUInt32 threadCounts[] = { 1, 4 };
+    for (int t = 0; t < 2; ++t) {
+        WorkerThreads workers(threadCounts[t]);
+        Painters painters(cvSize(camera->width, camera->height), &workers);
+        
+        xnOSGetHighResTimeStamp(&begin);
+        for (int f = 0; f < PAINT_FRAMES; ++f) {
+            for (int p = 0; p < PAINTERS; ++p) {
+                Painter& painter = painters.painter(p + 1, CV_RGB(255, 0, 0));
+                const CvPoint2D32f& pt = stroke[f];
+                painter.isDown = true;
+                painter.hasPoint = true;
+                painter.point = cvPoint2D32f(pt.x - 60 * (p - PAINTERS / 2) / 2, pt.y);
+            }
+            painters.update();
+            painters.draw(camera);
+        }
+        xnOSGetHighResTimeStamp(&end);
+        
+        std::cout << "Painters x" << PAINTERS << " (threads " << workers.size() << ") : " <<
+            ((end - begin) / 1000.0 / PAINT_FRAMES) << " ms/frame, " <<
+            painters.pool().size() << " canvases" << std::endl;
+    }
+    
+    ::cvReleaseImage(&camera);
+}
+
 int main (int argc, char * argv[])
 {
+    // 速度計測モード
+    if ((argc > 1) && (std::string(argv[1]) == "bench")) {
+        benchmark();
+        return 0;
+    }
+    
     IplImage* camera = 0;
     
     try {
@@ -181,9 +293,6 @@ int main (int argc, char * argv[])
             throw std::runtime_error(xnGetStatusString(rc));
         }
         
-        // 鏡モード(反転)にする
-        context.SetGlobalMirror(TRUE);
-        
         // イメージジェネレータの作成
         xn::ImageGenerator image;
         rc = context.FindExistingNode(XN_NODE_TYPE_IMAGE, image);
@@ -264,16 +373,18 @@ int main (int argc, char * argv[])
         bool isShowUser = true;
         bool isShowSkelton = true;
         
+        // 鏡モード(反転)にする
+        //  ドライバでは反転せず、表示用にコピーするときに反転して書く
+        bool mirror = true;
+        
+        // ユーザーのラベル(ランレングス)
+        LabelRuns runs;
+        const XnUInt32 colorsCount = sizeof(Colors) / sizeof(Colors[0]);
+        
 
-        // 描画状態
-        static enum State{
-            IDLE = 0,
-            CIRCLE,
-        } state[15] = { IDLE };
-
-        typedef std::vector<XnPoint3D> line;
-        line points;
-        CvScalar color = CV_RGB(0,0,0);
+        // ユーザーごとの描いた線(キャンバスはプールから割り当てる)
+        WorkerThreads workers(WorkerThreads::hardwareCount());
+        Painters painters(cvSize(camera->width, camera->height), &workers);
         
         typedef std::vector<CvScalar> LineColors;
         LineColors colors;
@@ -301,101 +412,101 @@ int main (int argc, char * argv[])
             user.GetUserPixels(0, sceneMD);
             
             // カメラ画像の表示
-            char* dest = camera->imageData;
-            const xn::RGB24Map& rgb = imageMD.RGB24Map();
-            for (int y = 0; y < imageMD.YRes(); ++y) {
-                for (int x = 0; x < imageMD.XRes(); ++x) {
-                    // ユーザー表示
-                    XnLabel label = sceneMD(x, y);
-                    if (!isShowUser) {
-                        label = 0;
+            if (isShowImage) {
+                copyPixels(imageMD.RGB24Data(), (XnRGB24Pixel*)camera->imageData,
+                           imageMD.XRes(), imageMD.YRes(), mirror);
+            }
+            else {
+                memset(camera->imageData, 255, camera->imageSize);
+            }
+            
+            // ユーザー表示(ユーザーのいる区間だけ色をかける)
+            if (isShowUser) {
+                runs.encode(sceneMD);
+                tintRuns(runs, Colors, colorsCount, (XnRGB24Pixel*)camera->imageData, mirror);
+            }
+            
+            // 左上に色を選ぶ場所を描く
+            const int r = 50;
+            for (int c = 0; c < colors.size(); ++c) {
+                cvRectangle(camera, cvPoint(c * r, 0), cvPoint((c+1)*r, r), colors[c], CV_FILLED);
+            }
+            
+            // いなくなったユーザーのキャンバスを返す
+            XnUserID aUsers[15];
+            XnUInt16 nUsers = 15;
+            user.GetUsers(aUsers, nUsers);
+            painters.retain(aUsers, nUsers);
+            
+            // ユーザーごとの入力
+            std::vector<CvPoint> cursors;
+            for (int i = 0; i < nUsers; ++i) {
+                if (!skelton.IsTracking(aUsers[i])) {
+                    continue;
+                }
+                
+                // スケルトンの描画
+                if (isShowSkelton) {
+                    SkeltonDrawer skeltonDrawer(camera, skelton,
+                                                depth, aUsers[i], mirror);
+                    skeltonDrawer.draw();
+                }
+                
+                // 右手と右肩の距離を表示
+                XnSkeletonJointPosition shoulder, l_shoulder, r_hand, l_hand;
+                skelton.GetSkeletonJointPosition(aUsers[i],
+                    joint(XN_SKEL_RIGHT_SHOULDER, XN_SKEL_LEFT_SHOULDER, mirror), shoulder);
+                skelton.GetSkeletonJointPosition(aUsers[i],
+                    joint(XN_SKEL_RIGHT_HAND, XN_SKEL_LEFT_HAND, mirror), r_hand);
+                skelton.GetSkeletonJointPosition(aUsers[i],
+                    joint(XN_SKEL_LEFT_SHOULDER, XN_SKEL_RIGHT_SHOULDER, mirror), l_shoulder);
+                skelton.GetSkeletonJointPosition(aUsers[i],
+                    joint(XN_SKEL_LEFT_HAND, XN_SKEL_RIGHT_HAND, mirror), l_hand);
+                
+                // 現実の座標を画面座標に変換する
+                XnPoint3D pt_r_hand = toScreen(depth, r_hand.position, camera->width, mirror);
+                XnPoint3D pt_l_hand = toScreen(depth, l_hand.position, camera->width, mirror);
+                
+                Painter& painter = painters.painter(aUsers[i], CV_RGB(0,0,0));
+                
+                // 右肩と右手の間隔が40cm以上(手を前に出してる感じ)
+                if (!painter.isDown && ((shoulder.position.Z - r_hand.position.Z) >= 400)) {
+                    std::cout << "ユーザー:" << aUsers[i] << " CIRCLE" << std::endl;
+                    painter.isDown = true;
+                }
+                // 左肩と左手の間隔が40cm以上(手を前に出してる感じ)
+                if (painter.isDown && ((l_shoulder.position.Z - l_hand.position.Z) >= 400)) {
+                    std::cout << "ユーザー:" << aUsers[i] << " IDLE" << std::endl;
+                    painter.isDown = false;
+                }
+                
+                // 左上に左手を持ってたら色を変える
+                if (pt_l_hand.Y < r) {
+                    int index = pt_l_hand.X / r;
+                    if (index == 0) {
+                        painter.isClear = true;
                     }
-                    
-                    // カメラ画像の表示
-                    XnRGB24Pixel pixel = rgb(x, y);
-                    if (!isShowImage) {
-                        pixel = xnRGB24Pixel( 255, 255, 255 );
+                    else if ((index < colors.size()) &&
+                             (memcmp(&painter.color, &colors[index], sizeof(painter.color)) != 0)) {
+                        std::cout << "ユーザー:" << aUsers[i] << " change color" << std::endl;
+                        painter.color = colors[index];
+                        painter.isColorChanged = true;
                     }
-                    
-                    // 出力先に描画
-                    dest[0] = pixel.nRed   * Colors[label][0];
-                    dest[1] = pixel.nGreen * Colors[label][1];
-                    dest[2] = pixel.nBlue  * Colors[label][2];
-                    dest += 3;
+                }
+                
+                if (painter.isDown) {
+                    painter.hasPoint = true;
+                    painter.point = cvPoint2D32f(pt_r_hand.X, pt_r_hand.Y);
+                    cursors.push_back(cvPoint(pt_r_hand.X, pt_r_hand.Y));
                 }
             }
             
-            // スケルトンの描画
-            if (isShowSkelton) {
-                XnUserID aUsers[15];
-                XnUInt16 nUsers = 15;
-                user.GetUsers(aUsers, nUsers);
-//                for (int i = 0; i < nUsers; ++i) {
-                for (int i = 0; i < 1; ++i) {
-                    if (skelton.IsTracking(aUsers[i])) {
-                        SkeltonDrawer skeltonDrawer(camera, skelton,
-                                                    depth, aUsers[i]);
-                        skeltonDrawer.draw();
-
-                        // 右手と右肩の距離を表示
-                        XnSkeletonJointPosition shoulder, l_shoulder, r_hand, l_hand;
-                        skelton.GetSkeletonJointPosition(aUsers[i], XN_SKEL_RIGHT_SHOULDER, shoulder);
-                        skelton.GetSkeletonJointPosition(aUsers[i], XN_SKEL_RIGHT_HAND, r_hand);
-                        skelton.GetSkeletonJointPosition(aUsers[i], XN_SKEL_LEFT_SHOULDER, l_shoulder);
-                        skelton.GetSkeletonJointPosition(aUsers[i], XN_SKEL_LEFT_HAND, l_hand);
-
-                        // 現実の座標を画面座標に変換する
-                        XnPoint3D pt_r_hand, pt_l_hand;
-                        depth.ConvertRealWorldToProjective(1, &r_hand.position, &pt_r_hand);
-                        depth.ConvertRealWorldToProjective(1, &l_hand.position, &pt_l_hand);
-
-                        // 右肩と右手の間隔が40cm以上(手を前に出してる感じ)
-                        if ((shoulder.position.Z - r_hand.position.Z) >= 400) {
-                            std::cout << " CIRCLE";
-                            state[i] = CIRCLE;
-                        }
-                        // 右肩と右手の間隔が40cm以上(手を前に出してる感じ)
-                        if ((l_shoulder.position.Z - l_hand.position.Z) >= 400) {
-                            std::cout << " IDLE";
-                            state[i] = IDLE;
-                        }
-                        
-                        
-                        // 左上に左手を持ってたら色を変える
-                        int r = 50;
-                        for (int c = 0; c < colors.size(); ++c) {
-                            cvRectangle(camera, cvPoint(c * r, 0), cvPoint((c+1)*r, r), colors[c], CV_FILLED);
-                        }
-                        if (pt_l_hand.Y < r) {
-                            int index = pt_l_hand.X / r;
-                            if (index == 0) {
-                                points.clear();
-                            }
-                            else if (index < colors.size()) {
-                                std::cout << " change color";
-                                color = colors[index];
-                            }
-                        }
-                        
-                        std::cout << std::endl;
-
-                        if (state[i] == CIRCLE) {
-                            points.push_back(pt_r_hand);
-                            cvCircle(camera, cvPoint(pt_r_hand.X, pt_r_hand.Y), 10, CV_RGB(255, 255, 0), 5);
-                        }
-
-                        // 線を書く
-                        for (line::iterator it = points.begin();it != points.end();){
-                            CvPoint pt1 = cvPoint(it->X, it->Y);
-                            CvPoint pt2 = cvPoint(it->X, it->Y);
-                            if (++it != points.end()) {
-                                pt2 = cvPoint(it->X, it->Y);
-                            }
-                            
-                            ::cvLine(camera, pt1, pt2, color, 3);
-                        }
-                    }
-                }
+            // キャンバスの更新はユーザーごとに並列に行い、まとめて重ねる
+            painters.update();
+            painters.draw(camera);
+            
+            for (std::vector<CvPoint>::iterator it = cursors.begin(); it != cursors.end(); ++it) {
+                cvCircle(camera, *it, 10, CV_RGB(255, 255, 0), 5);
             }
             
             ::cvCvtColor(camera, camera, CV_BGR2RGB);
@@ -409,7 +520,8 @@ int main (int argc, char * argv[])
             }
             // 反転する
             else if (key == 'm') {
-                context.SetGlobalMirror(!context.GetGlobalMirror());
+                mirror = !mirror;
+                painters.flip();
             }
             // 表示する/しないの切り替え
             else if (key == 'i') {
@@ -0,0 +1,821 @@
+#ifndef GESTUREDETECTORS_H_INCLUDE
+#define GESTUREDETECTORS_H_INCLUDE
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include <XnCppWrapper.h>
+
+#include "../../../NITE/cpp/SessionManager/GestureBus.h"
+
+// 手の座標の列からジェスチャーを検出する(NITEの検出器の代わり)
+//  座標はHandUpdateと同じ実世界の座標(mm)、時刻は秒。
+//  どの検出器も1点あたりの処理は点の数によらない(窓の出入りと合計の更新だけ)。
+//  イベントの名前と値はNITEのコールバックにそろえ、GestureEventにして出力先に渡す
+
+// 検出したイベントの出力先
+class GestureOutput
+{
+public:
+
+  GestureOutput(GestureBus::Handler handler = 0, void* cookie = 0)
+    :handler_(handler), cookie_(cookie)
+  {
+  }
+
+  void emit(const GestureEvent& event) const
+  {
+    if (handler_ != 0) {
+      handler_(event, cookie_);
+    }
+  }
+
+private:
+
+  GestureBus::Handler handler_;
+  void* cookie_;
+};
+
+// 決まった時間分の点を持つ窓
+//  位置の合計や2乗の合計などを出し入れのたびに更新して、ばらつきや当てはめた円を返す。
+//  合計は基準の点からの差で持ち、誤差がたまらないようにときどき数え直す
+class MotionWindow
+{
+public:
+
+  struct Sample
+  {
+    XnPoint3D position;
+    XnFloat   time;
+  };
+
+  MotionWindow(XnFloat duration, XnUInt32 capacity = 64)
+    :duration_(duration), samples_(capacity), head_(0), count_(0), removed_(0)
+  {
+    reset();
+  }
+
+  void reset()
+  {
+    head_ = 0;
+    count_ = 0;
+    removed_ = 0;
+    for (int i = 0; i < 3; ++i) {
+      origin_[i] = 0;
+    }
+    for (int i = 0; i < SUMS; ++i) {
+      sums_[i] = 0;
+    }
+  }
+
+  // 点を追加し、窓の時間より古い点を捨てる
+  void add(const XnPoint3D& position, XnFloat time)
+  {
+    if (count_ == 0) {
+      origin_[0] = position.X;
+      origin_[1] = position.Y;
+      origin_[2] = position.Z;
+    }
+
+    // 時刻が戻ったら(別の記録など)やり直す
+    if ((count_ != 0) && (time < newest().time)) {
+      reset();
+      add(position, time);
+      return;
+    }
+
+    if (count_ == samples_.size()) {
+      pop();
+    }
+    Sample& sample = samples_[(head_ + count_) % samples_.size()];
+    sample.position = position;
+    sample.time = time;
+    ++count_;
+    accumulate(position, 1);
+
+    while ((count_ > 1) && (time - oldest().time > duration_)) {
+      pop();
+    }
+
+    if (removed_ >= samples_.size() * 16) {
+      rebuild();
+    }
+  }
+
+  XnUInt32 size() const
+  {
+    return count_;
+  }
+
+  const Sample& oldest() const
+  {
+    return samples_[head_];
+  }
+
+  const Sample& newest() const
+  {
+    return samples_[(head_ + count_ - 1) % samples_.size()];
+  }
+
+  // 窓に入っている時間
+  XnFloat span() const
+  {
+    return (count_ < 2) ? 0 : (newest().time - oldest().time);
+  }
+
+  XnFloat duration() const
+  {
+    return duration_;
+  }
+
+  // 窓の最初から最後までの平均の速度(mm/s)
+  XnPoint3D velocity() const
+  {
+    XnPoint3D v = { 0, 0, 0 };
+    const XnFloat dt = span();
+    if (dt > 0) {
+      v.X = (newest().position.X - oldest().position.X) / dt;
+      v.Y = (newest().position.Y - oldest().position.Y) / dt;
+      v.Z = (newest().position.Z - oldest().position.Z) / dt;
+    }
+    return v;
+  }
+
+  // 位置の標準偏差(3軸の合計、mm)
+  XnFloat stdDev() const
+  {
+    if (count_ < 2) {
+      return 0;
+    }
+
+    double variance = 0;
+    for (int i = 0; i < 3; ++i) {
+      const double mean = sums_[SX + i] / count_;
+      variance += sums_[SXX + i] / count_ - mean * mean;
+    }
+    return (XnFloat)std::sqrt(std::max(0.0, variance));
+  }
+
+  // XY平面で窓の点に円を当てはめる(Kasaの方法)。点が足りないか一直線ならfalse
+  //  x^2 + y^2 + Dx + Ey + F = 0 の二乗誤差を最小にする D, E, F を正規方程式で解く
+  bool fitCircle(XnPoint3D& center, XnFloat& radius) const
+  {
+    if (count_ < 3) {
+      return false;
+    }
+
+    const double n = count_;
+    const double* s = sums_;
+    const double a[3][3] = {
+      { s[SXX], s[SXY], s[SX] },
+      { s[SXY], s[SYY], s[SY] },
+      { s[SX],  s[SY],  n     },
+    };
+    const double b[3] = {
+      -(s[SXXX] + s[SXYY]), -(s[SXXY] + s[SYYY]), -(s[SXX] + s[SYY])
+    };
+
+    // クラメルの公式
+    const double det = determinant(a);
+    if ((det == 0) || (std::fabs(det) < 1e-12 * std::fabs(s[SXX] * s[SYY] * n))) {
+      return false;
+    }
+
+    double solution[3];
+    for (int column = 0; column < 3; ++column) {
+      double m[3][3];
+      for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+          m[i][j] = (j == column) ? b[i] : a[i][j];
+        }
+      }
+      solution[column] = determinant(m) / det;
+    }
+
+    const double cx = -solution[0] / 2, cy = -solution[1] / 2;
+    const double r2 = cx * cx + cy * cy - solution[2];
+    if (r2 <= 0) {
+      return false;
+    }
+
+    center.X = (XnFloat)(cx + origin_[0]);
+    center.Y = (XnFloat)(cy + origin_[1]);
+    center.Z = (XnFloat)(sums_[SZ] / n + origin_[2]);
+    radius = (XnFloat)std::sqrt(r2);
+    return true;
+  }
+
+private:
+
+  // 合計の種類(XX, YY, ZZ は SX, SY, SZ と同じ並び)
+  enum { SX, SY, SZ, SXX, SYY, SZZ, SXY, SXXX, SYYY, SXXY, SXYY, SUMS };
+
+  static double determinant(const double m[3][3])
+  {
+    return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+           m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+           m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+  }
+
+  void accumulate(const XnPoint3D& position, double sign)
+  {
+    const double x = position.X - origin_[0];
+    const double y = position.Y - origin_[1];
+    const double z = position.Z - origin_[2];
+    const double xx = x * x, yy = y * y;
+    sums_[SX] += sign * x;
+    sums_[SY] += sign * y;
+    sums_[SZ] += sign * z;
+    sums_[SXX] += sign * xx;
+    sums_[SYY] += sign * yy;
+    sums_[SZZ] += sign * z * z;
+    sums_[SXY] += sign * x * y;
+    sums_[SXXX] += sign * xx * x;
+    sums_[SYYY] += sign * yy * y;
+    sums_[SXXY] += sign * xx * y;
+    sums_[SXYY] += sign * x * yy;
+  }
+
+  void pop()
+  {
+    accumulate(oldest().position, -1);
+    head_ = (head_ + 1) % samples_.size();
+    --count_;
+    ++removed_;
+  }
+
+  // 今の最初の点を基準にして合計を数え直す
+  void rebuild()
+  {
+    removed_ = 0;
+    origin_[0] = oldest().position.X;
+    origin_[1] = oldest().position.Y;
+    origin_[2] = oldest().position.Z;
+    for (int i = 0; i < SUMS; ++i) {
+      sums_[i] = 0;
+    }
+    for (XnUInt32 i = 0; i < count_; ++i) {
+      accumulate(samples_[(head_ + i) % samples_.size()].position, 1);
+    }
+  }
+
+  XnFloat duration_;
+  std::vector<Sample> samples_;
+  XnUInt32 head_;
+  XnUInt32 count_;
+  XnUInt32 removed_;
+
+  double origin_[3];
+  double sums_[SUMS];
+};
+
+namespace detail {
+
+  const double PI = 3.14159265358979323846;
+
+  inline XnFloat length(const XnPoint3D& v)
+  {
+    return std::sqrt(v.X * v.X + v.Y * v.Y + v.Z * v.Z);
+  }
+
+  inline XnFloat degrees(double radian)
+  {
+    return (XnFloat)(radian * 180.0 / PI);
+  }
+}
+
+// スワイプ : 窓の間にXY平面で一定以上の速さで、軸に近い向きに動いた
+//  1回出したら、速さが半分より遅くなるまで次は出さない。
+//  "Swipe:Up" などの値は (速さ m/s, 軸からの角度 度)
+class SwipeDetector
+{
+public:
+
+  struct Params
+  {
+    XnFloat duration;     // 動きを見る時間(秒)
+    XnFloat minSpeed;     // 最低の速さ(mm/s)
+    XnFloat xAngle;       // 左右のスワイプとみなす水平からの角度(度)
+    XnFloat yAngle;       // 上下のスワイプとみなす垂直からの角度(度)
+
+    Params()
+      :duration(0.35f), minSpeed(250), xAngle(25), yAngle(20)
+    {
+    }
+  };
+
+  SwipeDetector(XnUserID id, const GestureOutput* output, const Params& params = Params())
+    :id_(id), output_(output), params_(params), window_(params.duration), isArmed_(true)
+  {
+  }
+
+  void reset()
+  {
+    window_.reset();
+    isArmed_ = true;
+  }
+
+  void update(const XnPoint3D& position, XnFloat time)
+  {
+    window_.add(position, time);
+    if (window_.span() < params_.duration * 0.8f) {
+      return;
+    }
+
+    const XnPoint3D v = window_.velocity();
+    const XnFloat speed = std::sqrt(v.X * v.X + v.Y * v.Y);
+    if (speed < params_.minSpeed / 2) {
+      isArmed_ = true;
+    }
+    if (!isArmed_ || (speed < params_.minSpeed)) {
+      return;
+    }
+
+    const XnFloat fromX = detail::degrees(std::atan2(std::fabs(v.Y), std::fabs(v.X)));
+    const XnChar* name = 0;
+    XnFloat angle = 0;
+    if (fromX <= params_.xAngle) {
+      name = (v.X > 0) ? "Swipe:Right" : "Swipe:Left";
+      angle = fromX;
+    }
+    else if (90 - fromX <= params_.yAngle) {
+      name = (v.Y > 0) ? "Swipe:Up" : "Swipe:Down";
+      angle = 90 - fromX;
+    }
+    if (name == 0) {
+      return;
+    }
+
+    output_->emit(GestureEvent(name, id_).value(speed / 1000).value(angle).at(position));
+    isArmed_ = false;
+  }
+
+private:
+
+  XnUserID id_;
+  const GestureOutput* output_;
+  Params params_;
+  MotionWindow window_;
+  bool isArmed_;
+};
+
+// プッシュ : センサーの方(Zが減る向き)へ速く動いた。その後、止まったら Stabilized
+//  "Push" の値は (速さ m/s, Z軸からの角度 度)、"Stabilized" は (速さ m/s)
+class PushDetector
+{
+public:
+
+  struct Params
+  {
+    XnFloat duration;     // 動きを見る時間(秒)
+    XnFloat minSpeed;     // プッシュとみなす速さ(mm/s)
+    XnFloat maxAngle;     // -Z方向からの角度(度)
+    XnFloat stableSpeed;  // 止まったとみなす速さ(mm/s)
+
+    Params()
+      :duration(0.24f), minSpeed(330), maxAngle(30), stableSpeed(130)
+    {
+    }
+  };
+
+  PushDetector(XnUserID id, const GestureOutput* output, const Params& params = Params())
+    :id_(id), output_(output), params_(params), window_(params.duration), isPushed_(false)
+  {
+  }
+
+  void reset()
+  {
+    window_.reset();
+    isPushed_ = false;
+  }
+
+  void update(const XnPoint3D& position, XnFloat time)
+  {
+    window_.add(position, time);
+    if (window_.span() < params_.duration * 0.8f) {
+      return;
+    }
+
+    const XnPoint3D v = window_.velocity();
+    const XnFloat speed = detail::length(v);
+    if (!isPushed_) {
+      if ((speed < params_.minSpeed) || (v.Z >= 0)) {
+        return;
+      }
+
+      const XnFloat angle = detail::degrees(std::acos(-v.Z / speed));
+      if (angle <= params_.maxAngle) {
+        output_->emit(GestureEvent("Push", id_).value(speed / 1000).value(angle).at(position));
+        isPushed_ = true;
+      }
+    }
+    else if (speed < params_.stableSpeed) {
+      output_->emit(GestureEvent("Stabilized", id_).value(speed / 1000).at(position));
+      isPushed_ = false;
+      window_.reset();
+    }
+  }
+
+private:
+
+  XnUserID id_;
+  const GestureOutput* output_;
+  Params params_;
+  MotionWindow window_;
+  bool isPushed_;
+};
+
+// 静止 : 窓の間の位置のばらつきが小さい。動き出したら NotSteady
+//  "Steady" と "NotSteady" の値は (位置の標準偏差 mm)
+class SteadyDetector
+{
+public:
+
+  struct Params
+  {
+    XnFloat duration;     // 静止を見る時間(秒)
+    XnFloat maxStdDev;    // 静止とみなすばらつき(mm)
+    XnFloat moveStdDev;   // 動き出したとみなすばらつき(mm)
+
+    Params()
+      :duration(0.3f), maxStdDev(3), moveStdDev(8)
+    {
+    }
+  };
+
+  SteadyDetector(XnUserID id, const GestureOutput* output, const Params& params = Params())
+    :id_(id), output_(output), params_(params), window_(params.duration), isSteady_(false)
+  {
+  }
+
+  void reset()
+  {
+    window_.reset();
+    isSteady_ = false;
+  }
+
+  void update(const XnPoint3D& position, XnFloat time)
+  {
+    window_.add(position, time);
+    if (window_.span() < params_.duration * 0.8f) {
+      return;
+    }
+
+    const XnFloat stdDev = window_.stdDev();
+    if (!isSteady_ && (stdDev <= params_.maxStdDev)) {
+      output_->emit(GestureEvent("Steady", id_).value(stdDev).at(position));
+      isSteady_ = true;
+    }
+    else if (isSteady_ && (stdDev > params_.moveStdDev)) {
+      output_->emit(GestureEvent("NotSteady", id_).value(stdDev).at(position));
+      isSteady_ = false;
+    }
+  }
+
+private:
+
+  XnUserID id_;
+  const GestureOutput* output_;
+  Params params_;
+  MotionWindow window_;
+  bool isSteady_;
+};
+
+// ウェーブ : 左右の折り返しが、決まった間隔以内に決まった回数続いた
+//  折り返しは、その向きの一番端から一定以上戻ったところで数える。
+//  折り返しの間に上下にも大きく動いていたら(円など)数え直す
+class WaveDetector
+{
+public:
+
+  struct Params
+  {
+    XnFloat minAmplitude;   // 折り返しとみなす戻りの大きさ(mm)
+    XnFloat maxInterval;    // 折り返しの間隔(秒)
+    XnUInt32 flips;         // ウェーブとみなす折り返しの回数
+    XnFloat maxVertical;    // 折り返しの間の上下の動きの、左右の動きに対する割合
+
+    Params()
+      :minAmplitude(40), maxInterval(0.8f), flips(4), maxVertical(0.5f)
+    {
+    }
+  };
+
+  WaveDetector(XnUserID id, const GestureOutput* output, const Params& params = Params())
+    :id_(id), output_(output), params_(params)
+  {
+    reset();
+  }
+
+  void reset()
+  {
+    isStarted_ = false;
+    direction_ = 0;
+    extreme_ = 0;
+    lastFlip_ = 0;
+    flips_ = 0;
+    flipX_ = top_ = bottom_ = 0;
+  }
+
+  void update(const XnPoint3D& position, XnFloat time)
+  {
+    const XnFloat x = position.X;
+    if (!isStarted_) {
+      isStarted_ = true;
+      extreme_ = x;
+      lastFlip_ = time;
+      startStroke(position);
+      return;
+    }
+    top_ = std::max(top_, position.Y);
+    bottom_ = std::min(bottom_, position.Y);
+
+    // 折り返しの間が空いたら数え直す
+    if ((flips_ != 0) && (time - lastFlip_ > params_.maxInterval)) {
+      flips_ = 0;
+    }
+
+    if (direction_ == 0) {
+      // 最初の向きが決まるまで
+      if (std::fabs(x - extreme_) >= params_.minAmplitude) {
+        direction_ = (x > extreme_) ? 1 : -1;
+        startStroke(position);
+        extreme_ = x;
+        lastFlip_ = time;
+      }
+    }
+    else if ((x - extreme_) * direction_ > 0) {
+      extreme_ = x;
+    }
+    else if ((extreme_ - x) * direction_ >= params_.minAmplitude) {
+      const XnFloat horizontal = std::fabs(extreme_ - flipX_);
+      if ((time - lastFlip_ > params_.maxInterval) ||
+          (top_ - bottom_ > horizontal * params_.maxVertical)) {
+        flips_ = 0;
+      }
+      direction_ = -direction_;
+      lastFlip_ = time;
+      startStroke(position);
+      extreme_ = x;
+
+      if (++flips_ >= params_.flips) {
+        output_->emit(GestureEvent("Wave", id_).at(position));
+        flips_ = 0;
+      }
+    }
+  }
+
+private:
+
+  // 折り返しの間の上下の範囲を測り直す
+  void startStroke(const XnPoint3D& position)
+  {
+    flipX_ = extreme_;
+    top_ = bottom_ = position.Y;
+  }
+
+  XnUserID id_;
+  const GestureOutput* output_;
+  Params params_;
+
+  bool isStarted_;
+  int direction_;       // 今動いている向き(1:+X, -1:-X, 0:まだ決まっていない)
+  XnFloat extreme_;     // 今の向きで一番端の位置
+  XnFloat lastFlip_;
+  XnUInt32 flips_;
+
+  XnFloat flipX_;       // 前の向きの端(今の向きの動きの起点)
+  XnFloat top_;         // 前の折り返しからの上下の範囲
+  XnFloat bottom_;
+};
+
+// 円 : 窓の点に円を当てはめ(Kasaの方法、合計の出し入れで更新)、中心の周りに回った角度を積算する。
+//  1周するごとに "Circle" (周回数, 確信があるか, 半径 mm)、中心は位置に入れる。
+//  回っている途中で円でなくなったら "NoCircle" (最後の周回数, 理由)
+class CircleDetector
+{
+public:
+
+  // NoCircle の理由(XnVCircleDetector::XnVNoCircleReason にそろえる)
+  enum NoCircleReason
+  {
+    NO_CIRCLE_ILLEGAL,      // 逆に回り始めた
+    NO_CIRCLE_NO_INPUT,     // 円にならない(止まった、まっすぐ動いた)
+    NO_CIRCLE_BAD_POINTS    // 円からのずれが大きい
+  };
+
+  struct Params
+  {
+    XnFloat duration;       // 円を当てはめる時間(秒)
+    XnFloat minRadius;      // 半径の範囲(mm)
+    XnFloat maxRadius;
+    XnFloat maxError;       // 半径に対するずれの割合の上限
+    XnFloat confidentError; // 確信があるとみなすずれの割合
+
+    Params()
+      :duration(1.0f), minRadius(40), maxRadius(400), maxError(0.35f), confidentError(0.15f)
+    {
+    }
+  };
+
+  CircleDetector(XnUserID id, const GestureOutput* output, const Params& params = Params())
+    :id_(id), output_(output), params_(params), window_(params.duration)
+  {
+    reset();
+  }
+
+  void reset()
+  {
+    window_.reset();
+    angle_ = 0;
+    peak_ = 0;
+    progress_ = 0;
+    circles_ = 0;
+    error_ = 0;
+    hasPrevious_ = false;
+  }
+
+  void update(const XnPoint3D& position, XnFloat time)
+  {
+    window_.add(position, time);
+    if (window_.span() < params_.duration * 0.5f) {
+      return;
+    }
+
+    XnPoint3D center;
+    XnFloat radius;
+    if (!window_.fitCircle(center, radius) ||
+        (radius < params_.minRadius) || (radius > params_.maxRadius)) {
+      lose(NO_CIRCLE_NO_INPUT);
+      hasPrevious_ = false;
+      return;
+    }
+
+    // 円からのずれ(半径に対する割合)をならす
+    const XnFloat dx = position.X - center.X, dy = position.Y - center.Y;
+    const XnFloat distance = std::sqrt(dx * dx + dy * dy);
+    error_ += (std::fabs(distance - radius) / radius - error_) * 0.2f;
+    if (error_ > params_.maxError) {
+      lose(NO_CIRCLE_BAD_POINTS);
+      hasPrevious_ = false;
+      return;
+    }
+
+    // 前の点から中心の周りに回った角度
+    if (hasPrevious_) {
+      const double px = previous_.X - center.X, py = previous_.Y - center.Y;
+      const double delta = std::atan2(px * dy - py * dx, px * dx + py * dy);
+      angle_ += delta;
+
+      // 一番回ったところから大きく戻ったら逆回り、しばらく進まなければ止まった
+      if (std::fabs(angle_) > peak_) {
+        peak_ = std::fabs(angle_);
+        progress_ = time;
+      }
+      else if (std::fabs(angle_) < peak_ - detail::PI / 2) {
+        lose(NO_CIRCLE_ILLEGAL);
+      }
+      else if (time - progress_ > params_.duration / 2) {
+        lose(NO_CIRCLE_NO_INPUT);
+      }
+
+      const XnUInt32 circles = (XnUInt32)(std::fabs(angle_) / (2 * detail::PI));
+      if (circles > circles_) {
+        circles_ = circles;
+        const bool isConfident = error_ <= params_.confidentError;
+        output_->emit(GestureEvent("Circle", id_).value(times()).value(isConfident).
+          value(radius).at(center));
+      }
+    }
+    previous_ = position;
+    hasPrevious_ = true;
+  }
+
+private:
+
+  // 積算した周回数(符号は回る向き)
+  XnFloat times() const
+  {
+    return (XnFloat)(angle_ / (2 * detail::PI));
+  }
+
+  // 1周以上回っていたら NoCircle を出して、角度の積算をやめる
+  void lose(NoCircleReason reason)
+  {
+    if (circles_ != 0) {
+      output_->emit(GestureEvent("NoCircle", id_).value(times()).value((XnFloat)reason));
+    }
+    angle_ = 0;
+    peak_ = 0;
+    circles_ = 0;
+  }
+
+  XnUserID id_;
+  const GestureOutput* output_;
+  Params params_;
+  MotionWindow window_;
+
+  double angle_;          // 積算した角度(ラジアン、符号は回る向き)
+  double peak_;           // 積算した角度の大きさの最大
+  XnFloat progress_;      // peak_が増えた時刻
+  XnUInt32 circles_;      // Circle を出した周回数
+  XnFloat error_;
+  XnPoint3D previous_;
+  bool hasPrevious_;
+};
+
+// 手ごとの検出器
+//  HandUpdateの座標をそのまま渡す。手のIDごとにすべての検出器を持つ
+class HandGestures
+{
+public:
+
+  HandGestures(const GestureOutput& output)
+    :output_(output), samples_(0)
+  {
+  }
+
+  ~HandGestures()
+  {
+    clear();
+  }
+
+  void update(XnUserID id, const XnPoint3D& position, XnFloat time)
+  {
+    Detectors* detectors = find(id);
+    if (detectors == 0) {
+      detectors = new Detectors(id, &output_);
+      hands_.push_back(detectors);
+    }
+
+    detectors->swipe.update(position, time);
+    detectors->circle.update(position, time);
+    detectors->push.update(position, time);
+    detectors->steady.update(position, time);
+    detectors->wave.update(position, time);
+    ++samples_;
+  }
+
+  void remove(XnUserID id)
+  {
+    for (std::vector<Detectors*>::iterator it = hands_.begin(); it != hands_.end(); ++it) {
+      if ((*it)->id == id) {
+        delete *it;
+        hands_.erase(it);
+        return;
+      }
+    }
+  }
+
+  void clear()
+  {
+    for (std::vector<Detectors*>::iterator it = hands_.begin(); it != hands_.end(); ++it) {
+      delete *it;
+    }
+    hands_.clear();
+  }
+
+  // これまでに渡された点の数
+  XnUInt64 samples() const
+  {
+    return samples_;
+  }
+
+private:
+
+  HandGestures(const HandGestures&);
+  HandGestures& operator=(const HandGestures&);
+
+  struct Detectors
+  {
+    XnUserID id;
+    SwipeDetector swipe;
+    CircleDetector circle;
+    PushDetector push;
+    SteadyDetector steady;
+    WaveDetector wave;
+
+    Detectors(XnUserID handId, const GestureOutput* output)
+      :id(handId), swipe(handId, output), circle(handId, output), push(handId, output),
+       steady(handId, output), wave(handId, output)
+    {
+    }
+  };
+
+  Detectors* find(XnUserID id)
+  {
+    for (std::vector<Detectors*>::iterator it = hands_.begin(); it != hands_.end(); ++it) {
+      if ((*it)->id == id) {
+        return *it;
+      }
+    }
+    return 0;
+  }
+
+  GestureOutput output_;
+  std::vector<Detectors*> hands_;
+  XnUInt64 samples_;
+};
+
+#endif // #ifndef GESTUREDETECTORS_H_INCLUDE
@@ -0,0 +1,291 @@
+#ifndef HANDTRAILS_H_INCLUDE
+#define HANDTRAILS_H_INCLUDE
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include <XnCppWrapper.h>
+#include <XnOS.h>
+
+// 軌跡の1点
+struct TrailPoint
+{
+  XnPoint3D position;     // 実世界の座標
+  XnPoint3D projective;   // 画面の座標(追加したときに1回だけ変換する)
+  XnFloat   time;
+};
+
+// 手ごとの軌跡
+//  手ごとに決まった点数のリングバッファを持ち、古い点から上書きする。
+//  手のIDから軌跡への対応は小さなオープンアドレスの表で引く。
+//  コールバックのスレッドで追加し、描画のスレッドでsnapshotを取って読む
+class HandTrails
+{
+public:
+
+  // 描画用の写し(手ごとに古い点から並ぶ)
+  class Snapshot
+  {
+  public:
+
+    XnUInt32 hands() const
+    {
+      return (XnUInt32)ids_.size();
+    }
+
+    XnUserID id(XnUInt32 hand) const
+    {
+      return ids_[hand];
+    }
+
+    XnUInt32 size(XnUInt32 hand) const
+    {
+      return begin_[hand + 1] - begin_[hand];
+    }
+
+    const TrailPoint& point(XnUInt32 hand, XnUInt32 index) const
+    {
+      return points_[begin_[hand] + index];
+    }
+
+    // 最後に追加した点
+    const TrailPoint& last(XnUInt32 hand) const
+    {
+      return points_[begin_[hand + 1] - 1];
+    }
+
+  private:
+
+    friend class HandTrails;
+
+    std::vector<XnUserID> ids_;
+    std::vector<XnUInt32> begin_;     // 手ごとの最初の点の位置(hands + 1個)
+    std::vector<TrailPoint> points_;
+  };
+
+  HandTrails(XnUInt32 maxHands = 8, XnUInt32 capacity = 30)
+    :capacity_(capacity), depth_(0), dropped_(0)
+  {
+    XnStatus rc = xnOSCreateCriticalSection(&lock_);
+    if (rc != XN_STATUS_OK) {
+      throw std::runtime_error(xnGetStatusString(rc));
+    }
+
+    // 表は手の数の2倍以上の2のべき乗にする
+    XnUInt32 tableSize = 4;
+    while (tableSize < maxHands * 2) {
+      tableSize *= 2;
+    }
+    Entry empty = { 0, 0 };
+    table_.assign(tableSize, empty);
+
+    rings_.resize(maxHands);
+    points_.resize(maxHands * capacity);
+    for (XnUInt32 i = maxHands; i > 0; --i) {
+      free_.push_back(i - 1);
+    }
+  }
+
+  ~HandTrails()
+  {
+    xnOSCloseCriticalSection(&lock_);
+  }
+
+  // 画面座標への変換に使うデプス(0なら画面座標は実世界の座標のまま)
+  void setDepth(xn::DepthGenerator* depth)
+  {
+    depth_ = depth;
+  }
+
+  // 点を追加する。手の数が上限を超えていれば追加しない
+  bool add(XnUserID id, const XnPoint3D& position, XnFloat time)
+  {
+    TrailPoint point;
+    point.position = position;
+    point.projective = position;
+    point.time = time;
+    if (depth_ != 0) {
+      depth_->ConvertRealWorldToProjective(1, &point.position, &point.projective);
+    }
+
+    xnOSEnterCriticalSection(&lock_);
+
+    const XnInt32 slot = find(id, true);
+    if (slot >= 0) {
+      const XnUInt32 index = table_[slot].ring;
+      Ring& ring = rings_[index];
+      points_[index * capacity_ + (ring.head + ring.count) % capacity_] = point;
+      if (ring.count < capacity_) {
+        ++ring.count;
+      }
+      else {
+        ring.head = (ring.head + 1) % capacity_;
+      }
+    }
+    else {
+      ++dropped_;
+    }
+
+    xnOSLeaveCriticalSection(&lock_);
+
+    return slot >= 0;
+  }
+
+  // 手の軌跡を消す。軌跡がなければfalse
+  bool remove(XnUserID id)
+  {
+    xnOSEnterCriticalSection(&lock_);
+
+    const XnInt32 slot = find(id, false);
+    if (slot >= 0) {
+      free_.push_back(table_[slot].ring);
+
+      // 後ろの項目を詰めて、探索が途切れないようにする
+      XnUInt32 hole = slot;
+      for (XnUInt32 i = next(slot); table_[i].id != 0; i = next(i)) {
+        const XnUInt32 home = hash(table_[i].id);
+        if (((i - home) & mask()) >= ((i - hole) & mask())) {
+          table_[hole] = table_[i];
+          hole = i;
+        }
+      }
+      table_[hole].id = 0;
+    }
+
+    xnOSLeaveCriticalSection(&lock_);
+
+    return slot >= 0;
+  }
+
+  bool contains(XnUserID id) const
+  {
+    xnOSEnterCriticalSection(&lock_);
+    bool isFound = const_cast<HandTrails*>(this)->find(id, false) >= 0;
+    xnOSLeaveCriticalSection(&lock_);
+    return isFound;
+  }
+
+  void clear()
+  {
+    xnOSEnterCriticalSection(&lock_);
+    free_.clear();
+    for (XnUInt32 i = (XnUInt32)rings_.size(); i > 0; --i) {
+      free_.push_back(i - 1);
+    }
+    for (std::vector<Entry>::iterator it = table_.begin(); it != table_.end(); ++it) {
+      it->id = 0;
+    }
+    xnOSLeaveCriticalSection(&lock_);
+  }
+
+  // 今の軌跡を写す(ロックするのは写す間だけ)
+  void snapshot(Snapshot& out) const
+  {
+    out.ids_.clear();
+    out.begin_.clear();
+    out.points_.clear();
+
+    xnOSEnterCriticalSection(&lock_);
+
+    for (std::vector<Entry>::const_iterator it = table_.begin(); it != table_.end(); ++it) {
+      if (it->id == 0) {
+        continue;
+      }
+
+      const Ring& ring = rings_[it->ring];
+      const TrailPoint* points = &points_[it->ring * capacity_];
+      out.ids_.push_back(it->id);
+      out.begin_.push_back((XnUInt32)out.points_.size());
+
+      // リングの折り返しで2回に分けてコピーする
+      const XnUInt32 first = std::min(ring.count, capacity_ - ring.head);
+      out.points_.insert(out.points_.end(), points + ring.head, points + ring.head + first);
+      out.points_.insert(out.points_.end(), points, points + (ring.count - first));
+    }
+    out.begin_.push_back((XnUInt32)out.points_.size());
+
+    xnOSLeaveCriticalSection(&lock_);
+  }
+
+  XnUInt32 capacity() const
+  {
+    return capacity_;
+  }
+
+  // 手の数が上限を超えて追加できなかった点の数
+  XnUInt32 dropped() const
+  {
+    return dropped_;
+  }
+
+private:
+
+  HandTrails(const HandTrails&);
+  HandTrails& operator=(const HandTrails&);
+
+  // 表の項目(idが0なら空き)
+  struct Entry
+  {
+    XnUserID  id;
+    XnUInt32  ring;
+  };
+
+  // 軌跡のリングバッファ
+  struct Ring
+  {
+    XnUInt32  head;     // 一番古い点
+    XnUInt32  count;
+  };
+
+  XnUInt32 mask() const
+  {
+    return (XnUInt32)table_.size() - 1;
+  }
+
+  XnUInt32 hash(XnUserID id) const
+  {
+    return (id * 2654435761u) & mask();
+  }
+
+  XnUInt32 next(XnUInt32 slot) const
+  {
+    return (slot + 1) & mask();
+  }
+
+  // IDの表の位置を探す(isCreateなら、なければ作る)。なければ-1
+  XnInt32 find(XnUserID id, bool isCreate)
+  {
+    XnUInt32 slot = hash(id);
+    for (; table_[slot].id != 0; slot = next(slot)) {
+      if (table_[slot].id == id) {
+        return (XnInt32)slot;
+      }
+    }
+
+    if (!isCreate || free_.empty()) {
+      return -1;
+    }
+
+    const XnUInt32 index = free_.back();
+    free_.pop_back();
+    table_[slot].id = id;
+    table_[slot].ring = index;
+    rings_[index].head = 0;
+    rings_[index].count = 0;
+    return (XnInt32)slot;
+  }
+
+  XnUInt32 capacity_;
+  xn::DepthGenerator* depth_;
+  XnUInt32 dropped_;
+
+  std::vector<Entry> table_;
+  std::vector<Ring> rings_;
+  std::vector<TrailPoint> points_;
+  std::vector<XnUInt32> free_;
+
+  mutable XN_CRITICAL_SECTION_HANDLE lock_;
+};
+
+#endif // #ifndef HANDTRAILS_H_INCLUDE
@@ -1,5 +1,8 @@
 #include <iostream>
 #include <stdexcept>
+#include <string>
+#include <vector>
+#include <fstream>
 
 #include <map>
 #include <list>
@@ -8,6 +11,11 @@
 #include <opencv/highgui.h>
 
 #include <XnCppWrapper.h>
+#include <XnOS.h>
+
+#include "HandTrails.h"
+#include "../../../NITE/cpp/SessionManager/GestureBus.h"
+#include "GestureDetectors.h"
 
 // 設定ファイルのパス(環境に合わせて変更してください)
 #if (XN_PLATFORM == XN_PLATFORM_WIN32)
@@ -20,7 +28,36 @@ const char* CONFIG_XML_PATH = "../../../Data/SamplesConfig.xml";
 const char* CONFIG_XML_PATH = "Data/SamplesConfig.xml";
 #endif
 
-typedef std::map<int, std::list<XnPoint3D> > hand_point;
+// 描画の最大点数
+const int MAX_POINT = 30;
+
+// コールバックに渡す情報
+struct HandsContext
+{
+  xn::HandsGenerator* hands;
+  HandTrails* trails;
+  GestureBus* bus;
+  HandGestures* gestures;
+  std::ofstream* track;     // 手の座標の記録先(記録していなければ0)
+};
+
+// 検出したジェスチャーをバスに積む
+void publishGesture(const GestureEvent& event, void* cookie)
+{
+  ((GestureBus*)cookie)->publish(event);
+}
+
+// ジェスチャー名を付けたイベント("GestureRecognized:Click" など)
+GestureEvent gestureEvent(const XnChar* type, const XnChar* strGesture)
+{
+  GestureEvent event(type);
+  const size_t length = strlen(event.name);
+  if (length + 1 < GestureEvent::MAX_NAME) {
+    event.name[length] = ':';
+    strncpy(event.name + length + 1, strGesture, GestureEvent::MAX_NAME - length - 2);
+  }
+  return event;
+}
 
 // ジェスチャーの検出中
 void XN_CALLBACK_TYPE GestureProgress(xn::GestureGenerator& gesture,
@@ -29,7 +66,9 @@ void XN_CALLBACK_TYPE GestureProgress(xn::GestureGenerator& gesture,
   XnFloat fProgress,
   void* pCookie)
 {
-  std::cout << "GestureProgress:" << strGesture << ", " << fProgress << std::endl;
+  HandsContext& context = *(HandsContext*)pCookie;
+  context.bus->publish(gestureEvent("GestureProgress", strGesture).value(fProgress).
+    at(*pPosition));
 }
 
 // ジェスチャーの検出
@@ -39,10 +78,11 @@ void XN_CALLBACK_TYPE GestureRecognized(xn::GestureGenerator& gesture,
   const XnPoint3D* pEndPosition,
   void* pCookie)
 {
-  std::cout << "GestureRecognized:" << strGesture << std::endl;
+  HandsContext& context = *(HandsContext*)pCookie;
+  context.bus->publish(gestureEvent("GestureRecognized", strGesture).at(*pEndPosition));
 
-  xn::HandsGenerator* hands = (xn::HandsGenerator*)pCookie;
-  hands->StartTracking(*pEndPosition);
+  // トラッキングの開始は次のフレームに間に合うよう、ここで行う
+  context.hands->StartTracking(*pEndPosition);
 }
 
 // 手の検出開始
@@ -52,7 +92,8 @@ void XN_CALLBACK_TYPE HandCreate(xn::HandsGenerator& hands,
   XnFloat fTime,
   void* pCookie)
 {
-  std::cout << "HandCreate:" << nId << std::endl;
+  HandsContext& context = *(HandsContext*)pCookie;
+  context.bus->publish(GestureEvent("HandCreate", nId).at(*pPosition));
 }
 
 // 手の検出データの更新
@@ -63,9 +104,16 @@ void XN_CALLBACK_TYPE HandUpdate(xn::HandsGenerator& hands,
   void* pCookie)
 {
   //    std::cout << "HandUpdate:" << nId << std::endl;
-  // 現在の座標をキューに追加
-  hand_point& handPoint = *(hand_point*)pCookie;
-  handPoint[nId].push_back(*pPosition);
+  // 現在の座標を軌跡に追加
+  HandsContext& context = *(HandsContext*)pCookie;
+  context.trails->add(nId, *pPosition, fTime);
+
+  // ジェスチャーの検出と、座標の記録
+  context.gestures->update(nId, *pPosition, fTime);
+  if (context.track != 0) {
+    *context.track << nId << " " << fTime << " " <<
+      pPosition->X << " " << pPosition->Y << " " << pPosition->Z << "\n";
+  }
 }
 
 // 手の検出終了
@@ -76,21 +124,123 @@ void XN_CALLBACK_TYPE HandDestroy(xn::HandsGenerator& hands,
 {
   // 1.1.0.41では、StopTrackingを呼ぶとHandDestroyが呼ばれるので、
   // 追跡しているときのみ、トラッキングの停止をするようにした
-  hand_point& handPoint = *(hand_point*)pCookie;
-  if ( handPoint[nId].size() != 0 ) {
-    std::cout << "HandDestroy:" << nId << std::endl;
-
-    // キューの初期化
-    handPoint[nId] = hand_point::mapped_type();
+  HandsContext& context = *(HandsContext*)pCookie;
+  context.gestures->remove(nId);
+  if (context.trails->remove(nId)) {
+    context.bus->publish(GestureEvent("HandDestroy", nId));
 
     // トラッキングの停止
     hands.StopTracking(nId);
   }
 }
 
+// 4つの手の座標を更新し続けて、軌跡の追加と描画用の取り出しの速度を計測する
+//  (以前の std::map<int, std::list> で末尾に追加、先頭を削除する方法と比べる)
+void benchmark()
+{
+  const int HANDS = 4;
+  const int UPDATES = 200000;
+  const int UPDATES_PER_FRAME = HANDS;
+
+  XnPoint3D position = { 0, 0, 1000 };
+
+  std::map<int, std::list<XnPoint3D> > lists;
+  XnUInt64 begin, end;
+  double sum = 0;
+  xnOSGetHighResTimeStamp(&begin);
+  for (int i = 0; i < UPDATES; ++i) {
+    position.X = (XnFloat)i;
+    lists[i % HANDS + 1].push_back(position);
+    if ((i % UPDATES_PER_FRAME) == 0) {
+      for (std::map<int, std::list<XnPoint3D> >::iterator it = lists.begin();
+        it != lists.end(); ++it) {
+          for (std::list<XnPoint3D>::iterator pt = it->second.begin();
+            pt != it->second.end(); ++pt) {
+              sum += pt->X;
+          }
+          if (it->second.size() >= MAX_POINT) {
+            it->second.erase(it->second.begin());
+          }
+      }
+    }
+  }
+  xnOSGetHighResTimeStamp(&end);
+  double listTime = (end - begin) * 1000.0 / UPDATES;
+
+  HandTrails trails(HANDS, MAX_POINT);
+  HandTrails::Snapshot snapshot;
+  double trailSum = 0;
+  xnOSGetHighResTimeStamp(&begin);
+  for (int i = 0; i < UPDATES; ++i) {
+    position.X = (XnFloat)i;
+    trails.add(i % HANDS + 1, position, 0);
+    if ((i % UPDATES_PER_FRAME) == 0) {
+      trails.snapshot(snapshot);
+      for (XnUInt32 h = 0; h < snapshot.hands(); ++h) {
+        for (XnUInt32 p = 0; p < snapshot.size(h); ++p) {
+          trailSum += snapshot.point(h, p).position.X;
+        }
+      }
+    }
+  }
+  xnOSGetHighResTimeStamp(&end);
+  double trailTime = (end - begin) * 1000.0 / UPDATES;
+
+  // 以前は描画のたびにすべての点を画面座標に変換していたが、ここには含めていない
+  std::cout << "map<list> : " << listTime << " ns/update (" << sum << ")" << std::endl;
+  std::cout << "HandTrails: " << trailTime << " ns/update (" << trailSum << ")" << std::endl;
+
+  // ジェスチャーの検出(4つの手が円を描き続ける)
+  HandGestures gestures((GestureOutput()));
+  xnOSGetHighResTimeStamp(&begin);
+  for (int i = 0; i < UPDATES; ++i) {
+    const XnFloat time = (i / HANDS) / 30.0f;
+    position.X = 150 * std::cos(time * 6.28f);
+    position.Y = 150 * std::sin(time * 6.28f);
+    gestures.update(i % HANDS + 1, position, time);
+  }
+  xnOSGetHighResTimeStamp(&end);
+  std::cout << "HandGestures: " << ((end - begin) * 1000.0 / UPDATES) << " ns/update" << std::endl;
+}
+
+// 記録した手の座標(1行に "ID 時刻 X Y Z")でジェスチャーを検出する
+void detect(const char* path)
+{
+  std::ifstream track(path);
+  if (!track) {
+    throw std::runtime_error(std::string("error : cannot open ") + path);
+  }
+
+  HandGestures gestures(GestureOutput(&GestureBus::print));
+  XnUserID id;
+  XnFloat time;
+  XnPoint3D position;
+  while (track >> id >> time >> position.X >> position.Y >> position.Z) {
+    gestures.update(id, position, time);
+  }
+  std::cout << gestures.samples() << " samples" << std::endl;
+}
+
 
 int main (int argc, char * argv[])
 {
+  // 速度計測モード
+  if ((argc > 1) && (std::string(argv[1]) == "bench")) {
+    benchmark();
+    return 0;
+  }
+
+  // 記録した座標からジェスチャーを検出するモード
+  if ((argc > 2) && (std::string(argv[1]) == "detect")) {
+    try {
+      detect(argv[2]);
+    }
+    catch (std::exception& ex) {
+      std::cout << ex.what() << std::endl;
+    }
+    return 0;
+  }
+
   IplImage* camera = 0;
 
   try {
@@ -132,18 +282,30 @@ int main (int argc, char * argv[])
       throw std::runtime_error(xnGetStatusString(rc));
     }
 
+    // コールバックはイベントを積むだけにして、表示は配信スレッドで行う
+    GestureBus bus;
+    bus.subscribe(&GestureBus::print);
+    bus.start();
+
+    // 手の軌跡(画面座標は点を追加するときに変換しておく)
+    HandTrails trails(8, MAX_POINT);
+    trails.setDepth(&depth);
+    // 手の座標から、NITEを使わずにジェスチャーを検出する
+    HandGestures gestures(GestureOutput(&publishGesture, &bus));
+    std::ofstream track;
+    HandsContext handsContext = { &hands, &trails, &bus, &gestures, 0 };
+
     // ジェスチャー用のコールバックを登録する
     XnCallbackHandle gestureCallback, handsCallback, gestureChangeCallback;
     rc = gesture.RegisterGestureCallbacks(GestureRecognized, GestureProgress,
-      &hands, gestureCallback);
+      &handsContext, gestureCallback);
     if (rc != XN_STATUS_OK) {
       throw std::runtime_error(xnGetStatusString(rc));
     }
 
     // ハンドトラッキング用のコールバックを登録する
-    hand_point handPoint;
     rc =hands.RegisterHandCallbacks(HandCreate, HandUpdate, HandDestroy,
-      &handPoint, handsCallback);
+      &handsContext, handsCallback);
     if (rc != XN_STATUS_OK) {
       throw std::runtime_error(xnGetStatusString(rc));
     }
@@ -160,6 +322,12 @@ int main (int argc, char * argv[])
       throw std::runtime_error("error : cvCreateImage");
     }
 
+    // 描画用の軌跡
+    HandTrails::Snapshot snapshot;
+    std::vector<CvPoint> polyPoints;
+    std::vector<CvPoint*> polyLines;
+    std::vector<int> polyCounts;
+
     // メインループ
     while (1) {
       // カメライメージの更新を待ち、画像データを取得する
@@ -172,27 +340,28 @@ int main (int argc, char * argv[])
       memcpy(camera->imageData, imageMD.RGB24Data(), camera->imageSize);
 
       // 座標を描画
-      for (hand_point::iterator user = handPoint.begin();
-        user != handPoint.end(); ++user ){
-          for (hand_point::mapped_type::iterator it = user->second.begin();
-            it != user->second.end();  ) {
-              XnPoint3D pt;
-              depth.ConvertRealWorldToProjective(1, &*it, &pt);
-              CvPoint pt1 = cvPoint(pt.X, pt.Y);
-              CvPoint pt2 = cvPoint(pt.X, pt.Y);
-              if (++it != user->second.end()) {
-                depth.ConvertRealWorldToProjective(1, &*it, &pt);
-                pt2 = cvPoint(pt.X, pt.Y);
-              }
-
-              ::cvLine(camera, pt1, pt2, CV_RGB(255, 0, 0), 5);
-          }
-
-          // 描画の最大点数は30とする
-          const int MAX_POINT = 30;
-          if (user->second.size() >= MAX_POINT) {
-            user->second.erase(user->second.begin());
-          }
+      //  すべての手の軌跡を1回の cvPolyLine で描く
+      trails.snapshot(snapshot);
+      polyPoints.resize(MAX_POINT * snapshot.hands());
+      polyLines.clear();
+      polyCounts.clear();
+      for (XnUInt32 hand = 0; hand < snapshot.hands(); ++hand) {
+        const XnUInt32 count = snapshot.size(hand);
+        if (count == 0) {
+          continue;
+        }
+
+        CvPoint* points = &polyPoints[hand * MAX_POINT];
+        for (XnUInt32 i = 0; i < count; ++i) {
+          const XnPoint3D& pt = snapshot.point(hand, i).projective;
+          points[i] = cvPoint(pt.X, pt.Y);
+        }
+        polyLines.push_back(points);
+        polyCounts.push_back(count);
+      }
+      if (!polyLines.empty()) {
+        ::cvPolyLine(camera, &polyLines[0], &polyCounts[0], (int)polyLines.size(), 0,
+          CV_RGB(255, 0, 0), 5);
       }
 
       //  Kinectからの入力がRGBであるため、BGRに変換して表示する
@@ -204,7 +373,24 @@ int main (int argc, char * argv[])
       if (key == 'q') {
         break;
       }
+      // 手の座標の記録を開始/終了する
+      else if (key == 'r') {
+        if (handsContext.track == 0) {
+          track.open("hands.txt");
+          handsContext.track = &track;
+          std::cout << "record start : hands.txt" << std::endl;
+        }
+        else {
+          handsContext.track = 0;
+          track.close();
+          std::cout << "record end" << std::endl;
+        }
+      }
     }
+
+    // 配信を止めて、キューの統計を表示する
+    bus.stop();
+    bus.printStats(std::cout);
   }
   catch (std::exception& ex) {
     std::cout << ex.what() << std::endl;
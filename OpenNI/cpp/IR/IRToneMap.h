@@ -0,0 +1,195 @@
+#ifndef IRTONEMAP_H_INCLUDE
+#define IRTONEMAP_H_INCLUDE
+
+#include <vector>
+#include <algorithm>
+
+#include <XnCppWrapper.h>
+
+// SSE2が使える環境ではSIMDで変換する
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define IRTONEMAP_USE_SSE2
+#endif
+
+// IR(16bit、実際は10bit程度)を表示用の8bitにする
+//  ヒストグラムの下と上の何%かを黒と白にして、その間を256階調に割り当てる(自動露出)。
+//  ヒストグラムは毎フレーム全部の行ではなく、rowStep行ごとに開始行をずらしながら数え、
+//  範囲はフレーム間でなめらかに追いかける
+class IRToneMap
+{
+public:
+
+  struct Params
+  {
+    Params()
+      :low(0.01f), high(0.99f), adaptation(0.25f), rowStep(4), minRange(16)
+    {
+    }
+
+    float low;            // 黒にする割合
+    float high;           // これより明るい割合を白にする
+    float adaptation;     // 1フレームで範囲をどれだけ新しい値に近づけるか(1で即座)
+    XnUInt32 rowStep;     // 1フレームで数える行の間隔
+    XnUInt32 minRange;    // 暗いシーンでノイズを強調しすぎないよう、範囲の最小値
+  };
+
+  enum
+  {
+    BINS = 1024           // IRの値の上限(これより大きい値は最後のビンに入れる)
+  };
+
+  IRToneMap(const Params& params = Params())
+    :params_(params), histogram_(BINS), frame_(0),
+     lowValue_(0), highValue_(BINS - 1), low_(0), range_(BINS - 1)
+  {
+    updateScale();
+  }
+
+  // フレームのヒストグラムを数えて、範囲を更新する
+  void update(const XnIRPixel* src, XnUInt32 xRes, XnUInt32 yRes)
+  {
+    std::fill(histogram_.begin(), histogram_.end(), 0);
+
+    const XnUInt32 step = std::max(params_.rowStep, (XnUInt32)1);
+    XnUInt32 count = 0;
+    for (XnUInt32 y = frame_ % step; y < yRes; y += step) {
+      const XnIRPixel* row = src + y * xRes;
+      for (XnUInt32 x = 0; x < xRes; ++x) {
+        ++histogram_[std::min((XnUInt32)row[x], (XnUInt32)(BINS - 1))];
+      }
+      count += xRes;
+    }
+    ++frame_;
+    if (count == 0) {
+      return;
+    }
+
+    // 累積で割合の位置を探す
+    const XnUInt32 lowCount = (XnUInt32)(count * params_.low);
+    const XnUInt32 highCount = (XnUInt32)(count * params_.high);
+    XnUInt32 lowValue = 0, highValue = BINS - 1;
+    XnUInt32 sum = 0;
+    bool foundLow = false;
+    for (XnUInt32 i = 0; i < BINS; ++i) {
+      sum += histogram_[i];
+      if (!foundLow && (sum > lowCount)) {
+        lowValue = i;
+        foundLow = true;
+      }
+      if (sum > highCount) {
+        highValue = i;
+        break;
+      }
+    }
+
+    // 最初のフレームはそのまま、以降は少しずつ近づける
+    const float rate = (frame_ == 1) ? 1.0f : params_.adaptation;
+    lowValue_ += (lowValue - lowValue_) * rate;
+    highValue_ += (highValue - highValue_) * rate;
+
+    const XnUInt32 low = (XnUInt32)(lowValue_ + 0.5f);
+    const XnUInt32 high = std::max((XnUInt32)(highValue_ + 0.5f), low + params_.minRange);
+    setRange(low, high - low);
+  }
+
+  // 範囲を直接決める(自動露出を止めるとき)
+  void setRange(XnUInt32 low, XnUInt32 range)
+  {
+    low_ = (XnUInt16)std::min(low, (XnUInt32)0xFFFF);
+    range_ = (XnUInt16)std::max(std::min(range, (XnUInt32)0xFFFF), (XnUInt32)1);
+    updateScale();
+  }
+
+  XnUInt32 low() const
+  {
+    return low_;
+  }
+
+  XnUInt32 high() const
+  {
+    return low_ + range_;
+  }
+
+  // 16bitから8bitへ変換する。dstStepはdstの1行のバイト数(IplImageのwidthStep)
+  void convert(const XnIRPixel* src, XnUInt32 xRes, XnUInt32 yRes,
+               XnUInt8* dst, XnUInt32 dstStep) const
+  {
+    for (XnUInt32 y = 0; y < yRes; ++y) {
+      convertRow(src + y * xRes, dst + y * dstStep, xRes);
+    }
+  }
+
+  // SIMDを使わない変換(速度の比較と結果の確認用)
+  void convertScalar(const XnIRPixel* src, XnUInt32 xRes, XnUInt32 yRes,
+                     XnUInt8* dst, XnUInt32 dstStep) const
+  {
+    for (XnUInt32 y = 0; y < yRes; ++y) {
+      convertScalar(src + y * xRes, dst + y * dstStep, 0, xRes);
+    }
+  }
+
+private:
+
+  // 8bitの値 = ((min(v - low, range) << shift) * scale) >> 16
+  //  range << shift が16bitに収まる一番大きいshiftを選んで、16bitの掛け算の精度を保つ
+  void updateScale()
+  {
+    shift_ = 0;
+    while (((XnUInt32)range_ << (shift_ + 1)) <= 0xFFFF) {
+      ++shift_;
+    }
+    scale_ = (XnUInt16)((255u << 16) / ((XnUInt32)range_ << shift_));
+  }
+
+  void convertRow(const XnIRPixel* src, XnUInt8* dst, XnUInt32 xRes) const
+  {
+    XnUInt32 x = 0;
+
+#ifdef IRTONEMAP_USE_SSE2
+    // 16画素ずつ変換する
+    const __m128i low = _mm_set1_epi16((short)low_);
+    const __m128i range = _mm_set1_epi16((short)range_);
+    const __m128i scale = _mm_set1_epi16((short)scale_);
+    const __m128i shift = _mm_cvtsi32_si128(shift_);
+    for (; (x + 16) <= xRes; x += 16) {
+      __m128i a = _mm_loadu_si128((const __m128i*)(src + x));
+      __m128i b = _mm_loadu_si128((const __m128i*)(src + x + 8));
+
+      // 符号なしの min(v - low, range) (SSE2には符号なし16bitのminがないので飽和減算で作る)
+      a = _mm_subs_epu16(a, low);
+      b = _mm_subs_epu16(b, low);
+      a = _mm_sub_epi16(a, _mm_subs_epu16(a, range));
+      b = _mm_sub_epi16(b, _mm_subs_epu16(b, range));
+
+      a = _mm_mulhi_epu16(_mm_sll_epi16(a, shift), scale);
+      b = _mm_mulhi_epu16(_mm_sll_epi16(b, shift), scale);
+      _mm_storeu_si128((__m128i*)(dst + x), _mm_packus_epi16(a, b));
+    }
+#endif
+
+    convertScalar(src, dst, x, xRes);
+  }
+
+  void convertScalar(const XnIRPixel* src, XnUInt8* dst, XnUInt32 begin, XnUInt32 end) const
+  {
+    for (XnUInt32 x = begin; x < end; ++x) {
+      const XnUInt32 value = (src[x] > low_) ? std::min((XnUInt32)(src[x] - low_), (XnUInt32)range_) : 0;
+      dst[x] = (XnUInt8)(((value << shift_) * scale_) >> 16);
+    }
+  }
+
+  Params params_;
+  std::vector<XnUInt32> histogram_;
+  XnUInt32 frame_;
+
+  float lowValue_;        // なめらかにした範囲
+  float highValue_;
+
+  XnUInt16 low_;          // 変換に使う範囲
+  XnUInt16 range_;
+  XnUInt16 scale_;
+  int shift_;
+};
+
+#endif // #ifndef IRTONEMAP_H_INCLUDE
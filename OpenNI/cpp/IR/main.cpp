@@ -1,11 +1,15 @@
 #include <iostream>
 #include <stdexcept>
+#include <string>
+#include <vector>
 
 #include <opencv/cv.h>
 #include <opencv/highgui.h>
 
 #include <XnCppWrapper.h>
 
+#include "IRToneMap.h"
+
 // 設定ファイルのパス(環境に合わせて変更してください)
 #ifdef WIN32
 const char* CONFIG_XML_PATH = "../../../Data/SamplesConfig.xml";
@@ -13,8 +17,59 @@ const char* CONFIG_XML_PATH = "../../../Data/SamplesConfig.xml";
 const char* CONFIG_XML_PATH = "../../../../../../Data/SamplesConfig.xml";
 #endif
 
+// 合成したIR(明るさの傾きと斑点)で、ヒストグラムと8bitへの変換の速度を計測する
+void benchmark()
+{
+    const XnUInt32 XRES = 640;
+    const XnUInt32 YRES = 480;
+    const int FRAMES = 300;
+    
+    std::vector<XnIRPixel> ir(XRES * YRES);
+    XnUInt32 random = 1;
+    for (XnUInt32 y = 0; y < YRES; ++y) {
+        for (XnUInt32 x = 0; x < XRES; ++x) {
+            random = random * 1103515245 + 12345;
+            const XnUInt32 speckle = ((random >> 16) % 100 < 3) ? 600 : 0;
+            ir[y * XRES + x] = (XnIRPixel)std::min(x / 8 + y / 6 + (random >> 24) / 4 + speckle,
+                                                   (XnUInt32)1023);
+        }
+    }
+    std::vector<XnUInt8> simd(XRES * YRES), scalar(XRES * YRES);
+    
+    IRToneMap toneMap;
+    XnUInt64 begin, end;
+    xnOSGetHighResTimeStamp(&begin);
+    for (int f = 0; f < FRAMES; ++f) {
+        toneMap.update(&ir[0], XRES, YRES);
+    }
+    xnOSGetHighResTimeStamp(&end);
+    std::cout << "histogram : " << ((end - begin) / 1000.0 / FRAMES) << " ms/frame, range " <<
+        toneMap.low() << "-" << toneMap.high() << std::endl;
+    
+    xnOSGetHighResTimeStamp(&begin);
+    for (int f = 0; f < FRAMES; ++f) {
+        toneMap.convertScalar(&ir[0], XRES, YRES, &scalar[0], XRES);
+    }
+    xnOSGetHighResTimeStamp(&end);
+    std::cout << "convert (scalar) : " << ((end - begin) / 1000.0 / FRAMES) << " ms/frame" << std::endl;
+    
+    xnOSGetHighResTimeStamp(&begin);
+    for (int f = 0; f < FRAMES; ++f) {
+        toneMap.convert(&ir[0], XRES, YRES, &simd[0], XRES);
+    }
+    xnOSGetHighResTimeStamp(&end);
+    std::cout << "convert : " << ((end - begin) / 1000.0 / FRAMES) << " ms/frame" <<
+        ((simd == scalar) ? "" : " (MISMATCH)") << std::endl;
+}
+
 int main (int argc, char * argv[])
 {
+    // 速度計測モード
+    if ((argc > 1) && (std::string(argv[1]) == "bench")) {
+        benchmark();
+        return 0;
+    }
+    
     IplImage* camera = 0;
     
     try {
@@ -44,31 +99,53 @@ int main (int argc, char * argv[])
             std::cout << "(" << irMD.XRes() << "," << irMD.YRes() << ")" << std::endl;
         }
         
-        // カメラサイズのイメージを作成(8bitのRGB)
+        // カメラサイズのイメージを作成(8bitのグレー)
         XnMapOutputMode outputMode;
         ir.GetMapOutputMode(outputMode);
         camera = ::cvCreateImage(cvSize(outputMode.nXRes, outputMode.nYRes),
-                                 IPL_DEPTH_16U, 1);
+                                 IPL_DEPTH_8U, 1);
         if (!camera) {
             throw std::runtime_error("error : cvCreateImage");
         }
         
+        // IRの明るさを自動で合わせて8bitにする
+        IRToneMap toneMap;
+        bool autoExposure = true;
+        
+        context.StartGeneratingAll();
+        
         // メインループ
         while (1) {
-            if (ir.IsDataNew()){
-                xn::IRMetaData  irMD;
-                ir.GetMetaData(irMD);
-                
-                memcpy(camera->imageData, irMD.Data(), camera->imageSize);
+            // IRが更新されるまで待つ(IsDataNewで回り続けない)
+            rc = context.WaitOneUpdateAll(ir);
+            if (rc != XN_STATUS_OK) {
+                throw std::runtime_error(xnGetStatusString(rc));
             }
+            
+            xn::IRMetaData  irMD;
+            ir.GetMetaData(irMD);
+            
+            if (autoExposure) {
+                toneMap.update(irMD.Data(), irMD.XRes(), irMD.YRes());
+            }
+            toneMap.convert(irMD.Data(), irMD.XRes(), irMD.YRes(),
+                            (XnUInt8*)camera->imageData, camera->widthStep);
 
             ::cvShowImage("KinectImage", camera);
             
-            // 終了する
-            char key = cvWaitKey(10);
+            // 待つのはWaitOneUpdateAllでしているので、キーは見るだけ
+            char key = cvWaitKey(1);
             if (key == 'q') {
                 break;
             }
+            // 自動露出を止めて、IRの値をそのまま(10bitを8bitに)表示する
+            else if (key == 'a') {
+                autoExposure = !autoExposure;
+                if (!autoExposure) {
+                    toneMap.setRange(0, IRToneMap::BINS);
+                }
+                std::cout << "auto exposure " << (autoExposure ? "on" : "off") << std::endl;
+            }
             // 反転する
             else if (key == 'm') {
                 context.SetGlobalMirror(!context.GetGlobalMirror());
@@ -28,12 +28,13 @@ void XN_CALLBACK_TYPE MirrorChange(xn::ProductionNode &node, void *pCookie)
 }
 
 // デプスのヒストグラムを作成
-depth_hist getDepthHistgram(const xn::DepthGenerator& depth,
-                            const xn::DepthMetaData& depthMD)
+//  毎フレーム確保しないよう、呼び出し側のdepthHistを使いまわす
+void getDepthHistgram(const xn::DepthGenerator& depth,
+                      const xn::DepthMetaData& depthMD, depth_hist& depthHist)
 {
   // デプスの傾向を計算する(アルゴリズムはNiSimpleViewer.cppを利用)
   const int MAX_DEPTH = depth.GetDeviceMaxDepth();
-  depth_hist depthHist(MAX_DEPTH);
+  depthHist.assign(MAX_DEPTH, 0);
 
   unsigned int points = 0;
   const XnDepthPixel* pDepth = depthMD.Data();
@@ -56,8 +57,34 @@ depth_hist getDepthHistgram(const xn::DepthGenerator& depth,
         (unsigned int)(256 * (1.0f - (depthHist[i] / points)));
     }
   }
+}
 
-  return depthHist;
+// イメージにデプスを重ねて、表示用のBGRの画像に書く
+//  mirrorなら左右を反転して書く。コピー、重ね合わせ、色の並べ替え、反転を1回でする
+void drawDepthOverlay(const xn::ImageMetaData& imageMD, const xn::DepthMetaData& depthMD,
+                      const depth_hist& depthHist, IplImage* camera, bool mirror)
+{
+  const XnUInt32 xRes = imageMD.XRes();
+  const int step = mirror ? -3 : 3;
+  for (XnUInt y = 0; y < imageMD.YRes(); ++y) {
+    const XnRGB24Pixel* image = imageMD.RGB24Data() + y * xRes;
+    const XnDepthPixel* depth = depthMD.Data() + y * depthMD.XRes();
+    XnUInt8* dst = (XnUInt8*)camera->imageData + y * camera->widthStep +
+      (mirror ? (xRes - 1) * 3 : 0);
+    for (XnUInt x = 0; x < xRes; ++x, dst += step) {
+      if (depth[x] != 0) {
+        const XnUInt8 value = (XnUInt8)depthHist[depth[x]];
+        dst[0] = 0;
+        dst[1] = value;
+        dst[2] = value;
+      }
+      else {
+        dst[0] = image[x].nBlue;
+        dst[1] = image[x].nGreen;
+        dst[2] = image[x].nRed;
+      }
+    }
+  }
 }
 
 int main (int argc, char * argv[])
@@ -103,37 +130,27 @@ int main (int argc, char * argv[])
       throw std::runtime_error("error : cvCreateImage");
     }
 
+    // ドライバではなく、表示用に書くときに反転する
+    bool softwareMirror = false;
+
+    // フレームごとに作り直さずに使いまわす
+    xn::DepthMetaData depthMD;
+    depth_hist depthHist;
+
     // メインループ
     while (1) {
       // すべての更新を待ち、画像およびデプスデータを取得する
       context.WaitAndUpdateAll();
 
-      xn::ImageMetaData imageMD;
       image.GetMetaData(imageMD);
 
-      xn::DepthMetaData depthMD;
       depth.GetMetaData(depthMD);
 
       // デプスマップの作成
-      depth_hist depthHist = getDepthHistgram(depth, depthMD);
-
-      // イメージをデプスマップで上書きする
-      xn::RGB24Map& rgb = imageMD.WritableRGB24Map();
-      for (XnUInt y = 0; y < imageMD.YRes(); ++y) {
-        for (XnUInt x = 0; x < imageMD.XRes(); ++x) {
-          const XnDepthPixel& depth = depthMD(x, y);
-          if (depth != 0) {
-            XnRGB24Pixel& pixel = rgb(x, y);
-            pixel.nRed   = depthHist[depthMD(x, y)];
-            pixel.nGreen = depthHist[depthMD(x, y)];
-            pixel.nBlue  = 0;
-          }
-        }
-      }
+      getDepthHistgram(depth, depthMD, depthHist);
 
-      // 画像の表示
-      memcpy(camera->imageData, imageMD.RGB24Data(), camera->imageSize);
-      ::cvCvtColor(camera, camera, CV_RGB2BGR);
+      // イメージをデプスマップで上書きして表示する
+      drawDepthOverlay(imageMD, depthMD, depthHist, camera, softwareMirror);
       ::cvShowImage("KinectImage", camera);
 
       // 'q'が押されたら終了する
@@ -155,6 +172,10 @@ int main (int argc, char * argv[])
         xn::MirrorCapability mirror = depth.GetMirrorCap();
         mirror.SetMirror(!mirror.IsMirrored());
       }
+      // 表示するときに反転する(ドライバの設定は変えない)
+      else if (key == 's') {
+        softwareMirror = !softwareMirror;
+      }
     }
 
     // 登録したコールバックを削除する
@@ -0,0 +1,183 @@
+#ifndef STREAMINGTEXTURE_H_INCLUDE
+#define STREAMINGTEXTURE_H_INCLUDE
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+// GLのヘッダ(バッファオブジェクトの関数の宣言を含む)の後にインクルードする
+
+// 毎フレーム書き換えるテクスチャ
+//  テクスチャは最初に1回だけ確保し(glTexImage2D)、以降は glTexSubImage2D で中身だけを送る。
+//  ミップマップは作らない(画面いっぱいに貼るだけなので使われない)。
+//  PBO(ピクセルバッファオブジェクト)が使えるときは2つを交互に使い、
+//  前のフレームの転送中のバッファには書かないようにして、待たずに送る
+class StreamingTexture
+{
+public:
+
+  StreamingTexture(GLsizei width, GLsizei height, bool usePbo = true)
+    :width_(width), height_(height), size_(width * height * 3),
+     index_(0), usePbo_(usePbo && isPboSupported()), uploaded_(0), frames_(0)
+  {
+    ::glGenTextures(1, &texture_);
+    ::glBindTexture(GL_TEXTURE_2D, texture_);
+    ::glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    ::glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    ::glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    ::glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    ::glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width_, height_, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
+
+    if (usePbo_) {
+      ::glGenBuffers(PBO_COUNT, pbo_);
+      for (int i = 0; i < PBO_COUNT; ++i) {
+        ::glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo_[i]);
+        ::glBufferData(GL_PIXEL_UNPACK_BUFFER, size_, 0, GL_STREAM_DRAW);
+      }
+      ::glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    if (::glGetError() != GL_NO_ERROR) {
+      throw std::runtime_error("error : StreamingTexture");
+    }
+  }
+
+  ~StreamingTexture()
+  {
+    if (usePbo_) {
+      ::glDeleteBuffers(PBO_COUNT, pbo_);
+    }
+    ::glDeleteTextures(1, &texture_);
+  }
+
+  // RGB24の画像(width x height)を送る
+  void upload(const void* pixels)
+  {
+    ::glBindTexture(GL_TEXTURE_2D, texture_);
+    ::glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    if (usePbo_) {
+      // 前のフレームで使っていない方のバッファに書いて、そこから送る
+      //  glBufferData(0) で古い中身を捨て、転送が終わるのを待たずに書けるようにする
+      index_ = (index_ + 1) % PBO_COUNT;
+      ::glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo_[index_]);
+      ::glBufferData(GL_PIXEL_UNPACK_BUFFER, size_, 0, GL_STREAM_DRAW);
+      void* buffer = ::glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+      if (buffer != 0) {
+        memcpy(buffer, pixels, size_);
+        ::glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        ::glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width_, height_, GL_RGB, GL_UNSIGNED_BYTE, 0);
+      }
+      ::glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    else {
+      ::glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width_, height_, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+    }
+
+    uploaded_ += size_;
+    ++frames_;
+  }
+
+  void bind() const
+  {
+    ::glBindTexture(GL_TEXTURE_2D, texture_);
+  }
+
+  bool usesPbo() const
+  {
+    return usePbo_;
+  }
+
+  // 送ったバイト数
+  double uploadedBytes() const
+  {
+    return uploaded_;
+  }
+
+  unsigned int frames() const
+  {
+    return frames_;
+  }
+
+  // PBOはGL 2.1から(それより前は拡張)
+  static bool isPboSupported()
+  {
+    int major = 0, minor = 0;
+    const char* version = (const char*)::glGetString(GL_VERSION);
+    if ((version != 0) && (sscanf(version, "%d.%d", &major, &minor) == 2) &&
+        ((major > 2) || ((major == 2) && (minor >= 1)))) {
+      return true;
+    }
+    const char* extensions = (const char*)::glGetString(GL_EXTENSIONS);
+    return (extensions != 0) && (strstr(extensions, "GL_ARB_pixel_buffer_object") != 0);
+  }
+
+private:
+
+  StreamingTexture(const StreamingTexture&);
+  StreamingTexture& operator=(const StreamingTexture&);
+
+  enum { PBO_COUNT = 2 };
+
+  GLuint texture_;
+  GLuint pbo_[PBO_COUNT];
+  GLsizei width_;
+  GLsizei height_;
+  GLsizeiptr size_;
+  int index_;
+  bool usePbo_;
+
+  double uploaded_;
+  unsigned int frames_;
+};
+
+// 画面いっぱいの四角形
+//  頂点は最初に1回だけVBOに入れておき、毎フレームはglDrawArraysだけで描く
+class ScreenQuad
+{
+public:
+
+  ScreenQuad()
+  {
+    // x, y, s, t(テクスチャの上が画像の1行目)
+    static const GLfloat vertices[] = {
+      -1,  1,  0, 0,    // upper left
+      -1, -1,  0, 1,    // bottom left
+       1,  1,  1, 0,    // upper right
+       1, -1,  1, 1,    // bottom right
+    };
+
+    ::glGenBuffers(1, &vbo_);
+    ::glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+    ::glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    ::glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  ~ScreenQuad()
+  {
+    ::glDeleteBuffers(1, &vbo_);
+  }
+
+  void draw() const
+  {
+    const GLsizei stride = 4 * sizeof(GLfloat);
+    ::glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+    ::glEnableClientState(GL_VERTEX_ARRAY);
+    ::glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    ::glVertexPointer(2, GL_FLOAT, stride, (const GLvoid*)0);
+    ::glTexCoordPointer(2, GL_FLOAT, stride, (const GLvoid*)(2 * sizeof(GLfloat)));
+    ::glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    ::glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    ::glDisableClientState(GL_VERTEX_ARRAY);
+    ::glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+private:
+
+  ScreenQuad(const ScreenQuad&);
+  ScreenQuad& operator=(const ScreenQuad&);
+
+  GLuint vbo_;
+};
+
+#endif // #ifndef STREAMINGTEXTURE_H_INCLUDE
@@ -1,11 +1,22 @@
 #include <iostream>
 #include <stdexcept>
+#include <string>
+#include <vector>
 
+#ifdef __APPLE__
 #include <OpenGL/OpenGL.h>
 #include <GLUT/GLUT.h>
+#else
+#define GL_GLEXT_PROTOTYPES
+#include <GL/glut.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
 
 #include <XnCppWrapper.h>
 
+#include "StreamingTexture.h"
+
 // 設定ファイルのパス(環境に合わせて変更してください)
 #if (XN_PLATFORM == XN_PLATFORM_WIN32)
 const char* CONFIG_XML_PATH = "../../../Data/SamplesConfig.xml";
@@ -21,6 +32,9 @@ xn::Context g_context;
 xn::ImageGenerator g_image;
 XnMapOutputMode g_outputMode;
 
+StreamingTexture* g_texture = 0;
+ScreenQuad* g_quad = 0;
+
 // アイドル時の処理
 void idle()
 {
@@ -37,20 +51,10 @@ void display()
   g_image.GetMetaData( imageMD );
 
   // カメラ画像の表示 ... (5)
+  //  テクスチャは作り直さず、中身だけを送る
   ::glClear( GL_COLOR_BUFFER_BIT );
-
-  ::glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP_SGIS, GL_TRUE);
-  ::glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-  ::glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  ::glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB, imageMD.XRes(), imageMD.YRes(),
-    0, GL_RGB, GL_UNSIGNED_BYTE, imageMD.RGB24Data() );
-
-  ::glBegin(GL_QUADS);
-  ::glTexCoord2f(0, 0);    ::glVertex2f(-1,  1);    // upper left
-  ::glTexCoord2f(0, 1);    ::glVertex2f(-1, -1);    // bottom left
-  ::glTexCoord2f(1, 1);    ::glVertex2f( 1, -1);    // bottom right
-  ::glTexCoord2f(1, 0);    ::glVertex2f( 1,  1);    // upper right
-  ::glEnd();
+  g_texture->upload( imageMD.RGB24Data() );
+  g_quad->draw();
 
   ::glutSwapBuffers();
 }
@@ -59,6 +63,9 @@ void display()
 void keyboard(unsigned char key, int x, int y)
 {
   if ( key == 'q' ) {
+    std::cout << "upload : " << g_texture->frames() << " frames, " <<
+      (g_texture->uploadedBytes() / (1024 * 1024)) << " MB" <<
+      (g_texture->usesPbo() ? " (PBO)" : "") << std::endl;
     exit(0);
   }
 }
@@ -82,9 +89,189 @@ void xnInit()
   g_image.GetMapOutputMode(g_outputMode);
 }
 
+#ifndef __APPLE__
+// ウィンドウを出さずに描画するためのコンテキスト(EGLのpbuffer)
+//  MesaならGPUがなくてもソフトウェアラスタライザ(llvmpipe)で動く
+class OffscreenContext
+{
+public:
+
+  OffscreenContext(EGLint width, EGLint height)
+  {
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+      (PFNEGLGETPLATFORMDISPLAYEXTPROC)::eglGetProcAddress("eglGetPlatformDisplayEXT");
+    display_ = EGL_NO_DISPLAY;
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+    if (getPlatformDisplay != 0) {
+      display_ = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, 0);
+    }
+#endif
+    if (display_ == EGL_NO_DISPLAY) {
+      display_ = ::eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+
+    EGLint major, minor;
+    if (!::eglInitialize(display_, &major, &minor) || !::eglBindAPI(EGL_OPENGL_API)) {
+      throw std::runtime_error("error : eglInitialize");
+    }
+
+    const EGLint configAttributes[] = {
+      EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+      EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+      EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+      EGL_NONE
+    };
+    EGLConfig config;
+    EGLint count = 0;
+    if (!::eglChooseConfig(display_, configAttributes, &config, 1, &count) || (count == 0)) {
+      throw std::runtime_error("error : eglChooseConfig");
+    }
+
+    const EGLint surfaceAttributes[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+    surface_ = ::eglCreatePbufferSurface(display_, config, surfaceAttributes);
+    context_ = ::eglCreateContext(display_, config, EGL_NO_CONTEXT, 0);
+    if ((surface_ == EGL_NO_SURFACE) || (context_ == EGL_NO_CONTEXT) ||
+        !::eglMakeCurrent(display_, surface_, surface_, context_)) {
+      throw std::runtime_error("error : eglCreateContext");
+    }
+  }
+
+  ~OffscreenContext()
+  {
+    ::eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    ::eglDestroyContext(display_, context_);
+    ::eglDestroySurface(display_, surface_);
+    ::eglTerminate(display_);
+  }
+
+private:
+
+  OffscreenContext(const OffscreenContext&);
+  OffscreenContext& operator=(const OffscreenContext&);
+
+  EGLDisplay display_;
+  EGLSurface surface_;
+  EGLContext context_;
+};
+#endif
+
+// 以前の描画(毎フレームテクスチャを作り直し、ミップマップを作り、即時モードで描く)
+//  速度の比較用
+void drawImmediate(GLuint texture, const XnUInt8* pixels, GLsizei width, GLsizei height)
+{
+  ::glBindTexture(GL_TEXTURE_2D, texture);
+  ::glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  ::glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP_SGIS, GL_TRUE);
+  ::glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  ::glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  ::glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB, width, height,
+    0, GL_RGB, GL_UNSIGNED_BYTE, pixels );
+
+  ::glBegin(GL_QUADS);
+  ::glTexCoord2f(0, 0);    ::glVertex2f(-1,  1);    // upper left
+  ::glTexCoord2f(0, 1);    ::glVertex2f(-1, -1);    // bottom left
+  ::glTexCoord2f(1, 1);    ::glVertex2f( 1, -1);    // bottom right
+  ::glTexCoord2f(1, 0);    ::glVertex2f( 1,  1);    // upper right
+  ::glEnd();
+}
+
+// 1つの方法でFRAMESフレーム描いた時間を表示し、最後に描いた画面を返す
+//  texture == 0 なら以前の描画で測る
+std::vector<XnUInt8> measure(const char* name, StreamingTexture* texture, const ScreenQuad& quad,
+                             const std::vector<XnUInt8>* frames, GLsizei width, GLsizei height)
+{
+  const int FRAMES = 300;
+
+  GLuint immediate = 0;
+  ::glGenTextures(1, &immediate);
+
+  XnUInt64 begin, end;
+  xnOSGetHighResTimeStamp(&begin);
+  for (int f = 0; f < FRAMES; ++f) {
+    const std::vector<XnUInt8>& pixels = frames[f % 2];
+    ::glClear(GL_COLOR_BUFFER_BIT);
+    if (texture != 0) {
+      texture->upload(&pixels[0]);
+      quad.draw();
+    }
+    else {
+      drawImmediate(immediate, &pixels[0], width, height);
+    }
+    // 描き終わるまで待って、1フレームにかかった時間にする
+    ::glFinish();
+  }
+  xnOSGetHighResTimeStamp(&end);
+
+  const double seconds = (end - begin) / 1000000.0;
+  const double bytes = (double)width * height * 3 * FRAMES;
+  std::cout << name << " : " << (seconds * 1000 / FRAMES) << " ms/frame, " <<
+    (bytes / (1024 * 1024) / seconds) << " MB/s" << std::endl;
+
+  std::vector<XnUInt8> screen(width * height * 3);
+  ::glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  ::glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, &screen[0]);
+  ::glDeleteTextures(1, &immediate);
+  return screen;
+}
+
+// 速度計測モード(Kinectもウィンドウも使わない)
+void benchmark(int argc, char* argv[])
+{
+  const GLsizei XRES = 640;
+  const GLsizei YRES = 480;
+
+#ifdef __APPLE__
+  ::glutInit(&argc, argv);
+  ::glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE);
+  ::glutInitWindowSize(XRES, YRES);
+  ::glutCreateWindow("Camera Image (bench)");
+#else
+  OffscreenContext context(XRES, YRES);
+#endif
+  std::cout << ::glGetString(GL_RENDERER) << " / " << ::glGetString(GL_VERSION) << std::endl;
+
+  ::glViewport(0, 0, XRES, YRES);
+  ::glEnable(GL_TEXTURE_2D);
+
+  // 毎フレーム中身が変わるように、2枚を交互に送る
+  std::vector<XnUInt8> frames[2];
+  for (int i = 0; i < 2; ++i) {
+    frames[i].resize(XRES * YRES * 3);
+    XnUInt32 random = i + 1;
+    for (size_t p = 0; p < frames[i].size(); ++p) {
+      random = random * 1103515245 + 12345;
+      frames[i][p] = (XnUInt8)(random >> 24);
+    }
+  }
+
+  ScreenQuad quad;
+  const std::vector<XnUInt8> immediate =
+    measure("glTexImage2D + mipmap + immediate", 0, quad, frames, XRES, YRES);
+
+  StreamingTexture direct(XRES, YRES, false);
+  const std::vector<XnUInt8> subImage =
+    measure("glTexSubImage2D + VBO", &direct, quad, frames, XRES, YRES);
+
+  if (!StreamingTexture::isPboSupported()) {
+    std::cout << "PBO is not supported" << std::endl;
+    return;
+  }
+  StreamingTexture streaming(XRES, YRES);
+  const std::vector<XnUInt8> pbo =
+    measure("PBO x 2 + glTexSubImage2D + VBO", &streaming, quad, frames, XRES, YRES);
+
+  std::cout << ((immediate == subImage && immediate == pbo) ? "same image" : "MISMATCH") << std::endl;
+}
+
 int main (int argc, char * argv[])
 {
   try {
+    // 速度計測モード
+    if ((argc > 1) && (std::string(argv[1]) == "bench")) {
+      benchmark(argc, argv);
+      return 0;
+    }
+
     ::xnInit();
 
     ::glutInit(&argc, argv);
@@ -99,6 +286,10 @@ int main (int argc, char * argv[])
 
     ::glEnable(GL_TEXTURE_2D);
 
+    // テクスチャと四角形は最初に1回だけ作る
+    g_texture = new StreamingTexture(g_outputMode.nXRes, g_outputMode.nYRes);
+    g_quad = new ScreenQuad();
+
     ::glutMainLoop();
   }
   catch (std::exception& ex) {
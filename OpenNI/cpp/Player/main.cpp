@@ -1,4 +1,5 @@
 #include <iostream>
+#include <fstream>
 #include <stdexcept>
 #include <sstream>
 
@@ -7,15 +8,21 @@
 
 #include <XnCppWrapper.h>
 
+#include "../User/LabelRuns.h"
+
 // 設定ファイルのパス(環境に合わせて変更してください)
 #if (XN_PLATFORM == XN_PLATFORM_WIN32)
 const char* RECORDE_PATH = "../../../Data/record.oni";
+const char* LABEL_RECORDE_PATH = "../../../Data/record.labels";
 #elif (XN_PLATFORM == XN_PLATFORM_MACOSX)
 const char* RECORDE_PATH = "../../../../../Data/record.oni";
+const char* LABEL_RECORDE_PATH = "../../../../../Data/record.labels";
 #elif (XN_PLATFORM == XN_PLATFORM_LINUX_X86)
 const char* RECORDE_PATH = "../../../Data/record.oni";
+const char* LABEL_RECORDE_PATH = "../../../Data/record.labels";
 #else
 const char* RECORDE_PATH = "Data/record.oni";
+const char* LABEL_RECORDE_PATH = "Data/record.labels";
 #endif
 
 // ユーザーの色づけ
@@ -49,13 +56,14 @@ void XN_CALLBACK_TYPE UserLost(xn::UserGenerator& generator,
 }
 
 // デプスのヒストグラムを作成
+//  毎フレーム確保しないよう、呼び出し側のdepthHistを使いまわす
 typedef std::vector<float> depth_hist;
-depth_hist getDepthHistgram(const xn::DepthGenerator& depth,
-                            const xn::DepthMetaData& depthMD)
+void getDepthHistgram(const xn::DepthGenerator& depth,
+                      const xn::DepthMetaData& depthMD, depth_hist& depthHist)
 {
   // デプスの傾向を計算する(アルゴリズムはNiSimpleViewer.cppを利用)
   const int MAX_DEPTH = depth.GetDeviceMaxDepth();
-  depth_hist depthHist(MAX_DEPTH);
+  depthHist.assign(MAX_DEPTH, 0);
 
   unsigned int points = 0;
   const XnDepthPixel* pDepth = depthMD.Data();
@@ -78,8 +86,26 @@ depth_hist getDepthHistgram(const xn::DepthGenerator& depth,
         (unsigned int)(256 * (1.0f - (depthHist[i] / points)));
     }
   }
+}
 
-  return depthHist;
+// 記録されたラベルマップから、デプスのフレーム番号に合うものを読み込む
+//  巻き戻された場合は、ファイルの先頭から探し直す
+bool readLabelRuns(std::ifstream& file, LabelRuns& runs, bool& isValid, XnUInt32 frameID)
+{
+  if (!isValid || (runs.frameID > frameID)) {
+    file.clear();
+    file.seekg(0);
+    if (!LabelRuns::readHeader(file)) {
+      return false;
+    }
+    isValid = runs.read(file);
+  }
+
+  while (isValid && (runs.frameID < frameID)) {
+    isValid = runs.read(file);
+  }
+
+  return isValid && (runs.frameID == frameID);
 }
 
 int main (int argc, char * argv[])
@@ -198,6 +224,22 @@ int main (int argc, char * argv[])
     bool isShowDepth = true;
     bool isShowUser = true;
 
+    // 記録されたラベルマップがあれば使う(なければUserGeneratorで検出する)
+    std::ifstream labelFile(LABEL_RECORDE_PATH, std::ios::binary);
+    bool isRecordedLabel = labelFile && LabelRuns::readHeader(labelFile);
+    if (isRecordedLabel) {
+      std::cout << "記録されたラベルを使います : " << LABEL_RECORDE_PATH << std::endl;
+    }
+    bool isLabelValid = false;
+    LabelRuns runs;
+    const XnUInt32 colorsCount = sizeof(Colors) / sizeof(Colors[0]);
+
+    // フレームごとに作り直さずに使いまわす
+    xn::ImageMetaData imageMD;
+    xn::DepthMetaData depthMD;
+    xn::SceneMetaData sceneMD;
+    depth_hist depthHist;
+
     // メインループ
     while (1) {
       // データの更新
@@ -208,7 +250,6 @@ int main (int argc, char * argv[])
 
       // イメージが有効であれば、画像を表示する
       if (image.IsValid() && isShowImage) {
-        xn::ImageMetaData imageMD;
         image.GetMetaData(imageMD);
 
         memcpy(camera->imageData, imageMD.RGB24Data(), camera->imageSize);
@@ -217,14 +258,9 @@ int main (int argc, char * argv[])
 
       // デプスが有効であれば、ヒストグラムとユーザーを表示する
       if (depth.IsValid() && isShowDepth) {
-        xn::DepthMetaData depthMD;
         depth.GetMetaData(depthMD);
-        depth_hist depthHist = getDepthHistgram(depth, depthMD);
+        getDepthHistgram(depth, depthMD, depthHist);
 
-        // ユーザーデータの取得
-        xn::SceneMetaData sceneMD;
-        user.GetUserPixels(0, sceneMD);
-        
         // デプスマップの表示
         char* image = camera->imageData;
         for (XnUInt y = 0; y < depthMD.YRes(); ++y) {
@@ -235,17 +271,23 @@ int main (int argc, char * argv[])
               image[1] = depthHist[depthMD(x, y)];
               image[2] = depthHist[depthMD(x, y)];
             }
+          }
+        }
 
-            // ユーザー表示
-            XnLabel label = sceneMD(x, y);
-            if (!isShowUser) {
-              label = 0;
-            }
-            
-            // 出力先に描画
-            image[0] *= Colors[label][0];
-            image[1] *= Colors[label][1];
-            image[2] *= Colors[label][2];
+        // ユーザー表示(ユーザーのいる区間だけ色をかける)
+        if (isShowUser) {
+          bool hasLabel = false;
+          if (isRecordedLabel) {
+            hasLabel = readLabelRuns(labelFile, runs, isLabelValid, depthMD.FrameID());
+          }
+          else {
+            user.GetUserPixels(0, sceneMD);
+            runs.encode(sceneMD);
+            hasLabel = true;
+          }
+
+          if (hasLabel) {
+            tintRuns(runs, Colors, colorsCount, (XnRGB24Pixel*)camera->imageData);
           }
         }
       }
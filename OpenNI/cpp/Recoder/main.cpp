@@ -8,6 +8,8 @@
 //#define XN_CODEC_8Z				XN_CODEC_ID('I','m','8','z')
 
 #include <iostream>
+#include <fstream>
+#include <string>
 #include <stdexcept>
 
 #include <opencv/cv.h>
@@ -15,19 +17,25 @@
 
 #include <XnCppWrapper.h>
 
+#include "../User/LabelRuns.h"
+
 // 設定ファイルのパス(環境に合わせて変更してください)
 #if (XN_PLATFORM == XN_PLATFORM_WIN32)
 const char* CONFIG_XML_PATH = "../../../Data/SamplesConfig.xml";
 const char* RECORDE_PATH = "../../../Data/record.oni";
+const char* LABEL_RECORDE_PATH = "../../../Data/record.labels";
 #elif (XN_PLATFORM == XN_PLATFORM_MACOSX)
 const char* CONFIG_XML_PATH = "../../../../../Data/SamplesConfig.xml";
 const char* RECORDE_PATH = "../../../../../Data/record.oni";
+const char* LABEL_RECORDE_PATH = "../../../../../Data/record.labels";
 #elif (XN_PLATFORM == XN_PLATFORM_LINUX_X86)
 const char* CONFIG_XML_PATH = "../../../Data/SamplesConfig.xml";
 const char* RECORDE_PATH = "../../../Data/record.oni";
+const char* LABEL_RECORDE_PATH = "../../../Data/record.labels";
 #else
 const char* CONFIG_XML_PATH = "Data/SamplesConfig.xml";
 const char* RECORDE_PATH = "Data/record.oni";
+const char* LABEL_RECORDE_PATH = "Data/record.labels";
 #endif
 
 int main (int argc, char * argv[])
@@ -85,6 +93,20 @@ int main (int argc, char * argv[])
             throw std::runtime_error(xnGetStatusString(rc));
         }
         
+        // ユーザーがあれば、ラベルマップをランレングスで別ファイルに記録する
+        //  (ユーザーはoniファイルに記録できないため)
+        xn::UserGenerator user;
+        std::ofstream labelFile;
+        if (context.FindExistingNode(XN_NODE_TYPE_USER, user) == XN_STATUS_OK) {
+            labelFile.open(LABEL_RECORDE_PATH, std::ios::binary);
+            if (!labelFile) {
+                throw std::runtime_error(std::string("ラベルの記録ファイルが開けません : ") +
+                                         LABEL_RECORDE_PATH);
+            }
+            LabelRuns::writeHeader(labelFile);
+        }
+        LabelRuns runs;
+        
         // 記録開始(WaitOneUpdateAllのタイミングで記録される)
         rc = recorder.Record();
         if (rc != XN_STATUS_OK) {
@@ -107,6 +129,18 @@ int main (int argc, char * argv[])
             xn::ImageMetaData imageMD;
             image.GetMetaData(imageMD);
             
+            // ラベルマップを記録する(再生時にデプスと合わせるため、デプスのフレーム番号で)
+            if (labelFile.is_open()) {
+                xn::DepthMetaData depthMD;
+                depth.GetMetaData(depthMD);
+                
+                xn::SceneMetaData sceneMD;
+                user.GetUserPixels(0, sceneMD);
+                runs.encode(sceneMD);
+                runs.frameID = depthMD.FrameID();
+                runs.write(labelFile);
+            }
+            
             // カメラ画像の表示
             //  Kinectからの入力がRGBであるため、BGRに変換して表示する
             memcpy(camera->imageData, imageMD.RGB24Data(), camera->imageSize);
@@ -0,0 +1,112 @@
+#ifndef LABELPALETTE_H_INCLUDE
+#define LABELPALETTE_H_INCLUDE
+
+#include <vector>
+#include <algorithm>
+#include <ostream>
+
+#include <XnCppWrapper.h>
+
+#include "../User/LabelRuns.h"
+
+// ラベルの色の表
+//  最初のいくつかは決まった色で、それより大きいラベルはラベルの値から色を作る。
+//  表はフレームに出てきた一番大きいラベルまで伸ばす(ラベル0は使わない)
+class LabelPalette
+{
+public:
+
+  LabelPalette(const XnRGB24Pixel* colors, XnUInt32 count)
+    :fixed_(colors, colors + count), table_(colors, colors + count)
+  {
+  }
+
+  // フレームのラベルがすべて表にあるようにする
+  //  新しく色を作ったラベルは、フレームごとにまとめて取り出せるように覚えておく
+  void update(const LabelRuns& runs)
+  {
+    added_.clear();
+
+    XnLabel maxLabel = 0;
+    for (XnUInt32 y = 0; y < runs.yRes(); ++y) {
+      for (const LabelRun* run = runs.begin(y); run != runs.end(y); ++run) {
+        maxLabel = std::max(maxLabel, run->label);
+      }
+    }
+
+    for (XnUInt32 label = size(); label <= maxLabel; ++label) {
+      table_.push_back(makeColor((XnLabel)label));
+      added_.push_back((XnLabel)label);
+    }
+  }
+
+  // ラベルの区間を表の色で塗る(mirrorならdstは左右反転した画像)
+  void fill(const LabelRuns& runs, XnRGB24Pixel* dst, bool mirror = false) const
+  {
+    if (table_.empty()) {
+      return;
+    }
+    fillRuns(runs, &table_[0], size(), dst, mirror);
+  }
+
+  // 最後のupdateで色を作ったラベルを1行で書き出す(なければ何もしない)
+  void report(std::ostream& out) const
+  {
+    if (added_.empty()) {
+      return;
+    }
+
+    out << "新しいラベル:";
+    for (std::vector<XnLabel>::const_iterator it = added_.begin(); it != added_.end(); ++it) {
+      out << " " << *it;
+    }
+    out << " (" << size() << "色)" << std::endl;
+  }
+
+  // 色を作り直す(決まった色だけに戻す)
+  void reset()
+  {
+    table_ = fixed_;
+    added_.clear();
+  }
+
+  const XnRGB24Pixel& operator[](XnLabel label) const
+  {
+    return table_[label];
+  }
+
+  XnUInt32 size() const
+  {
+    return (XnUInt32)table_.size();
+  }
+
+private:
+
+  // ラベルをかき混ぜて色相を決める(同じラベルはいつも同じ色)
+  static XnRGB24Pixel makeColor(XnLabel label)
+  {
+    XnUInt32 hash = label * 2654435761u;
+    hash ^= hash >> 16;
+
+    // 色相を6区間に分け、彩度と明度は最大にする
+    const XnUInt32 hue = hash % (6 * 256);
+    const XnUInt8 rise = (XnUInt8)(hue % 256);
+    const XnUInt8 fall = (XnUInt8)(255 - rise);
+    XnRGB24Pixel color;
+    switch (hue / 256) {
+    case 0:  color.nRed = 255;  color.nGreen = rise; color.nBlue = 0;    break;
+    case 1:  color.nRed = fall; color.nGreen = 255;  color.nBlue = 0;    break;
+    case 2:  color.nRed = 0;    color.nGreen = 255;  color.nBlue = rise; break;
+    case 3:  color.nRed = 0;    color.nGreen = fall; color.nBlue = 255;  break;
+    case 4:  color.nRed = rise; color.nGreen = 0;    color.nBlue = 255;  break;
+    default: color.nRed = 255;  color.nGreen = 0;    color.nBlue = fall; break;
+    }
+    return color;
+  }
+
+  std::vector<XnRGB24Pixel> fixed_;
+  std::vector<XnRGB24Pixel> table_;
+  std::vector<XnLabel> added_;
+};
+
+#endif // #ifndef LABELPALETTE_H_INCLUDE
@@ -1,10 +1,16 @@
 #include <iostream>
 #include <stdexcept>
+#include <string>
+#include <vector>
 
 #include <opencv/cv.h>
 #include <opencv/highgui.h>
 
 #include <XnCppWrapper.h>
+#include <XnOS.h>
+
+#include "../User/LabelRuns.h"
+#include "LabelPalette.h"
 
 // 設定ファイルのパス(環境に合わせて変更してください)
 #ifdef WIN32
@@ -13,8 +19,60 @@ const char* CONFIG_XML_PATH = "../../../Data/SamplesConfig.xml";
 const char* CONFIG_XML_PATH = "../../../../../../Data/SamplesConfig.xml";
 #endif
 
+// ラベルによる色分け(これより大きいラベルの色は LabelPalette で作る)
+const XnRGB24Pixel Colors[] = {
+    { 0, 0, 0 },
+    { 255, 0, 0 },
+    { 0, 255, 0 },
+    { 0, 0, 255 },
+    { 255, 255, 0 },
+    { 255, 0, 255 },
+    { 0, 255, 255 },
+    { 255, 255, 255 },
+};
+
+// 合成したラベルマップ(縦の帯が40ラベル)で、色分けの速度を計測する
+void benchmark()
+{
+    const XnUInt32 XRES = 640;
+    const XnUInt32 YRES = 480;
+    const XnUInt32 LABELS = 40;
+    const int FRAMES = 300;
+    
+    std::vector<XnLabel> labels(XRES * YRES, 0);
+    for (XnUInt32 y = 40; y < YRES; ++y) {
+        for (XnUInt32 x = 0; x < XRES; ++x) {
+            if ((x % 16) < 12) {
+                labels[y * XRES + x] = (XnLabel)(x / 16 + 1);
+            }
+        }
+    }
+    std::vector<XnRGB24Pixel> rgb(XRES * YRES);
+    
+    LabelPalette palette(Colors, sizeof(Colors) / sizeof(Colors[0]));
+    LabelRuns runs;
+    XnUInt64 begin, end;
+    xnOSGetHighResTimeStamp(&begin);
+    for (int f = 0; f < FRAMES; ++f) {
+        runs.encode(&labels[0], XRES, YRES);
+        palette.update(runs);
+        palette.fill(runs, &rgb[0]);
+    }
+    xnOSGetHighResTimeStamp(&end);
+    
+    std::cout << "palette : " << ((end - begin) / 1000.0 / FRAMES) << " ms/frame, " <<
+        LABELS << " labels, " << runs.size() << " runs, " << palette.size() << " colors" <<
+        std::endl;
+}
+
 int main (int argc, char * argv[])
 {
+    // 速度計測モード
+    if ((argc > 1) && (std::string(argv[1]) == "bench")) {
+        benchmark();
+        return 0;
+    }
+    
     IplImage* camera = 0;
     
     try {
@@ -56,18 +114,14 @@ int main (int argc, char * argv[])
         }
         
         // ラベルによる色分け
-        const XnRGB24Pixel colors[] = {
-            { 0, 0, 0 },
-            { 255, 0, 0 },
-            { 0, 255, 0 },
-            { 0, 0, 255 },
-            { 255, 255, 0 },
-            { 255, 0, 255 },
-            { 0, 255, 255 },
-            { 255, 255, 255 },
-        };
+        //  足りない色はラベルから作る
+        LabelPalette palette(Colors, sizeof(Colors) / sizeof(Colors[0]));
+        
+        // シーンのラベル(ランレングス)
+        LabelRuns runs;
         
-        const int colorsCount = sizeof(colors) / sizeof(colors[0]);
+        // 左右反転はドライバに頼まず、表示用にコピーするときに行う
+        bool mirror = false;
         
         // メインループ
         while (1) {
@@ -80,28 +134,17 @@ int main (int argc, char * argv[])
             xn::SceneMetaData sceneMD;
             scene.GetMetaData(sceneMD);
 
-            // ラベルの色で上書き
-            const xn::LabelMap& labels = sceneMD.LabelMap();
-            xn::RGB24Map& rgb = imageMD.WritableRGB24Map();
-            
-            for (XnUInt y = 0; y < imageMD.YRes(); ++y) {
-                for (XnUInt x = 0; x < imageMD.XRes(); ++x) {
-                    XnLabel label = labels(x, y);
-                    if ( label != 0 ) {
-                        if (label < colorsCount) {
-                            rgb(x, y) = colors[label];
-                        }
-                        else {
-                            std::cout << label << ", ";
-                        }
-                    }
-                }
-            }
+            // カメラ画像をコピーして、ラベルの色で上書き(ラベルのある区間だけ塗る)
+            //  新しいラベルはフレームごとにまとめて表示する
+            XnRGB24Pixel* pixels = (XnRGB24Pixel*)camera->imageData;
+            copyPixels(imageMD.RGB24Data(), pixels, imageMD.XRes(), imageMD.YRes(), mirror);
+            runs.encode(sceneMD);
+            palette.update(runs);
+            palette.fill(runs, pixels, mirror);
+            palette.report(std::cout);
             
             // カメラ画像の表示
             //  Kinectからの入力がBGRであるため、RGBに変換して表示する
-            // イメージをデプスマップで上書きする
-            memcpy(camera->imageData, imageMD.RGB24Data(), camera->imageSize);
             ::cvCvtColor(camera, camera, CV_RGB2BGR);
             ::cvShowImage("KinectImage", camera);
             
@@ -112,7 +155,7 @@ int main (int argc, char * argv[])
             }
             // 反転する
             else if (key == 'm') {
-                context.SetGlobalMirror(!context.GetGlobalMirror());
+                mirror = !mirror;
             }
         }
     }
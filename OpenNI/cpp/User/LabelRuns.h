@@ -0,0 +1,371 @@
+#ifndef LABELRUNS_H_INCLUDE
+#define LABELRUNS_H_INCLUDE
+
+#include <vector>
+#include <algorithm>
+#include <istream>
+#include <ostream>
+#include <cstring>
+
+#include <XnCppWrapper.h>
+
+// ラベルマップの1行の中の連続区間
+struct LabelRun
+{
+  XnUInt16  start;
+  XnUInt16  length;
+  XnLabel   label;
+};
+
+// ランレングスで持つラベルマップ
+//  ほとんどの画素はラベル0なので、0以外の連続区間だけを行ごとに持つ。
+//  フレームごとに1回作り、合成やマスクの処理は画素ではなく区間ごとに行う
+class LabelRuns
+{
+public:
+
+  LabelRuns()
+    :frameID(0), timestamp(0), xRes_(0), yRes_(0), lastRow_(0)
+  {
+    rowBegin_.push_back(0);
+  }
+
+  // シーンのラベルマップから作る
+  void encode(const xn::SceneMetaData& sceneMD)
+  {
+    encode(sceneMD.Data(), sceneMD.XRes(), sceneMD.YRes());
+    frameID = sceneMD.FrameID();
+    timestamp = sceneMD.Timestamp();
+  }
+
+  void encode(const XnLabel* labels, XnUInt32 xRes, XnUInt32 yRes)
+  {
+    reset(xRes, yRes);
+    for (XnUInt32 y = 0; y < yRes; ++y) {
+      rowBegin_[y] = (XnUInt32)runs_.size();
+
+      const XnLabel* row = labels + y * xRes;
+      XnUInt32 x = 0;
+      while (x < xRes) {
+        // ラベル0の区間は4画素ずつ読み飛ばす
+        while ((x + 4) <= xRes) {
+          XnUInt64 four;
+          memcpy(&four, row + x, sizeof(four));
+          if (four != 0) {
+            break;
+          }
+          x += 4;
+        }
+        while ((x < xRes) && (row[x] == 0)) {
+          ++x;
+        }
+        if (x == xRes) {
+          break;
+        }
+
+        LabelRun run = { (XnUInt16)x, 0, row[x] };
+        for (++x; (x < xRes) && (row[x] == run.label); ++x) {
+        }
+        run.length = (XnUInt16)(x - run.start);
+        runs_.push_back(run);
+      }
+    }
+    rowBegin_[yRes] = (XnUInt32)runs_.size();
+    lastRow_ = yRes + 1;
+  }
+
+  // 画素ごとのラベルマップに戻す
+  void decode(XnLabel* labels) const
+  {
+    memset(labels, 0, xRes_ * yRes_ * sizeof(XnLabel));
+    for (XnUInt32 y = 0; y < yRes_; ++y) {
+      XnLabel* row = labels + y * xRes_;
+      for (const LabelRun* run = begin(y); run != end(y); ++run) {
+        for (XnUInt32 x = run->start; x < (XnUInt32)(run->start + run->length); ++x) {
+          row[x] = run->label;
+        }
+      }
+    }
+  }
+
+  // 区間を直接追加して作る(reset → 行の順にappend → close)
+  void reset(XnUInt32 xRes, XnUInt32 yRes)
+  {
+    xRes_ = xRes;
+    yRes_ = yRes;
+    runs_.clear();
+    rowBegin_.assign(yRes + 1, 0);
+    lastRow_ = 0;
+  }
+
+  void append(XnUInt32 y, XnUInt32 start, XnUInt32 length, XnLabel label)
+  {
+    for (; lastRow_ <= y; ++lastRow_) {
+      rowBegin_[lastRow_] = (XnUInt32)runs_.size();
+    }
+
+    LabelRun run = { (XnUInt16)start, (XnUInt16)length, label };
+    runs_.push_back(run);
+  }
+
+  void close()
+  {
+    for (; lastRow_ <= yRes_; ++lastRow_) {
+      rowBegin_[lastRow_] = (XnUInt32)runs_.size();
+    }
+  }
+
+  // 指定したラベルの区間だけを取り出す
+  void select(const LabelRuns& src, XnLabel label)
+  {
+    reset(src.xRes_, src.yRes_);
+    frameID = src.frameID;
+    timestamp = src.timestamp;
+    for (XnUInt32 y = 0; y < yRes_; ++y) {
+      rowBegin_[y] = (XnUInt32)runs_.size();
+      for (const LabelRun* run = src.begin(y); run != src.end(y); ++run) {
+        if (run->label == label) {
+          runs_.push_back(*run);
+        }
+      }
+    }
+    rowBegin_[yRes_] = (XnUInt32)runs_.size();
+    lastRow_ = yRes_ + 1;
+  }
+
+  // 画素数(labelが0ならすべてのユーザー)
+  XnUInt32 pixels(XnLabel label = 0) const
+  {
+    XnUInt32 count = 0;
+    for (std::vector<LabelRun>::const_iterator it = runs_.begin(); it != runs_.end(); ++it) {
+      if ((label == 0) || (it->label == label)) {
+        count += it->length;
+      }
+    }
+    return count;
+  }
+
+  // y行目の区間
+  const LabelRun* begin(XnUInt32 y) const
+  {
+    return data() + rowBegin_[y];
+  }
+
+  const LabelRun* end(XnUInt32 y) const
+  {
+    return data() + rowBegin_[y + 1];
+  }
+
+  XnUInt32 size() const
+  {
+    return (XnUInt32)runs_.size();
+  }
+
+  XnUInt32 xRes() const
+  {
+    return xRes_;
+  }
+
+  XnUInt32 yRes() const
+  {
+    return yRes_;
+  }
+
+  // 記録ファイルの先頭
+  static void writeHeader(std::ostream& out)
+  {
+    const XnUInt32 version = VERSION;
+    out.write(magic(), 4);
+    out.write((const char*)&version, sizeof(version));
+  }
+
+  static bool readHeader(std::istream& in)
+  {
+    char magic[4];
+    XnUInt32 version = 0;
+    in.read(magic, 4);
+    in.read((char*)&version, sizeof(version));
+    return in && (memcmp(magic, LabelRuns::magic(), 4) == 0) && (version == VERSION);
+  }
+
+  // 1フレーム分を記録する
+  //  フレーム番号、タイムスタンプ、解像度、区間数、行ごとの区間数、区間の順
+  //  (バイト順は記録した環境のまま)
+  void write(std::ostream& out) const
+  {
+    const XnUInt16 xRes = (XnUInt16)xRes_, yRes = (XnUInt16)yRes_;
+    const XnUInt32 count = size();
+    out.write((const char*)&frameID, sizeof(frameID));
+    out.write((const char*)&timestamp, sizeof(timestamp));
+    out.write((const char*)&xRes, sizeof(xRes));
+    out.write((const char*)&yRes, sizeof(yRes));
+    out.write((const char*)&count, sizeof(count));
+
+    rowCount_.resize(yRes_);
+    for (XnUInt32 y = 0; y < yRes_; ++y) {
+      rowCount_[y] = (XnUInt16)(rowBegin_[y + 1] - rowBegin_[y]);
+    }
+    if (yRes_ != 0) {
+      out.write((const char*)&rowCount_[0], yRes_ * sizeof(XnUInt16));
+    }
+    if (count != 0) {
+      out.write((const char*)&runs_[0], count * sizeof(LabelRun));
+    }
+  }
+
+  // 1フレーム分を読み込む。ファイルの終わりや不正なデータならfalse
+  bool read(std::istream& in)
+  {
+    XnUInt16 xRes = 0, yRes = 0;
+    XnUInt32 count = 0;
+    in.read((char*)&frameID, sizeof(frameID));
+    in.read((char*)&timestamp, sizeof(timestamp));
+    in.read((char*)&xRes, sizeof(xRes));
+    in.read((char*)&yRes, sizeof(yRes));
+    in.read((char*)&count, sizeof(count));
+    if (!in || (count > (XnUInt32)xRes * yRes)) {
+      return false;
+    }
+
+    reset(xRes, yRes);
+    rowCount_.resize(yRes);
+    runs_.resize(count);
+    if (yRes != 0) {
+      in.read((char*)&rowCount_[0], yRes * sizeof(XnUInt16));
+    }
+    if (count != 0) {
+      in.read((char*)&runs_[0], count * sizeof(LabelRun));
+    }
+    if (!in) {
+      return false;
+    }
+
+    XnUInt32 total = 0;
+    for (XnUInt32 y = 0; y < yRes; ++y) {
+      rowBegin_[y] = total;
+      total += rowCount_[y];
+    }
+    if (total != count) {
+      reset(0, 0);
+      return false;
+    }
+    rowBegin_[yRes] = total;
+    lastRow_ = yRes + 1;
+
+    // 区間は行の中に収まり、ラベルは0以外でなければならない
+    for (XnUInt32 i = 0; i < count; ++i) {
+      const LabelRun& run = runs_[i];
+      if ((run.label == 0) || (run.length == 0) || (((XnUInt32)run.start + run.length) > xRes)) {
+        reset(0, 0);
+        return false;
+      }
+    }
+    return true;
+  }
+
+  XnUInt32  frameID;
+  XnUInt64  timestamp;
+
+private:
+
+  const LabelRun* data() const
+  {
+    return runs_.empty() ? 0 : &runs_[0];
+  }
+
+  static const XnUInt32 VERSION = 1;
+
+  static const char* magic()
+  {
+    return "XNLR";
+  }
+
+  XnUInt32 xRes_;
+  XnUInt32 yRes_;
+  XnUInt32 lastRow_;
+  std::vector<LabelRun> runs_;
+  std::vector<XnUInt32> rowBegin_;            // 行の最初の区間の番号(yRes + 1個)
+  mutable std::vector<XnUInt16> rowCount_;    // 記録用
+};
+
+// 以下の関数の mirror は、dstを左右反転した画像として書く(反転のためにもう一度画像をなめない)。
+// 区間の位置はセンサーの座標のまま
+
+// 区間のdstでの開始位置
+inline XnUInt32 runStart(const LabelRuns& runs, const LabelRun& run, bool mirror)
+{
+  return mirror ? (runs.xRes() - run.start - run.length) : run.start;
+}
+
+// 画像全体をコピーする
+inline void copyPixels(const XnRGB24Pixel* src, XnRGB24Pixel* dst,
+                       XnUInt32 xRes, XnUInt32 yRes, bool mirror = false)
+{
+  if (!mirror) {
+    memcpy(dst, src, xRes * yRes * sizeof(XnRGB24Pixel));
+    return;
+  }
+
+  for (XnUInt32 y = 0; y < yRes; ++y) {
+    const XnRGB24Pixel* row = src + y * xRes;
+    std::reverse_copy(row, row + xRes, dst + y * xRes);
+  }
+}
+
+// 区間の部分だけ、srcの画素をdstにコピーする
+inline void copyRuns(const LabelRuns& runs, const XnRGB24Pixel* src, XnRGB24Pixel* dst,
+                     bool mirror = false)
+{
+  for (XnUInt32 y = 0; y < runs.yRes(); ++y) {
+    const XnUInt32 row = y * runs.xRes();
+    for (const LabelRun* run = runs.begin(y); run != runs.end(y); ++run) {
+      const XnRGB24Pixel* s = src + row + run->start;
+      if (mirror) {
+        std::reverse_copy(s, s + run->length, dst + row + runStart(runs, *run, true));
+      }
+      else {
+        memcpy(dst + row + run->start, s, run->length * sizeof(XnRGB24Pixel));
+      }
+    }
+  }
+}
+
+// 区間の部分を、ラベルごとの色で塗る(パレットにないラベルは塗らない)
+inline void fillRuns(const LabelRuns& runs, const XnRGB24Pixel* palette, XnUInt32 count,
+                     XnRGB24Pixel* dst, bool mirror = false)
+{
+  for (XnUInt32 y = 0; y < runs.yRes(); ++y) {
+    XnRGB24Pixel* row = dst + y * runs.xRes();
+    for (const LabelRun* run = runs.begin(y); run != runs.end(y); ++run) {
+      if (run->label < count) {
+        XnRGB24Pixel* start = row + runStart(runs, *run, mirror);
+        std::fill(start, start + run->length, palette[run->label]);
+      }
+    }
+  }
+}
+
+// 区間の部分に、ラベルごとの色をかける(colors[0]はユーザーなし。足りなければ繰り返す)
+inline void tintRuns(const LabelRuns& runs, const XnFloat (*colors)[3], XnUInt32 count,
+                     XnRGB24Pixel* dst, bool mirror = false)
+{
+  // colors[0]は背景用なので、ユーザーの色が1つもなければ何もしない
+  if (count <= 1) {
+    return;
+  }
+
+  for (XnUInt32 y = 0; y < runs.yRes(); ++y) {
+    XnRGB24Pixel* row = dst + y * runs.xRes();
+    for (const LabelRun* run = runs.begin(y); run != runs.end(y); ++run) {
+      const XnFloat* color = colors[((run->label - 1) % (count - 1)) + 1];
+      XnRGB24Pixel* pixel = row + runStart(runs, *run, mirror);
+      for (XnUInt32 i = 0; i < run->length; ++i, ++pixel) {
+        pixel->nRed   = (XnUInt8)(pixel->nRed   * color[0]);
+        pixel->nGreen = (XnUInt8)(pixel->nGreen * color[1]);
+        pixel->nBlue  = (XnUInt8)(pixel->nBlue  * color[2]);
+      }
+    }
+  }
+}
+
+#endif // #ifndef LABELRUNS_H_INCLUDE
@@ -0,0 +1,243 @@
+#ifndef LABELSTATS_H_INCLUDE
+#define LABELSTATS_H_INCLUDE
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+
+#include <XnCppWrapper.h>
+
+#include "LabelRuns.h"
+
+// ラベル(ユーザー)ごとの統計
+struct LabelStat
+{
+  XnLabel       label;
+  XnUInt32      pixels;       // 画素数
+  XnUInt16      left;         // 外接矩形(right/bottomも含む)
+  XnUInt16      top;
+  XnUInt16      right;
+  XnUInt16      bottom;
+  XnPoint3D     center;       // 画面上の重心と、デプスの平均(mm)。デプスがなければZは0
+  XnUInt32      depthPixels;  // デプスのある画素数
+  XnDepthPixel  minDepth;
+  XnDepthPixel  maxDepth;
+
+  XnUInt32 width() const
+  {
+    return right - left + 1;
+  }
+
+  XnUInt32 height() const
+  {
+    return bottom - top + 1;
+  }
+};
+
+// ラベルマップを1回なめて、ラベルごとの外接矩形、画素数、重心、デプスの範囲を求める
+//  結果は見つかったラベルだけを、ラベルの小さい順に持つ
+class LabelStats
+{
+public:
+
+  LabelStats()
+    :maxLabel_(0)
+  {
+  }
+
+  // デプスなし
+  void compute(const xn::SceneMetaData& sceneMD)
+  {
+    compute(sceneMD.Data(), 0, sceneMD.XRes(), sceneMD.YRes());
+  }
+
+  // デプスの視点をシーンと同じにしておくこと
+  void compute(const xn::SceneMetaData& sceneMD, const xn::DepthMetaData& depthMD)
+  {
+    compute(sceneMD.Data(), depthMD.Data(), sceneMD.XRes(), sceneMD.YRes());
+  }
+
+  // 画素ごとのラベルマップから求める(pDepthは0でもよい)
+  void compute(const XnLabel* labels, const XnDepthPixel* pDepth, XnUInt32 xRes, XnUInt32 yRes)
+  {
+    begin();
+    for (XnUInt32 y = 0; y < yRes; ++y) {
+      const XnLabel* row = labels + y * xRes;
+      const XnDepthPixel* depth = (pDepth != 0) ? (pDepth + y * xRes) : 0;
+
+      XnUInt32 x = 0;
+      while (x < xRes) {
+        // ラベル0の区間は4画素ずつ読み飛ばす
+        while ((x + 4) <= xRes) {
+          XnUInt64 four;
+          memcpy(&four, row + x, sizeof(four));
+          if (four != 0) {
+            break;
+          }
+          x += 4;
+        }
+        while ((x < xRes) && (row[x] == 0)) {
+          ++x;
+        }
+        if (x == xRes) {
+          break;
+        }
+
+        const XnUInt32 start = x;
+        const XnLabel label = row[x];
+        for (++x; (x < xRes) && (row[x] == label); ++x) {
+        }
+        add(label, y, start, x, depth);
+      }
+    }
+    end();
+  }
+
+  // ランレングスのラベルマップから求める(pDepthは0でもよい)
+  void compute(const LabelRuns& runs, const XnDepthPixel* pDepth)
+  {
+    begin();
+    for (XnUInt32 y = 0; y < runs.yRes(); ++y) {
+      const XnDepthPixel* depth = (pDepth != 0) ? (pDepth + y * runs.xRes()) : 0;
+      for (const LabelRun* run = runs.begin(y); run != runs.end(y); ++run) {
+        add(run->label, y, run->start, run->start + run->length, depth);
+      }
+    }
+    end();
+  }
+
+  XnUInt32 size() const
+  {
+    return (XnUInt32)stats_.size();
+  }
+
+  const LabelStat& operator[](XnUInt32 index) const
+  {
+    return stats_[index];
+  }
+
+  // ラベルの統計(なければ0)
+  const LabelStat* find(XnLabel label) const
+  {
+    for (std::vector<LabelStat>::const_iterator it = stats_.begin(); it != stats_.end(); ++it) {
+      if (it->label == label) {
+        return &*it;
+      }
+    }
+    return 0;
+  }
+
+private:
+
+  // 集計中の値(ラベルを添字にする)
+  struct Accumulator
+  {
+    XnUInt32      pixels;
+    XnUInt32      left;
+    XnUInt32      top;
+    XnUInt32      right;
+    XnUInt32      bottom;
+    XnUInt64      sumX;
+    XnUInt64      sumY;
+    XnUInt64      sumDepth;
+    XnUInt32      depthPixels;
+    XnDepthPixel  minDepth;
+    XnDepthPixel  maxDepth;
+  };
+
+  void begin()
+  {
+    // 前回使ったラベルだけ初期化する
+    for (std::vector<LabelStat>::const_iterator it = stats_.begin(); it != stats_.end(); ++it) {
+      acc_[it->label].pixels = 0;
+    }
+    stats_.clear();
+    maxLabel_ = 0;
+  }
+
+  // 1行の中の同じラベルの区間 [start, end) を加える
+  void add(XnLabel label, XnUInt32 y, XnUInt32 start, XnUInt32 end,
+           const XnDepthPixel* depth)
+  {
+    if (label >= acc_.size()) {
+      Accumulator zero;
+      memset(&zero, 0, sizeof(zero));
+      acc_.resize(label + 1, zero);
+    }
+
+    Accumulator& a = acc_[label];
+    const XnUInt32 length = end - start;
+    if (a.pixels == 0) {
+      a.left = start;
+      a.top = y;
+      a.right = end - 1;
+      a.sumX = a.sumY = a.sumDepth = 0;
+      a.depthPixels = 0;
+      a.minDepth = 0xFFFF;
+      a.maxDepth = 0;
+      maxLabel_ = std::max<XnUInt32>(maxLabel_, label);
+    }
+    else {
+      a.left = std::min(a.left, start);
+      a.right = std::max(a.right, end - 1);
+    }
+    a.bottom = y;
+    a.pixels += length;
+    a.sumX += (XnUInt64)(start + end - 1) * length / 2;
+    a.sumY += (XnUInt64)y * length;
+
+    if (depth != 0) {
+      XnUInt32 sum = 0, count = 0;
+      XnDepthPixel minDepth = a.minDepth, maxDepth = a.maxDepth;
+      for (XnUInt32 x = start; x < end; ++x) {
+        const XnDepthPixel d = depth[x];
+        if (d != 0) {
+          sum += d;
+          ++count;
+          minDepth = std::min(minDepth, d);
+          maxDepth = std::max(maxDepth, d);
+        }
+      }
+      a.sumDepth += sum;
+      a.depthPixels += count;
+      a.minDepth = minDepth;
+      a.maxDepth = maxDepth;
+    }
+  }
+
+  // 見つかったラベルを表にまとめる
+  void end()
+  {
+    if (acc_.empty()) {
+      return;
+    }
+
+    for (XnUInt32 label = 1; label <= maxLabel_; ++label) {
+      const Accumulator& a = acc_[label];
+      if (a.pixels == 0) {
+        continue;
+      }
+
+      LabelStat stat;
+      stat.label = (XnLabel)label;
+      stat.pixels = a.pixels;
+      stat.left = (XnUInt16)a.left;
+      stat.top = (XnUInt16)a.top;
+      stat.right = (XnUInt16)a.right;
+      stat.bottom = (XnUInt16)a.bottom;
+      stat.center.X = (XnFloat)((double)a.sumX / a.pixels);
+      stat.center.Y = (XnFloat)((double)a.sumY / a.pixels);
+      stat.center.Z = (a.depthPixels != 0) ? (XnFloat)((double)a.sumDepth / a.depthPixels) : 0;
+      stat.depthPixels = a.depthPixels;
+      stat.minDepth = (a.depthPixels != 0) ? a.minDepth : 0;
+      stat.maxDepth = a.maxDepth;
+      stats_.push_back(stat);
+    }
+  }
+
+  std::vector<Accumulator> acc_;
+  std::vector<LabelStat> stats_;
+  XnUInt32 maxLabel_;
+};
+
+#endif // #ifndef LABELSTATS_H_INCLUDE
@@ -1,13 +1,19 @@
 // Windows の場合はReleaseコンパイルにすると
 // 現実的な速度で動作します
 #include <iostream>
+#include <sstream>
 #include <stdexcept>
+#include <string>
 #include <vector>
 
 #include <opencv/cv.h>
 #include <opencv/highgui.h>
 
 #include <XnCppWrapper.h>
+#include <XnOS.h>
+
+#include "LabelRuns.h"
+#include "LabelStats.h"
 
 // 設定ファイルのパス(環境に合わせて変更してください)
 #if (XN_PLATFORM == XN_PLATFORM_WIN32)
@@ -51,8 +57,133 @@ inline XnRGB24Pixel xnRGB24Pixel( int r, int g, int b )
   return pixel;
 }
 
+// 合成したラベルマップで、画素ごとの合成とランレングスでの合成の速度を比べる
+void benchmark()
+{
+  const XnUInt32 XRES = 640;
+  const XnUInt32 YRES = 480;
+  const int FRAMES = 300;
+  const XnUInt32 colorsCount = sizeof(Colors) / sizeof(Colors[0]);
+
+  // 2人のユーザー(画面の1割程度)
+  std::vector<XnLabel> labels(XRES * YRES, 0);
+  for (XnUInt32 y = 120; y < 460; ++y) {
+    for (XnUInt32 x = 0; x < 45; ++x) {
+      labels[y * XRES + 150 + x] = 1;
+      labels[y * XRES + 420 + x] = 2;
+    }
+  }
+
+  std::vector<XnRGB24Pixel> rgb(XRES * YRES);
+  for (XnUInt32 i = 0; i < rgb.size(); ++i) {
+    rgb[i] = xnRGB24Pixel(i % 256, (i / XRES) % 256, 128);
+  }
+  std::vector<XnRGB24Pixel> dense(XRES * YRES), sparse(XRES * YRES);
+
+  // 画素ごと
+  XnUInt64 begin, end;
+  xnOSGetHighResTimeStamp(&begin);
+  for (int f = 0; f < FRAMES; ++f) {
+    char* dest = (char*)&dense[0];
+    for (XnUInt32 i = 0; i < XRES * YRES; ++i) {
+      XnLabel label = labels[i];
+      dest[0] = rgb[i].nRed   * Colors[label][0];
+      dest[1] = rgb[i].nGreen * Colors[label][1];
+      dest[2] = rgb[i].nBlue  * Colors[label][2];
+      dest += 3;
+    }
+  }
+  xnOSGetHighResTimeStamp(&end);
+  double denseTime = (end - begin) / 1000.0 / FRAMES;
+
+  // ランレングス(作成も含む)
+  LabelRuns runs;
+  xnOSGetHighResTimeStamp(&begin);
+  for (int f = 0; f < FRAMES; ++f) {
+    runs.encode(&labels[0], XRES, YRES);
+    memcpy(&sparse[0], &rgb[0], rgb.size() * sizeof(XnRGB24Pixel));
+    tintRuns(runs, Colors, colorsCount, &sparse[0]);
+  }
+  xnOSGetHighResTimeStamp(&end);
+  double sparseTime = (end - begin) / 1000.0 / FRAMES;
+
+  // ラベル0の画素は触らないので、マスクの操作だけの速度も測る
+  xnOSGetHighResTimeStamp(&begin);
+  XnUInt32 pixels = 0;
+  for (int f = 0; f < FRAMES; ++f) {
+    runs.encode(&labels[0], XRES, YRES);
+    pixels += runs.pixels();
+  }
+  xnOSGetHighResTimeStamp(&end);
+  double encodeTime = (end - begin) / 1000.0 / FRAMES;
+
+  std::cout << "dense : " << denseTime << " ms/frame" << std::endl;
+  std::cout << "runs  : " << sparseTime << " ms/frame (encode " << encodeTime << " ms, " <<
+    runs.size() << " runs, " << (runs.size() * sizeof(LabelRun)) << " bytes, " <<
+    (pixels / FRAMES) << " pixels)" << std::endl;
+  std::cout << "same result : " <<
+    (memcmp(&dense[0], &sparse[0], dense.size() * sizeof(XnRGB24Pixel)) == 0) << std::endl;
+
+  // 記録したフレームは読み戻せ、行からはみ出す区間のある壊れたフレームは読み込まない
+  {
+    std::stringstream file;
+    runs.write(file);
+    std::string frame = file.str();
+
+    LabelRuns loaded;
+    std::stringstream good(frame);
+    bool isLoaded = loaded.read(good) && (loaded.pixels() == runs.pixels());
+
+    LabelRun run;
+    const std::string::size_type offset = frame.size() - sizeof(LabelRun);
+    memcpy(&run, &frame[offset], sizeof(run));
+    run.start = (XnUInt16)(XRES - run.length + 1);
+    memcpy(&frame[offset], &run, sizeof(run));
+    std::stringstream broken(frame);
+    bool isRejected = !loaded.read(broken) && (loaded.size() == 0);
+
+    std::cout << "read back : " << isLoaded << ", reject broken : " << isRejected << std::endl;
+  }
+
+  // ユーザーごとの統計(外接矩形、重心、デプスの範囲)
+  std::vector<XnDepthPixel> depth(XRES * YRES);
+  for (XnUInt32 i = 0; i < depth.size(); ++i) {
+    depth[i] = (XnDepthPixel)(1000 + (i % XRES));
+  }
+
+  LabelStats stats;
+  xnOSGetHighResTimeStamp(&begin);
+  for (int f = 0; f < FRAMES; ++f) {
+    stats.compute(&labels[0], &depth[0], XRES, YRES);
+  }
+  xnOSGetHighResTimeStamp(&end);
+  double statsTime = (end - begin) / 1000.0 / FRAMES;
+
+  xnOSGetHighResTimeStamp(&begin);
+  for (int f = 0; f < FRAMES; ++f) {
+    stats.compute(runs, &depth[0]);
+  }
+  xnOSGetHighResTimeStamp(&end);
+  double runStatsTime = (end - begin) / 1000.0 / FRAMES;
+
+  std::cout << "stats : " << statsTime << " ms/frame (from runs " << runStatsTime << " ms)" << std::endl;
+  for (XnUInt32 i = 0; i < stats.size(); ++i) {
+    const LabelStat& s = stats[i];
+    std::cout << "  " << s.label << " : " << s.pixels << " pixels, (" <<
+      s.left << "," << s.top << ")-(" << s.right << "," << s.bottom << "), center (" <<
+      s.center.X << "," << s.center.Y << "," << s.center.Z << "), depth " <<
+      s.minDepth << "-" << s.maxDepth << std::endl;
+  }
+}
+
 int main (int argc, char * argv[])
 {
+  // 速度計測モード
+  if ((argc > 1) && (std::string(argv[1]) == "bench")) {
+    benchmark();
+    return 0;
+  }
+
   IplImage* camera = 0;
 
   try {
@@ -109,10 +240,21 @@ int main (int argc, char * argv[])
       throw std::runtime_error("error : cvCreateImage");
     }
 
+    // 統計表示用のフォント
+    CvFont font;
+    ::cvInitFont(&font, CV_FONT_HERSHEY_SIMPLEX, 0.5, 0.5);
+
     // 表示状態
     bool isShowImage = true;
     bool isShowUser = true;
 
+    bool isShowStats = false;
+
+    // ユーザーのラベル(ランレングス)と統計
+    LabelRuns runs;
+    LabelStats stats;
+    const XnUInt32 colorsCount = sizeof(Colors) / sizeof(Colors[0]);
+
     // メインループ
     while (1) {
       // すべてのノードの更新を待つ
@@ -126,32 +268,43 @@ int main (int argc, char * argv[])
       xn::SceneMetaData sceneMD;
       user.GetUserPixels(0, sceneMD);
 
+      xn::DepthMetaData depthMD;
+      depth.GetMetaData(depthMD);
+
       // カメラ画像の表示
-      char* dest = camera->imageData;
-      const xn::RGB24Map& rgb = imageMD.RGB24Map();
-      for (int y = 0; y < imageMD.YRes(); ++y) {
-        for (int x = 0; x < imageMD.XRes(); ++x) {
-          // ユーザー表示
-          XnLabel label = sceneMD(x, y);
-          if (!isShowUser) {
-            label = 0;
-          }
-
-          // カメラ画像の表示
-          XnRGB24Pixel pixel = rgb(x, y);
-          if (!isShowImage) {
-            pixel = xnRGB24Pixel( 255, 255, 255 );
-          }
-
-          // 出力先に描画
-          dest[0] = pixel.nRed   * Colors[label][0];
-          dest[1] = pixel.nGreen * Colors[label][1];
-          dest[2] = pixel.nBlue  * Colors[label][2];
-          dest += 3;
-        }
+      if (isShowImage) {
+        memcpy(camera->imageData, imageMD.RGB24Data(), camera->imageSize);
+      }
+      else {
+        memset(camera->imageData, 255, camera->imageSize);
+      }
+
+      // ユーザー表示(ユーザーのいる区間だけ色をかける)
+      if (isShowUser || isShowStats) {
+        runs.encode(sceneMD);
+      }
+      if (isShowUser) {
+        tintRuns(runs, Colors, colorsCount, (XnRGB24Pixel*)camera->imageData);
       }
 
       ::cvCvtColor(camera, camera, CV_BGR2RGB);
+
+      // ユーザーの外接矩形と重心、デプスの範囲
+      if (isShowStats) {
+        stats.compute(runs, depthMD.Data());
+        for (XnUInt32 i = 0; i < stats.size(); ++i) {
+          const LabelStat& s = stats[i];
+          ::cvRectangle(camera, cvPoint(s.left, s.top), cvPoint(s.right, s.bottom),
+            CV_RGB(255, 255, 0), 2);
+          ::cvCircle(camera, cvPoint((int)s.center.X, (int)s.center.Y), 5,
+            CV_RGB(255, 0, 0), -1);
+
+          std::stringstream ss;
+          ss << s.label << ": " << s.minDepth << "-" << s.maxDepth << "mm";
+          ::cvPutText(camera, ss.str().c_str(), cvPoint(s.left, s.top + 16), &font,
+            CV_RGB(255, 255, 0));
+        }
+      }
       ::cvShowImage("KinectImage", camera);
 
       // キーイベント
@@ -167,6 +320,9 @@ int main (int argc, char * argv[])
       else if (key == 'u') {
         isShowUser = !isShowUser;
       }
+      else if (key == 'b') {
+        isShowStats = !isShowStats;
+      }
     }
 
     // 登録したコールバックの削除
@@ -28,12 +28,13 @@ void XN_CALLBACK_TYPE ViewPointChange(xn::ProductionNode &node, void *pCookie)
 }
 
 // デプスのヒストグラムを作成
-depth_hist getDepthHistgram(const xn::DepthGenerator& depth,
-                            const xn::DepthMetaData& depthMD)
+//  毎フレーム確保しないよう、呼び出し側のdepthHistを使いまわす
+void getDepthHistgram(const xn::DepthGenerator& depth,
+                      const xn::DepthMetaData& depthMD, depth_hist& depthHist)
 {
   // デプスの傾向を計算する(アルゴリズムはNiSimpleViewer.cppを利用)
   const int MAX_DEPTH = depth.GetDeviceMaxDepth();
-  depth_hist depthHist(MAX_DEPTH);
+  depthHist.assign(MAX_DEPTH, 0);
 
   unsigned int points = 0;
   const XnDepthPixel* pDepth = depthMD.Data();
@@ -56,8 +57,6 @@ depth_hist getDepthHistgram(const xn::DepthGenerator& depth,
         (unsigned int)(256 * (1.0f - (depthHist[i] / points)));
     }
   }
-
-  return depthHist;
 }
 
 int main (int argc, char * argv[])
@@ -109,19 +108,21 @@ int main (int argc, char * argv[])
       throw std::runtime_error("error : cvCreateImage");
     }
 
+    // フレームごとに作り直さずに使いまわす
+    xn::DepthMetaData depthMD;
+    depth_hist depthHist;
+
     // メインループ
     while (1) {
       // すべての更新を待ち、画像およびデプスデータを取得する
       context.WaitAndUpdateAll();
 
-      xn::ImageMetaData imageMD;
       image.GetMetaData(imageMD);
 
-      xn::DepthMetaData depthMD;
       depth.GetMetaData(depthMD);
 
       // デプスマップの作成
-      depth_hist depthHist = getDepthHistgram(depth, depthMD);
+      getDepthHistgram(depth, depthMD, depthHist);
 
       // イメージをデプスマップで上書きする
       xn::RGB24Map& rgb = imageMD.WritableRGB24Map();
@@ -1,11 +1,15 @@
+#include <algorithm>
 #include <iostream>
 #include <stdexcept>
+#include <vector>
 
 #include <opencv/cv.h>
 #include <opencv/highgui.h>
 
 #include <XnCppWrapper.h>
 
+#include "../../../OpenNI/cpp/User/LabelStats.h"
+
 // 設定ファイルのパス(環境に合わせて変更してください)
 #if (XN_PLATFORM == XN_PLATFORM_WIN32)
 const char* CONFIG_XML_PATH = "../../../Data/SamplesConfig.xml";
@@ -21,6 +25,43 @@ const char* CONFIG_XML_PATH = "Data/SamplesConfig.xml";
 const char* FACE_CASCADE_PATH = "/usr/local/share/opencv/haarcascades/haarcascade_frontalface_alt.xml";
 #endif
 
+// ユーザーの外接矩形から、顔を探す範囲(上の方の、幅と同じ高さまで)を求める
+CvRect headRegion(const LabelStat& stat, int margin, int xRes, int yRes)
+{
+  int left = std::max(0, (int)stat.left - margin);
+  int top = std::max(0, (int)stat.top - margin);
+  int right = std::min(xRes, (int)stat.right + margin + 1);
+  int bottom = std::min(yRes, top + (int)std::min(stat.width(), stat.height()) + margin * 2);
+  return cvRect(left, top, right - left, bottom - top);
+}
+
+// 画像のroiの中で顔を探して、見つかった顔をfacesに追加する
+//  (描画はしないので、ほかの範囲の検出に枠が映り込まない)
+void detectFaces(IplImage* camera, CvHaarClassifierCascade* faceCascade,
+  CvMemStorage* storage, CvRect roi, std::vector<CvRect>& faces)
+{
+  ::cvSetImageROI(camera, roi);
+  CvSeq* found = ::cvHaarDetectObjects(camera, faceCascade, storage);
+  ::cvResetImageROI(camera);
+
+  for ( int i = 0; i < found->total; ++i ) {
+    CvRect rect = *(CvRect*)::cvGetSeqElem( found, i );
+    rect.x += roi.x;
+    rect.y += roi.y;
+    faces.push_back(rect);
+  }
+}
+
+// 矩形をまとめて描画する
+void drawRects(IplImage* camera, const std::vector<CvRect>& rects, CvScalar color, int thickness)
+{
+  for (std::vector<CvRect>::const_iterator it = rects.begin(); it != rects.end(); ++it) {
+    ::cvRectangle(camera, ::cvPoint( it->x, it->y ),
+      ::cvPoint( it->x + it->width, it->y + it->height ),
+      color, thickness );
+  }
+}
+
 int main (int argc, char * argv[])
 {
   IplImage* camera = 0;
@@ -40,6 +81,27 @@ int main (int argc, char * argv[])
       throw std::runtime_error(xnGetStatusString(rc));
     }
 
+    // ユーザーの作成
+    //  ユーザーがいれば、ユーザーの外接矩形の上の方だけで顔を探す
+    xn::DepthGenerator depth;
+    xn::UserGenerator user;
+    rc = context.FindExistingNode(XN_NODE_TYPE_DEPTH, depth);
+    if (rc != XN_STATUS_OK) {
+      std::cout << "DepthGenerator : " << xnGetStatusString(rc) << std::endl;
+    }
+    else {
+      depth.GetAlternativeViewPointCap().SetViewPoint(image);
+      rc = context.FindExistingNode(XN_NODE_TYPE_USER, user);
+      if (rc != XN_STATUS_OK) {
+        std::cout << "UserGenerator : " << xnGetStatusString(rc) << std::endl;
+      }
+    }
+    if (rc != XN_STATUS_OK) {
+      std::cout << "画像全体から顔を探します" << std::endl;
+    }
+    bool isUserRegion = user.IsValid();
+    LabelStats stats;
+
     // カメラサイズのイメージを作成(8bitのRGB)
     XnMapOutputMode outputMode;
     image.GetMapOutputMode(outputMode);
@@ -61,6 +123,10 @@ int main (int argc, char * argv[])
     CvMemStorage* storage = ::cvCreateMemStorage();
     bool isDetected = true;
 
+    // 1フレーム分の顔と探した範囲(すべて検出してから描画する)
+    std::vector<CvRect> faces;
+    std::vector<CvRect> regions;
+
     // メインループ
     while (1) {
       // カメライメージの更新を待ち、画像データを取得する
@@ -77,13 +143,25 @@ int main (int argc, char * argv[])
       // 顔の検出と検出された顔領域の描画
       if (isDetected) {
         cvClearMemStorage(storage);
-        CvSeq* faces = ::cvHaarDetectObjects(camera, faceCascade, storage);
-        for ( int i = 0; i < faces->total; ++i ) {
-          CvRect rect = *(CvRect*)::cvGetSeqElem( faces, i );
-          ::cvRectangle(camera, ::cvPoint( rect.x, rect.y ),
-            ::cvPoint( rect.x + rect.width, rect.y + rect.height ),
-            CV_RGB( 255, 0, 0 ), 3 );
+        faces.clear();
+        regions.clear();
+        if (isUserRegion) {
+          xn::SceneMetaData sceneMD;
+          user.GetUserPixels(0, sceneMD);
+          stats.compute(sceneMD);
+          for (XnUInt32 i = 0; i < stats.size(); ++i) {
+            CvRect roi = headRegion(stats[i], 16, camera->width, camera->height);
+            detectFaces(camera, faceCascade, storage, roi, faces);
+            regions.push_back(roi);
+          }
+        }
+        else {
+          detectFaces(camera, faceCascade, storage,
+            cvRect(0, 0, camera->width, camera->height), faces);
         }
+
+        drawRects(camera, faces, CV_RGB( 255, 0, 0 ), 3);
+        drawRects(camera, regions, CV_RGB( 255, 255, 0 ), 1);
       }
 
       ::cvShowImage("KinectImage", camera);
@@ -98,6 +176,12 @@ int main (int argc, char * argv[])
       else if (key == 'd') {
         isDetected = !isDetected;
       }
+      // ユーザーの範囲だけ/画像全体で探すの切り替え
+      else if (key == 'u') {
+        if (user.IsValid()) {
+          isUserRegion = !isUserRegion;
+        }
+      }
     }
   }
   catch (std::exception& ex) {
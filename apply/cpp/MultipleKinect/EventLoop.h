@@ -0,0 +1,431 @@
+#ifndef EVENTLOOP_H_INCLUDE
+#define EVENTLOOP_H_INCLUDE
+
+#include <vector>
+#include <algorithm>
+#include <ostream>
+#include <stdexcept>
+#include <cerrno>
+
+#include <XnCppWrapper.h>
+#include <XnOS.h>
+
+#if (XN_PLATFORM == XN_PLATFORM_LINUX_X86) || (XN_PLATFORM == XN_PLATFORM_LINUX_ARM)
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#define EVENT_LOOP_USE_EPOLL
+#elif (XN_PLATFORM == XN_PLATFORM_WIN32)
+#include <windows.h>
+#endif
+
+// イベントループ
+//  WaitAndUpdateAll + cvWaitKey(10) で回す代わりに、
+//  ・センサーの新しいフレーム(ドライバのスレッドからの通知)
+//  ・タイマー
+//  ・入力(ファイルディスクリプタから1バイトずつキーとして読む)
+//  を待ち、来たものから登録されたハンドラを呼ぶ。
+//  フレームの元(source)ごとに処理の段(stage)を順に登録しておき、通知が来たら順に呼ぶ。
+//  処理中に同じ元の通知が何回か来ても1回にまとめる(最新のフレームだけを処理する)。
+//  Linuxではすべてを1つのepollで待つ(通知はeventfd、タイマーはtimerfd)。
+//  ほかではXnOSのイベントで待ち、入力は扱わない
+class EventLoop
+{
+public:
+
+  // idはaddSourceやaddTimerが返した番号
+  typedef void (*Handler)(XnUInt32 id, void* cookie);
+  typedef void (*KeyHandler)(int key, void* cookie);
+
+  EventLoop()
+    :isQuit_(false)
+  {
+#ifdef EVENT_LOOP_USE_EPOLL
+    epoll_ = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_ < 0) {
+      throw std::runtime_error("error : epoll_create1");
+    }
+#else
+    XnStatus rc = xnOSCreateEvent(&wakeup_, FALSE);
+    if (rc != XN_STATUS_OK) {
+      throw std::runtime_error(xnGetStatusString(rc));
+    }
+#endif
+  }
+
+  ~EventLoop()
+  {
+    for (size_t i = 0; i < watches_.size(); ++i) {
+      watches_[i].generator.UnregisterFromNewDataAvailable(watches_[i].handle);
+    }
+    for (size_t i = 0; i < sources_.size(); ++i) {
+#ifdef EVENT_LOOP_USE_EPOLL
+      ::close(sources_[i]->fd);
+#endif
+      delete sources_[i];
+    }
+#ifdef EVENT_LOOP_USE_EPOLL
+    for (size_t i = 0; i < timers_.size(); ++i) {
+      ::close(timers_[i].fd);
+    }
+    ::close(epoll_);
+#else
+    xnOSCloseEvent(&wakeup_);
+#endif
+  }
+
+  // フレームの元を作る
+  XnUInt32 addSource()
+  {
+    Source* source = new Source();
+    source->id = (XnUInt32)sources_.size();
+    source->loop = this;
+    source->notifiedAt = 0;
+    source->pending = 0;
+    source->dispatched = 0;
+    source->coalesced = 0;
+    source->latencySum = 0;
+    source->latencyMax = 0;
+#ifdef EVENT_LOOP_USE_EPOLL
+    source->fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (source->fd < 0) {
+      delete source;
+      throw std::runtime_error("error : eventfd");
+    }
+    add(source->fd, SOURCE, source->id);
+#endif
+    sources_.push_back(source);
+    return source->id;
+  }
+
+  // フレームが来たときの処理の段を、呼ぶ順に登録する
+  void addStage(XnUInt32 source, Handler handler, void* cookie = 0)
+  {
+    Callback stage = { handler, cookie };
+    sources_.at(source)->stages.push_back(stage);
+  }
+
+  // ジェネレータに新しいデータが来たら、sourceに通知する
+  //  (1つの元に、同じセンサーのイメージとデプスなど複数をつないでよい)
+  void watch(xn::Generator& generator, XnUInt32 source)
+  {
+    Watch watch;
+    watch.generator = generator;
+    XnStatus rc = generator.RegisterToNewDataAvailable(&EventLoop::onNewData,
+                                                       sources_.at(source), watch.handle);
+    if (rc != XN_STATUS_OK) {
+      throw std::runtime_error(xnGetStatusString(rc));
+    }
+    watches_.push_back(watch);
+  }
+
+  // sourceに新しいフレームが来たことを知らせる(どのスレッドから呼んでもよい)
+  void notify(XnUInt32 source)
+  {
+    notify(sources_[source]);
+  }
+
+  // intervalミリ秒ごとにhandlerを呼ぶ
+  XnUInt32 addTimer(XnUInt32 interval, Handler handler, void* cookie = 0)
+  {
+    Timer timer;
+    timer.id = (XnUInt32)timers_.size();
+    timer.callback.handler = handler;
+    timer.callback.cookie = cookie;
+    timer.interval = (XnUInt64)interval * 1000;
+#ifdef EVENT_LOOP_USE_EPOLL
+    timer.fd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer.fd < 0) {
+      throw std::runtime_error("error : timerfd_create");
+    }
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = interval / 1000;
+    spec.it_interval.tv_nsec = (interval % 1000) * 1000000;
+    spec.it_value = spec.it_interval;
+    ::timerfd_settime(timer.fd, 0, &spec, 0);
+    add(timer.fd, TIMER, timer.id);
+#else
+    xnOSGetHighResTimeStamp(&timer.due);
+    timer.due += timer.interval;
+#endif
+    timers_.push_back(timer);
+    return timer.id;
+  }
+
+  // fdから読んだ1バイトずつをキーとしてhandlerに渡す(標準入力など)
+  //  入力を待てない環境や、epollで待てないfd(通常のファイルや/dev/null)ではfalse
+  bool addInput(int fd, KeyHandler handler, void* cookie = 0)
+  {
+#ifdef EVENT_LOOP_USE_EPOLL
+    Input input = { fd, handler, cookie };
+    if (!tryAdd(fd, INPUT, (XnUInt32)inputs_.size())) {
+      return false;
+    }
+    inputs_.push_back(input);
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  // イベントが来るまで最長timeoutミリ秒(負なら無期限)待ち、来たものを処理する。
+  //  処理したイベントの数を返す
+  int runOnce(int timeout = -1)
+  {
+#ifdef EVENT_LOOP_USE_EPOLL
+    struct epoll_event events[MAX_EVENTS];
+    const int count = ::epoll_wait(epoll_, events, MAX_EVENTS, timeout);
+    for (int i = 0; i < count; ++i) {
+      const XnUInt32 index = (XnUInt32)events[i].data.u64;
+      switch (events[i].data.u64 >> 32) {
+      case SOURCE:
+        {
+          Source* source = sources_[index];
+          XnUInt64 notified = 0;
+          if (::read(source->fd, &notified, sizeof(notified)) == sizeof(notified)) {
+            source->coalesced += (XnUInt32)(notified - 1);
+            dispatch(source);
+          }
+        }
+        break;
+
+      case TIMER:
+        {
+          XnUInt64 expired = 0;
+          if (::read(timers_[index].fd, &expired, sizeof(expired)) == sizeof(expired)) {
+            timers_[index].callback.handler(index, timers_[index].callback.cookie);
+          }
+        }
+        break;
+
+      case INPUT:
+        {
+          Input& input = inputs_[index];
+          char keys[64];
+          const ssize_t length = ::read(input.fd, keys, sizeof(keys));
+          if (length <= 0) {
+            // 閉じられた(読めなくなった)入力は待たない
+            ::epoll_ctl(epoll_, EPOLL_CTL_DEL, input.fd, 0);
+            break;
+          }
+          for (ssize_t k = 0; k < length; ++k) {
+            if ((keys[k] != '\n') && (keys[k] != '\r')) {
+              input.handler((unsigned char)keys[k], input.cookie);
+            }
+          }
+        }
+        break;
+      }
+    }
+    return (count > 0) ? count : 0;
+#else
+    // 一番近いタイマーまでしか待たない
+    XnUInt64 now;
+    xnOSGetHighResTimeStamp(&now);
+    XnUInt64 wait = (timeout < 0) ? (XnUInt64)-1 : (XnUInt64)timeout * 1000;
+    for (size_t i = 0; i < timers_.size(); ++i) {
+      wait = (timers_[i].due > now) ? std::min(wait, timers_[i].due - now) : 0;
+    }
+    if (wait != 0) {
+      xnOSWaitEvent(wakeup_, (wait == (XnUInt64)-1) ? XN_WAIT_INFINITE : (XnUInt32)((wait + 999) / 1000));
+    }
+
+    int count = 0;
+    for (size_t i = 0; i < sources_.size(); ++i) {
+      const XnUInt32 notified = exchange(&sources_[i]->pending, 0);
+      if (notified != 0) {
+        sources_[i]->coalesced += notified - 1;
+        dispatch(sources_[i]);
+        ++count;
+      }
+    }
+    xnOSGetHighResTimeStamp(&now);
+    for (size_t i = 0; i < timers_.size(); ++i) {
+      if (timers_[i].due <= now) {
+        timers_[i].due = now + timers_[i].interval;
+        timers_[i].callback.handler(timers_[i].id, timers_[i].callback.cookie);
+        ++count;
+      }
+    }
+    return count;
+#endif
+  }
+
+  // quit()が呼ばれるまで回す
+  void run()
+  {
+    isQuit_ = false;
+    while (!isQuit_) {
+      runOnce();
+    }
+  }
+
+  // run()を終える(ハンドラの中から呼ぶ)
+  void quit()
+  {
+    isQuit_ = true;
+  }
+
+  bool isQuit() const
+  {
+    return isQuit_;
+  }
+
+  // 元ごとの、通知からハンドラを呼ぶまでの時間と、まとめた通知の数
+  void printStats(std::ostream& out) const
+  {
+    for (size_t i = 0; i < sources_.size(); ++i) {
+      const Source& source = *sources_[i];
+      out << "source " << source.id << " : " << source.dispatched << " frames, " <<
+        source.coalesced << " coalesced, latency avg " <<
+        ((source.dispatched != 0) ? (source.latencySum / 1000.0 / source.dispatched) : 0) <<
+        " ms, max " << (source.latencyMax / 1000.0) << " ms" << std::endl;
+    }
+  }
+
+private:
+
+  EventLoop(const EventLoop&);
+  EventLoop& operator=(const EventLoop&);
+
+  enum Kind { SOURCE, TIMER, INPUT };
+  enum { MAX_EVENTS = 16 };
+
+  struct Callback
+  {
+    Handler handler;
+    void* cookie;
+  };
+
+  struct Source
+  {
+    XnUInt32 id;
+    EventLoop* loop;
+    std::vector<Callback> stages;
+#ifdef EVENT_LOOP_USE_EPOLL
+    int fd;
+#endif
+    volatile XnUInt64 notifiedAt;   // 最後に通知された時刻(us)
+    volatile XnUInt32 pending;      // 処理していない通知の数(epollを使わないとき)
+
+    XnUInt32 dispatched;
+    XnUInt32 coalesced;
+    XnUInt64 latencySum;
+    XnUInt64 latencyMax;
+  };
+
+  struct Timer
+  {
+    XnUInt32 id;
+    Callback callback;
+    XnUInt64 interval;              // us
+#ifdef EVENT_LOOP_USE_EPOLL
+    int fd;
+#else
+    XnUInt64 due;
+#endif
+  };
+
+  struct Input
+  {
+    int fd;
+    KeyHandler handler;
+    void* cookie;
+  };
+
+  struct Watch
+  {
+    xn::Generator generator;
+    XnCallbackHandle handle;
+  };
+
+  static void XN_CALLBACK_TYPE onNewData(xn::ProductionNode& node, void* cookie)
+  {
+    Source* source = (Source*)cookie;
+    source->loop->notify(source);
+  }
+
+  void notify(Source* source)
+  {
+    XnUInt64 now;
+    xnOSGetHighResTimeStamp(&now);
+    source->notifiedAt = now;
+#ifdef EVENT_LOOP_USE_EPOLL
+    const XnUInt64 one = 1;
+    ssize_t written = ::write(source->fd, &one, sizeof(one));
+    (void)written;
+#else
+    increment(&source->pending);
+    xnOSSetEvent(wakeup_);
+#endif
+  }
+
+  void dispatch(Source* source)
+  {
+    XnUInt64 now;
+    xnOSGetHighResTimeStamp(&now);
+    const XnUInt64 latency = (now > source->notifiedAt) ? (now - source->notifiedAt) : 0;
+    source->latencySum += latency;
+    source->latencyMax = std::max(source->latencyMax, latency);
+    ++source->dispatched;
+
+    for (size_t i = 0; i < source->stages.size(); ++i) {
+      source->stages[i].handler(source->id, source->stages[i].cookie);
+    }
+  }
+
+#ifdef EVENT_LOOP_USE_EPOLL
+  void add(int fd, Kind kind, XnUInt32 index)
+  {
+    if (!tryAdd(fd, kind, index)) {
+      throw std::runtime_error("error : epoll_ctl");
+    }
+  }
+
+  // epollで待てないfd(EPERM)ならfalse。ほかのエラーは例外
+  bool tryAdd(int fd, Kind kind, XnUInt32 index)
+  {
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = ((XnUInt64)kind << 32) | index;
+    if (::epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event) == 0) {
+      return true;
+    }
+    if (errno == EPERM) {
+      return false;
+    }
+    throw std::runtime_error("error : epoll_ctl");
+  }
+
+  int epoll_;
+#else
+  static XnUInt32 exchange(volatile XnUInt32* target, XnUInt32 value)
+  {
+#if (XN_PLATFORM == XN_PLATFORM_WIN32)
+    return (XnUInt32)InterlockedExchange((volatile LONG*)target, (LONG)value);
+#else
+    return __sync_lock_test_and_set(target, value);
+#endif
+  }
+
+  static void increment(volatile XnUInt32* target)
+  {
+#if (XN_PLATFORM == XN_PLATFORM_WIN32)
+    InterlockedIncrement((volatile LONG*)target);
+#else
+    __sync_fetch_and_add(target, 1);
+#endif
+  }
+
+  XN_EVENT_HANDLE wakeup_;
+#endif
+
+  std::vector<Source*> sources_;
+  std::vector<Timer> timers_;
+  std::vector<Input> inputs_;
+  std::vector<Watch> watches_;
+  bool isQuit_;
+};
+
+#endif // #ifndef EVENTLOOP_H_INCLUDE
@@ -0,0 +1,350 @@
+#ifndef FRAMEPOOL_H_INCLUDE
+#define FRAMEPOOL_H_INCLUDE
+
+#include <vector>
+#include <algorithm>
+#include <ostream>
+#include <cstring>
+#include <stdexcept>
+
+#include <XnCppWrapper.h>
+#include <XnOS.h>
+
+// フレームの画素の種類
+enum FrameFormat
+{
+  FRAME_RGB24,      // XnRGB24Pixel
+  FRAME_DEPTH16,    // XnDepthPixel
+  FRAME_LABEL16,    // XnLabel
+  FRAME_IR16,       // XnIRPixel
+  FRAME_FORMAT_COUNT
+};
+
+class FramePool;
+
+// プールのバッファ1つ
+struct FrameBlock
+{
+  FramePool* pool;
+  XnUInt32 sizeClass;
+  XnUInt32 bytes;       // 確保した大きさ
+  void* data;
+  XnUInt32 refs;
+
+  // 今使っている形
+  FrameFormat format;
+  XnUInt32 xRes;
+  XnUInt32 yRes;
+};
+
+// プールから借りたフレーム
+//  コピーしても中身は共有し、最後の1つが破棄されたらバッファをプールに返す
+class FrameBuffer
+{
+public:
+
+  FrameBuffer()
+    :block_(0)
+  {
+  }
+
+  FrameBuffer(const FrameBuffer& other);
+  FrameBuffer& operator=(const FrameBuffer& other);
+
+  ~FrameBuffer()
+  {
+    release();
+  }
+
+  // バッファを返す(ほかに持っているものがなければ)
+  void release();
+
+  bool empty() const
+  {
+    return block_ == 0;
+  }
+
+  FrameFormat format() const { return block_->format; }
+  XnUInt32 xRes() const { return block_->xRes; }
+  XnUInt32 yRes() const { return block_->yRes; }
+
+  void* data() { return block_->data; }
+  const void* data() const { return block_->data; }
+
+  XnRGB24Pixel* rgb24() { return (XnRGB24Pixel*)block_->data; }
+  const XnRGB24Pixel* rgb24() const { return (const XnRGB24Pixel*)block_->data; }
+  XnDepthPixel* depth() { return (XnDepthPixel*)block_->data; }
+  const XnDepthPixel* depth() const { return (const XnDepthPixel*)block_->data; }
+  XnLabel* labels() { return (XnLabel*)block_->data; }
+  const XnLabel* labels() const { return (const XnLabel*)block_->data; }
+  XnIRPixel* ir() { return (XnIRPixel*)block_->data; }
+  const XnIRPixel* ir() const { return (const XnIRPixel*)block_->data; }
+
+private:
+
+  friend class FramePool;
+
+  explicit FrameBuffer(FrameBlock* block)
+    :block_(block)
+  {
+  }
+
+  FrameBlock* block_;
+};
+
+// フレームのバッファのプール
+//  画素の種類とよく使う解像度(QQVGA/QVGA/VGA/SXGA)ごとの大きさのクラスに分け、
+//  返されたバッファは同じクラスで使いまわす(フレームごとにnew/deleteしない)。
+//  要求された解像度は、それを収める一番小さいクラスから借りる。SXGAより大きいものは
+//  プールせず、返されたら解放する。
+//  クラスごとに使用中の数、その最大(high-water mark)、実際に確保した数を数える。
+//  どのスレッドから借りても返してもよい。借りたバッファより先にプールを破棄しないこと
+class FramePool
+{
+public:
+
+  enum
+  {
+    RESOLUTION_COUNT = 4,
+    OVERSIZE = RESOLUTION_COUNT   // 解像度のクラスの最後は、プールしない大きいもの
+  };
+
+  struct Stats
+  {
+    XnUInt32 live;        // 使用中
+    XnUInt32 highWater;   // 使用中の最大
+    XnUInt32 cached;      // 返されて次を待っている
+    XnUInt32 allocated;   // 実際に確保した回数
+    XnUInt64 acquired;    // 借りられた回数
+  };
+
+  FramePool()
+    :classes_(FRAME_FORMAT_COUNT * (RESOLUTION_COUNT + 1))
+  {
+    XnStatus rc = xnOSCreateCriticalSection(&lock_);
+    if (rc != XN_STATUS_OK) {
+      throw std::runtime_error(xnGetStatusString(rc));
+    }
+  }
+
+  ~FramePool()
+  {
+    trim();
+    xnOSCloseCriticalSection(&lock_);
+  }
+
+  // xRes x yRes のフレームを借りる(中身は不定)
+  FrameBuffer acquire(FrameFormat format, XnUInt32 xRes, XnUInt32 yRes)
+  {
+    const XnUInt32 resolution = resolutionClass(xRes, yRes);
+    const XnUInt32 index = format * (RESOLUTION_COUNT + 1) + resolution;
+    const XnUInt32 bytes = bytesPerPixel(format) *
+      ((resolution == OVERSIZE) ? (xRes * yRes) : resolutionPixels(resolution));
+
+    xnOSEnterCriticalSection(&lock_);
+    SizeClass& sizeClass = classes_[index];
+    FrameBlock* block = 0;
+    if (!sizeClass.free.empty()) {
+      block = sizeClass.free.back();
+      sizeClass.free.pop_back();
+    }
+    ++sizeClass.stats.acquired;
+    ++sizeClass.stats.live;
+    sizeClass.stats.highWater = std::max(sizeClass.stats.highWater, sizeClass.stats.live);
+    sizeClass.stats.cached = (XnUInt32)sizeClass.free.size();
+    xnOSLeaveCriticalSection(&lock_);
+
+    if (block == 0) {
+      try {
+        block = allocate(index, bytes);
+      }
+      catch (...) {
+        xnOSEnterCriticalSection(&lock_);
+        --sizeClass.stats.live;
+        xnOSLeaveCriticalSection(&lock_);
+        throw;
+      }
+    }
+    block->refs = 1;
+    block->format = format;
+    block->xRes = xRes;
+    block->yRes = yRes;
+    return FrameBuffer(block);
+  }
+
+  // srcをコピーしたフレームを借りる
+  FrameBuffer copy(FrameFormat format, const void* src, XnUInt32 xRes, XnUInt32 yRes)
+  {
+    FrameBuffer buffer = acquire(format, xRes, yRes);
+    memcpy(buffer.data(), src, bytesPerPixel(format) * xRes * yRes);
+    return buffer;
+  }
+
+  // 返されて使っていないバッファを解放する
+  void trim()
+  {
+    xnOSEnterCriticalSection(&lock_);
+    for (size_t i = 0; i < classes_.size(); ++i) {
+      for (size_t b = 0; b < classes_[i].free.size(); ++b) {
+        free(classes_[i].free[b]);
+      }
+      classes_[i].free.clear();
+      classes_[i].stats.cached = 0;
+    }
+    xnOSLeaveCriticalSection(&lock_);
+  }
+
+  Stats stats(FrameFormat format, XnUInt32 xRes, XnUInt32 yRes) const
+  {
+    xnOSEnterCriticalSection(&lock_);
+    Stats stats = classes_[format * (RESOLUTION_COUNT + 1) + resolutionClass(xRes, yRes)].stats;
+    xnOSLeaveCriticalSection(&lock_);
+    return stats;
+  }
+
+  // 使われたクラスごとの数
+  void printStats(std::ostream& out) const
+  {
+    static const char* FORMAT_NAMES[FRAME_FORMAT_COUNT] = { "rgb24", "depth16", "label16", "ir16" };
+    static const char* RESOLUTION_NAMES[RESOLUTION_COUNT + 1] = { "QQVGA", "QVGA", "VGA", "SXGA", "larger" };
+
+    xnOSEnterCriticalSection(&lock_);
+    for (size_t i = 0; i < classes_.size(); ++i) {
+      const Stats& stats = classes_[i].stats;
+      if (stats.acquired == 0) {
+        continue;
+      }
+      out << FORMAT_NAMES[i / (RESOLUTION_COUNT + 1)] << " " <<
+        RESOLUTION_NAMES[i % (RESOLUTION_COUNT + 1)] << " : " <<
+        stats.live << " live, " << stats.highWater << " high-water, " <<
+        stats.cached << " cached, " << stats.allocated << " allocated, " <<
+        stats.acquired << " acquired" << std::endl;
+    }
+    xnOSLeaveCriticalSection(&lock_);
+  }
+
+  static XnUInt32 bytesPerPixel(FrameFormat format)
+  {
+    return (format == FRAME_RGB24) ? sizeof(XnRGB24Pixel) : sizeof(XnUInt16);
+  }
+
+private:
+
+  FramePool(const FramePool&);
+  FramePool& operator=(const FramePool&);
+
+  friend class FrameBuffer;
+
+  struct SizeClass
+  {
+    SizeClass()
+    {
+      memset(&stats, 0, sizeof(stats));
+    }
+
+    Stats stats;
+    std::vector<FrameBlock*> free;
+  };
+
+  // 解像度のクラスの画素数(QQVGA, QVGA, VGA, SXGA)
+  static XnUInt32 resolutionPixels(XnUInt32 resolution)
+  {
+    static const XnUInt32 PIXELS[RESOLUTION_COUNT] = {
+      160 * 120, 320 * 240, 640 * 480, 1280 * 1024
+    };
+    return PIXELS[resolution];
+  }
+
+  static XnUInt32 resolutionClass(XnUInt32 xRes, XnUInt32 yRes)
+  {
+    XnUInt32 r = 0;
+    while ((r < RESOLUTION_COUNT) && ((xRes * yRes) > resolutionPixels(r))) {
+      ++r;
+    }
+    return r;
+  }
+
+  FrameBlock* allocate(XnUInt32 index, XnUInt32 bytes)
+  {
+    FrameBlock* block = new FrameBlock();
+    block->data = xnOSMallocAligned(bytes, 16);
+    if (block->data == 0) {
+      delete block;
+      throw std::runtime_error("error : xnOSMallocAligned");
+    }
+    block->pool = this;
+    block->sizeClass = index;
+    block->bytes = bytes;
+
+    xnOSEnterCriticalSection(&lock_);
+    ++classes_[index].stats.allocated;
+    xnOSLeaveCriticalSection(&lock_);
+    return block;
+  }
+
+  static void free(FrameBlock* block)
+  {
+    xnOSFreeAligned(block->data);
+    delete block;
+  }
+
+  void retain(FrameBlock* block)
+  {
+    xnOSEnterCriticalSection(&lock_);
+    ++block->refs;
+    xnOSLeaveCriticalSection(&lock_);
+  }
+
+  void release(FrameBlock* block)
+  {
+    xnOSEnterCriticalSection(&lock_);
+    if (--block->refs != 0) {
+      xnOSLeaveCriticalSection(&lock_);
+      return;
+    }
+
+    SizeClass& sizeClass = classes_[block->sizeClass];
+    --sizeClass.stats.live;
+    const bool isPooled = ((block->sizeClass % (RESOLUTION_COUNT + 1)) != OVERSIZE);
+    if (isPooled) {
+      sizeClass.free.push_back(block);
+      sizeClass.stats.cached = (XnUInt32)sizeClass.free.size();
+    }
+    xnOSLeaveCriticalSection(&lock_);
+
+    if (!isPooled) {
+      free(block);
+    }
+  }
+
+  std::vector<SizeClass> classes_;
+  mutable XN_CRITICAL_SECTION_HANDLE lock_;
+};
+
+inline FrameBuffer::FrameBuffer(const FrameBuffer& other)
+  :block_(other.block_)
+{
+  if (block_ != 0) {
+    block_->pool->retain(block_);
+  }
+}
+
+inline FrameBuffer& FrameBuffer::operator=(const FrameBuffer& other)
+{
+  if (other.block_ != 0) {
+    other.block_->pool->retain(other.block_);
+  }
+  release();
+  block_ = other.block_;
+  return *this;
+}
+
+inline void FrameBuffer::release()
+{
+  if (block_ != 0) {
+    block_->pool->release(block_);
+    block_ = 0;
+  }
+}
+
+#endif // #ifndef FRAMEPOOL_H_INCLUDE
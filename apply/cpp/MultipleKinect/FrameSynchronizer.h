@@ -0,0 +1,466 @@
+#ifndef FRAMESYNCHRONIZER_H_INCLUDE
+#define FRAMESYNCHRONIZER_H_INCLUDE
+
+#include <map>
+#include <vector>
+#include <ostream>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include <XnCppWrapper.h>
+#include <XnOS.h>
+
+// タイムスタンプでフレームの組をそろえる
+//  ストリーム(センサーごとのイメージ/デプス/IRなど)ごとにフレームをためておき、
+//  各ストリームの先頭のうち最も古い時刻を基準に、許容範囲内のフレームを
+//  1つずつ選んで組にする。来ないフレームはlatencyだけ待ったら欠落とみなし、
+//  直前に返したフレーム(と次のフレーム)で代用するか、その組を捨てる。
+//  画素は補間しない(デプスを混ぜると、ありもしない点ができる)ので、代用するときは
+//  Match::nearestSlot()で時刻の近い方を使う。直前のフレームが古すぎれば代用せず、
+//  そのストリームは組から外す(止まったセンサーをいつまでも使わない)。
+//  一番遅いノードを待ってブロックしない。
+//
+//  フレームのデータは呼び出し側が持つ。push()が返すスロット番号の場所に
+//  コピーしておき、pop()で返されたスロット番号のデータを使う。
+//  スロットはストリームごとに slots() 個用意すること。
+//  pop()で返したスロットは、次にpush()かpop()を呼ぶまで書き換えられない
+class FrameSynchronizer
+{
+public:
+
+  // スキューのヒストグラム(0.5msごと、最後のビンはそれ以上)
+  enum { SKEW_BINS = 64 };
+  static const XnUInt64 SKEW_BIN_WIDTH = 500;
+
+  // 受け付けなかったフレーム
+  static const XnUInt32 INVALID_SLOT = 0xFFFFFFFF;
+
+  // 組になったフレーム
+  struct Match
+  {
+    XnUInt32  slot;           // 使うフレームのスロット(組から外れたときはINVALID_SLOT)
+    XnUInt32  nextSlot;       // 代用するときの次のフレーム(代用しないときはslotと同じ)
+    float     weight;         // slotからnextSlotまでのうち、基準時刻の位置(0～1)
+    XnUInt64  timestamp;      // PCの時刻にそろえたタイムスタンプ
+    XnUInt32  frameID;
+    XnInt64   skew;           // 基準時刻との差(マイクロ秒)
+    bool      isSubstituted;  // 欠落していたので、前後のフレームで代用した
+
+    // slotとnextSlotのうち、基準時刻に近い方
+    XnUInt32 nearestSlot() const
+    {
+      return (weight < 0.5f) ? slot : nextSlot;
+    }
+
+    // 代用できるフレームもなく、組から外れた
+    bool isMissing() const
+    {
+      return slot == INVALID_SLOT;
+    }
+  };
+
+  // ストリームごとの統計
+  struct Stats
+  {
+    XnUInt64  pushed;         // 受け取ったフレーム
+    XnUInt64  matched;        // 組にしたフレーム
+    XnUInt64  dropped;        // 組にできずに捨てたフレーム
+    XnUInt64  overflowed;     // バッファがいっぱいで捨てたフレーム(droppedに含む)
+    XnUInt64  substituted;    // 欠落していたため前後のフレームで代用した回数
+    XnUInt64  missing;        // 代用できるフレームもなく、組から外れた回数
+    XnUInt64  skewHistogram[SKEW_BINS];
+    XnUInt64  totalSkew;
+    XnUInt64  maxSkew;
+  };
+
+  // 時刻の差を求めるのに使うフレームの数
+  enum { CLOCK_SAMPLES = 30 };
+
+  // depth : ストリームごとにためておくフレームの数
+  FrameSynchronizer(XnUInt32 depth = 4)
+    :depth_(std::max<XnUInt32>(depth, 1)), tolerance_(16000), latency_(100000),
+     maxHeldAge_(100000), isSubstitution_(true), newest_(0), time_(0)
+  {
+  }
+
+  // ストリームを追加し、番号を返す
+  //  clockGroup : 同じデバイスのストリームには同じ番号をつける(タイムスタンプの起点が同じもの)
+  XnUInt32 addStream(int clockGroup)
+  {
+    Stream s;
+    s.group = clockGroup;
+    s.ring.resize(depth_);
+    s.head = 0;
+    s.count = 0;
+    s.lastRaw = 0;
+    s.hasHeld = false;
+    for (XnUInt32 i = 0; i < slots(); ++i) {
+      s.freeSlots.push_back(slots() - 1 - i);
+    }
+    memset(&s.stats, 0, sizeof(s.stats));
+    streams_.push_back(s);
+    return (XnUInt32)streams_.size() - 1;
+  }
+
+  XnUInt32 streams() const
+  {
+    return (XnUInt32)streams_.size();
+  }
+
+  // ストリームごとに必要なスロットの数
+  XnUInt32 slots() const
+  {
+    // バッファの分と、最後に返したフレームの分
+    return depth_ + 1;
+  }
+
+  // 同じ時刻とみなすタイムスタンプの差(マイクロ秒)
+  void setTolerance(XnUInt64 tolerance)
+  {
+    tolerance_ = tolerance;
+  }
+
+  // 来ないフレームを欠落とみなすまでの時間(マイクロ秒)
+  void setLatency(XnUInt64 latency)
+  {
+    latency_ = latency;
+  }
+
+  // 欠落したフレームを前後のフレームで代用するか(しなければ、その組を捨てる)
+  void setSubstitution(bool isSubstitution)
+  {
+    isSubstitution_ = isSubstitution;
+  }
+
+  // 代用に使う直前のフレームが、基準時刻よりどれだけ古くてもよいか(マイクロ秒)
+  void setMaxHeldAge(XnUInt64 maxHeldAge)
+  {
+    maxHeldAge_ = maxHeldAge;
+  }
+
+  // デバイスとPCの時刻の差を指定する
+  //  指定しない場合は最初のCLOCK_SAMPLESフレームで、届くまでの遅れが最も小さいものから決める
+  void setClockOffset(int clockGroup, XnInt64 offset)
+  {
+    ClockOffset& clock = clockOffset_[clockGroup];
+    clock.offset = offset;
+    clock.samples = CLOCK_SAMPLES;
+  }
+
+  // フレームを登録し、データをコピーするスロットを返す
+  //  前回より古いタイムスタンプのフレームは受け付けない
+  XnUInt32 push(XnUInt32 stream, XnUInt64 timestamp, XnUInt32 frameID)
+  {
+    Stream& s = streams_.at(stream);
+    if ((s.stats.pushed != 0) && (timestamp <= s.lastRaw)) {
+      return INVALID_SLOT;
+    }
+    s.lastRaw = timestamp;
+
+    // 最初のCLOCK_SAMPLESフレームで、デバイスとPCの時刻の差を求める
+    //  受け取った時刻は届くまでの遅れの分だけ後ろにずれるので、差の最小値を使う
+    ClockOffset& clock = clockOffset_[s.group];
+    if (clock.samples < CLOCK_SAMPLES) {
+      XnUInt64 now;
+      xnOSGetHighResTimeStamp(&now);
+      const XnInt64 offset = (XnInt64)now - (XnInt64)timestamp;
+      clock.offset = (clock.samples == 0) ? offset : std::min(clock.offset, offset);
+      ++clock.samples;
+    }
+
+    Frame frame;
+    frame.time = (XnUInt64)((XnInt64)timestamp + clock.offset);
+    frame.frameID = frameID;
+    newest_ = std::max(newest_, frame.time);
+
+    // いっぱいなら一番古いフレームを捨てる
+    if (s.count == depth_) {
+      drop(s);
+      ++s.stats.overflowed;
+    }
+
+    frame.slot = s.freeSlots.back();
+    s.freeSlots.pop_back();
+    s.ring[(s.head + s.count) % depth_] = frame;
+    ++s.count;
+    ++s.stats.pushed;
+
+    return frame.slot;
+  }
+
+  // そろったフレームの組を取り出す。まだそろっていなければfalse
+  //  matchesにはストリームの番号順に入る
+  bool pop(std::vector<Match>& matches)
+  {
+    if (streams_.empty()) {
+      return false;
+    }
+
+    std::vector<XnInt32>& chosen = chosen_;
+    chosen.resize(streams_.size());
+
+    while (1) {
+      // 各ストリームの先頭のうち、最も古い時刻を基準にする
+      //  (先頭がそれより許容範囲以上新しいストリームは、基準の時刻のフレームが欠落している)
+      XnUInt64 pivot = 0;
+      bool hasFrame = false;
+      for (std::vector<Stream>::iterator it = streams_.begin(); it != streams_.end(); ++it) {
+        if ((it->count != 0) && (!hasFrame || (front(*it).time < pivot))) {
+          pivot = front(*it).time;
+          hasFrame = true;
+        }
+      }
+      if (!hasFrame) {
+        return false;
+      }
+
+      // 許容範囲内で、基準に最も近いフレームを選ぶ
+      bool isMissing = false;
+      bool isWaiting = false;
+      for (XnUInt32 i = 0; i < streams_.size(); ++i) {
+        Stream& s = streams_[i];
+        chosen[i] = -1;
+        XnUInt64 best = 0;
+        for (XnUInt32 n = 0; n < s.count; ++n) {
+          const Frame& frame = at(s, n);
+          if (frame.time > (pivot + tolerance_)) {
+            break;
+          }
+
+          XnUInt64 diff = distance(frame.time, pivot);
+          if ((chosen[i] < 0) || (diff < best)) {
+            chosen[i] = n;
+            best = diff;
+          }
+        }
+
+        if (chosen[i] < 0) {
+          isMissing = true;
+          // 次のフレームが来ていなければ、まだ届く可能性がある
+          if ((s.count == 0) && ((newest_ - pivot) < latency_)) {
+            isWaiting = true;
+          }
+        }
+      }
+
+      if (isWaiting) {
+        return false;
+      }
+
+      // 代用しないなら、欠落したストリームがある組は捨てる
+      if (isMissing && !isSubstitution_) {
+        for (XnUInt32 i = 0; i < streams_.size(); ++i) {
+          for (XnInt32 n = 0; n <= chosen[i]; ++n) {
+            drop(streams_[i]);
+          }
+        }
+        continue;
+      }
+
+      // 組を作る
+      matches.resize(streams_.size());
+      for (XnUInt32 i = 0; i < streams_.size(); ++i) {
+        Stream& s = streams_[i];
+        Match& match = matches[i];
+
+        if (chosen[i] < 0) {
+          // 直前のフレームがない・古すぎるときは、このストリームを組から外す
+          if (!s.hasHeld || ((pivot - std::min(pivot, s.held.time)) > maxHeldAge_)) {
+            match.slot = INVALID_SLOT;
+            match.nextSlot = INVALID_SLOT;
+            match.weight = 0.0f;
+            match.timestamp = pivot;
+            match.frameID = 0;
+            match.skew = 0;
+            match.isSubstituted = false;
+            ++s.stats.missing;
+            continue;
+          }
+
+          // 前のフレームと、あれば次のフレームで代用する
+          const Frame& prev = s.held;
+          match.slot = prev.slot;
+          match.nextSlot = prev.slot;
+          match.weight = 0.0f;
+          match.frameID = prev.frameID;
+          if ((s.count != 0) && (front(s).time > prev.time)) {
+            const Frame& next = front(s);
+            match.nextSlot = next.slot;
+            match.weight = (float)((double)(pivot - std::min(pivot, prev.time)) /
+                                   (double)(next.time - prev.time));
+            match.weight = std::min(match.weight, 1.0f);
+          }
+          match.timestamp = pivot;
+          match.skew = (XnInt64)prev.time - (XnInt64)pivot;
+          match.isSubstituted = true;
+          ++s.stats.substituted;
+          continue;
+        }
+
+        // 選んだフレームより前のものは捨てる
+        for (XnInt32 n = 0; n < chosen[i]; ++n) {
+          drop(s);
+        }
+
+        Frame frame = front(s);
+        s.head = (s.head + 1) % depth_;
+        --s.count;
+        hold(s, frame);
+
+        match.slot = frame.slot;
+        match.nextSlot = frame.slot;
+        match.weight = 0.0f;
+        match.timestamp = frame.time;
+        match.frameID = frame.frameID;
+        match.skew = (XnInt64)frame.time - (XnInt64)pivot;
+        match.isSubstituted = false;
+
+        // スキューの分布
+        XnUInt64 skew = distance(frame.time, pivot);
+        Stats& stats = s.stats;
+        ++stats.matched;
+        ++stats.skewHistogram[std::min<XnUInt64>(skew / SKEW_BIN_WIDTH, SKEW_BINS - 1)];
+        stats.totalSkew += skew;
+        stats.maxSkew = std::max(stats.maxSkew, skew);
+      }
+
+      time_ = pivot;
+      return true;
+    }
+  }
+
+  // 最後に取り出した組の基準時刻
+  XnUInt64 time() const
+  {
+    return time_;
+  }
+
+  const Stats& stats(XnUInt32 stream) const
+  {
+    return streams_.at(stream).stats;
+  }
+
+  // スキューのパーセンタイル(マイクロ秒、ビンの上端)
+  XnUInt64 skewPercentile(XnUInt32 stream, double percent) const
+  {
+    const Stats& stats = streams_.at(stream).stats;
+    if (stats.matched == 0) {
+      return 0;
+    }
+
+    XnUInt64 threshold = (XnUInt64)(stats.matched * percent / 100.0);
+    XnUInt64 total = 0;
+    for (XnUInt32 i = 0; i < SKEW_BINS; ++i) {
+      total += stats.skewHistogram[i];
+      if (total > threshold) {
+        return (i + 1) * SKEW_BIN_WIDTH;
+      }
+    }
+
+    return stats.maxSkew;
+  }
+
+  // 統計を表示する
+  void printStats(std::ostream& out) const
+  {
+    for (XnUInt32 i = 0; i < streams_.size(); ++i) {
+      const Stats& stats = streams_[i].stats;
+      out << "stream " << i << " : " <<
+        stats.pushed << " pushed, " <<
+        stats.matched << " matched, " <<
+        stats.dropped << " dropped (" << stats.overflowed << " overflowed), " <<
+        stats.substituted << " substituted, " <<
+        stats.missing << " missing, skew(us) mean " <<
+        ((stats.matched != 0) ? (stats.totalSkew / stats.matched) : 0) <<
+        " p50 " << skewPercentile(i, 50) <<
+        " p95 " << skewPercentile(i, 95) <<
+        " max " << stats.maxSkew << std::endl;
+    }
+  }
+
+private:
+
+  FrameSynchronizer(const FrameSynchronizer&);
+  FrameSynchronizer& operator=(const FrameSynchronizer&);
+
+  struct Frame
+  {
+    XnUInt32  slot;
+    XnUInt64  time;       // PCの時刻にそろえたタイムスタンプ
+    XnUInt32  frameID;
+  };
+
+  struct Stream
+  {
+    int                   group;
+    std::vector<Frame>    ring;       // 時刻順のリングバッファ
+    XnUInt32              head;
+    XnUInt32              count;
+    XnUInt64              lastRaw;    // 最後に受け取ったデバイスのタイムスタンプ
+    std::vector<XnUInt32> freeSlots;
+    Frame                 held;       // 最後に返した(または捨てた)フレーム。代用に使う
+    bool                  hasHeld;
+    Stats                 stats;
+  };
+
+  struct ClockOffset
+  {
+    ClockOffset()
+      :offset(0), samples(0)
+    {
+    }
+
+    XnInt64   offset;     // PCの時刻 - デバイスの時刻
+    XnUInt32  samples;    // 求めるのに使ったフレームの数
+  };
+
+  static XnUInt64 distance(XnUInt64 a, XnUInt64 b)
+  {
+    return (a > b) ? (a - b) : (b - a);
+  }
+
+  const Frame& at(const Stream& s, XnUInt32 n) const
+  {
+    return s.ring[(s.head + n) % depth_];
+  }
+
+  const Frame& front(const Stream& s) const
+  {
+    return at(s, 0);
+  }
+
+  // 先頭のフレームを捨てる。補間用に直前のフレームとして残しておく
+  void drop(Stream& s)
+  {
+    Frame frame = front(s);
+    s.head = (s.head + 1) % depth_;
+    --s.count;
+    ++s.stats.dropped;
+    hold(s, frame);
+  }
+
+  // 直前のフレームを入れ替え、前のスロットを空きに戻す
+  void hold(Stream& s, const Frame& frame)
+  {
+    if (s.hasHeld) {
+      s.freeSlots.push_back(s.held.slot);
+    }
+    s.held = frame;
+    s.hasHeld = true;
+  }
+
+  XnUInt32 depth_;
+  XnUInt64 tolerance_;
+  XnUInt64 latency_;
+  XnUInt64 maxHeldAge_;
+  bool isSubstitution_;
+
+  std::vector<Stream> streams_;
+  std::map<int, ClockOffset> clockOffset_;
+  XnUInt64 newest_;   // 届いたフレームのうち最も新しい時刻
+  XnUInt64 time_;
+  std::vector<XnInt32> chosen_;
+};
+
+#endif // #ifndef FRAMESYNCHRONIZER_H_INCLUDE
@@ -0,0 +1,291 @@
+#ifndef POINTCLOUDFUSION_H_INCLUDE
+#define POINTCLOUDFUSION_H_INCLUDE
+
+#include <map>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include <XnCppWrapper.h>
+#include <XnOS.h>
+
+#include "../PointCloud/PointCloud.h"
+#include "../PointCloud/VoxelGrid.h"
+#include "../PointCloud/WorkerThreads.h"
+
+// センサーの座標系から共通の座標系への変換(world = R * p + T)
+struct Extrinsics
+{
+  float R[9];
+  float T[3];
+
+  // 回転(度、X→Y→Zの順)と平行移動(mm)から作成する
+  static Extrinsics fromEuler(float rx, float ry, float rz,
+                              float tx, float ty, float tz)
+  {
+    const float DEG = 3.14159265f / 180.0f;
+    float cx = std::cos(rx * DEG), sx = std::sin(rx * DEG);
+    float cy = std::cos(ry * DEG), sy = std::sin(ry * DEG);
+    float cz = std::cos(rz * DEG), sz = std::sin(rz * DEG);
+
+    // R = Rz * Ry * Rx
+    Extrinsics e;
+    e.R[0] = cz * cy; e.R[1] = cz * sy * sx - sz * cx; e.R[2] = cz * sy * cx + sz * sx;
+    e.R[3] = sz * cy; e.R[4] = sz * sy * sx + cz * cx; e.R[5] = sz * sy * cx - cz * sx;
+    e.R[6] = -sy;     e.R[7] = cy * sx;                e.R[8] = cy * cx;
+    e.T[0] = tx;
+    e.T[1] = ty;
+    e.T[2] = tz;
+    return e;
+  }
+
+  static Extrinsics identity()
+  {
+    return fromEuler(0, 0, 0, 0, 0, 0);
+  }
+};
+
+typedef std::map<int, Extrinsics> ExtrinsicsMap;
+
+// センサーごとの外部パラメータを読み込む
+//  1行に「センサー番号 回転X Y Z(度) 平行移動X Y Z(mm)」。#以降はコメント
+inline ExtrinsicsMap loadExtrinsics(const std::string& path)
+{
+  std::ifstream file(path.c_str());
+  if (!file) {
+    throw std::runtime_error("外部パラメータのファイルが開けません : " + path);
+  }
+
+  ExtrinsicsMap extrinsics;
+  std::string line;
+  int lineNo = 0;
+  while (std::getline(file, line)) {
+    ++lineNo;
+    std::string::size_type comment = line.find('#');
+    if (comment != std::string::npos) {
+      line.erase(comment);
+    }
+
+    std::istringstream iss(line);
+    int no;
+    if (!(iss >> no)) {
+      continue;
+    }
+
+    float rx, ry, rz, tx, ty, tz;
+    if (!(iss >> rx >> ry >> rz >> tx >> ty >> tz)) {
+      std::ostringstream oss;
+      oss << path << "(" << lineNo << ") : 外部パラメータの形式が不正です";
+      throw std::runtime_error(oss.str());
+    }
+
+    extrinsics[no] = Extrinsics::fromEuler(rx, ry, rz, tx, ty, tz);
+  }
+
+  return extrinsics;
+}
+
+// 複数センサーの点群を共通の座標系に変換し、1つのボクセル化した点群にまとめる
+//  センサーごとの座標変換は並列に行い、結果はVoxelGridで間引く。
+//  デバイスのタイムスタンプはセンサーごとに起点が違うので、最初のCLOCK_SAMPLESフレームで
+//  PCの時刻との差を求めておき、そろえてから許容範囲内のフレームだけを使う。
+//  FrameSynchronizerでそろえたタイムスタンプを渡すときは、setAlignedTimestamps(true)で
+//  もう一度そろえないようにする
+class PointCloudFusion
+{
+public:
+
+  // 時刻の差を求めるのに使うフレームの数
+  enum { CLOCK_SAMPLES = 30 };
+
+  PointCloudFusion(PointCloudPool& pool, WorkerThreads* workers = 0)
+    :pool_(pool), workers_(workers), voxel_(pool, workers), tolerance_(20000),
+     isAligned_(false), droppedFrames_(0)
+  {
+    voxel_.setLeafSize(20.0f);
+  }
+
+  void setExtrinsics(const ExtrinsicsMap& extrinsics)
+  {
+    extrinsics_ = extrinsics;
+  }
+
+  // ボクセルの一辺の長さ(mm)
+  void setLeafSize(float leafSize)
+  {
+    voxel_.setLeafSize(leafSize);
+  }
+
+  // 同じ時刻とみなすタイムスタンプの差(マイクロ秒)
+  void setTolerance(XnUInt64 tolerance)
+  {
+    tolerance_ = tolerance;
+  }
+
+  // 点群のタイムスタンプがすでにPCの時刻にそろっているか(FrameSynchronizerのMatch::timestampなど)
+  void setAlignedTimestamps(bool isAligned)
+  {
+    isAligned_ = isAligned;
+  }
+
+  // 今回まとめるセンサーの点群を登録する
+  void add(int sensor, const PointCloud& cloud)
+  {
+    if (isAligned_) {
+      Source source = { sensor, &cloud, 0, cloud.timestamp };
+      sources_.push_back(source);
+      return;
+    }
+
+    // 最初のCLOCK_SAMPLESフレームで、デバイスとPCの時刻の差を求める
+    //  受け取った時刻は届くまでの遅れの分だけ後ろにずれるので、差の最小値を使う
+    //  (1フレーム目の遅れがずっと残らないように)
+    ClockOffset& clock = clockOffset_[sensor];
+    if (clock.samples < CLOCK_SAMPLES) {
+      XnUInt64 now;
+      xnOSGetHighResTimeStamp(&now);
+      const XnInt64 offset = (XnInt64)now - (XnInt64)cloud.timestamp;
+      clock.offset = (clock.samples == 0) ? offset : std::min(clock.offset, offset);
+      ++clock.samples;
+    }
+
+    XnUInt64 time = (XnUInt64)((XnInt64)cloud.timestamp + clock.offset);
+    Source source = { sensor, &cloud, 0, time };
+    sources_.push_back(source);
+  }
+
+  // 登録された点群をまとめ、登録をクリアする。使ったセンサーの数を返す
+  XnUInt32 fuse(PointCloud& output)
+  {
+    // 最も新しいフレームを基準に、時刻がずれすぎているものを除く
+    XnUInt64 newest = 0;
+    for (std::vector<Source>::iterator it = sources_.begin(); it != sources_.end(); ++it) {
+      newest = std::max(newest, it->time);
+    }
+
+    std::vector<Source>& aligned = aligned_;
+    aligned.clear();
+    XnUInt32 total = 0;
+    for (std::vector<Source>::iterator it = sources_.begin(); it != sources_.end(); ++it) {
+      if ((newest - it->time) > tolerance_) {
+        ++droppedFrames_;
+        continue;
+      }
+
+      it->offset = total;
+      total += it->cloud->size;
+      aligned.push_back(*it);
+    }
+    sources_.clear();
+
+    if (aligned.empty()) {
+      output.reserve(pool_, 0);
+      return 0;
+    }
+
+    // 変換後の点群を並べるバッファ
+    merged_.reserve(pool_, total);
+    merged_.size = total;
+    merged_.hasColor = true;
+    merged_.timestamp = newest;
+    for (std::vector<Source>::iterator it = aligned.begin(); it != aligned.end(); ++it) {
+      merged_.hasColor = merged_.hasColor && it->cloud->hasColor;
+    }
+
+    // センサーごとに並列に座標変換する
+    WorkerThreads::run(workers_, &PointCloudFusion::transform, this);
+
+    // ボクセルグリッドで1つにまとめる
+    voxel_.filter(merged_, output);
+
+    return (XnUInt32)aligned.size();
+  }
+
+  // 時刻がずれていて使わなかったフレームの数
+  XnUInt64 droppedFrames() const
+  {
+    return droppedFrames_;
+  }
+
+private:
+
+  PointCloudFusion(const PointCloudFusion&);
+  PointCloudFusion& operator=(const PointCloudFusion&);
+
+  struct ClockOffset
+  {
+    ClockOffset()
+      :offset(0), samples(0)
+    {
+    }
+
+    XnInt64           offset;   // PCの時刻 - デバイスの時刻
+    XnUInt32          samples;  // 求めるのに使ったフレームの数
+  };
+
+  struct Source
+  {
+    int               sensor;
+    const PointCloud* cloud;
+    XnUInt32          offset;   // 結合後のバッファでの位置
+    XnUInt64          time;     // PCの時刻にそろえたタイムスタンプ
+  };
+
+  // スレッドごとにセンサーを受け持ち、共通の座標系に変換する
+  static void transform(void* param, XnUInt32 index, XnUInt32 count)
+  {
+    PointCloudFusion& self = *(PointCloudFusion*)param;
+    const std::vector<Source>& sources = self.aligned_;
+    PointCloud& merged = self.merged_;
+
+    for (XnUInt32 s = index; s < sources.size(); s += count) {
+      const Source& source = sources[s];
+      const PointCloud& cloud = *source.cloud;
+
+      ExtrinsicsMap::const_iterator e = self.extrinsics_.find(source.sensor);
+      const Extrinsics extrinsics = (e != self.extrinsics_.end()) ?
+                                    e->second : Extrinsics::identity();
+      const float* R = extrinsics.R;
+      const float* T = extrinsics.T;
+
+      const float* inX = cloud.X;
+      const float* inY = cloud.Y;
+      const float* inZ = cloud.Z;
+      float* outX = merged.X + source.offset;
+      float* outY = merged.Y + source.offset;
+      float* outZ = merged.Z + source.offset;
+      for (XnUInt32 i = 0; i < cloud.size; ++i) {
+        const float x = inX[i], y = inY[i], z = inZ[i];
+        outX[i] = R[0] * x + R[1] * y + R[2] * z + T[0];
+        outY[i] = R[3] * x + R[4] * y + R[5] * z + T[1];
+        outZ[i] = R[6] * x + R[7] * y + R[8] * z + T[2];
+      }
+
+      if (merged.hasColor) {
+        memcpy(merged.color + source.offset, cloud.color,
+               cloud.size * sizeof(XnRGB24Pixel));
+      }
+    }
+  }
+
+  PointCloudPool& pool_;
+  WorkerThreads* workers_;
+  VoxelGrid voxel_;
+
+  ExtrinsicsMap extrinsics_;
+  std::map<int, ClockOffset> clockOffset_;
+  XnUInt64 tolerance_;
+  bool isAligned_;
+  XnUInt64 droppedFrames_;
+
+  std::vector<Source> sources_;    // 登録された点群
+  std::vector<Source> aligned_;    // 時刻がそろっていて、今回使う点群
+  PointCloud merged_;
+};
+
+#endif // #ifndef POINTCLOUDFUSION_H_INCLUDE
@@ -2,30 +2,100 @@
 #include <stdexcept>
 #include <map>
 #include <sstream>
+#include <string>
+#include <cstdlib>
 
 #include <opencv/cv.h>
 #include <opencv/highgui.h>
 
 #include <XnCppWrapper.h>
+#include <XnOS.h>
+
+#include "../PointCloud/PointCloudDrawer.h"
+#include "../../../OpenNI/cpp/CameraImage/DisplaySink.h"
+#include "EventLoop.h"
+#include "FramePool.h"
+#include "FrameSynchronizer.h"
+#include "PointCloudFusion.h"
 
 const XnMapOutputMode OUTPUT_MODE = { 640, 480, 30 };
 
+// センサーごとの外部パラメータのパス(環境に合わせて変更してください)
+//  (このサンプルのDataフォルダにある)
+#if (XN_PLATFORM == XN_PLATFORM_WIN32)
+const char* EXTRINSICS_PATH = "Data/Extrinsics.txt";
+#elif (XN_PLATFORM == XN_PLATFORM_MACOSX)
+const char* EXTRINSICS_PATH = "../../Data/Extrinsics.txt";
+#elif (XN_PLATFORM == XN_PLATFORM_LINUX_X86)
+const char* EXTRINSICS_PATH = "Data/Extrinsics.txt";
+#else
+const char* EXTRINSICS_PATH = "Data/Extrinsics.txt";
+#endif
+
 // Kinectごとの表示情報
 struct Kinect
 {
   xn::ImageGenerator  image;
   xn::DepthGenerator  depth;
   IplImage*           camera;
+  PointCloud*         cloud;
+
+  // 時刻合わせのためにためておくフレーム(FrameSynchronizerのスロットごと)
+  //  バッファはFramePoolから借り、スロットが上書きされたら返す
+  XnUInt32            depthStream;
+  XnUInt32            imageStream;
+  std::vector<FrameBuffer> depthSlots;
+  std::vector<FrameBuffer> imageSlots;
+
+  // イベントループでのフレームの元と、最後に確かめてから来たフレームの数
+  XnUInt32            source;
+  XnUInt32            frames;
+
+  Kinect()
+    :camera(0), cloud(0), depthStream(0), imageStream(0), source(0), frames(0)
+  {
+  }
+};
+
+// 途中で例外が起きても、Kinectごとに作った画像と点群を解放する
+struct KinectReleaser
+{
+  std::map<int, Kinect>& kinect;
+
+  ~KinectReleaser()
+  {
+    for (std::map<int, Kinect>::iterator it = kinect.begin(); it != kinect.end(); ++it) {
+      if (it->second.camera != 0) {
+        ::cvReleaseImage(&it->second.camera);
+      }
+      delete it->second.cloud;
+      it->second.cloud = 0;
+    }
+  }
+};
+
+// 途中で例外が起きても、作った画像を解放する
+struct ImageReleaser
+{
+  IplImage*& image;
+
+  ~ImageReleaser()
+  {
+    if (image != 0) {
+      ::cvReleaseImage(&image);
+    }
+  }
 };
 
 // デプスのヒストグラムを作成
+//  毎フレーム確保しないよう、呼び出し側のdepthHistを使いまわす
 typedef std::vector<float> depth_hist;
-depth_hist getDepthHistgram(const xn::DepthGenerator& depth,
-                            const xn::DepthMetaData& depthMD)
+void getDepthHistgram(const xn::DepthGenerator& depth,
+                      const xn::DepthMetaData& depthMD, depth_hist& depthHist)
 {
   // デプスの傾向を計算する(アルゴリズムはNiSimpleViewer.cppを利用)
   const int MAX_DEPTH = depth.GetDeviceMaxDepth();
-  depth_hist depthHist(MAX_DEPTH);
+  depthHist.assign(MAX_DEPTH, 0);
   
   unsigned int points = 0;
   const XnDepthPixel* pDepth = depthMD.Data();
@@ -48,8 +118,6 @@ depth_hist getDepthHistgram(const xn::DepthGenerator& depth,
       (unsigned int)(256 * (1.0f - (depthHist[i] / points)));
     }
   }
-  
-  return depthHist;
 }
 
 // 検出されたデバイスを列挙する
@@ -94,11 +162,728 @@ T CreateGenerator(const xn::NodeInfo& node)
   return g;
 }
 
+// メインループで使うもの(イベントループのハンドラに渡す)
+struct Viewer
+{
+  xn::Context*                            context;
+  std::map<int, Kinect>*                  kinect;
+  DisplaySink*                            display;
+  FrameSynchronizer*                      sync;
+  std::vector<FrameSynchronizer::Match>*  matches;
+  PointCloudBuilder*                      builder;
+  PointCloudFusion*                       fusion;
+  PointCloud*                             fused;
+  IplImage*                               fusionView;
+  bool                                    isFusion;
+  EventLoop*                              loop;
+  FramePool*                              frames;
+
+  // フレームごとに作り直さずに使いまわす
+  xn::ImageMetaData                       imageMD;
+  xn::DepthMetaData                       depthMD;
+  depth_hist                              depthHist;
+};
+
+// ジェネレータに新しいフレームが来ていれば、そのジェネレータだけを更新する(更新したらtrue)
+//  metaDataには、更新したかどうかによらず今のフレームを取る。
+//  WaitNoneUpdateAllだとほかのセンサーのフレームまで更新してしまい、
+//  そのセンサーの通知を処理するときにはIsDataNewがfalseになって、フレームをためられない
+template<typename Generator, typename MetaData>
+bool updateIfNew(Generator& generator, MetaData& metaData)
+{
+  const bool isNew = generator.IsNewDataAvailable() &&
+                     (generator.WaitAndUpdateData() == XN_STATUS_OK);
+  generator.GetMetaData(metaData);
+  return isNew;
+}
+
+// フレームを時刻合わせにためる(スロットの前のフレームを返してから、プールから借りてコピーする)
+void keepFrame(FrameSynchronizer& sync, XnUInt32 stream, std::vector<FrameBuffer>& slots,
+               FramePool& frames, FrameFormat format, const void* data,
+               XnUInt32 xRes, XnUInt32 yRes, XnUInt64 timestamp, XnUInt32 frameID)
+{
+  XnUInt32 slot = sync.push(stream, timestamp, frameID);
+  if (slot != FrameSynchronizer::INVALID_SLOT) {
+    slots[slot].release();
+    slots[slot] = frames.copy(format, data, xRes, yRes);
+  }
+}
+
+// センサーにフレームが来たら、そのセンサーの画像を表示し、フレームをためておく
+void onSensorFrame(XnUInt32 source, void* cookie)
+{
+  Viewer& viewer = *(Viewer*)cookie;
+
+  for (std::map<int, Kinect>::iterator it = viewer.kinect->begin(); it != viewer.kinect->end(); ++it) {
+    Kinect& k = it->second;
+    if (k.source != source) {
+      continue;
+    }
+    ++k.frames;
+
+    // このセンサーのジェネレータだけを更新し、新しいフレームをためておく
+    xn::ImageMetaData& imageMD = viewer.imageMD;
+    if (updateIfNew(k.image, imageMD)) {
+      keepFrame(*viewer.sync, k.imageStream, k.imageSlots, *viewer.frames, FRAME_RGB24,
+                imageMD.RGB24Data(), imageMD.XRes(), imageMD.YRes(),
+                imageMD.Timestamp(), imageMD.FrameID());
+    }
+
+    xn::DepthMetaData& depthMD = viewer.depthMD;
+    if (updateIfNew(k.depth, depthMD)) {
+      keepFrame(*viewer.sync, k.depthStream, k.depthSlots, *viewer.frames, FRAME_DEPTH16,
+                depthMD.Data(), depthMD.XRes(), depthMD.YRes(),
+                depthMD.Timestamp(), depthMD.FrameID());
+    }
+
+    // デプスマップの作成
+    depth_hist& depthHist = viewer.depthHist;
+    getDepthHistgram(k.depth, depthMD, depthHist);
+
+    // イメージをデプスマップで上書きする
+    xn::RGB24Map& rgb = imageMD.WritableRGB24Map();
+    for (XnUInt y = 0; y < imageMD.YRes(); ++y) {
+      for (XnUInt x = 0; x < imageMD.XRes(); ++x) {
+        const XnDepthPixel& depth = depthMD(x, y);
+        if (depth != 0) {
+          XnRGB24Pixel& pixel = rgb(x, y);
+          pixel.nRed   = depthHist[depthMD(x, y)];
+          pixel.nGreen = depthHist[depthMD(x, y)];
+          pixel.nBlue  = 0;
+        }
+      }
+    }
+
+    // カメラ画像の表示
+    memcpy(k.camera->imageData, imageMD.RGB24Data(), k.camera->imageSize);
+    ::cvCvtColor(k.camera, k.camera, CV_BGR2RGB);
+    viewer.display->show(k.image.GetName(), k.camera);
+  }
+}
+
+// 時刻のそろったフレームの組ごとに、すべてのKinectの点群を統合して、
+// 上から見た図を表示する
+void onFuse(XnUInt32 source, void* cookie)
+{
+  Viewer& viewer = *(Viewer*)cookie;
+  while (viewer.sync->pop(*viewer.matches)) {
+    if (!viewer.isFusion) {
+      continue;
+    }
+
+    for (std::map<int, Kinect>::iterator it = viewer.kinect->begin(); it != viewer.kinect->end(); ++it) {
+      Kinect& k = it->second;
+
+      // 止まっているセンサーは使わない。欠落したフレームの代わりは、前後の近い方を使う
+      const FrameSynchronizer::Match& d = (*viewer.matches)[k.depthStream];
+      const FrameSynchronizer::Match& i = (*viewer.matches)[k.imageStream];
+      if (d.isMissing() || i.isMissing()) {
+        continue;
+      }
+      const FrameBuffer& depth = k.depthSlots[d.nearestSlot()];
+      const FrameBuffer& rgb = k.imageSlots[i.nearestSlot()];
+      if (depth.empty() || rgb.empty() ||
+          (depth.xRes() != rgb.xRes()) || (depth.yRes() != rgb.yRes())) {
+        continue;
+      }
+
+      viewer.builder->build(depth.depth(), rgb.rgb24(), depth.xRes(), depth.yRes(), 0, 0, *k.cloud);
+      k.cloud->timestamp = d.timestamp;
+      k.cloud->frameID = d.frameID;
+      viewer.fusion->add(it->first, *k.cloud);
+    }
+
+    viewer.fusion->fuse(*viewer.fused);
+    drawTopView(viewer.fusionView, *viewer.fused);
+    viewer.display->show("Fusion", viewer.fusionView);
+  }
+}
+
+// キーの処理
+void onKey(int key, void* cookie)
+{
+  Viewer& viewer = *(Viewer*)cookie;
+  // 終了する
+  if (key == 'q') {
+    viewer.loop->quit();
+  }
+  // 点群の統合の有効/無効を切り替える
+  else if (key == 'f') {
+    viewer.isFusion = !viewer.isFusion;
+  }
+  // 時刻合わせの統計を表示する
+  else if (key == 's') {
+    viewer.sync->printStats(std::cout);
+    viewer.loop->printStats(std::cout);
+    viewer.frames->printStats(std::cout);
+  }
+}
+
+// 1秒ごとに、フレームが来なくなったセンサーを知らせる
+void onStallCheck(XnUInt32 timer, void* cookie)
+{
+  Viewer& viewer = *(Viewer*)cookie;
+  for (std::map<int, Kinect>::iterator it = viewer.kinect->begin(); it != viewer.kinect->end(); ++it) {
+    if (it->second.frames == 0) {
+      std::cout << it->second.image.GetName() << " : no frames" << std::endl;
+    }
+    it->second.frames = 0;
+  }
+}
+
+// 合成したデプスデータ(センサーごとに球の位置を変える)
+void createSyntheticDepth(std::vector<XnDepthPixel>& depth, int no)
+{
+  depth.resize(OUTPUT_MODE.nXRes * OUTPUT_MODE.nYRes);
+  int cx = 200 + no * 80, cy = 240;
+  for (XnUInt32 y = 0; y < OUTPUT_MODE.nYRes; ++y) {
+    for (XnUInt32 x = 0; x < OUTPUT_MODE.nXRes; ++x) {
+      int dx = (int)x - cx, dy = (int)y - cy;
+      XnDepthPixel d = 4000;
+      if ((dx * dx + dy * dy) < (120 * 120)) {
+        d = 1800 + (dx * dx + dy * dy) / 80;
+      }
+      depth[y * OUTPUT_MODE.nXRes + x] = d;
+    }
+  }
+}
+
+// 4台分の合成データで、点群の統合の速度を計測する
+void benchmark()
+{
+  const int SENSORS = 4;
+  const int TICKS = 100;
+
+  PointCloudPool pool;
+  WorkerThreads workers(SENSORS);
+  PointCloudBuilder builder(pool);
+  builder.setup(KINECT_HFOV, KINECT_VFOV, OUTPUT_MODE.nXRes, OUTPUT_MODE.nYRes);
+
+  // 中心を囲むように配置する
+  ExtrinsicsMap extrinsics;
+  extrinsics[0] = Extrinsics::fromEuler(0,   0, 0,     0, 0,    0);
+  extrinsics[1] = Extrinsics::fromEuler(0, -90, 0,  2000, 0, 2000);
+  extrinsics[2] = Extrinsics::fromEuler(0, 180, 0,     0, 0, 4000);
+  extrinsics[3] = Extrinsics::fromEuler(0,  90, 0, -2000, 0, 2000);
+
+  PointCloudFusion fusion(pool, &workers);
+  fusion.setExtrinsics(extrinsics);
+
+  std::vector<XnDepthPixel> depth[SENSORS];
+  PointCloud clouds[SENSORS];
+  for (int i = 0; i < SENSORS; ++i) {
+    createSyntheticDepth(depth[i], i);
+  }
+
+  PointCloud fused;
+  XnUInt64 inputPoints = 0, outputPoints = 0, fuseTime = 0;
+  for (int t = 0; t < TICKS; ++t) {
+    // 30fps相当のタイムスタンプ
+    for (int i = 0; i < SENSORS; ++i) {
+      builder.build(&depth[i][0], 0, OUTPUT_MODE.nXRes, OUTPUT_MODE.nYRes, 0, 0, clouds[i]);
+      clouds[i].timestamp = t * 33333;
+      fusion.add(i, clouds[i]);
+      inputPoints += clouds[i].size;
+    }
+
+    XnUInt64 begin, end;
+    xnOSGetHighResTimeStamp(&begin);
+    fusion.fuse(fused);
+    xnOSGetHighResTimeStamp(&end);
+
+    fuseTime += end - begin;
+    outputPoints += fused.size;
+  }
+
+  double sec = fuseTime / 1000000.0;
+  std::cout << SENSORS << " sensors, " << TICKS << " ticks : " <<
+    (inputPoints / TICKS) << " -> " << (outputPoints / TICKS) << " points/tick, " <<
+    (sec * 1000 / TICKS) << " ms/tick, " <<
+    (inputPoints / sec / 1000000) << " Mpoints/s fused, " <<
+    fusion.droppedFrames() << " dropped" << std::endl;
+}
+
+// 2台分のイメージ/デプスを、揺らぎと欠落のあるタイムスタンプで組にする
+//  途中で2台目が10秒止まる
+void benchmarkSync()
+{
+  const int DEVICES = 2;
+  const int FRAMES = 10000;
+  const XnUInt64 INTERVAL = 33333;
+  const int STALL_BEGIN = 5000;
+  const int STALL_END = 5300;
+
+  FrameSynchronizer sync;
+  std::vector<XnUInt32> streams;
+  for (int d = 0; d < DEVICES; ++d) {
+    // デバイスごとに時刻の起点が違う
+    sync.setClockOffset(d, -(XnInt64)(d + 1) * 1000000000);
+    streams.push_back(sync.addStream(d));   // デプス
+    streams.push_back(sync.addStream(d));   // イメージ
+  }
+
+  ::srand(0);
+  std::vector<FrameSynchronizer::Match> matches;
+  XnUInt64 tuples = 0, substituted = 0, missing = 0;
+  XnUInt64 begin, end;
+  xnOSGetHighResTimeStamp(&begin);
+  for (int t = 0; t < FRAMES; ++t) {
+    for (XnUInt32 s = 0; s < streams.size(); ++s) {
+      // 5%のフレームが欠落する
+      if ((::rand() % 100) < 5) {
+        continue;
+      }
+
+      // デバイスごとに位相がずれ、±3msの揺らぎがある
+      int d = s / 2;
+      if ((d == 1) && (t >= STALL_BEGIN) && (t < STALL_END)) {
+        continue;
+      }
+      XnUInt64 timestamp = (d + 1) * 1000000000ULL + t * INTERVAL + d * 7000 +
+                           (::rand() % 6000);
+      sync.push(streams[s], timestamp, t);
+    }
+
+    while (sync.pop(matches)) {
+      ++tuples;
+      for (XnUInt32 s = 0; s < matches.size(); ++s) {
+        substituted += matches[s].isSubstituted ? 1 : 0;
+        missing += matches[s].isMissing() ? 1 : 0;
+      }
+    }
+  }
+  xnOSGetHighResTimeStamp(&end);
+
+  std::cout << "sync " << streams.size() << " streams, " << FRAMES << " frames : " <<
+    tuples << " tuples, " << substituted << " substituted, " << missing << " missing, " <<
+    ((end - begin) * 1000.0 / FRAMES) << " ns/frame" << std::endl;
+  sync.printStats(std::cout);
+}
+
+// 4台分のフレームをスロットにためるとき、毎回確保する場合とプールから借りる場合を比べる
+void benchmarkFramePool()
+{
+  const int SENSORS = 4;
+  const int FRAMES = 300;
+  const XnUInt32 SLOTS = 8;
+  const XnUInt32 PIXELS = OUTPUT_MODE.nXRes * OUTPUT_MODE.nYRes;
+
+  std::vector<XnDepthPixel> depth(PIXELS, 1000);
+  std::vector<XnRGB24Pixel> rgb(PIXELS);
+
+  // 毎フレーム新しいvectorにコピーしてスロットに入れる
+  XnUInt64 begin, end;
+  {
+    std::vector<std::vector<XnDepthPixel> > depthSlots(SENSORS * SLOTS);
+    std::vector<std::vector<XnRGB24Pixel> > imageSlots(SENSORS * SLOTS);
+    xnOSGetHighResTimeStamp(&begin);
+    for (int f = 0; f < FRAMES; ++f) {
+      for (int s = 0; s < SENSORS; ++s) {
+        std::vector<XnDepthPixel> d(depth.begin(), depth.end());
+        std::vector<XnRGB24Pixel> i(rgb.begin(), rgb.end());
+        depthSlots[s * SLOTS + f % SLOTS].swap(d);
+        imageSlots[s * SLOTS + f % SLOTS].swap(i);
+      }
+    }
+    xnOSGetHighResTimeStamp(&end);
+  }
+  std::cout << "frame slots (new vector) : " << ((end - begin) / 1000.0 / FRAMES) << " ms/frame" << std::endl;
+
+  FramePool frames;
+  {
+    std::vector<FrameBuffer> depthSlots(SENSORS * SLOTS);
+    std::vector<FrameBuffer> imageSlots(SENSORS * SLOTS);
+    xnOSGetHighResTimeStamp(&begin);
+    for (int f = 0; f < FRAMES; ++f) {
+      for (int s = 0; s < SENSORS; ++s) {
+        FrameBuffer& d = depthSlots[s * SLOTS + f % SLOTS];
+        FrameBuffer& i = imageSlots[s * SLOTS + f % SLOTS];
+        d.release();
+        d = frames.copy(FRAME_DEPTH16, &depth[0], OUTPUT_MODE.nXRes, OUTPUT_MODE.nYRes);
+        i.release();
+        i = frames.copy(FRAME_RGB24, &rgb[0], OUTPUT_MODE.nXRes, OUTPUT_MODE.nYRes);
+      }
+    }
+    xnOSGetHighResTimeStamp(&end);
+  }
+  std::cout << "frame slots (FramePool) : " << ((end - begin) / 1000.0 / FRAMES) << " ms/frame" << std::endl;
+  frames.printStats(std::cout);
+}
+
+// ベンチマーク用のジェネレータ(ドライバに来たフレームと、更新して見えているフレームを持つ)
+struct FakeMetaData
+{
+  const void* data;
+  XnUInt32 frameID;
+  XnUInt64 timestamp;
+
+  const void* Data() const { return data; }
+  XnUInt32 FrameID() const { return frameID; }
+  XnUInt64 Timestamp() const { return timestamp; }
+};
+
+struct FakeGenerator
+{
+  const void* data;
+  XnUInt32 pending;           // ドライバに来ているフレーム
+  XnUInt64 pendingTimestamp;
+  FakeMetaData current;       // 更新したフレーム
+  bool isNew;
+
+  XnBool IsNewDataAvailable() const { return pending != current.frameID; }
+  XnBool IsDataNew() const { return isNew; }
+  void GetMetaData(FakeMetaData& metaData) const { metaData = current; }
+
+  XnStatus WaitAndUpdateData()
+  {
+    isNew = (pending != current.frameID);
+    current.data = data;
+    current.frameID = pending;
+    current.timestamp = pendingTimestamp;
+    return XN_STATUS_OK;
+  }
+};
+
+// 2台のセンサーが同時にフレームを出すときに、イベントループからためられるフレーム
+struct UpdateBench
+{
+  enum { SENSORS = 2 };
+
+  FakeGenerator depth[SENSORS];
+  FakeGenerator image[SENSORS];
+  XnUInt32 source[SENSORS];
+  XnUInt32 depthStream[SENSORS];
+  XnUInt32 imageStream[SENSORS];
+  std::vector<FrameBuffer> depthSlots[SENSORS];
+  std::vector<FrameBuffer> imageSlots[SENSORS];
+  FrameSynchronizer* sync;
+  FramePool* frames;
+  bool isUpdateAll;           // 以前のようにWaitNoneUpdateAllの代わりにすべてを更新する
+  XnUInt32 kept;
+};
+
+void onBenchFrame(XnUInt32 source, void* cookie)
+{
+  UpdateBench& bench = *(UpdateBench*)cookie;
+  if (bench.isUpdateAll) {
+    for (int s = 0; s < UpdateBench::SENSORS; ++s) {
+      bench.depth[s].WaitAndUpdateData();
+      bench.image[s].WaitAndUpdateData();
+    }
+  }
+
+  for (int s = 0; s < UpdateBench::SENSORS; ++s) {
+    if (bench.source[s] != source) {
+      continue;
+    }
+
+    FakeMetaData depthMD, imageMD;
+    bool isNewDepth, isNewImage;
+    if (bench.isUpdateAll) {
+      bench.depth[s].GetMetaData(depthMD);
+      bench.image[s].GetMetaData(imageMD);
+      isNewDepth = bench.depth[s].IsDataNew() != 0;
+      isNewImage = bench.image[s].IsDataNew() != 0;
+    }
+    else {
+      isNewDepth = updateIfNew(bench.depth[s], depthMD);
+      isNewImage = updateIfNew(bench.image[s], imageMD);
+    }
+
+    if (isNewDepth) {
+      keepFrame(*bench.sync, bench.depthStream[s], bench.depthSlots[s], *bench.frames,
+                FRAME_DEPTH16, depthMD.Data(), OUTPUT_MODE.nXRes, OUTPUT_MODE.nYRes,
+                depthMD.Timestamp(), depthMD.FrameID());
+      ++bench.kept;
+    }
+    if (isNewImage) {
+      keepFrame(*bench.sync, bench.imageStream[s], bench.imageSlots[s], *bench.frames,
+                FRAME_RGB24, imageMD.Data(), OUTPUT_MODE.nXRes, OUTPUT_MODE.nYRes,
+                imageMD.Timestamp(), imageMD.FrameID());
+      ++bench.kept;
+    }
+  }
+}
+
+// 2台のセンサーがほぼ同時にフレームを出すとき、すべてを更新する以前の方法と、
+// 通知が来たセンサーだけを更新する方法で、時刻合わせにためられるフレームの数を比べる
+void benchmarkUpdate(bool isUpdateAll)
+{
+  const int FRAMES = 300;
+  const XnUInt64 INTERVAL = 33333;
+  const XnUInt32 PIXELS = OUTPUT_MODE.nXRes * OUTPUT_MODE.nYRes;
+
+  std::vector<XnDepthPixel> depth(PIXELS, 1000);
+  std::vector<XnRGB24Pixel> rgb(PIXELS);
+
+  FrameSynchronizer sync;
+  FramePool frames;
+  EventLoop loop;
+  UpdateBench bench;
+  bench.sync = &sync;
+  bench.frames = &frames;
+  bench.isUpdateAll = isUpdateAll;
+  bench.kept = 0;
+  for (int s = 0; s < UpdateBench::SENSORS; ++s) {
+    FakeGenerator* generators[] = { &bench.depth[s], &bench.image[s] };
+    for (int g = 0; g < 2; ++g) {
+      memset(generators[g], 0, sizeof(FakeGenerator));
+    }
+    bench.depth[s].data = &depth[0];
+    bench.image[s].data = &rgb[0];
+
+    sync.setClockOffset(s, 0);
+    bench.depthStream[s] = sync.addStream(s);
+    bench.imageStream[s] = sync.addStream(s);
+    bench.depthSlots[s].resize(sync.slots());
+    bench.imageSlots[s].resize(sync.slots());
+    bench.source[s] = loop.addSource();
+    loop.addStage(bench.source[s], &onBenchFrame, &bench);
+  }
+
+  std::vector<FrameSynchronizer::Match> matches;
+  XnUInt64 tuples = 0;
+  for (int t = 1; t <= FRAMES; ++t) {
+    // 2台とも、イベントループが処理する前にフレームを出す
+    for (int s = 0; s < UpdateBench::SENSORS; ++s) {
+      const XnUInt64 timestamp = t * INTERVAL + s * 1000;
+      FakeGenerator* generators[] = { &bench.depth[s], &bench.image[s] };
+      for (int g = 0; g < 2; ++g) {
+        generators[g]->pending = t;
+        generators[g]->pendingTimestamp = timestamp;
+      }
+      loop.notify(bench.source[s]);
+    }
+    while (loop.runOnce(0) > 0) {
+    }
+
+    while (sync.pop(matches)) {
+      ++tuples;
+    }
+  }
+
+  std::cout << "update " << (isUpdateAll ? "all sensors" : "notified sensor") << " : kept " <<
+    bench.kept << "/" << (FRAMES * UpdateBench::SENSORS * 2) << " frames, " <<
+    tuples << " tuples" << std::endl;
+}
+
+#ifdef EVENT_LOOP_USE_EPOLL
+#include <fcntl.h>
+
+// センサーとキーボードの代わり
+//  センサーごとに30fpsで(センサーごとに位相をずらして)フレームを届け、
+//  ときどきパイプにキーを書く
+struct FakeSensors
+{
+  enum { MAX_SENSORS = 4 };
+
+  int sensors;
+  volatile XnUInt32 frame[MAX_SENSORS];
+  volatile XnUInt64 deliveredAt[MAX_SENSORS];
+  volatile XnUInt64 keyAt;
+  int keyPipe[2];
+  volatile bool isQuit;
+
+  EventLoop* loop;                  // イベントループで待つとき
+  XnUInt32 source[MAX_SENSORS];
+  XN_EVENT_HANDLE anyUpdate;        // WaitAnyUpdateAllの代わり
+};
+
+XN_THREAD_PROC fakeSensorsProc(XN_THREAD_PARAM param)
+{
+  FakeSensors& fake = *(FakeSensors*)param;
+  const XnUInt64 INTERVAL = 33333;
+  XnUInt64 begin, now;
+  xnOSGetHighResTimeStamp(&begin);
+  XnUInt64 tick = 0;
+  while (!fake.isQuit) {
+    for (int s = 0; s < fake.sensors; ++s) {
+      // センサーsのフレームの時刻まで待つ
+      const XnUInt64 due = begin + tick * INTERVAL + s * INTERVAL / fake.sensors;
+      xnOSGetHighResTimeStamp(&now);
+      if (due > now) {
+        xnOSSleep((XnUInt32)((due - now) / 1000));
+      }
+      xnOSGetHighResTimeStamp(&now);
+      fake.deliveredAt[s] = now;
+      fake.frame[s] = fake.frame[s] + 1;
+      if (fake.loop != 0) {
+        fake.loop->notify(fake.source[s]);
+      }
+      else {
+        xnOSSetEvent(fake.anyUpdate);
+      }
+    }
+
+    // 約0.1秒ごとにキーを押す
+    if ((tick % 3) == 2) {
+      fake.keyAt = now;
+      ssize_t written = ::write(fake.keyPipe[1], "k", 1);
+      (void)written;
+    }
+    ++tick;
+  }
+  XN_THREAD_PROC_RETURN(XN_STATUS_OK);
+}
+
+// 表示までの遅れを数える
+struct LatencyStats
+{
+  FakeSensors* fake;
+  XnUInt32 lastFrame[FakeSensors::MAX_SENSORS];
+  XnUInt64 keyAt;                   // 読んだがまだ表示していないキーの時刻(0ならない)
+  XnUInt64 frames, dropped, frameSum, frameMax;
+  XnUInt64 keys, keySum, keyMax;
+
+  // センサーsのフレームを処理して表示する(処理に3msかかるとする)
+  void show(int s)
+  {
+    XnUInt64 begin, now;
+    xnOSGetHighResTimeStamp(&begin);
+    do {
+      xnOSGetHighResTimeStamp(&now);
+    } while ((now - begin) < 3000);
+
+    const XnUInt32 frame = fake->frame[s];
+    if (frame == lastFrame[s]) {
+      return;
+    }
+    dropped += frame - lastFrame[s] - 1;
+    lastFrame[s] = frame;
+    ++frames;
+    const XnUInt64 latency = now - fake->deliveredAt[s];
+    frameSum += latency;
+    frameMax = std::max(frameMax, latency);
+
+    if (keyAt != 0) {
+      ++keys;
+      keySum += now - keyAt;
+      keyMax = std::max(keyMax, now - keyAt);
+      keyAt = 0;
+    }
+  }
+
+  void readKey()
+  {
+    char key;
+    if (::read(fake->keyPipe[0], &key, 1) == 1) {
+      keyAt = fake->keyAt;
+    }
+  }
+
+  void print(const char* name) const
+  {
+    std::cout << name << " : frame->display avg " << (frameSum / 1000.0 / std::max(frames, (XnUInt64)1)) <<
+      " ms, max " << (frameMax / 1000.0) << " ms, " << dropped << "/" << (frames + dropped) <<
+      " dropped, key->display avg " << (keySum / 1000.0 / std::max(keys, (XnUInt64)1)) <<
+      " ms, max " << (keyMax / 1000.0) << " ms" << std::endl;
+  }
+};
+
+void onFakeFrame(XnUInt32 source, void* cookie)
+{
+  LatencyStats& stats = *(LatencyStats*)cookie;
+  for (int s = 0; s < stats.fake->sensors; ++s) {
+    if (stats.fake->source[s] == source) {
+      stats.show(s);
+    }
+  }
+}
+
+void onFakeKey(int key, void* cookie)
+{
+  LatencyStats& stats = *(LatencyStats*)cookie;
+  stats.keyAt = stats.fake->keyAt;
+}
+
+// 今のループ(WaitAnyUpdateAll + センサーごとにcvWaitKey(10))とイベントループで、
+// フレームとキーが表示されるまでの遅れを比べる
+void benchmarkLoop(int sensors, bool isEventLoop)
+{
+  const XnUInt64 DURATION = 3000000;
+
+  FakeSensors fake;
+  memset(&fake, 0, sizeof(fake));
+  fake.sensors = sensors;
+  if ((::pipe(fake.keyPipe) != 0) || (xnOSCreateEvent(&fake.anyUpdate, FALSE) != XN_STATUS_OK)) {
+    throw std::runtime_error("error : pipe");
+  }
+  ::fcntl(fake.keyPipe[0], F_SETFL, O_NONBLOCK);
+
+  LatencyStats stats;
+  memset(&stats, 0, sizeof(stats));
+  stats.fake = &fake;
+
+  EventLoop loop;
+  if (isEventLoop) {
+    fake.loop = &loop;
+    for (int s = 0; s < sensors; ++s) {
+      fake.source[s] = loop.addSource();
+      loop.addStage(fake.source[s], &onFakeFrame, &stats);
+    }
+    loop.addInput(fake.keyPipe[0], &onFakeKey, &stats);
+  }
+
+  XN_THREAD_HANDLE thread;
+  xnOSCreateThread(fakeSensorsProc, &fake, &thread);
+
+  XnUInt64 begin, now;
+  xnOSGetHighResTimeStamp(&begin);
+  do {
+    if (isEventLoop) {
+      loop.runOnce(100);
+    }
+    else {
+      xnOSWaitEvent(fake.anyUpdate, 100);
+      for (int s = 0; s < sensors; ++s) {
+        stats.show(s);
+        // cvWaitKey(10)
+        xnOSSleep(10);
+        stats.readKey();
+      }
+    }
+    xnOSGetHighResTimeStamp(&now);
+  } while ((now - begin) < DURATION);
+
+  fake.isQuit = true;
+  xnOSWaitForThreadExit(thread, XN_WAIT_INFINITE);
+  xnOSCloseThread(&thread);
+  xnOSCloseEvent(&fake.anyUpdate);
+  ::close(fake.keyPipe[0]);
+  ::close(fake.keyPipe[1]);
+
+  std::ostringstream name;
+  name << sensors << " sensors, " << (isEventLoop ? "event loop" : "cvWaitKey(10)");
+  stats.print(name.str().c_str());
+}
+#endif
+
 int main (int argc, char * argv[])
 {
+  // 速度計測モード
+  if ((argc > 1) && (std::string(argv[1]) == "bench")) {
+    benchmark();
+    benchmarkSync();
+    benchmarkFramePool();
+    benchmarkUpdate(true);
+    benchmarkUpdate(false);
+#ifdef EVENT_LOOP_USE_EPOLL
+    for (int sensors = 1; sensors <= FakeSensors::MAX_SENSORS; sensors *= 4) {
+      benchmarkLoop(sensors, false);
+      benchmarkLoop(sensors, true);
+    }
+#endif
+    return 0;
+  }
+
+  DisplaySink* display = 0;
+
   try {
     XnStatus rc;
     
+    // 表示先(display=null などでウィンドウなしで動かす)
+    display = DisplaySink::create(argc, argv);
+
     xn::Context context;
     rc = context.Init();
     if (rc != XN_STATUS_OK) {
@@ -120,7 +905,10 @@ int main (int argc, char * argv[])
     std::cout << "Success" << std::endl;
 
     // 登録されたデバイスからジェネレータを生成する
+    //  Kinectが持つフレームのバッファを返せるよう、プールを先に作る
+    FramePool frames;
     std::map<int, Kinect> kinect;
+    KinectReleaser releaser = { kinect };
     for ( xn::NodeInfoList::Iterator it = nodeList.Begin();
          it != nodeList.End(); ++it ) {
       
@@ -156,68 +944,93 @@ int main (int argc, char * argv[])
       k.depth.GetAlternativeViewPointCap().SetViewPoint(k.image);
 
       
-      ::cvNamedWindow( k.image.GetName() );
-      ::cvResizeWindow( k.image.GetName(), OUTPUT_MODE.nXRes, OUTPUT_MODE.nYRes );
-      ::cvMoveWindow( k.image.GetName(), (no % 2) * OUTPUT_MODE.nXRes, (no / 2) * OUTPUT_MODE.nYRes );
+      display->move( k.image.GetName(), (no % 2) * OUTPUT_MODE.nXRes, (no / 2) * OUTPUT_MODE.nYRes );
       
       kinect[no].camera = ::cvCreateImage(cvSize(OUTPUT_MODE.nXRes, OUTPUT_MODE.nYRes),
                                           IPL_DEPTH_8U, 3);
       if (!kinect[no].camera) {
         throw std::runtime_error("error : cvCreateImage");
       }
+
+      kinect[no].cloud = new PointCloud();
+    }
+
+    // イメージとデプスのフレームをタイムスタンプでそろえる準備
+    //  ストリームごとに別々に更新を受け取り、一番遅いセンサーを待たない
+    FrameSynchronizer sync;
+    for (std::map<int, Kinect>::iterator it = kinect.begin(); it != kinect.end(); ++it) {
+      Kinect& k = it->second;
+      k.depthStream = sync.addStream(it->first);
+      k.imageStream = sync.addStream(it->first);
+      k.depthSlots.resize(sync.slots());
+      k.imageSlots.resize(sync.slots());
+    }
+    std::vector<FrameSynchronizer::Match> matches;
+
+    // 点群の統合の準備
+    PointCloudPool pool;
+    WorkerThreads workers(kinect.size());
+    PointCloudBuilder builder(pool);
+    builder.setup(kinect.begin()->second.depth);
+
+    PointCloudFusion fusion(pool, &workers);
+    try {
+      fusion.setExtrinsics(loadExtrinsics(EXTRINSICS_PATH));
     }
+    catch (std::exception& ex) {
+      std::cout << ex.what() << std::endl;
+      std::cout << "すべてのセンサーを同じ位置として扱います" << std::endl;
+    }
+    // 時刻はFrameSynchronizerでPCの時刻にそろえてあるので、そのまま使い、1フレーム分のずれまで通す
+    fusion.setAlignedTimestamps(true);
+    fusion.setTolerance(1000000 / OUTPUT_MODE.nFPS);
+
+    PointCloud fused;
+    IplImage* fusionView = ::cvCreateImage(cvSize(OUTPUT_MODE.nXRes, OUTPUT_MODE.nYRes),
+                                           IPL_DEPTH_8U, 3);
+    if (!fusionView) {
+      throw std::runtime_error("error : cvCreateImage");
+    }
+    ImageReleaser fusionViewReleaser = { fusionView };
+    bool isFusion = true;
+    EventLoop loop;
     
     // メインループ
-    bool shouldRun = true;
-    while ( shouldRun ) {
-      context.WaitAndUpdateAll();
-
-      // 検出したすべてのKinectの画像を表示する
-      for (std::map<int, Kinect>::iterator it = kinect.begin(); it != kinect.end(); ++it) {
-        Kinect& k = it->second;
-        
-        xn::ImageMetaData imageMD;
-        k.image.GetMetaData(imageMD);
-
-        xn::DepthMetaData depthMD;
-        k.depth.GetMetaData(depthMD);
-
-        // デプスマップの作成
-        depth_hist depthHist = getDepthHistgram(k.depth, depthMD);
-        
-        // イメージをデプスマップで上書きする
-        xn::RGB24Map& rgb = imageMD.WritableRGB24Map();
-        for (XnUInt y = 0; y < imageMD.YRes(); ++y) {
-          for (XnUInt x = 0; x < imageMD.XRes(); ++x) {
-            const XnDepthPixel& depth = depthMD(x, y);
-            if (depth != 0) {
-              XnRGB24Pixel& pixel = rgb(x, y);
-              pixel.nRed   = depthHist[depthMD(x, y)];
-              pixel.nGreen = depthHist[depthMD(x, y)];
-              pixel.nBlue  = 0;
-            }
-          }
-        }
-        
-        // カメラ画像の表示
-        memcpy(k.camera->imageData, imageMD.RGB24Data(), k.camera->imageSize);
-        ::cvCvtColor(k.camera, k.camera, CV_BGR2RGB);
-        ::cvShowImage(k.image.GetName(), k.camera);
-        
-        // 連続してcvShowImageを呼び出すとすべてのウィンドウで最後のデータが表示されてしまうので、
-        // OpenCVのWait機能を利用して少し待つ
-        // キーの取得
-        char key = ::cvWaitKey(10);
-        // 終了する
-        if (key == 'q') {
-          shouldRun = false;
-        }
+    //  センサーごとにフレームが来たら、そのセンサーの表示と点群の統合を行う。
+    //  キーはウィンドウと標準入力から受け取る
+    Viewer viewer = { &context, &kinect, display, &sync, &matches, &builder, &fusion, &fused,
+                      fusionView, isFusion, &loop, &frames };
+    for (std::map<int, Kinect>::iterator it = kinect.begin(); it != kinect.end(); ++it) {
+      Kinect& k = it->second;
+      k.source = loop.addSource();
+      k.frames = 0;
+      loop.watch(k.depth, k.source);
+      loop.watch(k.image, k.source);
+      loop.addStage(k.source, &onSensorFrame, &viewer);
+      loop.addStage(k.source, &onFuse, &viewer);
+    }
+    loop.addTimer(1000, &onStallCheck, &viewer);
+    // 標準入力がepollで待てないとき(ファイルや/dev/nullのとき)は、ウィンドウのキーだけを使う
+    loop.addInput(0, &onKey, &viewer);
+
+    while (!loop.isQuit()) {
+      // ウィンドウのイベントを処理するため、フレームが来なくても15msごとには戻る
+      loop.runOnce(15);
+      int key = display->pollKey();
+      if (key >= 0) {
+        onKey(key, &viewer);
       }
     }
+    loop.printStats(std::cout);
+    frames.printStats(std::cout);
+
+    sync.printStats(std::cout);
   }
   catch (std::exception& ex) {
     std::cout << ex.what() << std::endl;
   }
+
+  delete display;
   
   return 0;
 }
@@ -0,0 +1,455 @@
+#ifndef DEPTHSEGMENTER_H_INCLUDE
+#define DEPTHSEGMENTER_H_INCLUDE
+
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+
+#include <XnCppWrapper.h>
+#include <XnOS.h>
+
+#include "../PointCloud/WorkerThreads.h"
+#include "../../../OpenNI/cpp/User/LabelRuns.h"
+#include "../../../OpenNI/cpp/CroppingCapability/FrameRoi.h"
+
+// デプスだけでユーザー(前景)を切り出し、SceneMetaDataと同じ形式のラベルマップを作る
+//  UserGeneratorが使えない環境向け。
+//  最初の数フレームで背景の距離を覚え、それより手前にある画素を前景とする。
+//  前景は行ごとのラン(連続区間)にまとめ、上下に重なるランを
+//  Union-Findでつないで連結成分にし、小さいものはノイズとして除く。
+//  画面を横長の帯に分けてスレッドごとにラベル付けし、帯の境目だけ後でつなぐ。
+//  結果は画素ごとのラベルマップと、ランレングスの両方で取り出せる。
+//  クロッピングされたデプスでは、窓の中だけを調べる(背景とラベルはフレーム全体の座標で持つ)
+class DepthSegmenter
+{
+public:
+
+  DepthSegmenter(WorkerThreads* workers = 0)
+    :workers_(workers), learningFrames_(30), learned_(0), threshold_(100),
+     depthJump_(100), minSize_(2000), xRes_(0), yRes_(0), users_(0), depth_(0)
+  {
+  }
+
+  // 背景を覚えるのに使うフレーム数
+  void setLearningFrames(XnUInt32 frames)
+  {
+    learningFrames_ = std::max<XnUInt32>(frames, 1);
+  }
+
+  // 背景より手前とみなす距離(mm)。遠いほどデプスの誤差に合わせて広げる
+  void setThreshold(XnDepthPixel threshold)
+  {
+    threshold_ = threshold;
+  }
+
+  // 隣り合う画素を同じ物体とみなすデプスの差(mm)
+  void setDepthJump(XnDepthPixel depthJump)
+  {
+    depthJump_ = depthJump;
+  }
+
+  // ユーザーとみなす最小の画素数
+  void setMinSize(XnUInt32 minSize)
+  {
+    minSize_ = minSize;
+  }
+
+  // 背景を覚え直す
+  void resetBackground()
+  {
+    learned_ = 0;
+  }
+
+  bool isLearning() const
+  {
+    return learned_ < learningFrames_;
+  }
+
+  void segment(const xn::DepthMetaData& depthMD)
+  {
+    segment(depthMD.Data(), FrameRoi::fromMetaData(depthMD));
+  }
+
+  // デプスからラベルマップを作る(背景を覚えている間はすべて0)
+  void segment(const XnDepthPixel* pDepth, XnUInt32 xRes, XnUInt32 yRes)
+  {
+    segment(pDepth, FrameRoi::full(xRes, yRes));
+  }
+
+  // 窓(roi)の大きさのデプスから、窓の中だけラベルをつける。窓の外のラベルは0
+  void segment(const XnDepthPixel* pDepth, const FrameRoi& roi)
+  {
+    const XnUInt32 xRes = roi.fullWidth;
+    const XnUInt32 yRes = roi.fullHeight;
+    if ((xRes != xRes_) || (yRes != yRes_)) {
+      if ((xRes > 0xFFFF) || (yRes > 0xFFFF)) {
+        throw std::runtime_error("DepthSegmenter : 解像度が大きすぎます");
+      }
+
+      xRes_ = xRes;
+      yRes_ = yRes;
+      background_.assign(xRes * yRes, 0);
+      limit_.assign(xRes * yRes, 0);
+      labels_.assign(xRes * yRes, 0);
+      rowBegin_.resize(yRes + 1);
+      learned_ = 0;
+      roi_ = roi;
+    }
+
+    // 窓が変わったら、窓の外に残ったラベルを消す
+    if (roi != roi_) {
+      std::fill(labels_.begin(), labels_.end(), 0);
+      roi_ = roi;
+    }
+
+    depth_ = pDepth;
+    if (isLearning()) {
+      learn();
+      std::fill(labels_.begin(), labels_.end(), 0);
+      runs_.reset(xRes_, yRes_);
+      runs_.close();
+      users_ = 0;
+      return;
+    }
+
+    // 帯ごとにランを作ってつなぎ、境目をつないでラベルを決め、書き込む
+    bands_.resize((workers_ != 0) ? workers_->size() : 1);
+    WorkerThreads::run(workers_, &DepthSegmenter::extract, this);
+    merge();
+    WorkerThreads::run(workers_, &DepthSegmenter::paint, this);
+
+    // ランレングスのラベルマップ
+    runs_.reset(xRes_, yRes_);
+    for (XnUInt32 b = 0; b < bands_.size(); ++b) {
+      const Band& band = bands_[b];
+      for (XnUInt32 i = 0; i < band.runs.size(); ++i) {
+        const XnLabel label = runLabel_[base_[b] + i];
+        if (label != 0) {
+          const Run& run = band.runs[i];
+          runs_.append(run.row, run.start, run.end - run.start, label);
+        }
+      }
+    }
+    runs_.close();
+  }
+
+  // ラベルマップ(0は背景、1からユーザー)
+  const XnLabel* labels() const
+  {
+    return labels_.empty() ? 0 : &labels_[0];
+  }
+
+  // ラベルマップ(ランレングス)
+  const LabelRuns& runs() const
+  {
+    return runs_;
+  }
+
+  const XnLabel& operator()(XnUInt32 x, XnUInt32 y) const
+  {
+    return labels_[y * xRes_ + x];
+  }
+
+  // 見つかったユーザーの数
+  XnUInt32 users() const
+  {
+    return users_;
+  }
+
+  XnUInt32 xRes() const
+  {
+    return xRes_;
+  }
+
+  XnUInt32 yRes() const
+  {
+    return yRes_;
+  }
+
+  // 最後に調べた窓
+  const FrameRoi& roi() const
+  {
+    return roi_;
+  }
+
+private:
+
+  DepthSegmenter(const DepthSegmenter&);
+  DepthSegmenter& operator=(const DepthSegmenter&);
+
+  // 行の中の前景の連続区間 [start, end)
+  struct Run
+  {
+    XnUInt16  row;
+    XnUInt16  start;
+    XnUInt16  end;
+  };
+
+  // スレッドごとの帯
+  struct Band
+  {
+    XnUInt32              top;
+    XnUInt32              bottom;
+    std::vector<Run>      runs;
+    std::vector<XnUInt32> parent;   // 帯の中でのランの番号で持つ
+  };
+
+  // 背景は見えた中で最も遠い距離とする(学習中に前を横切ったものを残さない)
+  //  覚えるのは窓の中だけ。窓の外は背景がわからないままになる
+  void learn()
+  {
+    if (learned_ == 0) {
+      std::fill(background_.begin(), background_.end(), 0);
+    }
+    for (XnUInt32 y = roi_.y; y < roi_.bottom(); ++y) {
+      const XnDepthPixel* depth = depthRow(y);
+      XnDepthPixel* background = &background_[y * xRes_];
+      for (XnUInt32 x = roi_.x; x < roi_.right(); ++x) {
+        background[x] = std::max(background[x], depth[x]);
+      }
+    }
+
+    if (++learned_ < learningFrames_) {
+      return;
+    }
+
+    // 前景とみなすデプスの上限。背景がわからない画素は前景にしない
+    const XnUInt32 size = xRes_ * yRes_;
+    for (XnUInt32 i = 0; i < size; ++i) {
+      XnUInt32 bg = background_[i];
+      XnUInt32 margin = threshold_ + bg * bg / 300000;
+      limit_[i] = (XnDepthPixel)((bg > margin) ? (bg - margin) : 0);
+    }
+  }
+
+  // y行目のデプス。フレーム全体のxで引けるように、窓の左端の分だけずらしてある
+  const XnDepthPixel* depthRow(XnUInt32 y) const
+  {
+    return depth_ + (y - roi_.y) * roi_.width - roi_.x;
+  }
+
+  static bool isForeground(const XnDepthPixel* depth, const XnDepthPixel* limit, XnUInt32 x)
+  {
+    return (depth[x] != 0) && (depth[x] < limit[x]);
+  }
+
+  static XnUInt32 find(std::vector<XnUInt32>& parent, XnUInt32 i)
+  {
+    while (parent[i] != i) {
+      parent[i] = parent[parent[i]];
+      i = parent[i];
+    }
+    return i;
+  }
+
+  // 番号の小さい方を根にする(ラベルがラスター順に並ぶ)
+  static void unite(std::vector<XnUInt32>& parent, XnUInt32 a, XnUInt32 b)
+  {
+    a = find(parent, a);
+    b = find(parent, b);
+    if (a < b) {
+      parent[b] = a;
+    }
+    else if (b < a) {
+      parent[a] = b;
+    }
+  }
+
+  // 上下のランが重なり、デプスが連続していればつなぐ
+  void connect(std::vector<XnUInt32>& parent,
+               const Run* above, XnUInt32 aboveBase, XnUInt32 aboveCount,
+               const Run* below, XnUInt32 belowBase, XnUInt32 belowCount) const
+  {
+    XnUInt32 a = 0;
+    for (XnUInt32 b = 0; b < belowCount; ++b) {
+      const Run& r = below[b];
+      while ((a < aboveCount) && (above[a].end <= r.start)) {
+        ++a;
+      }
+
+      for (XnUInt32 q = a; (q < aboveCount) && (above[q].start < r.end); ++q) {
+        XnUInt32 x = std::max(r.start, above[q].start);
+        int diff = (int)depthRow(r.row)[x] - (int)depthRow(above[q].row)[x];
+        if (std::abs(diff) <= depthJump_) {
+          unite(parent, aboveBase + q, belowBase + b);
+        }
+      }
+    }
+  }
+
+  // 帯の中でランを作り、帯の中だけでつなぐ
+  static void extract(void* param, XnUInt32 index, XnUInt32 count)
+  {
+    DepthSegmenter& self = *(DepthSegmenter*)param;
+    Band& band = self.bands_[index];
+    const FrameRoi& roi = self.roi_;
+    band.top = roi.y + roi.height * index / count;
+    band.bottom = roi.y + roi.height * (index + 1) / count;
+    band.runs.clear();
+    band.parent.clear();
+
+    const XnUInt32 left = roi.x;
+    const XnUInt32 right = roi.right();
+    const int depthJump = self.depthJump_;
+
+    for (XnUInt32 y = band.top; y < band.bottom; ++y) {
+      const XnUInt32 begin = (XnUInt32)band.runs.size();
+      self.rowBegin_[y] = begin;
+
+      const XnDepthPixel* depth = self.depthRow(y);
+      const XnDepthPixel* limit = &self.limit_[y * self.xRes_];
+      XnUInt32 x = left;
+      while (x < right) {
+        while ((x < right) && !isForeground(depth, limit, x)) {
+          ++x;
+        }
+        if (x == right) {
+          break;
+        }
+
+        // デプスが大きく変わるところでは区切る
+        Run run = { (XnUInt16)y, (XnUInt16)x, 0 };
+        for (++x; (x < right) && isForeground(depth, limit, x); ++x) {
+          if (std::abs((int)depth[x] - (int)depth[x - 1]) > depthJump) {
+            break;
+          }
+        }
+        run.end = (XnUInt16)x;
+
+        band.parent.push_back((XnUInt32)band.runs.size());
+        band.runs.push_back(run);
+      }
+
+      // 上の行とつなぐ
+      if (y > band.top) {
+        const XnUInt32 above = self.rowBegin_[y - 1];
+        const XnUInt32 end = (XnUInt32)band.runs.size();
+        if ((begin != end) && (above != begin)) {
+          self.connect(band.parent,
+                       &band.runs[above], above, begin - above,
+                       &band.runs[begin], begin, end - begin);
+        }
+      }
+    }
+  }
+
+  // 帯の境目をつなぎ、大きさで選別してラベルを決める
+  void merge()
+  {
+    // 帯ごとのランの番号を通し番号にする
+    std::vector<XnUInt32>& base = base_;
+    base.resize(bands_.size() + 1);
+    base[0] = 0;
+    for (XnUInt32 b = 0; b < bands_.size(); ++b) {
+      base[b + 1] = base[b] + (XnUInt32)bands_[b].runs.size();
+    }
+
+    const XnUInt32 total = base[bands_.size()];
+    parent_.resize(total);
+    for (XnUInt32 b = 0; b < bands_.size(); ++b) {
+      const Band& band = bands_[b];
+      for (XnUInt32 i = 0; i < band.parent.size(); ++i) {
+        parent_[base[b] + i] = base[b] + band.parent[i];
+      }
+    }
+
+    // 帯の最後の行と、次の帯の最初の行をつなぐ
+    //  (行数がスレッド数より少ないと空の帯ができるので、空でない帯どうしをつなぐ)
+    XnUInt32 prev = (XnUInt32)bands_.size();
+    for (XnUInt32 b = 0; b < bands_.size(); ++b) {
+      if (bands_[b].top == bands_[b].bottom) {
+        continue;
+      }
+      if (prev == bands_.size()) {
+        prev = b;
+        continue;
+      }
+
+      const Band& upper = bands_[prev];
+      const Band& lower = bands_[b];
+      const XnUInt32 upperBase = base[prev];
+      prev = b;
+
+      const XnUInt32 aboveBegin = rowBegin_[upper.bottom - 1];
+      const XnUInt32 aboveCount = (XnUInt32)upper.runs.size() - aboveBegin;
+      const XnUInt32 belowCount = ((lower.top + 1) < lower.bottom) ?
+                                  rowBegin_[lower.top + 1] : (XnUInt32)lower.runs.size();
+      if ((aboveCount != 0) && (belowCount != 0)) {
+        connect(parent_,
+                &upper.runs[aboveBegin], upperBase + aboveBegin, aboveCount,
+                &lower.runs[0], base[b], belowCount);
+      }
+    }
+
+    // 根は常に番号の小さい方なので、前から1回たどれば根が決まる
+    size_.assign(total, 0);
+    for (XnUInt32 b = 0; b < bands_.size(); ++b) {
+      const Band& band = bands_[b];
+      for (XnUInt32 i = 0; i < band.runs.size(); ++i) {
+        XnUInt32 g = base[b] + i;
+        parent_[g] = parent_[parent_[g]];
+        size_[parent_[g]] += band.runs[i].end - band.runs[i].start;
+      }
+    }
+
+    // 小さい連結成分を除き、見つかった順にラベルをつける
+    users_ = 0;
+    runLabel_.resize(total);
+    for (XnUInt32 g = 0; g < total; ++g) {
+      if (parent_[g] == g) {
+        runLabel_[g] = ((size_[g] >= minSize_) && (users_ < 0xFFFF)) ?
+                       (XnLabel)++users_ : 0;
+      }
+      else {
+        runLabel_[g] = runLabel_[parent_[g]];
+      }
+    }
+  }
+
+  // 帯ごとにラベルマップに書き込む
+  static void paint(void* param, XnUInt32 index, XnUInt32 count)
+  {
+    DepthSegmenter& self = *(DepthSegmenter*)param;
+    const Band& band = self.bands_[index];
+    const XnUInt32 base = self.base_[index];
+
+    XnLabel* labels = &self.labels_[band.top * self.xRes_];
+    std::fill(labels, labels + (band.bottom - band.top) * self.xRes_, 0);
+    for (XnUInt32 i = 0; i < band.runs.size(); ++i) {
+      const XnLabel label = self.runLabel_[base + i];
+      if (label != 0) {
+        const Run& run = band.runs[i];
+        XnLabel* row = &self.labels_[run.row * self.xRes_];
+        std::fill(row + run.start, row + run.end, label);
+      }
+    }
+  }
+
+  WorkerThreads* workers_;
+  XnUInt32 learningFrames_;
+  XnUInt32 learned_;
+  XnUInt32 threshold_;
+  int depthJump_;
+  XnUInt32 minSize_;
+
+  XnUInt32 xRes_;
+  XnUInt32 yRes_;
+  XnUInt32 users_;
+  const XnDepthPixel* depth_;   // 窓の大きさのデプス
+  FrameRoi roi_;
+
+  std::vector<XnDepthPixel> background_;
+  std::vector<XnDepthPixel> limit_;
+  std::vector<XnLabel> labels_;
+  LabelRuns runs_;
+
+  std::vector<Band> bands_;
+  std::vector<XnUInt32> rowBegin_;    // 行の最初のランの、帯の中での番号
+  std::vector<XnUInt32> base_;        // 帯の最初のランの通し番号
+  std::vector<XnUInt32> parent_;
+  std::vector<XnUInt32> size_;
+  std::vector<XnLabel> runLabel_;
+};
+
+#endif // #ifndef DEPTHSEGMENTER_H_INCLUDE
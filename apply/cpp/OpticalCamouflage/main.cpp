@@ -1,10 +1,20 @@
+#include <algorithm>
 #include <iostream>
 #include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include <opencv/cv.h>
 #include <opencv/highgui.h>
 
 #include <XnCppWrapper.h>
+#include <XnOS.h>
+
+#include "DepthSegmenter.h"
+#include "../../../OpenNI/cpp/CameraImage/DisplaySink.h"
+#include "../../../OpenNI/cpp/User/LabelRuns.h"
+#include "../../../OpenNI/cpp/User/LabelStats.h"
 
 // 設定ファイルのパス(環境に合わせて変更してください)
 #if (XN_PLATFORM == XN_PLATFORM_WIN32)
@@ -17,12 +27,163 @@ const char* CONFIG_XML_PATH = "../../../Data/SamplesConfig.xml";
 const char* CONFIG_XML_PATH = "Data/SamplesConfig.xml";
 #endif
 
+// ユーザーの外接矩形(marginだけ広げる)の外側だけ、srcをdstにコピーする
+void copyOutsideUsers(const LabelStats& stats, XnUInt32 margin,
+                      const XnRGB24Pixel* src, XnRGB24Pixel* dst, XnUInt32 xRes, XnUInt32 yRes)
+{
+    std::vector<std::pair<XnUInt32, XnUInt32> > spans;
+    for (XnUInt32 y = 0; y < yRes; ++y) {
+        // この行にかかる外接矩形の範囲を左から順に並べる
+        spans.clear();
+        for (XnUInt32 i = 0; i < stats.size(); ++i) {
+            const LabelStat& s = stats[i];
+            if ((y + margin >= s.top) && (y <= s.bottom + margin)) {
+                spans.push_back(std::make_pair((s.left > margin) ? (s.left - margin) : 0,
+                                               std::min(xRes, (XnUInt32)s.right + margin + 1)));
+            }
+        }
+        std::sort(spans.begin(), spans.end());
+
+        const XnUInt32 row = y * xRes;
+        XnUInt32 x = 0;
+        for (XnUInt32 i = 0; i < spans.size(); ++i) {
+            if (spans[i].first > x) {
+                memcpy(dst + row + x, src + row + x, (spans[i].first - x) * sizeof(XnRGB24Pixel));
+            }
+            x = std::max(x, spans[i].second);
+        }
+        if (x < xRes) {
+            memcpy(dst + row + x, src + row + x, (xRes - x) * sizeof(XnRGB24Pixel));
+        }
+    }
+}
+
+// 合成したデプスデータで、ユーザーの切り出しの速度を計測する
+void benchmark()
+{
+    const XnUInt32 XRES = 640;
+    const XnUInt32 YRES = 480;
+    const int FRAMES = 300;
+
+    // 奥の壁と床
+    std::vector<XnDepthPixel> background(XRES * YRES);
+    for (XnUInt32 y = 0; y < YRES; ++y) {
+        for (XnUInt32 x = 0; x < XRES; ++x) {
+            background[y * XRES + x] = (y < 300) ? 3500 : (XnDepthPixel)(3500 - (y - 300) * 8);
+        }
+    }
+
+    // 手前に3人(楕円)と、小さなノイズ
+    std::vector<XnDepthPixel> scene(background);
+    const int people[][2] = { { 150, 2000 }, { 330, 2500 }, { 500, 1800 } };
+    for (XnUInt32 y = 0; y < YRES; ++y) {
+        for (XnUInt32 x = 0; x < XRES; ++x) {
+            for (int p = 0; p < 3; ++p) {
+                int dx = (int)x - people[p][0], dy = (int)y - 260;
+                if ((dx * dx * 9 + dy * dy) < (190 * 190)) {
+                    scene[y * XRES + x] = (XnDepthPixel)(people[p][1] + (x % 7) * 5);
+                }
+            }
+            if (((x % 50) == 3) && ((y % 40) == 5)) {
+                scene[y * XRES + x] = 1000;
+            }
+            if (((x * 7 + y * 13) % 61) == 0) {
+                scene[y * XRES + x] = 0;
+            }
+        }
+    }
+
+    const XnUInt32 threads[] = { 1, 2, 4 };
+    for (XnUInt32 t = 0; t < sizeof(threads) / sizeof(threads[0]); ++t) {
+        WorkerThreads workers(threads[t]);
+        DepthSegmenter segmenter(&workers);
+        segmenter.setLearningFrames(1);
+        segmenter.segment(&background[0], XRES, YRES);
+        segmenter.segment(&scene[0], XRES, YRES);
+
+        XnUInt64 begin, end;
+        xnOSGetHighResTimeStamp(&begin);
+        for (int i = 0; i < FRAMES; ++i) {
+            segmenter.segment(&scene[0], XRES, YRES);
+        }
+        xnOSGetHighResTimeStamp(&end);
+
+        XnUInt32 pixels = 0;
+        for (XnUInt32 i = 0; i < XRES * YRES; ++i) {
+            pixels += (segmenter.labels()[i] != 0) ? 1 : 0;
+        }
+
+        double sec = (end - begin) / 1000000.0;
+        std::cout << "segment threads=" << threads[t] << " : " <<
+            segmenter.users() << " users, " << pixels << " pixels (" <<
+            segmenter.runs().size() << " runs, " << segmenter.runs().pixels() << " pixels), " <<
+            (sec * 1000 / FRAMES) << " ms/frame" << std::endl;
+    }
+
+    // 真ん中の人だけを囲む窓にクロッピングされたデプスで、窓の中だけを調べる
+    {
+        const FrameRoi roi(260, 60, 144, 400, XRES, YRES);
+        std::vector<XnDepthPixel> cropped(roi.area());
+        for (XnUInt32 y = 0; y < roi.height; ++y) {
+            std::copy(&scene[(roi.y + y) * XRES + roi.x], &scene[(roi.y + y) * XRES + roi.right()],
+                      &cropped[y * roi.width]);
+        }
+
+        DepthSegmenter segmenter;
+        segmenter.setLearningFrames(1);
+        segmenter.segment(&background[0], XRES, YRES);
+        segmenter.segment(&cropped[0], roi);
+
+        XnUInt64 begin, end;
+        xnOSGetHighResTimeStamp(&begin);
+        for (int i = 0; i < FRAMES; ++i) {
+            segmenter.segment(&cropped[0], roi);
+        }
+        xnOSGetHighResTimeStamp(&end);
+
+        double sec = (end - begin) / 1000000.0;
+        std::cout << "segment cropped " << roi.width << "x" << roi.height << " : " <<
+            segmenter.users() << " users, " << segmenter.runs().pixels() << " pixels, " <<
+            (sec * 1000 / FRAMES) << " ms/frame" << std::endl;
+    }
+
+    // 行数がスレッド数より少ない窓では空の帯ができる。1スレッドと結果が同じになるか確認する
+    {
+        const FrameRoi roi(0, 256, XRES, 8, XRES, YRES);
+        std::vector<XnDepthPixel> strip(&scene[roi.y * XRES], &scene[roi.bottom() * XRES]);
+
+        const XnUInt32 stripThreads[] = { 1, 16 };
+        for (XnUInt32 t = 0; t < sizeof(stripThreads) / sizeof(stripThreads[0]); ++t) {
+            WorkerThreads workers(stripThreads[t]);
+            DepthSegmenter segmenter(&workers);
+            segmenter.setLearningFrames(1);
+            segmenter.setMinSize(100);
+            segmenter.segment(&background[0], XRES, YRES);
+            segmenter.segment(&strip[0], roi);
+
+            std::cout << "segment strip " << roi.width << "x" << roi.height <<
+                " threads=" << stripThreads[t] << " : " << segmenter.users() << " users, " <<
+                segmenter.runs().pixels() << " pixels" << std::endl;
+        }
+    }
+}
+
 int main (int argc, char * argv[])
 {
+    // 速度計測モード
+    if ((argc > 1) && (std::string(argv[1]) == "bench")) {
+        benchmark();
+        return 0;
+    }
+
     IplImage* camera = 0;
     IplImage* background = 0;
+    DisplaySink* display = 0;
     
     try {
+        // 表示先(display=null などでウィンドウなしで動かす)
+        display = DisplaySink::create(argc, argv);
+        
         // コンテキストの初期化
         xn::Context context;
         XnStatus rc = context.InitFromXmlFile(CONFIG_XML_PATH);
@@ -48,11 +209,19 @@ int main (int argc, char * argv[])
         depth.GetAlternativeViewPointCap().SetViewPoint(image);
         
         // ユーザーの作成
+        //  UserGeneratorがなければ、デプスからユーザーを切り出す
         xn::UserGenerator user;
         rc = context.FindExistingNode(XN_NODE_TYPE_USER, user);
-        if ( rc != XN_STATUS_OK ) {
-            throw std::runtime_error(xnGetStatusString( rc ));
+        bool isUserGenerator = (rc == XN_STATUS_OK);
+        if (!isUserGenerator) {
+            std::cout << "UserGenerator : " << xnGetStatusString(rc) << std::endl;
+            std::cout << "デプスからユーザーを切り出します" << std::endl;
         }
+
+        WorkerThreads workers(WorkerThreads::hardwareCount());
+        DepthSegmenter segmenter(&workers);
+        LabelRuns runs;
+        LabelStats stats;
         
         // カメラサイズのイメージを作成(8bitのRGB)
         XnMapOutputMode outputMode;
@@ -71,8 +240,12 @@ int main (int argc, char * argv[])
         }
         
         bool isBackgroundRefresh = true;
+        bool isAutoRefresh = false;
         bool isCamouflage = true;
         
+        // 表示用に書くときに左右反転する(背景とラベルはセンサーの座標のまま)
+        bool mirror = false;
+        
         // メインループ
         while (1) {
             // すべてのノードの更新を待つ
@@ -83,47 +256,48 @@ int main (int argc, char * argv[])
             image.GetMetaData(imageMD);
             
             // ユーザーデータの取得
-            xn::SceneMetaData sceneMD;
-            user.GetUserPixels(0, sceneMD);
-
+            //  ユーザーのいる区間だけを扱う
+            const LabelRuns* labels = &runs;
+            if (isUserGenerator) {
+                xn::SceneMetaData sceneMD;
+                user.GetUserPixels(0, sceneMD);
+                runs.encode(sceneMD);
+            }
+            else {
+                xn::DepthMetaData depthMD;
+                depth.GetMetaData(depthMD);
+                segmenter.segment(depthMD);
+                labels = &segmenter.runs();
+            }
             
             // 背景画像の更新
             if (isBackgroundRefresh) {
                 isBackgroundRefresh = false;
                 memcpy(background->imageData, imageMD.RGB24Data(), background->imageSize);
             }
+            // ユーザーの外接矩形の外側は、毎フレーム背景を更新する
+            else if (isAutoRefresh) {
+                stats.compute(*labels, 0);
+                copyOutsideUsers(stats, 16, (const XnRGB24Pixel*)imageMD.RGB24Data(),
+                                 (XnRGB24Pixel*)background->imageData,
+                                 imageMD.XRes(), imageMD.YRes());
+            }
             
             // カメラ画像の表示
-            char* dest = camera->imageData;
-            char* back = background->imageData;
-            for (int y = 0; y < imageMD.YRes(); ++y) {
-                for (int x = 0; x < imageMD.XRes(); ++x) {
-                    // 光学迷彩が有効で、ユーザーがいる場合、背景を描画する
-                    if (isCamouflage && (sceneMD(x, y) != 0)) {
-                        dest[0] = back[0];
-                        dest[1] = back[1];
-                        dest[2] = back[2];
-                    }
-                    // ユーザーではないので、カメラ画像を描画する
-                    else {
-                        // カメラ画像の表示
-                        XnRGB24Pixel rgb = imageMD.RGB24Map()(x, y);
-                        dest[0] = rgb.nRed;
-                        dest[1] = rgb.nGreen;
-                        dest[2] = rgb.nBlue;
-                    }
-                    
-                    dest += 3;
-                    back += 3;
-                }
+            copyPixels(imageMD.RGB24Data(), (XnRGB24Pixel*)camera->imageData,
+                       imageMD.XRes(), imageMD.YRes(), mirror);
+
+            // 光学迷彩が有効なら、ユーザーのいる区間に背景を描画する
+            if (isCamouflage) {
+                copyRuns(*labels, (const XnRGB24Pixel*)background->imageData,
+                         (XnRGB24Pixel*)camera->imageData, mirror);
             }
 
             ::cvCvtColor(camera, camera, CV_BGR2RGB);
-            ::cvShowImage("KinectImage", camera);
+            display->show("KinectImage", camera);
             
-            
-            // キーの取得
-            char key = cvWaitKey(10);
+            // キーの取得(待たない)
+            int key = display->pollKey();
             // 終了する
             if (key == 'q') {
                 break;
@@ -131,11 +305,26 @@ int main (int argc, char * argv[])
             // 背景の更新
             else if (key == 'r') {
                 isBackgroundRefresh = true;
+                segmenter.resetBackground();
+            }
+            // UserGeneratorとデプスからの切り出しを切り替える
+            else if (key == 'u') {
+                if (user.IsValid()) {
+                    isUserGenerator = !isUserGenerator;
+                }
+            }
+            // 背景の自動更新の入り/切り
+            else if (key == 'a') {
+                isAutoRefresh = !isAutoRefresh;
             }
             // 迷彩の入り/切り
             else if (key == 'c') {
                 isCamouflage = !isCamouflage;
             }
+            // 反転する
+            else if (key == 'm') {
+                mirror = !mirror;
+            }
         }
     }
     catch (std::exception& ex) {
@@ -144,6 +333,7 @@ int main (int argc, char * argv[])
     
     ::cvReleaseImage(&background);
     ::cvReleaseImage(&camera);
+    delete display;
     
     return 0;
 }
@@ -0,0 +1,386 @@
+#ifndef POINTCLOUD_H_INCLUDE
+#define POINTCLOUD_H_INCLUDE
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include <XnCppWrapper.h>
+#include <XnOS.h>
+
+// SSE2が使える環境ではSIMDで変換する
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define POINTCLOUD_USE_SSE2
+#endif
+
+// Kinectの画角(GetFieldOfViewで取得できる値とほぼ同じ。合成データ用)
+const XnDouble KINECT_HFOV = 1.0144686707507438;
+const XnDouble KINECT_VFOV = 0.78980943449644714;
+
+// 点群バッファのプール
+//  フレームごとにnew/deleteしないよう、解放されたバッファを使いまわす
+class PointCloudPool
+{
+public:
+
+  PointCloudPool()
+  {
+    XnStatus rc = xnOSCreateCriticalSection(&lock_);
+    if (rc != XN_STATUS_OK) {
+      throw std::runtime_error(xnGetStatusString(rc));
+    }
+  }
+
+  ~PointCloudPool()
+  {
+    for (std::vector<Block>::iterator it = blocks_.begin(); it != blocks_.end(); ++it) {
+      xnOSFreeAligned(it->data);
+    }
+
+    xnOSCloseCriticalSection(&lock_);
+  }
+
+  // 指定サイズ以上の空きバッファを取得する(16バイト境界)
+  void* acquire(XnUInt32 bytes)
+  {
+    xnOSEnterCriticalSection(&lock_);
+
+    void* data = 0;
+    for (std::vector<Block>::iterator it = blocks_.begin(); it != blocks_.end(); ++it) {
+      if (!it->used && (it->bytes >= bytes)) {
+        it->used = true;
+        data = it->data;
+        break;
+      }
+    }
+
+    if (data == 0) {
+      data = xnOSMallocAligned(bytes, 16);
+      if (data != 0) {
+        Block block = { data, bytes, true };
+        blocks_.push_back(block);
+      }
+    }
+
+    xnOSLeaveCriticalSection(&lock_);
+
+    if (data == 0) {
+      throw std::runtime_error("error : xnOSMallocAligned");
+    }
+
+    return data;
+  }
+
+  // バッファをプールに返す
+  void release(void* data)
+  {
+    xnOSEnterCriticalSection(&lock_);
+    for (std::vector<Block>::iterator it = blocks_.begin(); it != blocks_.end(); ++it) {
+      if (it->data == data) {
+        it->used = false;
+        break;
+      }
+    }
+    xnOSLeaveCriticalSection(&lock_);
+  }
+
+private:
+
+  PointCloudPool(const PointCloudPool&);
+  PointCloudPool& operator=(const PointCloudPool&);
+
+  struct Block
+  {
+    void*     data;
+    XnUInt32  bytes;
+    bool      used;
+  };
+
+  std::vector<Block> blocks_;
+  XN_CRITICAL_SECTION_HANDLE lock_;
+};
+
+// 点群(X/Y/Zを別々の配列に持つ)
+//  座標の単位はConvertProjectiveToRealWorldと同じmm
+class PointCloud
+{
+public:
+
+  PointCloud()
+    :X(0), Y(0), Z(0), color(0), size(0), capacity(0), hasColor(false),
+     timestamp(0), frameID(0), pool_(0)
+  {
+  }
+
+  ~PointCloud()
+  {
+    release();
+  }
+
+  // 最大点数分のバッファをプールから確保する
+  void reserve(PointCloudPool& pool, XnUInt32 count)
+  {
+    if ((pool_ == &pool) && (count <= capacity)) {
+      size = 0;
+      return;
+    }
+
+    release();
+
+    // SIMDで4点ずつ書き込めるよう、4の倍数に切り上げる
+    XnUInt32 aligned = std::max<XnUInt32>((count + 3) & ~3, 4);
+    X = (float*)pool.acquire(aligned * sizeof(float));
+    Y = (float*)pool.acquire(aligned * sizeof(float));
+    Z = (float*)pool.acquire(aligned * sizeof(float));
+    color = (XnRGB24Pixel*)pool.acquire(aligned * sizeof(XnRGB24Pixel));
+    pool_ = &pool;
+    capacity = aligned;
+    size = 0;
+  }
+
+  // バッファをプールに返す
+  void release()
+  {
+    if (pool_ != 0) {
+      pool_->release(X);
+      pool_->release(Y);
+      pool_->release(Z);
+      pool_->release(color);
+    }
+
+    X = Y = Z = 0;
+    color = 0;
+    size = capacity = 0;
+    hasColor = false;
+    pool_ = 0;
+  }
+
+  float*        X;
+  float*        Y;
+  float*        Z;
+  XnRGB24Pixel* color;    // hasColorがfalseの場合は不定
+  XnUInt32      size;
+  XnUInt32      capacity;
+  bool          hasColor;
+  XnUInt64      timestamp;
+  XnUInt32      frameID;
+
+private:
+
+  PointCloud(const PointCloud&);
+  PointCloud& operator=(const PointCloud&);
+
+  PointCloudPool* pool_;
+};
+
+// デプスマップから点群を作成する
+//  ConvertProjectiveToRealWorldと同じ計算を、列ごと/行ごとの係数を
+//  あらかじめ計算しておくことで、1点あたり乗算2回で行う
+class PointCloudBuilder
+{
+public:
+
+  PointCloudBuilder(PointCloudPool& pool)
+    :pool_(pool), step_(1), roiX_(0), roiY_(0), roiWidth_(0), roiHeight_(0),
+     fullXRes_(0), fullYRes_(0)
+  {
+  }
+
+  // デプスジェネレータの画角と解像度から係数を計算する
+  void setup(xn::DepthGenerator& depth)
+  {
+    XnFieldOfView fov;
+    XnStatus rc = depth.GetFieldOfView(fov);
+    if (rc != XN_STATUS_OK) {
+      throw std::runtime_error(xnGetStatusString(rc));
+    }
+
+    xn::DepthMetaData depthMD;
+    depth.GetMetaData(depthMD);
+
+    setup(fov.fHFOV, fov.fVFOV, depthMD.FullXRes(), depthMD.FullYRes());
+  }
+
+  void setup(XnDouble hFOV, XnDouble vFOV, XnUInt32 fullXRes, XnUInt32 fullYRes)
+  {
+    fullXRes_ = fullXRes;
+    fullYRes_ = fullYRes;
+
+    // realX = (x / XRes - 0.5) * Z * tan(hFOV/2) * 2
+    // realY = (0.5 - y / YRes) * Z * tan(vFOV/2) * 2
+    const XnDouble xzFactor = std::tan(hFOV / 2) * 2;
+    const XnDouble yzFactor = std::tan(vFOV / 2) * 2;
+
+    columnFactor_.resize(fullXRes);
+    for (XnUInt32 x = 0; x < columnFactor_.size(); ++x) {
+      columnFactor_[x] = (float)(((XnDouble)x / fullXRes - 0.5) * xzFactor);
+    }
+
+    rowFactor_.resize(fullYRes);
+    for (XnUInt32 y = 0; y < fullYRes; ++y) {
+      rowFactor_[y] = (float)((0.5 - (XnDouble)y / fullYRes) * yzFactor);
+    }
+  }
+
+  // 間引き(step画素ごとに1点)
+  void setDecimation(XnUInt32 step)
+  {
+    step_ = (step == 0) ? 1 : step;
+  }
+
+  // 処理する領域(フル解像度の座標)。幅か高さが0なら全体
+  void setROI(XnUInt32 x, XnUInt32 y, XnUInt32 width, XnUInt32 height)
+  {
+    roiX_ = x;
+    roiY_ = y;
+    roiWidth_ = width;
+    roiHeight_ = height;
+  }
+
+  // デプスのみから点群を作成する
+  void build(const xn::DepthMetaData& depthMD, PointCloud& cloud)
+  {
+    build(depthMD.Data(), 0, depthMD.XRes(), depthMD.YRes(),
+          depthMD.XOffset(), depthMD.YOffset(), cloud);
+    cloud.timestamp = depthMD.Timestamp();
+    cloud.frameID = depthMD.FrameID();
+  }
+
+  // 色付きの点群を作成する(デプスの視点をイメージに合わせておくこと)
+  void build(const xn::DepthMetaData& depthMD, const xn::ImageMetaData& imageMD,
+             PointCloud& cloud)
+  {
+    if ((depthMD.XRes() != imageMD.XRes()) || (depthMD.YRes() != imageMD.YRes())) {
+      throw std::runtime_error("デプスとイメージの解像度が異なります");
+    }
+
+    build(depthMD.Data(), imageMD.RGB24Data(), depthMD.XRes(), depthMD.YRes(),
+          depthMD.XOffset(), depthMD.YOffset(), cloud);
+    cloud.timestamp = depthMD.Timestamp();
+    cloud.frameID = depthMD.FrameID();
+  }
+
+  // xRes/yRes/xOffset/yOffsetは入力バッファの大きさと、フル解像度上の位置
+  void build(const XnDepthPixel* pDepth, const XnRGB24Pixel* pRGB,
+             XnUInt32 xRes, XnUInt32 yRes, XnUInt32 xOffset, XnUInt32 yOffset,
+             PointCloud& cloud)
+  {
+    if (columnFactor_.empty()) {
+      throw std::runtime_error("PointCloudBuilder::setup が呼ばれていません");
+    }
+
+    // ROIと入力バッファの重なる部分だけ処理する
+    XnUInt32 left = xOffset, top = yOffset;
+    XnUInt32 right = xOffset + xRes, bottom = yOffset + yRes;
+    if ((roiWidth_ != 0) && (roiHeight_ != 0)) {
+      left   = std::max(left, roiX_);
+      top    = std::max(top, roiY_);
+      right  = std::min(right, roiX_ + roiWidth_);
+      bottom = std::min(bottom, roiY_ + roiHeight_);
+    }
+    right  = std::min(right, fullXRes_);
+    bottom = std::min(bottom, fullYRes_);
+
+    if ((left >= right) || (top >= bottom)) {
+      cloud.reserve(pool_, 0);
+      cloud.hasColor = (pRGB != 0);
+      return;
+    }
+
+    const XnUInt32 width  = (right - left + step_ - 1) / step_;
+    const XnUInt32 height = (bottom - top + step_ - 1) / step_;
+    cloud.reserve(pool_, width * height);
+
+    float* outX = cloud.X;
+    float* outY = cloud.Y;
+    float* outZ = cloud.Z;
+    XnRGB24Pixel* outColor = cloud.color;
+    XnUInt32 count = 0;
+
+    for (XnUInt32 y = top; y < bottom; y += step_) {
+      // 入力バッファの行の先頭(xOffsetの位置)
+      const XnDepthPixel* depthRow = pDepth + (y - yOffset) * xRes;
+      const XnRGB24Pixel* rgbRow = (pRGB != 0) ? (pRGB + (y - yOffset) * xRes) : 0;
+      const float rowFactor = rowFactor_[y];
+
+      XnUInt32 x = left;
+
+#ifdef POINTCLOUD_USE_SSE2
+      // 間引きなしの場合は4点ずつ変換する
+      if (step_ == 1) {
+        const __m128 row = _mm_set1_ps(rowFactor);
+        const __m128i zero = _mm_setzero_si128();
+        for (; (x + 4) <= right; x += 4) {
+          __m128i d16 = _mm_loadl_epi64((const __m128i*)(depthRow + x - xOffset));
+
+          // 4点とも有効なら、まとめて書き込む
+          if (_mm_movemask_epi8(_mm_cmpeq_epi16(d16, zero)) & 0xFF) {
+            count = convertScalar(depthRow, rgbRow, xOffset, rowFactor, x, x + 4, 1,
+                                  outX, outY, outZ, outColor, count);
+            continue;
+          }
+
+          __m128 z = _mm_cvtepi32_ps(_mm_unpacklo_epi16(d16, zero));
+          __m128 col = _mm_loadu_ps(&columnFactor_[x]);
+          _mm_storeu_ps(outX + count, _mm_mul_ps(col, z));
+          _mm_storeu_ps(outY + count, _mm_mul_ps(row, z));
+          _mm_storeu_ps(outZ + count, z);
+          if (rgbRow != 0) {
+            const XnRGB24Pixel* rgb = rgbRow + x - xOffset;
+            outColor[count + 0] = rgb[0];
+            outColor[count + 1] = rgb[1];
+            outColor[count + 2] = rgb[2];
+            outColor[count + 3] = rgb[3];
+          }
+          count += 4;
+        }
+      }
+#endif
+
+      count = convertScalar(depthRow, rgbRow, xOffset, rowFactor, x, right, step_,
+                            outX, outY, outZ, outColor, count);
+    }
+
+    cloud.size = count;
+    cloud.hasColor = (pRGB != 0);
+  }
+
+private:
+
+  XnUInt32 convertScalar(const XnDepthPixel* depthRow, const XnRGB24Pixel* rgbRow,
+                         XnUInt32 xOffset, float rowFactor, XnUInt32 begin, XnUInt32 end, XnUInt32 step,
+                         float* outX, float* outY, float* outZ,
+                         XnRGB24Pixel* outColor, XnUInt32 count) const
+  {
+    for (XnUInt32 x = begin; x < end; x += step) {
+      const XnDepthPixel depth = depthRow[x - xOffset];
+      if (depth == 0) {
+        continue;
+      }
+
+      const float z = depth;
+      outX[count] = columnFactor_[x] * z;
+      outY[count] = rowFactor * z;
+      outZ[count] = z;
+      if (rgbRow != 0) {
+        outColor[count] = rgbRow[x - xOffset];
+      }
+      ++count;
+    }
+
+    return count;
+  }
+
+  PointCloudPool& pool_;
+
+  XnUInt32 step_;
+  XnUInt32 roiX_, roiY_, roiWidth_, roiHeight_;
+  XnUInt32 fullXRes_, fullYRes_;
+
+  std::vector<float> columnFactor_;
+  std::vector<float> rowFactor_;
+};
+
+#endif // #ifndef POINTCLOUD_H_INCLUDE
@@ -0,0 +1,35 @@
+#ifndef POINTCLOUDDRAWER_H_INCLUDE
+#define POINTCLOUDDRAWER_H_INCLUDE
+
+#include <opencv/cv.h>
+
+#include "PointCloud.h"
+
+// 点群を上から見た図(X-Z平面)を描画する
+//  centerZ : 画像の中心にする奥行き(mm)、range : 画像の幅に入る範囲(mm)
+inline void drawTopView(IplImage* view, const PointCloud& cloud,
+                        float centerZ = 2500.0f, float range = 5000.0f)
+{
+  memset(view->imageData, 0, view->imageSize);
+
+  const float scale = view->width / range;
+  for (XnUInt32 i = 0; i < cloud.size; ++i) {
+    int u = (int)(view->width / 2 + cloud.X[i] * scale);
+    int v = (int)(view->height / 2 - (cloud.Z[i] - centerZ) * scale);
+    if ((u < 0) || (u >= view->width) || (v < 0) || (v >= view->height)) {
+      continue;
+    }
+
+    char* dest = view->imageData + (v * view->widthStep) + (u * 3);
+    if (cloud.hasColor) {
+      dest[0] = cloud.color[i].nBlue;
+      dest[1] = cloud.color[i].nGreen;
+      dest[2] = cloud.color[i].nRed;
+    }
+    else {
+      dest[0] = dest[1] = dest[2] = (char)255;
+    }
+  }
+}
+
+#endif // #ifndef POINTCLOUDDRAWER_H_INCLUDE
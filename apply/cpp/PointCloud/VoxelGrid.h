@@ -0,0 +1,384 @@
+#ifndef VOXELGRID_H_INCLUDE
+#define VOXELGRID_H_INCLUDE
+
+#include <vector>
+#include <stdexcept>
+
+#include <XnCppWrapper.h>
+
+#include "PointCloud.h"
+#include "WorkerThreads.h"
+
+// ボクセルグリッドによる点群の間引き
+//  ボクセル座標をキーにしたオープンアドレス法のハッシュ表で点をまとめる。
+//  ハッシュ値でパーティションに分け、パーティションごとに別のスレッドが
+//  担当するので、ハッシュ表へのアクセスにロックは不要
+//  (作業領域は使い回すので、点数やボクセル数が最大値を超えない限り確保は発生しない)
+class VoxelGrid
+{
+public:
+
+  enum Mode
+  {
+    CENTROID = 0,   // ボクセル内の点の重心
+    FIRST_POINT,    // ボクセルに最初に入った点
+  };
+
+  // パーティション数はスレッド数に関係なく固定(出力の順番を変えないため)
+  static const XnUInt32 PARTITIONS = 16;
+
+  VoxelGrid(PointCloudPool& pool, WorkerThreads* workers = 0)
+    :pool_(pool), workers_(workers), leafSize_(10.0f), mode_(CENTROID),
+     input_(0), output_(0)
+  {
+    XnUInt32 threads = (workers != 0) ? workers->size() : 1;
+    counts_.resize(threads * PARTITIONS);
+  }
+
+  // ボクセルの一辺の長さ(mm)
+  void setLeafSize(float leafSize)
+  {
+    if (leafSize <= 0) {
+      throw std::runtime_error("ボクセルの大きさが不正です");
+    }
+
+    leafSize_ = leafSize;
+  }
+
+  void setMode(Mode mode)
+  {
+    mode_ = mode;
+  }
+
+  void filter(const PointCloud& input, PointCloud& output)
+  {
+    input_ = &input;
+    output_ = &output;
+    inverseLeafSize_ = 1.0f / leafSize_;
+
+    // 点がなければ空の点群を返す(ワーカーには渡さない)
+    if (input.size == 0) {
+      output.reserve(pool_, 0);
+      output.size = 0;
+      output.hasColor = input.hasColor;
+      output.timestamp = input.timestamp;
+      output.frameID = input.frameID;
+      return;
+    }
+
+    if (keys_.size() < input.size) {
+      keys_.resize(input.size);
+      sorted_.resize(input.size);
+    }
+
+    // 1. ボクセルのキーを計算し、パーティションごとの点数を数える
+    WorkerThreads::run(workers_, &VoxelGrid::computeKeys, this);
+
+    // パーティションごとの先頭位置を計算する(パーティション順、スレッド順)
+    XnUInt32 threads = (XnUInt32)(counts_.size() / PARTITIONS);
+    XnUInt32 offset = 0;
+    for (XnUInt32 p = 0; p < PARTITIONS; ++p) {
+      partitionBegin_[p] = offset;
+      for (XnUInt32 t = 0; t < threads; ++t) {
+        XnUInt32 count = counts_[t * PARTITIONS + p];
+        counts_[t * PARTITIONS + p] = offset;
+        offset += count;
+      }
+    }
+    partitionBegin_[PARTITIONS] = offset;
+
+    // 2. 点をパーティションごとに並べ替える(ハッシュ表への登録で連続アクセスにするため)
+    WorkerThreads::run(workers_, &VoxelGrid::scatter, this);
+
+    // 3. パーティションごとにハッシュ表へ登録する
+    WorkerThreads::run(workers_, &VoxelGrid::insert, this);
+
+    // 4. 出力先を確保し、パーティションごとに書き出す
+    XnUInt32 total = 0;
+    for (XnUInt32 p = 0; p < PARTITIONS; ++p) {
+      outputBegin_[p] = total;
+      total += (XnUInt32)tables_[p].used.size();
+    }
+
+    output.reserve(pool_, total);
+    output.size = total;
+    output.hasColor = input.hasColor;
+    output.timestamp = input.timestamp;
+    output.frameID = input.frameID;
+
+    WorkerThreads::run(workers_, &VoxelGrid::write, this);
+  }
+
+private:
+
+  VoxelGrid(const VoxelGrid&);
+  VoxelGrid& operator=(const VoxelGrid&);
+
+  // パーティションごとに並べ替えた点
+  struct Point
+  {
+    XnUInt64      key;
+    float         x, y, z;
+    XnUInt32      index;    // 入力での番号
+    XnRGB24Pixel  color;
+  };
+
+  // ハッシュ表の1スロット(探索で触るメモリを減らすため、1つにまとめる)
+  struct Entry
+  {
+    XnUInt64  key;      // 0は空き
+    float     sumX, sumY, sumZ;
+    XnUInt32  count;
+    XnUInt32  first;    // 最初の点の番号
+    XnUInt32  sumR, sumG, sumB;
+  };
+
+  // パーティションごとのハッシュ表
+  //  大きさは前回のボクセル数から決め、埋まってきたら拡張する
+  struct Table
+  {
+    std::vector<Entry>    entries;
+    std::vector<XnUInt32> used;     // 使用中のスロット(登録順)
+    XnUInt32              mask;
+
+    Table() : mask(0) {}
+
+    // 前回使ったスロットだけを空きに戻す
+    void clear()
+    {
+      for (std::vector<XnUInt32>::iterator it = used.begin(); it != used.end(); ++it) {
+        entries[*it].key = 0;
+      }
+      used.clear();
+
+      if (entries.empty()) {
+        resize(64);
+      }
+    }
+
+    // 2のべき乗の大きさにして、登録済みのスロットを入れなおす
+    void resize(XnUInt32 capacity)
+    {
+      std::vector<Entry> old;
+      old.swap(entries);
+
+      Entry empty = Entry();
+      entries.assign(capacity, empty);
+      mask = capacity - 1;
+      used.reserve(capacity / 2 + 1);
+
+      std::vector<XnUInt32> oldUsed;
+      oldUsed.swap(used);
+      for (std::vector<XnUInt32>::iterator it = oldUsed.begin(); it != oldUsed.end(); ++it) {
+        XnUInt32 slot = find(old[*it].key);
+        entries[slot] = old[*it];
+        used.push_back(slot);
+      }
+    }
+
+    // 線形探索で空きか同じキーのスロットを探す
+    XnUInt32 find(XnUInt64 key) const
+    {
+      XnUInt32 slot = (XnUInt32)hash(key) & mask;
+      while ((entries[slot].key != 0) && (entries[slot].key != key)) {
+        slot = (slot + 1) & mask;
+      }
+
+      return slot;
+    }
+  };
+
+  // ボクセル座標(各21bit)を1つのキーにまとめる
+  XnUInt64 voxelKey(float x, float y, float z) const
+  {
+    const XnInt32 BIAS = 1 << 20;
+    XnUInt64 ix = (XnUInt32)(floorToInt(x * inverseLeafSize_) + BIAS) & 0x1FFFFF;
+    XnUInt64 iy = (XnUInt32)(floorToInt(y * inverseLeafSize_) + BIAS) & 0x1FFFFF;
+    XnUInt64 iz = (XnUInt32)(floorToInt(z * inverseLeafSize_) + BIAS) & 0x1FFFFF;
+
+    // 0は空きを表すので最上位ビットを立てておく
+    return (1ULL << 63) | (ix << 42) | (iy << 21) | iz;
+  }
+
+  // std::floorは関数呼び出しになり遅いので、整数への変換で切り捨てる
+  static XnInt32 floorToInt(float value)
+  {
+    XnInt32 i = (XnInt32)value;
+    return i - (value < i);
+  }
+
+  static XnUInt64 hash(XnUInt64 key)
+  {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+  }
+
+  // パーティションは乗算ハッシュの上位4bit(16分割)
+  static XnUInt32 partitionOf(XnUInt64 key)
+  {
+    return (XnUInt32)((key * 0x9E3779B97F4A7C15ULL) >> 60);
+  }
+
+  static void range(XnUInt32 total, XnUInt32 index, XnUInt32 count,
+                    XnUInt32& begin, XnUInt32& end)
+  {
+    begin = (XnUInt32)((XnUInt64)total * index / count);
+    end   = (XnUInt32)((XnUInt64)total * (index + 1) / count);
+  }
+
+  static void computeKeys(void* param, XnUInt32 index, XnUInt32 count)
+  {
+    VoxelGrid& self = *(VoxelGrid*)param;
+    const PointCloud& input = *self.input_;
+
+    // 共有メモリへの書き込みを減らすため、ローカルで数えてから書き戻す
+    XnUInt32 counts[PARTITIONS] = { 0 };
+    const float* X = input.X;
+    const float* Y = input.Y;
+    const float* Z = input.Z;
+    XnUInt64* keys = &self.keys_[0];
+
+    XnUInt32 begin, end;
+    range(input.size, index, count, begin, end);
+    for (XnUInt32 i = begin; i < end; ++i) {
+      XnUInt64 key = self.voxelKey(X[i], Y[i], Z[i]);
+      keys[i] = key;
+      ++counts[partitionOf(key)];
+    }
+
+    for (XnUInt32 p = 0; p < PARTITIONS; ++p) {
+      self.counts_[index * PARTITIONS + p] = counts[p];
+    }
+  }
+
+  static void scatter(void* param, XnUInt32 index, XnUInt32 count)
+  {
+    VoxelGrid& self = *(VoxelGrid*)param;
+
+    const PointCloud& input = *self.input_;
+
+    XnUInt32* offsets = &self.counts_[index * PARTITIONS];
+    XnUInt32 begin, end;
+    range(input.size, index, count, begin, end);
+    for (XnUInt32 i = begin; i < end; ++i) {
+      const XnUInt64 key = self.keys_[i];
+      Point& point = self.sorted_[offsets[partitionOf(key)]++];
+      point.key = key;
+      point.x = input.X[i];
+      point.y = input.Y[i];
+      point.z = input.Z[i];
+      point.index = i;
+      if (input.hasColor) {
+        point.color = input.color[i];
+      }
+    }
+  }
+
+  static void insert(void* param, XnUInt32 index, XnUInt32 count)
+  {
+    VoxelGrid& self = *(VoxelGrid*)param;
+    const PointCloud& input = *self.input_;
+    const bool isCentroid = (self.mode_ == CENTROID);
+
+    for (XnUInt32 p = index; p < PARTITIONS; p += count) {
+      Table& table = self.tables_[p];
+      table.clear();
+
+      for (XnUInt32 n = self.partitionBegin_[p]; n < self.partitionBegin_[p + 1]; ++n) {
+        const Point& point = self.sorted_[n];
+        const XnUInt64 key = point.key;
+
+        XnUInt32 slot = table.find(key);
+        if (table.entries[slot].key == 0) {
+          // 半分以上埋まったら拡張する
+          if ((table.used.size() + 1) * 2 > table.entries.size()) {
+            table.resize((XnUInt32)table.entries.size() * 2);
+            slot = table.find(key);
+          }
+
+          Entry& entry = table.entries[slot];
+          entry.key = key;
+          entry.count = 0;
+          entry.first = point.index;
+          entry.sumX = entry.sumY = entry.sumZ = 0;
+          entry.sumR = entry.sumG = entry.sumB = 0;
+          table.used.push_back(slot);
+        }
+
+        if (isCentroid) {
+          Entry& entry = table.entries[slot];
+          entry.count++;
+          entry.sumX += point.x;
+          entry.sumY += point.y;
+          entry.sumZ += point.z;
+          if (input.hasColor) {
+            entry.sumR += point.color.nRed;
+            entry.sumG += point.color.nGreen;
+            entry.sumB += point.color.nBlue;
+          }
+        }
+      }
+    }
+  }
+
+  static void write(void* param, XnUInt32 index, XnUInt32 count)
+  {
+    VoxelGrid& self = *(VoxelGrid*)param;
+    const PointCloud& input = *self.input_;
+    PointCloud& output = *self.output_;
+    const bool isCentroid = (self.mode_ == CENTROID);
+
+    for (XnUInt32 p = index; p < PARTITIONS; p += count) {
+      const Table& table = self.tables_[p];
+      XnUInt32 o = self.outputBegin_[p];
+      for (std::vector<XnUInt32>::const_iterator it = table.used.begin();
+           it != table.used.end(); ++it, ++o) {
+        const Entry& entry = table.entries[*it];
+        if (isCentroid) {
+          const XnUInt32 n = entry.count;
+          const float inverse = 1.0f / n;
+          output.X[o] = entry.sumX * inverse;
+          output.Y[o] = entry.sumY * inverse;
+          output.Z[o] = entry.sumZ * inverse;
+          if (input.hasColor) {
+            output.color[o].nRed   = (XnUInt8)(entry.sumR / n);
+            output.color[o].nGreen = (XnUInt8)(entry.sumG / n);
+            output.color[o].nBlue  = (XnUInt8)(entry.sumB / n);
+          }
+        }
+        else {
+          const XnUInt32 i = entry.first;
+          output.X[o] = input.X[i];
+          output.Y[o] = input.Y[i];
+          output.Z[o] = input.Z[i];
+          if (input.hasColor) {
+            output.color[o] = input.color[i];
+          }
+        }
+      }
+    }
+  }
+
+  PointCloudPool& pool_;
+  WorkerThreads* workers_;
+
+  float leafSize_;
+  float inverseLeafSize_;
+  Mode mode_;
+
+  const PointCloud* input_;
+  PointCloud* output_;
+
+  std::vector<XnUInt64> keys_;      // 点ごとのキー
+  std::vector<Point>    sorted_;    // パーティション順に並べた点
+  std::vector<XnUInt32> counts_;    // スレッドxパーティションの点数(のち書き込み位置)
+  XnUInt32 partitionBegin_[PARTITIONS + 1];
+  XnUInt32 outputBegin_[PARTITIONS];
+  Table tables_[PARTITIONS];
+};
+
+#endif // #ifndef VOXELGRID_H_INCLUDE
@@ -0,0 +1,167 @@
+#ifndef WORKERTHREADS_H_INCLUDE
+#define WORKERTHREADS_H_INCLUDE
+
+#include <vector>
+#include <stdexcept>
+
+#include <XnCppWrapper.h>
+#include <XnOS.h>
+
+// 常駐するワーカースレッド
+//  run()で渡した処理を全スレッドで実行し、すべて終わるまで待つ
+//  (スレッドの作成はコンストラクタでのみ行う)
+class WorkerThreads
+{
+public:
+
+  // index : 0 ～ count-1 のスレッド番号
+  typedef void (*Task)(void* param, XnUInt32 index, XnUInt32 count);
+
+  // 呼び出し元のスレッドも1つとして数える
+  WorkerThreads(XnUInt32 count)
+    :task_(0), param_(0), isQuit_(false)
+  {
+    if (count == 0) {
+      count = 1;
+    }
+
+    // スレッドにはWorkerのアドレスを渡すので、途中で再確保させない
+    //  (workers_には、スレッドまで作れたものだけを入れる)
+    workers_.reserve(count - 1);
+    for (XnUInt32 i = 0; i < count - 1; ++i) {
+      Worker worker = Worker();
+      worker.owner = this;
+      worker.index = i + 1;
+
+      XnStatus rc = xnOSCreateEvent(&worker.start, FALSE);
+      if (rc != XN_STATUS_OK) {
+        shutdown();
+        throw std::runtime_error(xnGetStatusString(rc));
+      }
+
+      rc = xnOSCreateEvent(&worker.done, FALSE);
+      if (rc != XN_STATUS_OK) {
+        xnOSCloseEvent(&worker.start);
+        shutdown();
+        throw std::runtime_error(xnGetStatusString(rc));
+      }
+
+      workers_.push_back(worker);
+      Worker& added = workers_.back();
+      rc = xnOSCreateThread(threadProc, &added, &added.thread);
+      if (rc != XN_STATUS_OK) {
+        xnOSCloseEvent(&added.start);
+        xnOSCloseEvent(&added.done);
+        workers_.pop_back();
+        shutdown();
+        throw std::runtime_error(xnGetStatusString(rc));
+      }
+    }
+  }
+
+  ~WorkerThreads()
+  {
+    shutdown();
+  }
+
+  XnUInt32 size() const
+  {
+    return (XnUInt32)workers_.size() + 1;
+  }
+
+  // このマシンのプロセッサ数(取得できないときは1)
+  static XnUInt32 hardwareCount()
+  {
+    xnOSInfo info;
+    if ((xnOSGetInfo(&info) != XN_STATUS_OK) || (info.nProcessorsCount == 0)) {
+      return 1;
+    }
+
+    return info.nProcessorsCount;
+  }
+
+  // すべてのスレッドでtaskを実行する
+  void run(Task task, void* param)
+  {
+    task_ = task;
+    param_ = param;
+
+    for (XnUInt32 i = 0; i < workers_.size(); ++i) {
+      xnOSSetEvent(workers_[i].start);
+    }
+
+    task(param, 0, size());
+
+    for (XnUInt32 i = 0; i < workers_.size(); ++i) {
+      xnOSWaitEvent(workers_[i].done, XN_WAIT_INFINITE);
+    }
+  }
+
+  // ワーカーがなければ、呼び出し元のスレッドだけで実行する
+  static void run(WorkerThreads* workers, Task task, void* param)
+  {
+    if (workers != 0) {
+      workers->run(task, param);
+    }
+    else {
+      task(param, 0, 1);
+    }
+  }
+
+private:
+
+  WorkerThreads(const WorkerThreads&);
+  WorkerThreads& operator=(const WorkerThreads&);
+
+  // 起動済みのスレッドをすべて止めて、ハンドルを閉じる
+  void shutdown()
+  {
+    isQuit_ = true;
+    for (XnUInt32 i = 0; i < workers_.size(); ++i) {
+      xnOSSetEvent(workers_[i].start);
+    }
+
+    for (XnUInt32 i = 0; i < workers_.size(); ++i) {
+      xnOSWaitForThreadExit(workers_[i].thread, XN_WAIT_INFINITE);
+      xnOSCloseThread(&workers_[i].thread);
+      xnOSCloseEvent(&workers_[i].start);
+      xnOSCloseEvent(&workers_[i].done);
+    }
+
+    workers_.clear();
+  }
+
+  struct Worker
+  {
+    WorkerThreads*    owner;
+    XnUInt32          index;
+    XN_THREAD_HANDLE  thread;
+    XN_EVENT_HANDLE   start;
+    XN_EVENT_HANDLE   done;
+  };
+
+  static XN_THREAD_PROC threadProc(XN_THREAD_PARAM param)
+  {
+    Worker& worker = *(Worker*)param;
+    WorkerThreads& owner = *worker.owner;
+
+    while (1) {
+      xnOSWaitEvent(worker.start, XN_WAIT_INFINITE);
+      if (owner.isQuit_) {
+        break;
+      }
+
+      owner.task_(owner.param_, worker.index, owner.size());
+      xnOSSetEvent(worker.done);
+    }
+
+    XN_THREAD_PROC_RETURN(0);
+  }
+
+  std::vector<Worker> workers_;
+  Task task_;
+  void* param_;
+  volatile bool isQuit_;
+};
+
+#endif // #ifndef WORKERTHREADS_H_INCLUDE
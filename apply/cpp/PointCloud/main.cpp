@@ -0,0 +1,244 @@
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <opencv/cv.h>
+#include <opencv/highgui.h>
+
+#include <XnCppWrapper.h>
+#include <XnOS.h>
+
+#include "PointCloud.h"
+#include "PointCloudDrawer.h"
+#include "VoxelGrid.h"
+#include "WorkerThreads.h"
+
+// 設定ファイルのパス(環境に合わせて変更してください)
+#if (XN_PLATFORM == XN_PLATFORM_WIN32)
+const char* CONFIG_XML_PATH = "../../../Data/SamplesConfig.xml";
+#elif (XN_PLATFORM == XN_PLATFORM_MACOSX)
+const char* CONFIG_XML_PATH = "../../../../../Data/SamplesConfig.xml";
+#elif (XN_PLATFORM == XN_PLATFORM_LINUX_X86)
+const char* CONFIG_XML_PATH = "../../../Data/SamplesConfig.xml";
+#else
+const char* CONFIG_XML_PATH = "Data/SamplesConfig.xml";
+#endif
+
+// 合成したデプスデータで点群作成の速度を計測する
+void benchmark()
+{
+  const XnUInt32 XRES = 640;
+  const XnUInt32 YRES = 480;
+  const int FRAMES = 300;
+
+  // 奥の壁と、手前の球(一部にデプスの欠損あり)
+  std::vector<XnDepthPixel> depth(XRES * YRES);
+  std::vector<XnRGB24Pixel> rgb(XRES * YRES);
+  for (XnUInt32 y = 0; y < YRES; ++y) {
+    for (XnUInt32 x = 0; x < XRES; ++x) {
+      int dx = (int)x - 320, dy = (int)y - 240;
+      XnDepthPixel d = 3000;
+      if ((dx * dx + dy * dy) < (150 * 150)) {
+        d = 1500 + (dx * dx + dy * dy) / 100;
+      }
+      if (((x / 8) % 7) == 0 && ((y / 8) % 5) == 0) {
+        d = 0;
+      }
+      depth[y * XRES + x] = d;
+      XnRGB24Pixel pixel = { (XnUInt8)x, (XnUInt8)y, (XnUInt8)(x + y) };
+      rgb[y * XRES + x] = pixel;
+    }
+  }
+
+  PointCloudPool pool;
+  PointCloudBuilder builder(pool);
+  builder.setup(KINECT_HFOV, KINECT_VFOV, XRES, YRES);
+  PointCloud cloud;
+
+  const XnUInt32 steps[] = { 1, 2, 4 };
+  for (XnUInt32 s = 0; s < sizeof(steps) / sizeof(steps[0]); ++s) {
+    for (int c = 0; c < 2; ++c) {
+      builder.setDecimation(steps[s]);
+
+      XnUInt64 begin, end;
+      xnOSGetHighResTimeStamp(&begin);
+      XnUInt64 points = 0;
+      for (int i = 0; i < FRAMES; ++i) {
+        builder.build(&depth[0], (c == 0) ? 0 : &rgb[0], XRES, YRES, 0, 0, cloud);
+        points += cloud.size;
+      }
+      xnOSGetHighResTimeStamp(&end);
+
+      double sec = (end - begin) / 1000000.0;
+      std::cout << "step=" << steps[s] << (c == 0 ? " depth" : " color") <<
+        " : " << (sec * 1000 / FRAMES) << " ms/frame, " <<
+        (points / sec / 1000000) << " Mpoints/s" << std::endl;
+    }
+  }
+
+  // ボクセルグリッドの速度(スレッド数ごと)
+  builder.setDecimation(1);
+  builder.build(&depth[0], &rgb[0], XRES, YRES, 0, 0, cloud);
+
+  const XnUInt32 threads[] = { 1, 2, 4 };
+  for (XnUInt32 t = 0; t < sizeof(threads) / sizeof(threads[0]); ++t) {
+    for (int m = 0; m < 2; ++m) {
+      WorkerThreads workers(threads[t]);
+      VoxelGrid voxel(pool, &workers);
+      voxel.setLeafSize(20.0f);
+      voxel.setMode((m == 0) ? VoxelGrid::CENTROID : VoxelGrid::FIRST_POINT);
+
+      PointCloud filtered;
+      voxel.filter(cloud, filtered);
+
+      XnUInt64 begin, end;
+      xnOSGetHighResTimeStamp(&begin);
+      for (int i = 0; i < FRAMES; ++i) {
+        voxel.filter(cloud, filtered);
+      }
+      xnOSGetHighResTimeStamp(&end);
+
+      double sec = (end - begin) / 1000000.0;
+      std::cout << "voxel threads=" << threads[t] <<
+        (m == 0 ? " centroid" : " first") << " : " <<
+        cloud.size << " -> " << filtered.size << " points, " <<
+        (sec * 1000 / FRAMES) << " ms/frame, " <<
+        ((XnUInt64)cloud.size * FRAMES / sec / 1000000) << " Mpoints/s" << std::endl;
+    }
+  }
+}
+
+int main (int argc, char * argv[])
+{
+  // 速度計測モード
+  if ((argc > 1) && (std::string(argv[1]) == "bench")) {
+    benchmark();
+    return 0;
+  }
+
+  IplImage* view = 0;
+
+  try {
+    // コンテキストの初期化
+    xn::Context context;
+    XnStatus rc = context.InitFromXmlFile(CONFIG_XML_PATH);
+    if (rc != XN_STATUS_OK) {
+      throw std::runtime_error(xnGetStatusString(rc));
+    }
+
+    // イメージジェネレータの作成
+    xn::ImageGenerator image;
+    rc = context.FindExistingNode(XN_NODE_TYPE_IMAGE, image);
+    if (rc != XN_STATUS_OK) {
+      throw std::runtime_error(xnGetStatusString(rc));
+    }
+
+    // デプスジェネレータの作成
+    xn::DepthGenerator depth;
+    rc = context.FindExistingNode(XN_NODE_TYPE_DEPTH, depth);
+    if (rc != XN_STATUS_OK) {
+      throw std::runtime_error(xnGetStatusString(rc));
+    }
+
+    // デプスの座標をイメージに合わせる
+    depth.GetAlternativeViewPointCap().SetViewPoint(image);
+
+    // 点群の作成準備
+    PointCloudPool pool;
+    PointCloudBuilder builder(pool);
+    builder.setup(depth);
+    PointCloud cloud;
+
+    // ボクセルグリッドの準備
+    WorkerThreads workers(4);
+    VoxelGrid voxel(pool, &workers);
+    voxel.setLeafSize(20.0f);
+    PointCloud filtered;
+
+    // 表示用のイメージを作成(8bitのRGB)
+    view = ::cvCreateImage(cvSize(640, 480), IPL_DEPTH_8U, 3);
+    if (!view) {
+      throw std::runtime_error("error : cvCreateImage");
+    }
+
+    bool isColor = true;
+    bool isROI = false;
+    bool isVoxel = false;
+    XnUInt32 step = 1;
+
+    // メインループ
+    while (1) {
+      // すべての更新を待ち、画像およびデプスデータを取得する
+      context.WaitAndUpdateAll();
+
+      xn::ImageMetaData imageMD;
+      image.GetMetaData(imageMD);
+
+      xn::DepthMetaData depthMD;
+      depth.GetMetaData(depthMD);
+
+      // 点群を作成する
+      if (isColor) {
+        builder.build(depthMD, imageMD, cloud);
+      }
+      else {
+        builder.build(depthMD, cloud);
+      }
+
+      // ボクセルグリッドで間引く
+      if (isVoxel) {
+        voxel.filter(cloud, filtered);
+      }
+
+      // 上から見た図を表示する
+      drawTopView(view, isVoxel ? filtered : cloud);
+      ::cvShowImage("PointCloud", view);
+
+      // キーの取得
+      char key = cvWaitKey(10);
+      // 終了する
+      if (key == 'q') {
+        break;
+      }
+      // カラーの有無を切り替える
+      else if (key == 'c') {
+        isColor = !isColor;
+      }
+      // 間引きを切り替える(1, 2, 4)
+      else if (key == 'd') {
+        step = (step >= 4) ? 1 : (step * 2);
+        builder.setDecimation(step);
+        std::cout << "decimation : " << step << std::endl;
+      }
+      // ボクセルグリッドの有効/無効を切り替える
+      else if (key == 'v') {
+        isVoxel = !isVoxel;
+      }
+      // ボクセルの代表点を切り替える(重心/最初の点)
+      else if (key == 'f') {
+        static bool isFirst = false;
+        isFirst = !isFirst;
+        voxel.setMode(isFirst ? VoxelGrid::FIRST_POINT : VoxelGrid::CENTROID);
+      }
+      // 中央部分だけを処理する
+      else if (key == 'r') {
+        isROI = !isROI;
+        if (isROI) {
+          builder.setROI(depthMD.FullXRes() / 4, depthMD.FullYRes() / 4,
+                         depthMD.FullXRes() / 2, depthMD.FullYRes() / 2);
+        }
+        else {
+          builder.setROI(0, 0, 0, 0);
+        }
+      }
+    }
+  }
+  catch (std::exception& ex) {
+    std::cout << ex.what() << std::endl;
+  }
+
+  ::cvReleaseImage(&view);
+
+  return 0;
+}